@@ -0,0 +1,440 @@
+#include "EventQueue.h"
+
+
+static
+BOOLEAN
+EvqSpill(
+    _Inout_ PEVENT_QUEUE Queue,
+    _In_    ULONG        First,
+    _In_    PPROC_INFO   Info
+);
+
+static
+BOOLEAN
+EvqOverflow(
+    _Inout_ PEVENT_QUEUE Queue,
+    _In_    ULONG        Local,
+    _In_    PPROC_INFO   Info,
+    _Inout_ PULONG       Attempts
+);
+
+
+NTSTATUS
+EvqInit(
+    _Out_ PEVENT_QUEUE Queue,
+    _In_  ULONG        Capacity,
+    _In_  QUEUE_POLICY Policy
+)
+{
+    NTSTATUS status      = STATUS_UNSUCCESSFUL;
+    ULONG    i           = 0;
+    ULONG    cpuCapacity = RNG_MIN_CAPACITY;
+
+    ASSERT(Queue != NULL);
+
+    ASSERT(Policy < QueuePolicyMax);
+
+    RtlZeroMemory(Queue, sizeof(*Queue));
+
+    Queue->Policy = (LONG)Policy;
+    Queue->CpuCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    while ((ULONG64)cpuCapacity * 2 * Queue->CpuCount <= Capacity)
+    {
+        cpuCapacity <<= 1;
+    }
+
+    __try
+    {
+        Queue->Rings = (PEVENT_RING)ExAllocatePoolWithTag(NonPagedPoolCacheAligned, Queue->CpuCount * sizeof(EVENT_RING), IOC_TAG_NAME);
+        Queue->Next = (PPROC_INFO)ExAllocatePoolWithTag(NonPagedPool, Queue->CpuCount * sizeof(PROC_INFO), IOC_TAG_NAME);
+        Queue->HasNext = (PBOOLEAN)ExAllocatePoolWithTag(NonPagedPool, Queue->CpuCount * sizeof(BOOLEAN), IOC_TAG_NAME);
+        if (Queue->Rings == NULL || Queue->Next == NULL || Queue->HasNext == NULL)
+        {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            __leave;
+        }
+        RtlZeroMemory(Queue->Rings, Queue->CpuCount * sizeof(EVENT_RING));
+        RtlZeroMemory(Queue->HasNext, Queue->CpuCount * sizeof(BOOLEAN));
+
+        for (i = 0; i < Queue->CpuCount; ++i)
+        {
+            status = RngInit(&Queue->Rings[i], cpuCapacity);
+            if (!NT_SUCCESS(status))
+            {
+                __leave;
+            }
+        }
+
+        status = STATUS_SUCCESS;
+    }
+    __finally
+    {
+        if (!NT_SUCCESS(status))
+        {
+            EvqUninit(Queue);
+        }
+    }
+
+    return status;
+}
+
+
+VOID
+EvqUninit(
+    _Inout_ PEVENT_QUEUE Queue
+)
+{
+    ULONG i = 0;
+
+    ASSERT(Queue != NULL);
+
+    if (Queue->Rings != NULL)
+    {
+        for (i = 0; i < Queue->CpuCount; ++i)
+        {
+            RngUninit(&Queue->Rings[i]);
+        }
+        ExFreePoolWithTag(Queue->Rings, IOC_TAG_NAME);
+        Queue->Rings = NULL;
+    }
+    if (Queue->Next != NULL)
+    {
+        ExFreePoolWithTag(Queue->Next, IOC_TAG_NAME);
+        Queue->Next = NULL;
+    }
+    if (Queue->HasNext != NULL)
+    {
+        ExFreePoolWithTag(Queue->HasNext, IOC_TAG_NAME);
+        Queue->HasNext = NULL;
+    }
+
+    return;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN
+EvqEnqueue(
+    _Inout_ PEVENT_QUEUE Queue,
+    _Inout_ PPROC_INFO   Info
+)
+{
+    KIRQL   irql     = PASSIVE_LEVEL;
+    ULONG   local    = 0;
+    ULONG   attempts = 0;
+    BOOLEAN bQueued  = FALSE;
+
+    ASSERT(Queue != NULL);
+    ASSERT(Info != NULL);
+
+    //
+    // Stay on this processor between taking the timestamp and publishing,
+    // so its own records land on its ring in Timestamp order. Spilling
+    // producers from other processors can still publish older records in
+    // between, which is why the merge is only best effort around a spill;
+    // the rings themselves are MPMC safe
+    //
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    {
+        Info->Timestamp = KeQueryPerformanceCounter(NULL).QuadPart;
+        local = KeGetCurrentProcessorNumberEx(NULL) % Queue->CpuCount;
+
+        while (!(bQueued = EvqSpill(Queue, local, Info)))
+        {
+            if (!EvqOverflow(Queue, local, Info, &attempts))
+            {
+                break;
+            }
+        }
+    }
+    KeLowerIrql(irql);
+
+    return bQueued;
+}
+
+
+static
+BOOLEAN
+EvqSpill(
+    _Inout_ PEVENT_QUEUE Queue,
+    _In_    ULONG        First,
+    _In_    PPROC_INFO   Info
+)
+/*++
+
+Routine Description:
+
+    Queues Info on ring First, or on the next one with room. Only a burst
+    that filled the local ring pays for going around; records that do are
+    charged to ring First as Spilled.
+
+--*/
+{
+    ULONG i = 0;
+
+    for (i = 0; i < Queue->CpuCount; ++i)
+    {
+        if (RngEnqueue(&Queue->Rings[(First + i) % Queue->CpuCount], Info))
+        {
+            if (i != 0)
+            {
+                InterlockedIncrement64(&Queue->Rings[First].Spilled);
+            }
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+static
+BOOLEAN
+EvqOverflow(
+    _Inout_ PEVENT_QUEUE Queue,
+    _In_    ULONG        Local,
+    _In_    PPROC_INFO   Info,
+    _Inout_ PULONG       Attempts
+)
+/*++
+
+Routine Description:
+
+    Applies Queue->Policy to Info that found every ring full; counters go
+    to the ring of the processor Info was raised on.
+
+Return Value:
+
+    TRUE if room was made and the caller should try again, FALSE if Info
+    was dropped (or coalesced).
+
+--*/
+{
+    PROC_INFO   discarded = { 0 };
+    PEVENT_RING ring      = &Queue->Rings[Local];
+    LONG64      timestamp = 0;
+    LONG64      oldest    = 0;
+    ULONG       victim    = MAXULONG;
+    ULONG       i         = 0;
+
+    switch ((QUEUE_POLICY)ReadNoFence(&Queue->Policy))
+    {
+        case QueuePolicyDropOldest:
+        {
+            if (*Attempts < EVQ_MAX_OVERFLOW_RETRIES)
+            {
+                ++(*Attempts);
+
+                // the oldest record left in any ring, not just this one;
+                // the ones in Next are the consumer's and may be older
+                for (i = 0; i < Queue->CpuCount; ++i)
+                {
+                    if (RngPeekTimestamp(&Queue->Rings[i], &timestamp) && (victim == MAXULONG || timestamp < oldest))
+                    {
+                        victim = i;
+                        oldest = timestamp;
+                    }
+                }
+                if (victim != MAXULONG && RngDequeue(&Queue->Rings[victim], &discarded))
+                {
+                    InterlockedIncrement64(&ring->DroppedOldest);
+                }
+                return TRUE;
+            }
+            break;
+        }
+        case QueuePolicyCoalesce:
+        {
+            // the process came and went while nobody was listening; its
+            // create may have been raised on any processor
+            if (!Info->Create)
+            {
+                for (i = 0; i < Queue->CpuCount; ++i)
+                {
+                    if (RngCoalesce(&Queue->Rings[(Local + i) % Queue->CpuCount], Info->ProcessId))
+                    {
+                        InterlockedIncrement64(&ring->Coalesced);
+                        return FALSE;
+                    }
+                }
+            }
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+
+    InterlockedIncrement64(&ring->DroppedNewest);
+
+    return FALSE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN
+EvqDequeue(
+    _Inout_ PEVENT_QUEUE Queue,
+    _Out_   PPROC_INFO   Info
+)
+{
+    ULONG  i       = 0;
+    ULONG  best    = MAXULONG;
+    LONG64 dropped = 0;
+
+    ASSERT(Queue != NULL);
+    ASSERT(Info != NULL);
+
+    for (i = 0; i < Queue->CpuCount; ++i)
+    {
+        if (!Queue->HasNext[i])
+        {
+            if (!RngDequeue(&Queue->Rings[i], &Queue->Next[i]))
+            {
+                continue;
+            }
+            Queue->HasNext[i] = TRUE;
+            InterlockedIncrement(&Queue->Lookahead);
+        }
+
+        if (best == MAXULONG || Queue->Next[i].Timestamp < Queue->Next[best].Timestamp)
+        {
+            best = i;
+        }
+    }
+
+    if (best == MAXULONG)
+    {
+        return FALSE;
+    }
+
+    *Info = Queue->Next[best];
+    Queue->HasNext[best] = FALSE;
+    InterlockedDecrement(&Queue->Lookahead);
+
+    //
+    // Numbered on the way out: a number taken by the producer could be
+    // overtaken by a later event that was published first on another ring
+    //
+    dropped = EvqDropped(Queue);
+    Info->Sequence = ++Queue->Delivered + (ULONG64)dropped;
+    Info->Dropped = (ULONG)dropped;
+
+    return TRUE;
+}
+
+
+_Use_decl_annotations_
+ULONG
+EvqDequeueBatch(
+    _Inout_                                 PEVENT_QUEUE Queue,
+    _Out_writes_to_(MaxCount, return)       PPROC_INFO   Infos,
+    _In_                                    ULONG        MaxCount
+)
+{
+    ULONG count = 0;
+
+    ASSERT(Queue != NULL);
+    ASSERT(Infos != NULL || MaxCount == 0);
+
+    while (count < MaxCount && EvqDequeue(Queue, &Infos[count]))
+    {
+        ++count;
+    }
+
+    return count;
+}
+
+
+ULONG
+EvqCount(
+    _In_ PEVENT_QUEUE Queue
+)
+{
+    ULONG i     = 0;
+    ULONG count = 0;
+
+    ASSERT(Queue != NULL);
+
+    count = (ULONG)Queue->Lookahead;
+    for (i = 0; i < Queue->CpuCount; ++i)
+    {
+        count += RngCount(&Queue->Rings[i]);
+    }
+
+    return count;
+}
+
+
+LONG64
+EvqDropped(
+    _In_ PEVENT_QUEUE Queue
+)
+{
+    ULONG  i       = 0;
+    LONG64 dropped = 0;
+
+    ASSERT(Queue != NULL);
+
+    // counters only move on overflow, so these lines stay shared between CPUs
+    for (i = 0; i < Queue->CpuCount; ++i)
+    {
+        dropped += RngDropped(&Queue->Rings[i]);
+    }
+
+    return dropped;
+}
+
+
+VOID
+EvqSetPolicy(
+    _Inout_ PEVENT_QUEUE Queue,
+    _In_    QUEUE_POLICY Policy
+)
+{
+    ASSERT(Queue != NULL);
+    ASSERT(Policy < QueuePolicyMax);
+
+    InterlockedExchange(&Queue->Policy, (LONG)Policy);
+
+    return;
+}
+
+
+VOID
+EvqQueryStats(
+    _In_    PEVENT_QUEUE Queue,
+    _Inout_ PIOC_STATS   Stats
+)
+{
+    ULONG       i    = 0;
+    PEVENT_RING ring = NULL;
+
+    ASSERT(Queue != NULL);
+    ASSERT(Stats != NULL);
+
+    Stats->QueueCapacity = 0;
+    Stats->QueuePolicy = (ULONG)Queue->Policy;
+    Stats->QueueDepth = EvqCount(Queue);
+    Stats->QueueHighWater = 0;
+    Stats->DroppedNewest = 0;
+    Stats->DroppedOldest = 0;
+    Stats->Coalesced = 0;
+    Stats->Spilled = 0;
+
+    for (i = 0; i < Queue->CpuCount; ++i)
+    {
+        ring = &Queue->Rings[i];
+
+        // rings peak at different times, so the sum is an upper bound
+        Stats->QueueCapacity += RngCapacity(ring);
+        Stats->QueueHighWater += (ULONG)ring->HighWater;
+        Stats->DroppedNewest += ring->DroppedNewest;
+        Stats->DroppedOldest += ring->DroppedOldest;
+        Stats->Coalesced += ring->Coalesced;
+        Stats->Spilled += ring->Spilled;
+    }
+
+    return;
+}
\ No newline at end of file
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "WdmDriver.h"
+#include "Public.h"
+#include "Ring.h"
+
+
+#define EVQ_MAX_OVERFLOW_RETRIES    8       // QueuePolicyDropOldest attempts before giving up on an event
+
+
+//
+// Process events for UM, staged in one EVENT_RING per processor so producers
+// on different CPUs never touch the same Tail. The notify thread is the only
+// consumer; it merges the rings back in Timestamp order, keeping the oldest
+// record of every ring aside (Next) while it compares them.
+//
+// A full ring spills into the others, so the queue only overflows once all
+// of them are full, and Policy is applied to the queue as a whole: the oldest
+// record still in a ring is evicted, and an exit cancels its create wherever
+// that was queued. Records already held in Next belong to the consumer and
+// are never evicted, so the victim is not always the oldest record overall.
+//
+// The merge assumes every ring is in Timestamp order, which only holds for
+// records a processor queued on its own ring. A spilled record is published
+// on a ring whose owner may have queued newer ones meanwhile, so around a
+// spill the merge is best effort and may deliver it late; spills are counted
+// (Spilled) so the stats show when that can have happened.
+//
+typedef struct _EVENT_QUEUE
+{
+    volatile LONG   Policy;             // QUEUE_POLICY applied when every ring is full
+    ULONG           CpuCount;
+    PEVENT_RING     Rings;              // CpuCount entries
+    PPROC_INFO      Next;               // Consumer lookahead, one per ring
+    PBOOLEAN        HasNext;
+    volatile LONG   Lookahead;          // Records currently held in Next
+    ULONG64         Delivered;          // Records dequeued so far, consumer only
+
+}EVENT_QUEUE, *PEVENT_QUEUE;
+
+
+//
+// Capacity is the total for all processors; every ring gets an equal power
+// of 2 share, but never less than RNG_MIN_CAPACITY. A processor only has its
+// share to itself (Capacity / CpuCount, rounded down to a power of 2), past
+// it its events go to the other rings, slower but still queued
+//
+NTSTATUS
+EvqInit(
+    _Out_ PEVENT_QUEUE Queue,
+    _In_  ULONG        Capacity,
+    _In_  QUEUE_POLICY Policy
+);
+
+VOID
+EvqUninit(
+    _Inout_ PEVENT_QUEUE Queue
+);
+
+//
+// Queues Info on the current processor ring, or any ring with room, and
+// stamps Info->Timestamp; records a processor queues on its own ring are in
+// Timestamp order
+//
+// returns:
+//      - FALSE - every ring is full and Info was dropped or coalesced, see Policy
+//      - TRUE  - Info is queued
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+EvqEnqueue(
+    _Inout_ PEVENT_QUEUE Queue,
+    _Inout_ PPROC_INFO   Info
+);
+
+//
+// Single consumer. Sequence and Dropped are stamped here, in delivery order:
+// Sequence counts delivered plus dropped events, so it always grows and
+// only skips numbers for events that were lost
+//
+// returns:
+//      - FALSE - all rings are empty
+//      - TRUE  - oldest PROC_INFO (by Timestamp) was copied in Info
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+EvqDequeue(
+    _Inout_ PEVENT_QUEUE Queue,
+    _Out_   PPROC_INFO   Info
+);
+
+//
+// Single consumer; copies up to MaxCount oldest PROC_INFO in Infos
+//
+// returns number of records copied
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG
+EvqDequeueBatch(
+    _Inout_                                 PEVENT_QUEUE Queue,
+    _Out_writes_to_(MaxCount, return)       PPROC_INFO   Infos,
+    _In_                                    ULONG        MaxCount
+);
+
+//
+// Records queued, including the ones held by the consumer; may be stale
+//
+ULONG
+EvqCount(
+    _In_ PEVENT_QUEUE Queue
+);
+
+//
+// Events that will never reach the client, whatever the reason
+//
+LONG64
+EvqDropped(
+    _In_ PEVENT_QUEUE Queue
+);
+
+VOID
+EvqSetPolicy(
+    _Inout_ PEVENT_QUEUE Queue,
+    _In_    QUEUE_POLICY Policy
+);
+
+//
+// Fills the Queue* / Dropped* / Coalesced / Spilled fields of Stats
+//
+VOID
+EvqQueryStats(
+    _In_    PEVENT_QUEUE Queue,
+    _Inout_ PIOC_STATS   Stats
+);
+
+FORCEINLINE
+BOOLEAN
+EvqIsEmpty(
+    _In_ PEVENT_QUEUE Queue
+)
+{
+    return (BOOLEAN)(EvqCount(Queue) == 0);
+}
\ No newline at end of file
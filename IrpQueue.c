@@ -0,0 +1,206 @@
+#include "IrpQueue.h"
+
+
+IO_CSQ_INSERT_IRP_EX            IrpQCsqInsertIrpEx;
+IO_CSQ_REMOVE_IRP               IrpQCsqRemoveIrp;
+IO_CSQ_PEEK_NEXT_IRP            IrpQCsqPeekNextIrp;
+IO_CSQ_ACQUIRE_LOCK             IrpQCsqAcquireLock;
+IO_CSQ_RELEASE_LOCK             IrpQCsqReleaseLock;
+IO_CSQ_COMPLETE_CANCELED_IRP    IrpQCsqCompleteCanceledIrp;
+
+
+#define IRPQ_FROM_CSQ(Csq)      CONTAINING_RECORD(Csq, IRP_QUEUE, Csq)
+
+#define IRPQ_INSERT_HEAD        ((PVOID)1)  // InsertContext of an IRP put back in front
+
+
+_Use_decl_annotations_
+NTSTATUS
+IrpQCsqInsertIrpEx(
+    _In_ PIO_CSQ Csq,
+    _In_ PIRP    Irp,
+    _In_ PVOID   InsertContext
+)
+{
+    PIRP_QUEUE queue = IRPQ_FROM_CSQ(Csq);
+
+    if (InsertContext == IRPQ_INSERT_HEAD)
+    {
+        InsertHeadList(&queue->Head, &Irp->Tail.Overlay.ListEntry);
+    }
+    else
+    {
+        InsertTailList(&queue->Head, &Irp->Tail.Overlay.ListEntry);
+    }
+    InterlockedIncrement(&queue->Count);
+
+    return STATUS_SUCCESS;
+}
+
+
+_Use_decl_annotations_
+VOID
+IrpQCsqRemoveIrp(
+    _In_ PIO_CSQ Csq,
+    _In_ PIRP    Irp
+)
+{
+    PIRP_QUEUE queue = IRPQ_FROM_CSQ(Csq);
+
+    RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
+    InterlockedDecrement(&queue->Count);
+
+    return;
+}
+
+
+_Use_decl_annotations_
+PIRP
+IrpQCsqPeekNextIrp(
+    _In_ PIO_CSQ Csq,
+    _In_ PIRP    Irp,
+    _In_ PVOID   PeekContext
+)
+{
+    PIRP_QUEUE  queue = IRPQ_FROM_CSQ(Csq);
+    PLIST_ENTRY next  = NULL;
+
+    UNREFERENCED_PARAMETER(PeekContext);
+
+    // we never filter on PeekContext, the next IRP is always the answer
+    next = (Irp == NULL) ? queue->Head.Flink : Irp->Tail.Overlay.ListEntry.Flink;
+    if (next == &queue->Head)
+    {
+        return NULL;
+    }
+
+    return CONTAINING_RECORD(next, IRP, Tail.Overlay.ListEntry);
+}
+
+
+_Use_decl_annotations_
+VOID
+IrpQCsqAcquireLock(
+    _In_  PIO_CSQ Csq,
+    _Out_ PKIRQL  Irql
+)
+{
+    KeAcquireSpinLock(&IRPQ_FROM_CSQ(Csq)->Lock, Irql);
+
+    return;
+}
+
+
+_Use_decl_annotations_
+VOID
+IrpQCsqReleaseLock(
+    _In_ PIO_CSQ Csq,
+    _In_ KIRQL   Irql
+)
+{
+    KeReleaseSpinLock(&IRPQ_FROM_CSQ(Csq)->Lock, Irql);
+
+    return;
+}
+
+
+_Use_decl_annotations_
+VOID
+IrpQCsqCompleteCanceledIrp(
+    _In_ PIO_CSQ Csq,
+    _In_ PIRP    Irp
+)
+{
+    UNREFERENCED_PARAMETER(Csq);
+
+    Irp->IoStatus.Information = 0;
+    Irp->IoStatus.Status = STATUS_CANCELLED;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return;
+}
+
+
+NTSTATUS
+IrpQInit(
+    _Out_ PIRP_QUEUE Queue
+)
+{
+    ASSERT(Queue != NULL);
+
+    RtlZeroMemory(Queue, sizeof(*Queue));
+
+    InitializeListHead(&Queue->Head);
+    KeInitializeSpinLock(&Queue->Lock);
+
+    return IoCsqInitializeEx(
+        &Queue->Csq,
+        IrpQCsqInsertIrpEx,
+        IrpQCsqRemoveIrp,
+        IrpQCsqPeekNextIrp,
+        IrpQCsqAcquireLock,
+        IrpQCsqReleaseLock,
+        IrpQCsqCompleteCanceledIrp);
+}
+
+
+NTSTATUS
+IrpQInsert(
+    _Inout_ PIRP_QUEUE Queue,
+    _Inout_ PIRP       Irp
+)
+{
+    ASSERT(Queue != NULL);
+    ASSERT(Irp != NULL);
+
+    // marks the IRP pending; a cancelled IRP is completed by IrpQCsqCompleteCanceledIrp
+    IoCsqInsertIrpEx(&Queue->Csq, Irp, NULL, NULL);
+
+    return STATUS_PENDING;
+}
+
+
+VOID
+IrpQInsertHead(
+    _Inout_ PIRP_QUEUE Queue,
+    _Inout_ PIRP       Irp
+)
+{
+    ASSERT(Queue != NULL);
+    ASSERT(Irp != NULL);
+
+    IoCsqInsertIrpEx(&Queue->Csq, Irp, NULL, IRPQ_INSERT_HEAD);
+
+    return;
+}
+
+
+PIRP
+IrpQRemoveNext(
+    _Inout_ PIRP_QUEUE Queue
+)
+{
+    ASSERT(Queue != NULL);
+
+    return IoCsqRemoveNextIrp(&Queue->Csq, NULL);
+}
+
+
+VOID
+IrpQFlush(
+    _Inout_ PIRP_QUEUE Queue
+)
+{
+    PIRP irp = NULL;
+
+    ASSERT(Queue != NULL);
+
+    while ((irp = IrpQRemoveNext(Queue)) != NULL)
+    {
+        irp->IoStatus.Information = 0;
+        irp->IoStatus.Status = STATUS_CANCELLED;
+        IoCompleteRequest(irp, IO_NO_INCREMENT);
+    }
+
+    return;
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "WdmDriver.h"
+
+
+//
+// Cancel safe queue of pended notification IRPs (IO_CSQ based).
+// The IRP stays cancelable for the whole time it sits in the queue.
+//
+typedef struct _IRP_QUEUE
+{
+    IO_CSQ          Csq;
+    LIST_ENTRY      Head;
+    KSPIN_LOCK      Lock;
+    volatile LONG   Count;          // IRPs currently pended
+
+}IRP_QUEUE, *PIRP_QUEUE;
+
+
+NTSTATUS
+IrpQInit(
+    _Out_ PIRP_QUEUE Queue
+);
+
+//
+// Pends Irp (marks it pending) and returns STATUS_PENDING; an IRP that is
+// already cancelled gets completed with STATUS_CANCELLED instead of queued
+//
+NTSTATUS
+IrpQInsert(
+    _Inout_ PIRP_QUEUE Queue,
+    _Inout_ PIRP       Irp
+);
+
+//
+// Puts back an IRP taken with IrpQRemoveNext in front of the others, so it
+// is still the oldest; cancelable again, completed if it was cancelled meanwhile
+//
+VOID
+IrpQInsertHead(
+    _Inout_ PIRP_QUEUE Queue,
+    _Inout_ PIRP       Irp
+);
+
+//
+// returns:
+//      - NULL - no IRP pended
+//      - oldest pended IRP, no longer cancelable; caller must complete it
+PIRP
+IrpQRemoveNext(
+    _Inout_ PIRP_QUEUE Queue
+);
+
+//
+// Completes every pended IRP with STATUS_CANCELLED
+//
+VOID
+IrpQFlush(
+    _Inout_ PIRP_QUEUE Queue
+);
\ No newline at end of file
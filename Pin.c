@@ -0,0 +1,272 @@
+#include "Pin.h"
+#include "Process.h"
+
+
+static PIN_BUDGET gPinBudget;
+
+
+//
+// Unlinks Process and chains its MDL on Released (MDL.Next) for PinRelease;
+// budget lock held
+//
+static
+VOID
+PinUnlink(
+    _Inout_ PPROCESS_T Process,
+    _Inout_ PMDL      *Released
+)
+{
+    PMDL mdl = Process->Mdl;
+
+    RemoveEntryList(&Process->PinEntry);
+    InitializeListHead(&Process->PinEntry);
+    gPinBudget.LockedBytes -= Process->PinnedBytes;
+    Process->PinnedBytes = 0;
+    Process->Mdl = NULL;
+
+    mdl->Next = *Released;
+    *Released = mdl;
+
+    return;
+}
+
+//
+// Unlocks a chain built by PinUnlink; budget lock dropped
+//
+static
+VOID
+PinRelease(
+    _In_opt_ PMDL Released
+)
+{
+    PMDL next = NULL;
+
+    while (Released != NULL)
+    {
+        next = Released->Next;
+        Released->Next = NULL;
+
+        MmUnlockPages(Released);
+        IoFreeMdl(Released);
+        Released = next;
+    }
+
+    return;
+}
+
+
+VOID
+PinInitialize(
+    _In_ ULONG LimitMb
+)
+{
+    RtlZeroMemory(&gPinBudget, sizeof(gPinBudget));
+
+    KeInitializeSpinLock(&gPinBudget.Lock);
+    InitializeListHead(&gPinBudget.Lru);
+    gPinBudget.Limit = (LONG64)LimitMb << 20;
+
+    return;
+}
+
+
+VOID
+PinUninitialize(
+    VOID
+)
+{
+    ASSERT(IsListEmpty(&gPinBudget.Lru));
+    ASSERT(gPinBudget.LockedBytes == 0);
+
+    return;
+}
+
+
+VOID
+PinQueryStats(
+    _Inout_ PIOC_STATS Stats
+)
+{
+    KIRQL irql = PASSIVE_LEVEL;
+
+    KeAcquireSpinLock(&gPinBudget.Lock, &irql);
+    {
+        Stats->PinnedBytes = gPinBudget.LockedBytes;
+        Stats->PinnedHighWater = gPinBudget.HighWater;
+        Stats->PinnedLimit = gPinBudget.Limit;
+        Stats->PinEvictions = gPinBudget.Evictions;
+        Stats->PinRefused = gPinBudget.Refused;
+    }
+    KeReleaseSpinLock(&gPinBudget.Lock, irql);
+
+    return;
+}
+
+
+_Use_decl_annotations_
+NTSTATUS
+PinAttach(
+    PPROCESS_T  Process,
+    PVOID       UserVa,
+    ULONG       Length
+)
+{
+    PMDL        mdl      = NULL;
+    PMDL        released = NULL;
+    PLIST_ENTRY e        = NULL;
+    LONG64      bytes    = 0;
+    KIRQL       irql     = PASSIVE_LEVEL;
+    NTSTATUS    status   = STATUS_SUCCESS;
+
+    ASSERT(Process != NULL);
+
+    // what actually stays resident, whole pages
+    bytes = (LONG64)ADDRESS_AND_SIZE_TO_SPAN_PAGES(UserVa, Length) * PAGE_SIZE;
+
+    KeAcquireSpinLock(&gPinBudget.Lock, &irql);
+    {
+        if (Process->Mdl != NULL)
+        {
+            // dumped again, it is the last one to go now
+            RemoveEntryList(&Process->PinEntry);
+            InsertTailList(&gPinBudget.Lru, &Process->PinEntry);
+            bytes = 0;
+        }
+        else if (bytes > gPinBudget.Limit)
+        {
+            ++gPinBudget.Refused;
+            status = STATUS_QUOTA_EXCEEDED;
+        }
+        else
+        {
+            // reserve before locking, so parallel dumps never overshoot together
+            while (gPinBudget.LockedBytes + bytes > gPinBudget.Limit && !IsListEmpty(&gPinBudget.Lru))
+            {
+                e = gPinBudget.Lru.Flink;
+                PinUnlink(CONTAINING_RECORD(e, PROCESS_T, PinEntry), &released);
+                ++gPinBudget.Evictions;
+            }
+
+            // what is left is being locked by other dumps right now
+            if (gPinBudget.LockedBytes + bytes > gPinBudget.Limit)
+            {
+                ++gPinBudget.Refused;
+                status = STATUS_QUOTA_EXCEEDED;
+            }
+            else
+            {
+                gPinBudget.LockedBytes += bytes;
+            }
+        }
+    }
+    KeReleaseSpinLock(&gPinBudget.Lock, irql);
+
+    PinRelease(released);
+    released = NULL;
+
+    if (!NT_SUCCESS(status) || bytes == 0)
+    {
+        return status;
+    }
+
+    mdl = IoAllocateMdl(UserVa, Length, FALSE, FALSE, NULL);
+    if (mdl == NULL)
+    {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto clean_up;
+    }
+
+    __try
+    {
+        MmProbeAndLockPages(mdl, UserMode, IoReadAccess);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        IoFreeMdl(mdl);
+        mdl = NULL;
+
+        status = GetExceptionCode();
+        goto clean_up;
+    }
+
+clean_up:
+    KeAcquireSpinLock(&gPinBudget.Lock, &irql);
+    {
+        // dumps of the same PID may run in parallel, first MDL wins
+        if (mdl != NULL && Process->Mdl == NULL)
+        {
+            Process->Mdl = mdl;
+            Process->PinnedBytes = bytes;
+            InsertTailList(&gPinBudget.Lru, &Process->PinEntry);
+            mdl = NULL;
+
+            if (gPinBudget.LockedBytes > gPinBudget.HighWater)
+            {
+                gPinBudget.HighWater = gPinBudget.LockedBytes;
+            }
+        }
+        else
+        {
+            gPinBudget.LockedBytes -= bytes;
+        }
+    }
+    KeReleaseSpinLock(&gPinBudget.Lock, irql);
+
+    if (mdl != NULL)
+    {
+        MmUnlockPages(mdl);
+        IoFreeMdl(mdl);
+    }
+
+    return status;
+}
+
+
+_Use_decl_annotations_
+VOID
+PinDetach(
+    PPROCESS_T Process
+)
+{
+    PMDL    released = NULL;
+    KIRQL   irql     = PASSIVE_LEVEL;
+
+    ASSERT(Process != NULL);
+
+    KeAcquireSpinLock(&gPinBudget.Lock, &irql);
+    {
+        if (Process->Mdl != NULL)
+        {
+            PinUnlink(Process, &released);
+        }
+    }
+    KeReleaseSpinLock(&gPinBudget.Lock, irql);
+
+    PinRelease(released);
+
+    return;
+}
+
+
+_Use_decl_annotations_
+VOID
+PinDetachAll(
+    VOID
+)
+{
+    PMDL    released = NULL;
+    KIRQL   irql     = PASSIVE_LEVEL;
+
+    KeAcquireSpinLock(&gPinBudget.Lock, &irql);
+    {
+        while (!IsListEmpty(&gPinBudget.Lru))
+        {
+            PinUnlink(CONTAINING_RECORD(gPinBudget.Lru.Flink, PROCESS_T, PinEntry), &released);
+        }
+    }
+    KeReleaseSpinLock(&gPinBudget.Lock, irql);
+
+    PinRelease(released);
+
+    return;
+}
\ No newline at end of file
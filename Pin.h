@@ -0,0 +1,82 @@
+#pragma once
+
+#include "WdmDriver.h"
+#include "Public.h"
+
+
+#define PIN_DEFAULT_LIMIT_MB        64      // Locked bytes allowed before the least recently dumped process is unpinned
+#define PIN_MIN_LIMIT_MB            1
+#define PIN_MAX_LIMIT_MB            4096
+
+struct _PROCESS_T;
+
+
+//
+// Caller pages locked for dumped processes, counted against a cap. What is
+// locked is the request buffer of IOCTL_DUMP_PROCESS, as the driver always
+// did; the target's own memory is never pinned, dumps read it through
+// IOCTL_READ_PROCESS_MEMORY. The budget only keeps that
+// legacy pinning from growing without bound.
+// Every pinned PROCESS_T is linked (PinEntry) from the least to the most
+// recently dumped; making room unpins from the front. One spin lock covers
+// the list, PROCESS_T.Mdl and the counters, pages are only unlocked once it
+// is dropped
+//
+typedef struct _PIN_BUDGET
+{
+    KSPIN_LOCK  Lock;
+    LIST_ENTRY  Lru;
+    LONG64      Limit;                  // Bytes
+    LONG64      LockedBytes;            // Locked, or reserved by a PinAttach still locking
+    LONG64      HighWater;
+    LONG64      Evictions;
+    LONG64      Refused;                // PinAttach that did not fit even after evicting everything idle
+
+}PIN_BUDGET, *PPIN_BUDGET;
+
+
+VOID
+PinInitialize(
+    _In_ ULONG LimitMb
+);
+
+//
+// Every PROCESS_T must have been unpinned (PrcTableFree does it)
+//
+VOID
+PinUninitialize(
+    VOID
+);
+
+VOID
+PinQueryStats(
+    _Inout_ PIOC_STATS Stats
+);
+
+//
+// Locks the pages of [UserVa, UserVa + Length) for Process, unpinning the
+// least recently dumped processes until they fit. A process already pinned
+// keeps what it has and just becomes the most recent. Caller context, passive
+//
+_IRQL_requires_(PASSIVE_LEVEL)
+NTSTATUS
+PinAttach(
+    _Inout_ struct _PROCESS_T *Process,
+    _In_    PVOID              UserVa,
+    _In_    ULONG              Length
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+PinDetach(
+    _Inout_ struct _PROCESS_T *Process
+);
+
+//
+// IOCTL_EXIT: unpin every process
+//
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+PinDetachAll(
+    VOID
+);
\ No newline at end of file
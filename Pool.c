@@ -0,0 +1,242 @@
+#include "Pool.h"
+
+
+FORCEINLINE
+PPOOL_CPU_CACHE
+PolCurrentCache(
+    _In_ PPOOL_T Pool
+)
+{
+    //
+    // We may be rescheduled on another CPU right after this; SLISTs are
+    // interlocked so that only costs locality, never correctness
+    //
+    return &Pool->Caches[KeGetCurrentProcessorNumberEx(NULL) % Pool->CpuCount];
+}
+
+
+static
+PVOID
+PolRefill(
+    _In_    PPOOL_T         Pool,
+    _Inout_ PPOOL_CPU_CACHE Cache
+)
+/*++
+
+Routine Description:
+
+    Miss path of PolAlloc: allocates LowWatermark objects, returns the first
+    and puts the rest in Cache with one interlocked push, so a burst that
+    drained the cache goes back to pool once per LowWatermark allocations
+    instead of on every one.
+
+--*/
+{
+    PVOID        obj = NULL;
+    PSLIST_ENTRY first = NULL;
+    PSLIST_ENTRY last = NULL;
+    PSLIST_ENTRY e = NULL;
+    ULONG        count = 0;
+
+    obj = ExAllocatePoolWithTag(NonPagedPool, Pool->ObjectSize, Pool->Tag);
+    if (obj == NULL)
+    {
+        return NULL;
+    }
+
+    // running short on the rest is not fatal, the next miss tries again
+    for (count = 0; count + 1 < Pool->LowWatermark; ++count)
+    {
+        e = (PSLIST_ENTRY)ExAllocatePoolWithTag(NonPagedPool, Pool->ObjectSize, Pool->Tag);
+        if (e == NULL)
+        {
+            break;
+        }
+
+        e->Next = first;
+        first = e;
+        if (last == NULL)
+        {
+            last = e;
+        }
+    }
+
+    if (first != NULL)
+    {
+        InterlockedPushListSListEx(&Cache->FreeList, first, last, count);
+    }
+
+    return obj;
+}
+
+
+NTSTATUS
+PolInit(
+    _Out_ PPOOL_T Pool,
+    _In_  SIZE_T  ObjectSize,
+    _In_  ULONG   Tag,
+    _In_  USHORT  LowWatermark,
+    _In_  USHORT  HighWatermark
+)
+{
+    ULONG   i = 0;
+    USHORT  j = 0;
+    PVOID   obj = NULL;
+
+    ASSERT(Pool != NULL);
+    ASSERT(ObjectSize >= sizeof(SLIST_ENTRY));
+    ASSERT(LowWatermark <= HighWatermark);
+
+    RtlZeroMemory(Pool, sizeof(*Pool));
+
+    Pool->ObjectSize = ObjectSize;
+    Pool->Tag = Tag;
+    Pool->LowWatermark = LowWatermark;
+    Pool->HighWatermark = HighWatermark;
+    Pool->CpuCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    Pool->Caches = (PPOOL_CPU_CACHE)ExAllocatePoolWithTag(NonPagedPoolCacheAligned, Pool->CpuCount * sizeof(POOL_CPU_CACHE), Tag);
+    if (Pool->Caches == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(Pool->Caches, Pool->CpuCount * sizeof(POOL_CPU_CACHE));
+
+    for (i = 0; i < Pool->CpuCount; ++i)
+    {
+        InitializeSListHead(&Pool->Caches[i].FreeList);
+
+        // pre-fill; running short here is not fatal, PolAlloc falls back to pool
+        for (j = 0; j < LowWatermark; ++j)
+        {
+            obj = ExAllocatePoolWithTag(NonPagedPool, ObjectSize, Tag);
+            if (obj == NULL)
+            {
+                break;
+            }
+            InterlockedPushEntrySList(&Pool->Caches[i].FreeList, (PSLIST_ENTRY)obj);
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+PolUninit(
+    _Inout_ PPOOL_T Pool
+)
+{
+    ULONG        i = 0;
+    PSLIST_ENTRY e = NULL;
+
+    ASSERT(Pool != NULL);
+
+    if (Pool->Caches == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < Pool->CpuCount; ++i)
+    {
+        while ((e = InterlockedPopEntrySList(&Pool->Caches[i].FreeList)) != NULL)
+        {
+            ExFreePoolWithTag(e, Pool->Tag);
+        }
+    }
+
+    ExFreePoolWithTag(Pool->Caches, Pool->Tag);
+    Pool->Caches = NULL;
+
+    return;
+}
+
+
+_Use_decl_annotations_
+PVOID
+PolAlloc(
+    _Inout_ PPOOL_T Pool
+)
+{
+    PPOOL_CPU_CACHE cache = NULL;
+    PVOID           obj   = NULL;
+
+    ASSERT(Pool != NULL);
+
+    cache = PolCurrentCache(Pool);
+    InterlockedIncrement64(&cache->Allocs);
+
+    obj = InterlockedPopEntrySList(&cache->FreeList);
+    if (obj != NULL)
+    {
+        InterlockedIncrement64(&cache->Hits);
+        return obj;
+    }
+
+    // miss
+    obj = PolRefill(Pool, cache);
+    if (obj == NULL)
+    {
+        InterlockedDecrement64(&cache->Allocs);
+    }
+
+    return obj;
+}
+
+
+_Use_decl_annotations_
+VOID
+PolFree(
+    _Inout_ PPOOL_T Pool,
+    _In_    PVOID   Object
+)
+{
+    PPOOL_CPU_CACHE cache = NULL;
+
+    ASSERT(Pool != NULL);
+    ASSERT(Object != NULL);
+
+    cache = PolCurrentCache(Pool);
+    InterlockedIncrement64(&cache->Frees);
+
+    // above the high watermark the object goes back to the system
+    if (QueryDepthSList(&cache->FreeList) >= Pool->HighWatermark)
+    {
+        ExFreePoolWithTag(Object, Pool->Tag);
+        return;
+    }
+
+    InterlockedPushEntrySList(&cache->FreeList, (PSLIST_ENTRY)Object);
+
+    return;
+}
+
+
+VOID
+PolQueryStats(
+    _In_  PPOOL_T     Pool,
+    _Out_ PPOOL_STATS Stats
+)
+{
+    ULONG  i = 0;
+    LONG64 allocs = 0;
+    LONG64 frees = 0;
+
+    ASSERT(Pool != NULL);
+    ASSERT(Stats != NULL);
+
+    RtlZeroMemory(Stats, sizeof(*Stats));
+
+    for (i = 0; i < Pool->CpuCount; ++i)
+    {
+        allocs += Pool->Caches[i].Allocs;
+        frees += Pool->Caches[i].Frees;
+        Stats->Hits += Pool->Caches[i].Hits;
+        Stats->Cached += QueryDepthSList(&Pool->Caches[i].FreeList);
+    }
+
+    Stats->Misses = allocs - Stats->Hits;
+    Stats->Outstanding = allocs - frees;
+
+    return;
+}
\ No newline at end of file
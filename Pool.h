@@ -0,0 +1,89 @@
+#pragma once
+
+#include "WdmDriver.h"
+
+
+#define POL_DEFAULT_LOW_WATERMARK   16      // Objects pre-filled in every processor cache, and refilled at once when it runs dry
+#define POL_DEFAULT_HIGH_WATERMARK  256     // Objects kept in a processor cache before going back to pool
+
+
+//
+// Per processor cache of free objects; cache aligned so CPUs don't share lines
+//
+typedef struct DECLSPEC_CACHEALIGN _POOL_CPU_CACHE
+{
+    SLIST_HEADER    FreeList;       // Free objects cached on this processor
+    volatile LONG64 Allocs;         // PolAlloc calls served on this processor
+    volatile LONG64 Hits;           // ... of which came from FreeList
+    volatile LONG64 Frees;          // PolFree calls made on this processor
+
+}POOL_CPU_CACHE, *PPOOL_CPU_CACHE;
+
+
+//
+// Fixed size object pool with a lock free cache per processor
+//
+typedef struct _POOL_T
+{
+    SIZE_T          ObjectSize;
+    ULONG           Tag;
+    USHORT          LowWatermark;
+    USHORT          HighWatermark;
+    ULONG           CpuCount;
+    PPOOL_CPU_CACHE Caches;         // CpuCount entries
+
+}POOL_T, *PPOOL_T;
+
+
+typedef struct _POOL_STATS
+{
+    LONG64  Hits;                   // Allocs served from a processor cache
+    LONG64  Misses;                 // Allocs that went to ExAllocatePoolWithTag
+    LONG64  Outstanding;            // Objects currently handed out
+    LONG64  Cached;                 // Objects sitting in processor caches
+
+}POOL_STATS, *PPOOL_STATS;
+
+
+//
+// Allocates the processor caches and pre-fills each one up to LowWatermark
+//
+NTSTATUS
+PolInit(
+    _Out_ PPOOL_T Pool,
+    _In_  SIZE_T  ObjectSize,
+    _In_  ULONG   Tag,
+    _In_  USHORT  LowWatermark,
+    _In_  USHORT  HighWatermark
+);
+
+//
+// Frees every cached object; all objects must have been returned with PolFree
+//
+VOID
+PolUninit(
+    _Inout_ PPOOL_T Pool
+);
+
+//
+// Takes an object from the current processor cache; when that is empty,
+// allocates LowWatermark objects from pool, returns one and caches the rest
+//
+_IRQL_requires_max_(DISPATCH_LEVEL)
+PVOID
+PolAlloc(
+    _Inout_ PPOOL_T Pool
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+PolFree(
+    _Inout_ PPOOL_T Pool,
+    _In_    PVOID   Object
+);
+
+VOID
+PolQueryStats(
+    _In_  PPOOL_T     Pool,
+    _Out_ PPOOL_STATS Stats
+);
\ No newline at end of file
@@ -1,25 +1,62 @@
 #include "Process.h"
 
 
+//
+// PROCESS_T records are allocated on every process create / exit, so they come
+// from a per processor cache instead of going to the pool each time
+//
+static POOL_T gProcessPool;
+
+
+NTSTATUS
+PrcInitialize(
+    VOID
+)
+{
+    return PolInit(&gProcessPool, sizeof(PROCESS_T), IOC_TAG_NAME, POL_DEFAULT_LOW_WATERMARK, POL_DEFAULT_HIGH_WATERMARK);
+}
+
+
+VOID
+PrcUninitialize(
+    VOID
+)
+{
+    PolUninit(&gProcessPool);
+
+    return;
+}
+
+
+VOID
+PrcQueryPoolStats(
+    _Out_ PPOOL_STATS Stats
+)
+{
+    PolQueryStats(&gProcessPool, Stats);
+
+    return;
+}
+
 PPROCESS_T
 PrcAlloc(
     _In_   HANDLE  ParentId,
-    _In_   HANDLE  ProcessId,
-    _In_   BOOLEAN Create
+    _In_   HANDLE  ProcessId
 )
 {
     PPROCESS_T p = NULL;
 
-    p = (PPROCESS_T)ExAllocatePoolWithTag(NonPagedPool, sizeof(PROCESS_T), IOC_TAG_NAME);
+    p = (PPROCESS_T)PolAlloc(&gProcessPool);
     if (p == NULL)
     {
         goto cleanup;
     }
     RtlZeroMemory(p, sizeof(PROCESS_T));
 
-    p->Info.ParentId = ParentId;
-    p->Info.ProcessId = ProcessId;
-    p->Info.Create = Create;
+    p->ParentId = ParentId;
+    p->ProcessId = ProcessId;
+    p->RefCount = 1;
+    InitializeListHead(&p->PinEntry);
 
 
 cleanup:
@@ -35,14 +72,9 @@ PrcFree(
 {
     if (Process != NULL)
     {
-        if (Process->Mdl != NULL)
-        {
-            MmUnlockPages(Process->Mdl);   
-            IoFreeMdl(Process->Mdl);
-            Process->Mdl = NULL;
-        }
+        PinDetach(Process);
 
-        ExFreePoolWithTag(Process, IOC_TAG_NAME);
+        PolFree(&gProcessPool, Process);
         Process = NULL;
     }
 
@@ -51,58 +83,8 @@ PrcFree(
 
 
 VOID
-PrcInsertProcess(
-    _Inout_ PLIST_T     List,
-    _Inout_ PPROCESS_T  Process
-)
-{
-    ASSERT(List != NULL);
-    ASSERT(Process != NULL);
-
-    LopInsertHeadSync(List, &(Process->ListEntry));
-
-    return;
-}
-
-
-PPROCESS_T
-PrcRemoveProcessId(
-    _Inout_  PLIST_T  List,
-    _In_opt_ PHANDLE  ParentId,
-    _In_     PHANDLE  ProcessId
-)
-{
-    PPROCESS_T   p      = NULL;
-    PKSPIN_LOCK  sLock  = NULL;
-    KIRQL        irql   = PASSIVE_LEVEL;
-    
-    ASSERT(List != NULL);
-    ASSERT(ProcessId != NULL);
-
-    p = PrcFindProcessId(List, *ProcessId);
-    if (p != NULL)
-    {
-        sLock = List->SpinLock;
-
-        KeAcquireSpinLock(sLock, &irql);
-        
-        if (ParentId != NULL)
-        {
-            ASSERT(p->Info.ParentId == *ParentId);
-        }
-        RemoveEntryList(&p->ListEntry); 
-        
-        KeReleaseSpinLock(sLock, irql);
-    }
-
-    return p;
-}
-
-
-PPROCESS_T
-PrcFindProcessId(
-    _In_ PLIST_T List,
-    _In_ HANDLE  ProcessId
+PrcFreeList(
+    _Inout_ PLIST_T List
 )
 {
     PPROCESS_T   p      = NULL;
@@ -115,164 +97,174 @@ PrcFindProcessId(
     sLock = List->SpinLock;
     KeAcquireSpinLock(sLock, &irql);
     {
-        PLIST_ENTRY  head = &List->Head;
-        PLIST_ENTRY  e = NULL;
-
-        for (e = LopListBegin(List); e != head; e = LopEntryNext(e), p = NULL)
+        PLIST_T      listT = List;
+        PLIST_ENTRY  e = LopListBegin(listT);
+        PLIST_ENTRY  next = NULL;
+            
+        while (!IsListEmpty(&listT->Head))
         {
+            next = e->Flink;
+            RemoveEntryList(e);
+            
             p = CONTAINING_RECORD(e, PROCESS_T, ListEntry);
 
-            // Found PID in list
-            if (p->Info.ProcessId == ProcessId)
-            {
-                break;
-            }
-            p = NULL; // i know i already did this in for(;;p=null); vizibility
+            PrcDereference(p);
+            p = NULL;
+            e = next;
         }
     }
     KeReleaseSpinLock(sLock, irql);
 
-    return p;
+    return;
 }
 
 
 VOID
-PrcUnlockMdlsFromList(
-    _Inout_ PLIST_T List
+PrcTableInit(
+    _Out_ PPROCESS_TABLE Table
 )
 {
-    PPROCESS_T   p = NULL;
-    PKSPIN_LOCK  sLock = NULL;
-    KIRQL        irql = PASSIVE_LEVEL;
-
-    ASSERT(List != NULL);
+    ULONG i = 0;
 
+    ASSERT(Table != NULL);
 
-    sLock = List->SpinLock;
-    KeAcquireSpinLock(sLock, &irql);
+    for (i = 0; i < PRC_TABLE_BUCKETS; ++i)
     {
-        PLIST_T      listT = List;
-        PLIST_ENTRY  e = LopListBegin(listT);
-        PLIST_ENTRY  next = NULL;
+        InitializeListHead(&Table->Buckets[i]);
+        Table->Locks[i] = 0;
+    }
 
-        while (!IsListEmpty(&listT->Head))
-        {
-            next = e->Flink;
+    return;
+}
 
-            p = CONTAINING_RECORD(e, PROCESS_T, ListEntry);
-            if (p->Mdl != NULL)
-            {
-                MmUnlockPages(p->Mdl);
-                IoFreeMdl(p->Mdl);
-                p->Mdl = NULL;
-            }
 
-            PrcFree(p);
-            p = NULL;
-            e = next;
-        }
+VOID
+PrcTableInsert(
+    _Inout_ PPROCESS_TABLE Table,
+    _Inout_ PPROCESS_T     Process
+)
+{
+    ULONG   i    = 0;
+    KIRQL   irql = PASSIVE_LEVEL;
+
+    ASSERT(Table != NULL);
+    ASSERT(Process != NULL);
+
+    i = PRC_TABLE_HASH(Process->ProcessId);
+    irql = ExAcquireSpinLockExclusive(&Table->Locks[i]);
+    {
+        InsertHeadList(&Table->Buckets[i], &Process->ListEntry);
     }
-    KeReleaseSpinLock(sLock, irql);
+    ExReleaseSpinLockExclusive(&Table->Locks[i], irql);
 
     return;
 }
 
 
-VOID
-PrcFreeList(
-    _Inout_ PLIST_T List
+PPROCESS_T
+PrcTableFind(
+    _In_ PPROCESS_TABLE Table,
+    _In_ HANDLE         ProcessId
 )
 {
-    PPROCESS_T   p      = NULL;
-    PKSPIN_LOCK  sLock  = NULL;
-    KIRQL        irql   = PASSIVE_LEVEL;
+    PPROCESS_T   p    = NULL;
+    ULONG        i    = 0;
+    KIRQL        irql = PASSIVE_LEVEL;
 
-    ASSERT(List != NULL);
+    ASSERT(Table != NULL);
 
 
-    sLock = List->SpinLock;
-    KeAcquireSpinLock(sLock, &irql);
+    i = PRC_TABLE_HASH(ProcessId);
+    irql = ExAcquireSpinLockShared(&Table->Locks[i]);
     {
-        PLIST_T      listT = List;
-        PLIST_ENTRY  e = LopListBegin(listT);
-        PLIST_ENTRY  next = NULL;
-            
-        while (!IsListEmpty(&listT->Head))
+        PLIST_ENTRY  head = &Table->Buckets[i];
+        PLIST_ENTRY  e = NULL;
+
+        for (e = head->Flink; e != head; e = LopEntryNext(e), p = NULL)
         {
-            next = e->Flink;
-            RemoveEntryList(e);
-            
             p = CONTAINING_RECORD(e, PROCESS_T, ListEntry);
 
-            PrcFree(p);
-            p = NULL;
-            e = next;
+            // Found PID in bucket, keep it alive for the caller; other
+            // readers may be doing the same, hence the interlocked reference
+            if (p->ProcessId == ProcessId)
+            {
+                PrcReference(p);
+                break;
+            }
         }
     }
-    KeReleaseSpinLock(sLock, irql);
+    ExReleaseSpinLockShared(&Table->Locks[i], irql);
 
-    return;
+    return p;
 }
 
 
 PPROCESS_T
-PrcRemoveHeadProcess(
-    _Inout_ PLIST_T List
+PrcTableRemove(
+    _Inout_  PPROCESS_TABLE Table,
+    _In_opt_ PHANDLE        ParentId,
+    _In_     PHANDLE        ProcessId
 )
 {
-    PPROCESS_T   p      = NULL;
-    PKSPIN_LOCK  sLock  = NULL;
-    KIRQL        irql   = PASSIVE_LEVEL;
+    PPROCESS_T   p    = NULL;
+    ULONG        i    = 0;
+    KIRQL        irql = PASSIVE_LEVEL;
 
-    ASSERT(List != NULL);
+    ASSERT(Table != NULL);
+    ASSERT(ProcessId != NULL);
 
 
-    sLock = List->SpinLock;
-    KeAcquireSpinLock(sLock, &irql);
+    i = PRC_TABLE_HASH(*ProcessId);
+    irql = ExAcquireSpinLockExclusive(&Table->Locks[i]);
     {
+        PLIST_ENTRY  head = &Table->Buckets[i];
         PLIST_ENTRY  e = NULL;
 
-        e = LopListBegin(List);
-        RemoveEntryList(e);
-        
-        p = CONTAINING_RECORD(e, PROCESS_T, ListEntry);
+        for (e = head->Flink; e != head; e = LopEntryNext(e), p = NULL)
+        {
+            p = CONTAINING_RECORD(e, PROCESS_T, ListEntry);
+
+            // Found PID in bucket, unlink it while we still hold the lock
+            if (p->ProcessId == *ProcessId)
+            {
+                if (ParentId != NULL)
+                {
+                    ASSERT(p->ParentId == *ParentId);
+                }
+                RemoveEntryList(&p->ListEntry);
+                break;
+            }
+        }
     }
-    KeReleaseSpinLock(sLock, irql);
+    ExReleaseSpinLockExclusive(&Table->Locks[i], irql);
 
     return p;
 }
 
 
 VOID
-PrcUnlockMdlList(
-    _Inout_ PLIST_T List
+PrcTableFree(
+    _Inout_ PPROCESS_TABLE Table
 )
 {
-    PPROCESS_T   p      = NULL;
-    PKSPIN_LOCK  sLock  = NULL;
-    KIRQL        irql   = PASSIVE_LEVEL;
-
-    ASSERT(List != NULL);
+    ULONG        i    = 0;
+    PLIST_ENTRY  e    = NULL;
+    KIRQL        irql = PASSIVE_LEVEL;
 
+    ASSERT(Table != NULL);
 
-    sLock = List->SpinLock;
-    KeAcquireSpinLock(sLock, &irql);
+    for (i = 0; i < PRC_TABLE_BUCKETS; ++i)
     {
-        PLIST_ENTRY  head = &List->Head;
-        PLIST_ENTRY  e = NULL;
-
-        for (e = LopListBegin(List); e != head; e = LopEntryNext(e), p = NULL)
+        irql = ExAcquireSpinLockExclusive(&Table->Locks[i]);
         {
-            p = CONTAINING_RECORD(e, PROCESS_T, ListEntry);
-            if (p->Mdl != NULL)
+            while (!IsListEmpty(&Table->Buckets[i]))
             {
-                MmUnlockPages(p->Mdl);
-                IoFreeMdl(p->Mdl);
-                p->Mdl = NULL;
+                e = RemoveHeadList(&Table->Buckets[i]);
+                PrcDereference(CONTAINING_RECORD(e, PROCESS_T, ListEntry));
             }
         }
+        ExReleaseSpinLockExclusive(&Table->Locks[i], irql);
     }
-    KeReleaseSpinLock(sLock, irql);
 
     return;
 }
\ No newline at end of file
@@ -3,75 +3,169 @@
 #include "WdmDriver.h"
 #include "Public.h"
 #include "ListOp.h"
+#include "Pool.h"
+#include "Pin.h"
 
 
+//
+// One record per live process, owned by the PID table. Lookups take their own
+// reference so the record outlives a concurrent exit; the last PrcDereference frees it
+//
 typedef struct _PROCESS_T
 {
-    PROC_INFO  Info;           // PPID, PID and Create
-    PMDL       Mdl;            // Memory descriptor list
-    PVOID      SystemVA;       // System Address Space
-    LIST_ENTRY ListEntry;
+    HANDLE        ParentId;
+    HANDLE        ProcessId;
+    PMDL          Mdl;            // Caller request pages locked when it was dumped, PIN_BUDGET lock
+    LIST_ENTRY    PinEntry;       // PIN_BUDGET LRU link while Mdl != NULL
+    ULONG         PinnedBytes;    // Charged to the PIN_BUDGET for Mdl
+    PVOID         SystemVA;       // System Address Space
+    LIST_ENTRY    ListEntry;      // PROCESS_TABLE bucket link
+    volatile LONG RefCount;
 
 }PROCESS_T, *PPROCESS_T;
 
 
+//
+// PIDs are multiples of 4, so the low 2 bits are dropped before bucketing
+//
+#define PRC_TABLE_BUCKETS           1024
+#define PRC_TABLE_HASH(Pid)         ((((ULONG_PTR)(Pid)) >> 2) & (PRC_TABLE_BUCKETS - 1))
+
+//
+// PID indexed hash of PROCESS_T; every bucket has its own reader / writer lock.
+// Lookups (dump requests) take it shared so they run in parallel with each
+// other; inserts and removes take it exclusive
+//
+typedef struct _PROCESS_TABLE
+{
+    LIST_ENTRY   Buckets[PRC_TABLE_BUCKETS];
+    EX_SPIN_LOCK Locks[PRC_TABLE_BUCKETS];
+
+}PROCESS_TABLE, *PPROCESS_TABLE;
+
+
+//
+// Sets up the PROCESS_T pool; must run before the first PrcAlloc
+//
+NTSTATUS
+PrcInitialize(
+    VOID
+);
+
+//
+// Releases the PROCESS_T pool; every PROCESS_T must have been freed
+//
+VOID
+PrcUninitialize(
+    VOID
+);
+
+VOID
+PrcQueryPoolStats(
+    _Out_ PPOOL_STATS Stats
+);
 
+//
+// Returns a PROCESS_T holding one reference
+//
 PPROCESS_T
 PrcAlloc(
     _In_   HANDLE      ParentId,
-    _In_   HANDLE      ProcessId,
-    _In_   BOOLEAN     Create
+    _In_   HANDLE      ProcessId
 );
 
+//
+// Releases the record; only called once the last reference is gone
+//
 VOID
 PrcFree(
     _Inout_ PPROCESS_T Process
 );
 
-/* Synq */
+FORCEINLINE
+VOID
+PrcReference(
+    _Inout_ PPROCESS_T Process
+)
+{
+    ASSERT(Process != NULL);
+    ASSERT(Process->RefCount > 0);
+
+    InterlockedIncrement(&Process->RefCount);
+
+    return;
+}
 
+FORCEINLINE
 VOID
-PrcInsertProcess(
-    _Inout_ PLIST_T     List,
-    _Inout_ PPROCESS_T  Process
-);
+PrcDereference(
+    _Inout_ PPROCESS_T Process
+)
+{
+    LONG refCount = 0;
+
+    ASSERT(Process != NULL);
+
+    refCount = InterlockedDecrement(&Process->RefCount);
+    ASSERT(refCount >= 0);
+
+    if (refCount == 0)
+    {
+        PrcFree(Process);
+    }
+
+    return;
+}
+
+/* Synq */
 
 //
-// Removes PID from PROCESS_T list
+// Drops every PROCESS_T linked through ListEntry
 //
-// return:
-//      - NULL - not found (or head?)
-//      - valid pointer to PROCESS_T that was removed from list (free pointer)
-PPROCESS_T
-PrcRemoveProcessId(
-    _Inout_  PLIST_T  List,
-    _In_opt_ PHANDLE  ParentId,
-    _In_     PHANDLE  ProcessId
+VOID
+PrcFreeList(
+    _Inout_ PLIST_T List
+);
+
+/* PID table */
+
+VOID
+PrcTableInit(
+    _Out_ PPROCESS_TABLE Table
+);
+
+VOID
+PrcTableInsert(
+    _Inout_ PPROCESS_TABLE Table,
+    _Inout_ PPROCESS_T     Process
 );
 
 //
-// Find Pid in PROCESS_T list
+// Find Pid in PROCESS_T table; the PID bucket is only locked shared
 //
 // returns:
 //      - NULL - not found
-//      - valid ptr
+//      - valid ptr holding a new reference (PrcDereference when done)
 PPROCESS_T
-PrcFindProcessId(
-    _In_ PLIST_T List,
-    _In_ HANDLE  ProcessId
-);
-
-VOID
-PrcFreeList(
-    _Inout_ PLIST_T List
+PrcTableFind(
+    _In_ PPROCESS_TABLE Table,
+    _In_ HANDLE         ProcessId
 );
 
+//
+// Finds and unlinks PID in one pass over its bucket
+//
+// return:
+//      - NULL - not found
+//      - valid pointer to PROCESS_T that was removed from table; the table reference moves to the caller
 PPROCESS_T
-PrcRemoveHeadProcess(
-    _Inout_ PLIST_T List
+PrcTableRemove(
+    _Inout_  PPROCESS_TABLE Table,
+    _In_opt_ PHANDLE        ParentId,
+    _In_     PHANDLE        ProcessId
 );
 
 VOID
-PrcUnlockMdlList(
-    _Inout_ PLIST_T List
+PrcTableFree(
+    _Inout_ PPROCESS_TABLE Table
 );
\ No newline at end of file
@@ -7,19 +7,169 @@
 #define IOCTL_NOTIFY_CALLBACK       CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_DUMP_PROCESS          CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_NEITHER,  FILE_ANY_ACCESS)
 #define IOCTL_EXIT                  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x802, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_NOTIFY_CALLBACK_BATCH CTL_CODE(FILE_DEVICE_UNKNOWN, 0x803, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_MAP_SHARED_RING       CTL_CODE(FILE_DEVICE_UNKNOWN, 0x804, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_UNMAP_SHARED_RING     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x805, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_QUERY_VERSION         CTL_CODE(FILE_DEVICE_UNKNOWN, 0x806, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_QUERY_STATS           CTL_CODE(FILE_DEVICE_UNKNOWN, 0x807, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SET_QUEUE_POLICY      CTL_CODE(FILE_DEVICE_UNKNOWN, 0x808, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_READ_PROCESS_MEMORY   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x809, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+#define IOCTL_DUMP_PROCESS_BATCH    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80A, METHOD_NEITHER,  FILE_ANY_ACCESS)
 
 
 #define IOC_BUFFER_MAX_SIZE         64
+#define IOC_READ_MAX_SIZE           (1024 * 1024)   // Output buffer of one IOCTL_READ_PROCESS_MEMORY
+#define IOC_READ_MAX_IN_FLIGHT      64              // IOCTL_READ_PROCESS_MEMORY one handle may have queued
+#define IOC_DUMP_BATCH_MAX          4096            // Entries in one IOCTL_DUMP_PROCESS_BATCH
 
 
 
+#define PROC_INFO_VERSION           2
+
+
 //
-// Info provided by process notify
+// What the driver does with a new event when its queue is full
+// (IOCTL_SET_QUEUE_POLICY input, "QueuePolicy" service parameter)
 //
+typedef enum _QUEUE_POLICY
+{
+    QueuePolicyDropNewest = 0,              // Keep what is queued, lose the new event
+    QueuePolicyDropOldest,                  // Lose the oldest queued event
+    QueuePolicyCoalesce,                    // An exit cancels its still queued create, otherwise drop newest
+    QueuePolicyMax
+
+}QUEUE_POLICY, *PQUEUE_POLICY;
+
+
+
+//
+// Info provided by process notify (wire format v2).
+// Fixed width and packed, so 32 and 64 bit builds agree on the layout; 64 bit
+// fields come first and the size is a multiple of 8 to keep them aligned in arrays.
+//
+#pragma pack(push, 1)
 typedef struct _PROC_INFO
 {
-    HANDLE  ParentId;
-    HANDLE  ProcessId;
-    BOOLEAN Create;
+    ULONG64 Sequence;                       // Monotonic per driver load, starts at 1; a gap means lost events
+    LONG64  Timestamp;                      // KeQueryPerformanceCounter taken in the notify routine (QueryPerformanceCounter units)
+    ULONG   ParentId;
+    ULONG   ProcessId;
+    ULONG   Dropped;                        // Events dropped by the driver before this one (cumulative)
+    UCHAR   Create;
+    UCHAR   Reserved[3];
+
+}PROC_INFO, *PPROC_INFO;
+#pragma pack(pop)
+
+C_ASSERT(sizeof(PROC_INFO) == 32);
+
+
+//
+// IOCTL_QUERY_VERSION input (what the client speaks) and output (what the driver speaks)
+//
+typedef struct _PROC_INFO_VERSION_INFO
+{
+    ULONG   Version;                        // PROC_INFO_VERSION
+    ULONG   RecordSize;                     // sizeof(PROC_INFO)
+
+}PROC_INFO_VERSION_INFO, *PPROC_INFO_VERSION_INFO;
+
+
+//
+// Output of IOCTL_NOTIFY_CALLBACK_BATCH; the driver fills as many records as
+// fit in the caller output buffer
+//
+typedef struct _PROC_INFO_BATCH
+{
+    ULONG     Count;                        // Records filled in Records
+    ULONG     Pending;                      // Records still queued in the driver
+    PROC_INFO Records[ANYSIZE_ARRAY];
+
+}PROC_INFO_BATCH, *PPROC_INFO_BATCH;
+
+#define PROC_INFO_BATCH_HEADER_SIZE         FIELD_OFFSET(PROC_INFO_BATCH, Records)
+#define PROC_INFO_BATCH_SIZE(Count)         (PROC_INFO_BATCH_HEADER_SIZE + (Count) * sizeof(PROC_INFO))
+
+
+//
+// Output of IOCTL_QUERY_STATS
+//
+typedef struct _IOC_STATS
+{
+    ULONG   QueueCapacity;
+    ULONG   QueuePolicy;                    // QUEUE_POLICY
+    ULONG   QueueDepth;
+    ULONG   QueueHighWater;                 // Deepest the queue has been since the driver loaded
+    LONG64  DroppedNewest;
+    LONG64  DroppedOldest;
+    LONG64  Coalesced;                      // Pairs, each one is two events
+    LONG64  PoolHits;                       // PROCESS_T allocator
+    LONG64  PoolMisses;
+    LONG64  PoolOutstanding;
+    LONG64  PinnedBytes;                    // Caller request pages locked by IOCTL_DUMP_PROCESS, not target memory
+    LONG64  PinnedHighWater;
+    LONG64  PinnedLimit;                    // "PinnedMemoryMB" service parameter, in bytes
+    LONG64  PinEvictions;                   // Least recently dumped processes unpinned to make room
+    LONG64  PinRefused;                     // Pins that did not fit even after evicting
+    LONG64  Spilled;                        // Events queued on another CPU's ring, delivered in Timestamp order only best effort
+
+}IOC_STATS, *PIOC_STATS;
+
+
+//
+// Input of IOCTL_READ_PROCESS_MEMORY. The output buffer (at most
+// IOC_READ_MAX_SIZE) is filled straight through its MDL with the memory at
+// Address; the request completes with success and the number of bytes up to
+// the first page that can't be read, so a short count is not an error: the
+// caller skips that page and asks again for the rest.
+// Needs SeDebugPrivilege, and the caller must be allowed to open the target
+// for PROCESS_VM_READ (so no protected processes). Requests are served off
+// the caller thread; up to IOC_READ_MAX_IN_FLIGHT may be in flight on an
+// overlapped handle, more fail with STATUS_DEVICE_BUSY.
+//
+typedef struct _IOC_READ_REQUEST
+{
+    ULONG   ProcessId;
+    ULONG   Reserved;
+    ULONG64 Address;
+
+}IOC_READ_REQUEST, *PIOC_READ_REQUEST;
+
+C_ASSERT(sizeof(IOC_READ_REQUEST) == 16);
+
+
+//
+// Per PID options of IOCTL_DUMP_PROCESS_BATCH
+//
+#define IOC_DUMP_FLAG_UNPIN         0x2             // Release what IOCTL_DUMP_PROCESS locked for the process (IOCTL_EXIT does it for all)
+                                                    // 0x1 (pin the entry) is gone, entries carrying it fail with STATUS_INVALID_PARAMETER
+
+#define IOC_DUMP_STATUS_NOT_FOUND   ((LONG)0xC0000225L) // STATUS_NOT_FOUND, for user mode
+
+typedef struct _IOC_DUMP_ENTRY
+{
+    ULONG   ProcessId;
+    ULONG   Flags;                          // IOC_DUMP_FLAG_*
+    LONG    Status;                         // Out: NTSTATUS, STATUS_NOT_FOUND if the driver does not track the PID
+    ULONG   Reserved;
+
+}IOC_DUMP_ENTRY, *PIOC_DUMP_ENTRY;
+
+C_ASSERT(sizeof(IOC_DUMP_ENTRY) == 16);
+
+//
+// Input and output of IOCTL_DUMP_PROCESS_BATCH, the same buffer for both: the
+// driver locks it once, goes through every entry and fills in its Status, so
+// any number of PIDs cost one round trip. The IOCTL itself only fails when
+// the batch is malformed
+//
+typedef struct _IOC_DUMP_BATCH
+{
+    ULONG           Count;                  // Entries, at most IOC_DUMP_BATCH_MAX
+    ULONG           Found;                  // Out: entries with a successful Status
+    IOC_DUMP_ENTRY  Entries[ANYSIZE_ARRAY];
+
+}IOC_DUMP_BATCH, *PIOC_DUMP_BATCH;
 
-}PROC_INFO, *PPROC_INFO;
\ No newline at end of file
+#define IOC_DUMP_BATCH_HEADER_SIZE          FIELD_OFFSET(IOC_DUMP_BATCH, Entries)
+#define IOC_DUMP_BATCH_SIZE(Count)          (IOC_DUMP_BATCH_HEADER_SIZE + (Count) * sizeof(IOC_DUMP_ENTRY))
\ No newline at end of file
@@ -0,0 +1,252 @@
+#include "Ring.h"
+
+
+NTSTATUS
+RngInit(
+    _Out_ PEVENT_RING  Ring,
+    _In_  ULONG        Capacity
+)
+{
+    ULONG i = 0;
+
+    ASSERT(Ring != NULL);
+    ASSERT(Capacity != 0 && (Capacity & (Capacity - 1)) == 0);
+
+    RtlZeroMemory(Ring, sizeof(*Ring));
+
+    Ring->Slots = (PRING_SLOT)ExAllocatePoolWithTag(NonPagedPool, Capacity * sizeof(RING_SLOT), IOC_TAG_NAME);
+    if (Ring->Slots == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(Ring->Slots, Capacity * sizeof(RING_SLOT));
+
+    for (i = 0; i < Capacity; ++i)
+    {
+        Ring->Slots[i].Sequence = i;
+        Ring->Slots[i].Claim = -1;
+    }
+    Ring->Mask = Capacity - 1;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+RngUninit(
+    _Inout_ PEVENT_RING Ring
+)
+{
+    ASSERT(Ring != NULL);
+
+    if (Ring->Slots != NULL)
+    {
+        ExFreePoolWithTag(Ring->Slots, IOC_TAG_NAME);
+        Ring->Slots = NULL;
+    }
+
+    return;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN
+RngEnqueue(
+    _Inout_ PEVENT_RING Ring,
+    _In_    PPROC_INFO  Info
+)
+{
+    PRING_SLOT  slot     = NULL;
+    LONG64      pos      = 0;
+    LONG64      seq      = 0;
+    LONG64      prev     = 0;
+    LONG        depth    = 0;
+    LONG        high     = 0;
+
+    ASSERT(Ring != NULL);
+    ASSERT(Info != NULL);
+
+    pos = ReadNoFence64(&Ring->Tail);
+    for (;;)
+    {
+        slot = &Ring->Slots[pos & Ring->Mask];
+        seq = ReadAcquire64(&slot->Sequence);
+
+        if (seq == pos)
+        {
+            // slot is free, try to claim the position
+            prev = InterlockedCompareExchange64(&Ring->Tail, pos + 1, pos);
+            if (prev == pos)
+            {
+                break;
+            }
+            pos = prev;
+        }
+        else if (seq < pos)
+        {
+            // consumer is a whole lap behind
+            return FALSE;
+        }
+        else
+        {
+            // another producer took it
+            pos = ReadNoFence64(&Ring->Tail);
+        }
+    }
+
+    slot->Info = *Info;
+    slot->Claim = RNG_CLAIM_FREE(pos);
+    WriteRelease64(&slot->Sequence, pos + 1);
+
+    // high water mark
+    depth = (LONG)(pos + 1 - ReadNoFence64(&Ring->Head));
+    high = ReadNoFence(&Ring->HighWater);
+    while (depth > high)
+    {
+        prev = InterlockedCompareExchange(&Ring->HighWater, depth, high);
+        if (prev == high)
+        {
+            break;
+        }
+        high = (LONG)prev;
+    }
+
+    return TRUE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN
+RngDequeue(
+    _Inout_ PEVENT_RING Ring,
+    _Out_   PPROC_INFO  Info
+)
+{
+    PRING_SLOT  slot  = NULL;
+    LONG64      pos   = 0;
+    LONG64      seq   = 0;
+    LONG64      claim = 0;
+
+    ASSERT(Ring != NULL);
+    ASSERT(Info != NULL);
+
+    for (;;)
+    {
+        pos = ReadNoFence64(&Ring->Head);
+        slot = &Ring->Slots[pos & Ring->Mask];
+        seq = ReadAcquire64(&slot->Sequence);
+
+        if (seq < pos + 1)
+        {
+            // empty, or the producer that claimed pos hasn't published yet
+            return FALSE;
+        }
+        if (seq > pos + 1 || InterlockedCompareExchange64(&Ring->Head, pos + 1, pos) != pos)
+        {
+            // a producer making room took it first
+            continue;
+        }
+
+        *Info = slot->Info;
+        claim = InterlockedCompareExchange64(&slot->Claim, RNG_CLAIM_CONSUMED(pos), RNG_CLAIM_FREE(pos));
+        WriteRelease64(&slot->Sequence, pos + Ring->Mask + 1);
+
+        if (claim == RNG_CLAIM_FREE(pos))
+        {
+            return TRUE;
+        }
+
+        // a create whose exit got coalesced with it; neither goes out
+    }
+}
+
+
+_Use_decl_annotations_
+ULONG
+RngDequeueBatch(
+    _Inout_                                 PEVENT_RING Ring,
+    _Out_writes_to_(MaxCount, return)       PPROC_INFO  Infos,
+    _In_                                    ULONG       MaxCount
+)
+{
+    ULONG count = 0;
+
+    ASSERT(Ring != NULL);
+    ASSERT(Infos != NULL || MaxCount == 0);
+
+    while (count < MaxCount && RngDequeue(Ring, &Infos[count]))
+    {
+        ++count;
+    }
+
+    return count;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN
+RngCoalesce(
+    _Inout_ PEVENT_RING Ring,
+    _In_    ULONG       ProcessId
+)
+/*++
+
+Routine Description:
+
+    Looks for a still queued create of ProcessId and marks it so the consumer
+    skips it. Walks the whole ring, so it only runs on overflow.
+
+    Info is read without owning the slot; it can only be trusted if the
+    Claim CAS succeeds, since a slot is never rewritten before it is claimed.
+
+--*/
+{
+    PRING_SLOT  slot = NULL;
+    LONG64      pos  = 0;
+    LONG64      tail = 0;
+
+    tail = ReadNoFence64(&Ring->Tail);
+    for (pos = ReadNoFence64(&Ring->Head); pos < tail; ++pos)
+    {
+        slot = &Ring->Slots[pos & Ring->Mask];
+
+        if (ReadAcquire64(&slot->Sequence) != pos + 1)
+        {
+            continue;
+        }
+        if (!slot->Info.Create || slot->Info.ProcessId != ProcessId)
+        {
+            continue;
+        }
+
+        if (InterlockedCompareExchange64(&slot->Claim, RNG_CLAIM_COALESCED(pos), RNG_CLAIM_FREE(pos)) == RNG_CLAIM_FREE(pos))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN
+RngPeekTimestamp(
+    _In_  PEVENT_RING Ring,
+    _Out_ PLONG64     Timestamp
+)
+{
+    PRING_SLOT  slot = NULL;
+    LONG64      pos  = 0;
+
+    pos = ReadNoFence64(&Ring->Head);
+    slot = &Ring->Slots[pos & Ring->Mask];
+    if (ReadAcquire64(&slot->Sequence) != pos + 1)
+    {
+        return FALSE;
+    }
+
+    *Timestamp = slot->Info.Timestamp;
+
+    return TRUE;
+}
\ No newline at end of file
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "WdmDriver.h"
+#include "Public.h"
+
+
+#define RNG_DEFAULT_CAPACITY        4096    // Must be a power of 2
+#define RNG_MIN_CAPACITY            256
+#define RNG_MAX_CAPACITY            (1 << 18)
+
+//
+// RING_SLOT.Claim for position pos; whoever moves it off RNG_CLAIM_FREE owns the record
+//
+#define RNG_CLAIM_FREE(Pos)         ((Pos) * 4)
+#define RNG_CLAIM_CONSUMED(Pos)     ((Pos) * 4 + 1)
+#define RNG_CLAIM_COALESCED(Pos)    ((Pos) * 4 + 2)
+
+
+//
+// A slot is free for producers when Sequence == position and holds a
+// published PROC_INFO when Sequence == position + 1
+//
+typedef struct _RING_SLOT
+{
+    volatile LONG64 Sequence;
+    volatile LONG64 Claim;          // Consumer and coalescing producers race on it
+    PROC_INFO       Info;
+
+}RING_SLOT, *PRING_SLOT;
+
+
+//
+// Bounded lock free FIFO of PROC_INFO.
+// Producers only contend on a CAS of Tail. Head is normally only moved by the
+// notify thread; producers touch it too when they make room (QueuePolicyDropOldest)
+// or cancel a queued create (QueuePolicyCoalesce) on overflow. The ring has no
+// policy of its own, the EVENT_QUEUE applies it across all its rings and
+// charges the counters to the ring of the CPU the event was raised on.
+//
+typedef struct _EVENT_RING
+{
+    DECLSPEC_CACHEALIGN volatile LONG64 Tail;   // Next position producers claim
+    DECLSPEC_CACHEALIGN volatile LONG64 Head;   // Next position the consumer reads
+
+    DECLSPEC_CACHEALIGN PRING_SLOT      Slots;
+    ULONG                               Mask;   // Capacity - 1
+    volatile LONG                       HighWater;      // Deepest the ring has been
+
+    volatile LONG64                     DroppedNewest;  // Events refused because the ring was full
+    volatile LONG64                     DroppedOldest;  // Queued events thrown away to make room
+    volatile LONG64                     Coalesced;      // create / exit pairs that never reached the client
+    volatile LONG64                     Spilled;        // Events this CPU queued on another ring because its own was full
+
+}EVENT_RING, *PEVENT_RING;
+
+
+NTSTATUS
+RngInit(
+    _Out_ PEVENT_RING  Ring,
+    _In_  ULONG        Capacity
+);
+
+VOID
+RngUninit(
+    _Inout_ PEVENT_RING Ring
+);
+
+//
+// Any number of concurrent callers, IRQL <= DISPATCH_LEVEL
+//
+// returns:
+//      - FALSE - ring is full, nothing was queued
+//      - TRUE  - Info is queued
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+RngEnqueue(
+    _Inout_ PEVENT_RING Ring,
+    _In_    PPROC_INFO  Info
+);
+
+//
+// returns:
+//      - FALSE - ring is empty
+//      - TRUE  - oldest PROC_INFO was copied in Info
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+RngDequeue(
+    _Inout_ PEVENT_RING Ring,
+    _Out_   PPROC_INFO  Info
+);
+
+//
+// Marks a still queued create of ProcessId so the consumer skips it; walks
+// the whole ring, overflow only
+//
+// returns:
+//      - FALSE - no create of ProcessId is queued
+//      - TRUE  - the create will never reach the client
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+RngCoalesce(
+    _Inout_ PEVENT_RING Ring,
+    _In_    ULONG       ProcessId
+);
+
+//
+// Timestamp of the record at Head, without dequeuing it; stale as soon as it
+// returns, only good to pick a ring to make room in
+//
+// returns:
+//      - FALSE - ring is empty
+//      - TRUE  - Timestamp is set
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+RngPeekTimestamp(
+    _In_  PEVENT_RING Ring,
+    _Out_ PLONG64     Timestamp
+);
+
+//
+// Copies up to MaxCount oldest PROC_INFO in Infos
+//
+// returns number of records copied
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG
+RngDequeueBatch(
+    _Inout_                                 PEVENT_RING Ring,
+    _Out_writes_to_(MaxCount, return)       PPROC_INFO  Infos,
+    _In_                                    ULONG       MaxCount
+);
+
+FORCEINLINE
+ULONG
+RngCount(
+    _In_ PEVENT_RING Ring
+)
+{
+    ASSERT(Ring != NULL);
+
+    // may be stale by the time the caller looks at it
+    return (ULONG)(Ring->Tail - Ring->Head);
+}
+
+FORCEINLINE
+BOOLEAN
+RngIsEmpty(
+    _In_ PEVENT_RING Ring
+)
+{
+    return (BOOLEAN)(RngCount(Ring) == 0);
+}
+
+FORCEINLINE
+ULONG
+RngCapacity(
+    _In_ PEVENT_RING Ring
+)
+{
+    return Ring->Mask + 1;
+}
+
+//
+// Events that will never reach the client, whatever the reason
+//
+FORCEINLINE
+LONG64
+RngDropped(
+    _In_ PEVENT_RING Ring
+)
+{
+    return Ring->DroppedNewest + Ring->DroppedOldest + 2 * Ring->Coalesced;
+}
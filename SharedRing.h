@@ -0,0 +1,165 @@
+#pragma once
+
+#include "Public.h"
+
+
+//
+// PROC_INFO ring mapped in the client address space by IOCTL_MAP_SHARED_RING.
+// The driver is the only producer and the client the only consumer; each side
+// only ever writes its own index, records are read in place.
+// While it is mapped every event goes to it: IOCTL_NOTIFY_CALLBACK(_BATCH)
+// fails with STATUS_INVALID_DEVICE_STATE on any handle. It is dropped by
+// IOCTL_UNMAP_SHARED_RING, the cleanup of the handle that mapped it, or the
+// exit of the process that did.
+//
+#define SHR_CAPACITY                8192    // Must be a power of 2
+
+
+typedef struct _SHARED_RING
+{
+    DECLSPEC_ALIGN(64) volatile LONG64 Producer;    // Next position the driver writes (driver only)
+    DECLSPEC_ALIGN(64) volatile LONG64 Consumer;    // Next position the client reads (client only)
+
+    DECLSPEC_ALIGN(64) volatile LONG   Waiting;     // Client is about to block on the doorbell
+    ULONG                              Capacity;    // SHR_CAPACITY
+    volatile LONG64                    Dropped;     // Records the driver dropped so far (queue overflow)
+
+    DECLSPEC_ALIGN(64) PROC_INFO       Records[SHR_CAPACITY];
+
+}SHARED_RING, *PSHARED_RING;
+
+
+//
+// IOCTL_MAP_SHARED_RING input / output
+//
+typedef struct _SHARED_RING_MAP_IN
+{
+    ULONG64 Doorbell;                       // Auto reset event handle, signaled when records arrive in an empty ring
+
+}SHARED_RING_MAP_IN, *PSHARED_RING_MAP_IN;
+
+typedef struct _SHARED_RING_MAP_OUT
+{
+    ULONG64 Ring;                           // PSHARED_RING in the caller address space
+    ULONG   Size;                           // Bytes mapped
+
+}SHARED_RING_MAP_OUT, *PSHARED_RING_MAP_OUT;
+
+
+/* Producer (driver) */
+
+FORCEINLINE
+VOID
+ShrInit(
+    _Out_ PSHARED_RING Ring
+)
+{
+    RtlZeroMemory(Ring, sizeof(*Ring));
+    Ring->Capacity = SHR_CAPACITY;
+}
+
+//
+// returns the slot for the Index-th record after Producer, NULL if the ring would be full
+//
+FORCEINLINE
+PPROC_INFO
+ShrProducerSlot(
+    _In_ PSHARED_RING Ring,
+    _In_ ULONG        Index
+)
+{
+    LONG64 pos = Ring->Producer + Index;
+
+    if (pos - ReadAcquire64(&Ring->Consumer) >= SHR_CAPACITY)
+    {
+        return NULL;
+    }
+
+    return &Ring->Records[pos & (SHR_CAPACITY - 1)];
+}
+
+//
+// publishes Count records written through ShrProducerSlot
+//
+// returns TRUE if the consumer went to sleep and the doorbell must be signaled
+FORCEINLINE
+BOOLEAN
+ShrProducerCommit(
+    _Inout_ PSHARED_RING Ring,
+    _In_    ULONG        Count
+)
+{
+    WriteRelease64(&Ring->Producer, Ring->Producer + Count);
+
+    // full barrier; pairs with the one in ShrConsumerPrepareWait
+    return (BOOLEAN)(InterlockedCompareExchange(&Ring->Waiting, 0, 1) == 1);
+}
+
+
+/* Consumer (client) */
+
+//
+// returns the oldest published records, at most up to the end of the buffer
+//
+FORCEINLINE
+PPROC_INFO
+ShrConsumerPeek(
+    _In_  PSHARED_RING Ring,
+    _Out_ PULONG       Count
+)
+{
+    LONG64 pos = Ring->Consumer;
+    LONG64 available = ReadAcquire64(&Ring->Producer) - pos;
+    ULONG  index = (ULONG)(pos & (SHR_CAPACITY - 1));
+
+    if (available > (LONG64)(SHR_CAPACITY - index))
+    {
+        available = SHR_CAPACITY - index;
+    }
+    *Count = (ULONG)available;
+
+    return &Ring->Records[index];
+}
+
+FORCEINLINE
+VOID
+ShrConsumerRelease(
+    _Inout_ PSHARED_RING Ring,
+    _In_    ULONG        Count
+)
+{
+    WriteRelease64(&Ring->Consumer, Ring->Consumer + Count);
+}
+
+//
+// Records published but not read yet; the driver may add more right after
+//
+FORCEINLINE
+ULONG
+ShrConsumerPending(
+    _In_ PSHARED_RING Ring
+)
+{
+    return (ULONG)(ReadAcquire64(&Ring->Producer) - Ring->Consumer);
+}
+
+//
+// Call before blocking on the doorbell; returns FALSE if records showed up
+// meanwhile and the caller must not block
+//
+FORCEINLINE
+BOOLEAN
+ShrConsumerPrepareWait(
+    _Inout_ PSHARED_RING Ring
+)
+{
+    InterlockedExchange(&Ring->Waiting, 1);
+
+    if (ReadAcquire64(&Ring->Producer) != Ring->Consumer)
+    {
+        InterlockedExchange(&Ring->Waiting, 0);
+        return FALSE;
+    }
+
+    return TRUE;
+}
\ No newline at end of file
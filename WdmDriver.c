@@ -18,6 +18,9 @@ Environment:
 #include "Public.h"
 #include "ListOp.h"
 #include "Process.h"
+#include "EventQueue.h"
+#include "IrpQueue.h"
+#include "SharedRing.h"
 
 #include "Trace.h"
 #include "WdmDriver.tmh"
@@ -25,18 +28,36 @@ Environment:
 
 typedef struct _IOC_DRIVER
 {
-    LIST_T      ProcessList;                 // A list of active processes (used internal for print)
-    LIST_T      ProcessQueue;                // Processes queue for UM
+    PROCESS_TABLE ProcessTable;              // PID hash of active processes (used internal for print)
+    EVENT_QUEUE ProcessQueue;                // Processes queue for UM (lock free, per processor, merged by Timestamp)
 
     KEVENT      EventProcessCreateClose;     // A proc has been CREATED / CLOSED  (for proc queue)
+    KEVENT      EventIrpQueued;              // A notify IRP has been pended (for IrpQueue)
     KEVENT      EventDriverUnload;           // Driver Unload has been called
     HANDLE      ThreadHandle;
     
-    PIRP        IrpCurrent;                  // Current pended IRP 
-    KSPIN_LOCK  IrpLock;                     // SpinLock to use IRP
+    IRP_QUEUE   IrpQueue;                    // Pended notify IRPs, cancel safe
+
+    PSHARED_RING SharedRing;                 // Ring mapped in the client (kernel VA), NULL if not mapped
+    PMDL        SharedRingMdl;               // Pages backing SharedRing
+    PVOID       SharedRingUserVA;            // SharedRing in SharedRingProcess address space
+    PFILE_OBJECT SharedRingOwner;            // Handle the ring was mapped through; it lives until its cleanup
+    PEPROCESS   SharedRingProcess;           // Process that mapped the ring, referenced; the ring goes when it exits
+    PKEVENT     SharedRingDoorbell;          // Client event signaled when the ring stops being empty
+    KSPIN_LOCK  SharedRingLock;              // Guards the SharedRing* fields
+    FAST_MUTEX  SharedRingUnmapLock;         // One UnmapSharedRing at a time, held across the user view unmap
 
 } IOC_DRIVER, *PIOC_DRIVER;
 
+//
+// Per handle state, FILE_OBJECT.FsContext from IRP_MJ_CREATE to IRP_MJ_CLOSE
+//
+typedef struct _IOC_HANDLE
+{
+    volatile LONG ReadsInFlight;             // IOCTL_READ_PROCESS_MEMORY queued or running, at most IOC_READ_MAX_IN_FLIGHT
+
+} IOC_HANDLE, *PIOC_HANDLE;
+
 // 
 //  Structure that contains all the global data structures
 //  used throughout the filter.
@@ -45,17 +66,59 @@ IOC_DRIVER gDriver;
 
 KSTART_ROUTINE ProcessIoctlNotifyRoutine;
 
+ULONG
+FillNotifyIrp(
+    _Inout_ PIRP Irp
+);
+
 NTSTATUS
 ProcessIoctlDumpRoutine(
     _In_ PIRP Irp
 );
 
-VOID
-CancelIrpRoutine(
-    _In_ PDEVICE_OBJECT DeviceObject,
+NTSTATUS
+ProcessIoctlDumpBatchRoutine(
+    _In_ PIRP Irp
+);
+
+NTSTATUS
+DumpBatchEntry(
+    _In_ ULONG  ProcessId,
+    _In_ ULONG  Flags
+);
+
+NTSTATUS
+ProcessIoctlMapRingRoutine(
     _In_ PIRP Irp
 );
 
+NTSTATUS
+ProcessIoctlReadRoutine(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP           Irp
+);
+
+IO_WORKITEM_ROUTINE ReadProcessMemoryWorker;
+
+VOID
+UnmapSharedRing(
+    _In_opt_ PFILE_OBJECT FileObject,
+    _In_opt_ PEPROCESS    Process
+);
+
+BOOLEAN
+FillSharedRing(
+    VOID
+);
+
+VOID
+ReadParameters(
+    _In_  PUNICODE_STRING RegistryPath,
+    _Out_ PULONG          QueueCapacity,
+    _Out_ PQUEUE_POLICY   QueuePolicy,
+    _Out_ PULONG          PinnedLimitMb
+);
+
 NTSTATUS
 DriverEntry(
     _In_ PDRIVER_OBJECT DriverObject,
@@ -87,8 +150,9 @@ Return Value:
     UNICODE_STRING      devName         = { 0 };
     PDEVICE_OBJECT      deviceObject    = NULL;
     OBJECT_ATTRIBUTES   objAtr          = { 0 };
-
-    UNREFERENCED_PARAMETER(RegistryPath);
+    ULONG               queueCapacity   = RNG_DEFAULT_CAPACITY;
+    QUEUE_POLICY        queuePolicy     = QueuePolicyDropNewest;
+    ULONG               pinnedLimitMb   = PIN_DEFAULT_LIMIT_MB;
 
     WPP_INIT_TRACING(DriverObject, RegistryPath);
 
@@ -98,28 +162,44 @@ Return Value:
     {
         // init.. 
         RtlZeroMemory(&gDriver, sizeof(gDriver));
-        KeInitializeSpinLock(&gDriver.IrpLock);
+        status = IrpQInit(&gDriver.IrpQueue);
+        if (!NT_SUCCESS(status))
+        {
+            LogErrorNt("IrpQInit", status);
+            __leave;
+        }
 
-        // init km proc list 
-        gDriver.ProcessList.SpinLock = (PKSPIN_LOCK)ExAllocatePoolWithTag(NonPagedPool, sizeof(KSPIN_LOCK), IOC_TAG_NAME);
-        if (gDriver.ProcessList.SpinLock == NULL)
+        // init PROCESS_T allocator
+        status = PrcInitialize();
+        if (!NT_SUCCESS(status))
         {
-            LogErrorHex("ExAllocatePoolWithTag", 0);
+            LogErrorNt("PrcInitialize", status);
             __leave;
         }
-        LopInit(&gDriver.ProcessList);
+
+        // init km proc table 
+        PrcTableInit(&gDriver.ProcessTable);
         
         // init um proc queue
-        gDriver.ProcessQueue.SpinLock = (PKSPIN_LOCK)ExAllocatePoolWithTag(NonPagedPool, sizeof(KSPIN_LOCK), IOC_TAG_NAME);
-        if (gDriver.ProcessQueue.SpinLock == NULL)
+        ReadParameters(RegistryPath, &queueCapacity, &queuePolicy, &pinnedLimitMb);
+        LogInfo("ProcessQueue capacity:%u policy:%u", queueCapacity, queuePolicy);
+
+        // cap on pages locked for dumps
+        PinInitialize(pinnedLimitMb);
+        LogInfo("pinned memory limit:%u MB", pinnedLimitMb);
+
+        status = EvqInit(&gDriver.ProcessQueue, queueCapacity, queuePolicy);
+        if (!NT_SUCCESS(status))
         {
-            LogErrorHex("ExAllocatePoolWithTag", 0);
+            LogErrorNt("EvqInit", status);
             __leave;
         }
-        LopInit(&gDriver.ProcessQueue);
 
         // init events
         KeInitializeEvent(&gDriver.EventProcessCreateClose, SynchronizationEvent, FALSE);
+        KeInitializeEvent(&gDriver.EventIrpQueued, SynchronizationEvent, FALSE);
+        KeInitializeSpinLock(&gDriver.SharedRingLock);
+        ExInitializeFastMutex(&gDriver.SharedRingUnmapLock);
         KeInitializeEvent(&gDriver.EventDriverUnload, SynchronizationEvent, FALSE);
         
         // Device name
@@ -140,6 +220,7 @@ Return Value:
 
         DriverObject->MajorFunction[IRP_MJ_CREATE] = IocDispatchCreateClose;
         DriverObject->MajorFunction[IRP_MJ_CLOSE] = IocDispatchCreateClose;
+        DriverObject->MajorFunction[IRP_MJ_CLEANUP] = IocDispatchCleanup;
         DriverObject->MajorFunction[IRP_MJ_DEVICE_CONTROL] = IocDispatchDeviceControl;
         DriverObject->DriverUnload = DriverUnload;
 
@@ -190,16 +271,9 @@ Return Value:
             IoDeleteSymbolicLink(&symLinkName);
             IoDeleteDevice(deviceObject);
 
-            if (gDriver.ProcessList.SpinLock != NULL)
-            { 
-                ExFreePoolWithTag(gDriver.ProcessList.SpinLock, IOC_TAG_NAME);
-                gDriver.ProcessList.SpinLock = NULL;
-            }
-            if (gDriver.ProcessQueue.SpinLock != NULL)
-            {
-                ExFreePoolWithTag(gDriver.ProcessQueue.SpinLock, IOC_TAG_NAME);
-                gDriver.ProcessQueue.SpinLock = NULL;
-            }
+            EvqUninit(&gDriver.ProcessQueue);
+
+            PrcUninitialize();
 
             WPP_CLEANUP(DriverObject);
         }
@@ -250,21 +324,38 @@ DriverUnload(
     status = ZwWaitForSingleObject(gDriver.ThreadHandle, FALSE, NULL);  
     ZwClose(gDriver.ThreadHandle);
 
-    // Free procs from lists & free list_t
-    if (gDriver.ProcessList.SpinLock != NULL)
+    // Free procs from table & free queue
+    PrcTableFree(&gDriver.ProcessTable);
+
+    // the last PROCESS_T unpinned itself
+    {
+        IOC_STATS stats = { 0 };
+
+        PinQueryStats(&stats);
+        LogInfo("pinned high water:%I64d/%I64d bytes evictions:%I64d refused:%I64d",
+            stats.PinnedHighWater, stats.PinnedLimit, stats.PinEvictions, stats.PinRefused);
+
+        PinUninitialize();
+    }
+
     {
-        PrcFreeList(&gDriver.ProcessList);
+        IOC_STATS stats = { 0 };
 
-        ExFreePoolWithTag(gDriver.ProcessList.SpinLock, IOC_TAG_NAME);
-        gDriver.ProcessList.SpinLock = NULL;
+        EvqQueryStats(&gDriver.ProcessQueue, &stats);
+        LogInfo("ProcessQueue high water:%u/%u dropped newest:%I64d oldest:%I64d coalesced:%I64d spilled:%I64d",
+            stats.QueueHighWater, stats.QueueCapacity, stats.DroppedNewest, stats.DroppedOldest, stats.Coalesced, stats.Spilled);
     }
-    
-    if (gDriver.ProcessQueue.SpinLock != NULL)
+    EvqUninit(&gDriver.ProcessQueue);
+
+    // All PROCESS_T are back, release the allocator
     {
-        PrcFreeList(&gDriver.ProcessQueue);
+        POOL_STATS stats = { 0 };
 
-        ExFreePoolWithTag(gDriver.ProcessQueue.SpinLock, IOC_TAG_NAME);
-        gDriver.ProcessQueue.SpinLock = NULL;
+        PrcQueryPoolStats(&stats);
+        LogInfo("PROCESS_T pool: hits:%I64d misses:%I64d outstanding:%I64d cached:%I64d",
+            stats.Hits, stats.Misses, stats.Outstanding, stats.Cached);
+
+        PrcUninitialize();
     }
 
 
@@ -280,11 +371,56 @@ IocDispatchCreateClose(
     _Inout_ struct _DEVICE_OBJECT *DeviceObject,
     _Inout_ struct _IRP           *Irp
 )
+{
+    NTSTATUS            status  = STATUS_SUCCESS;
+    PIO_STACK_LOCATION  irpSp   = IoGetCurrentIrpStackLocation(Irp);
+    PIOC_HANDLE         handle  = NULL;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    if (irpSp->MajorFunction == IRP_MJ_CREATE)
+    {
+        handle = (PIOC_HANDLE)ExAllocatePoolWithTag(NonPagedPool, sizeof(IOC_HANDLE), IOC_TAG_NAME);
+        if (handle == NULL)
+        {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+        else
+        {
+            RtlZeroMemory(handle, sizeof(*handle));
+            irpSp->FileObject->FsContext = handle;
+        }
+    }
+    else if (irpSp->FileObject->FsContext != NULL)
+    {
+        // IRP_MJ_CLOSE: every IRP of the handle has completed
+        ExFreePoolWithTag(irpSp->FileObject->FsContext, IOC_TAG_NAME);
+        irpSp->FileObject->FsContext = NULL;
+    }
+
+    Irp->IoStatus.Information = 0;
+    Irp->IoStatus.Status = status;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return status;
+}
+
+
+_Use_decl_annotations_
+NTSTATUS
+IocDispatchCleanup(
+    _Inout_ struct _DEVICE_OBJECT *DeviceObject,
+    _Inout_ struct _IRP           *Irp
+)
 {
     NTSTATUS status = STATUS_SUCCESS;
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
+    // the last handle to this file object is gone; other handles of the same
+    // process may still be open and are not affected
+    UnmapSharedRing(IoGetCurrentIrpStackLocation(Irp)->FileObject, NULL);
+
     Irp->IoStatus.Information = 0;
     Irp->IoStatus.Status = status;
     IoCompleteRequest(Irp, IO_NO_INCREMENT);
@@ -303,34 +439,144 @@ IocDispatchDeviceControl(
     NTSTATUS            irpStatus       = STATUS_SUCCESS;
     PIO_STACK_LOCATION  irpSp           = NULL;
 
-    UNREFERENCED_PARAMETER(DeviceObject);
-
 
     irpSp = IoGetCurrentIrpStackLocation(Irp);
 
     switch (irpSp->Parameters.DeviceIoControl.IoControlCode)
     {
         case IOCTL_NOTIFY_CALLBACK:
+        case IOCTL_NOTIFY_CALLBACK_BATCH:
         {
-            KIRQL irql = PASSIVE_LEVEL;
+            ULONG minLen = 0;
 
-            while (gDriver.IrpCurrent != NULL) {} 
-            
-            KeAcquireSpinLock(&gDriver.IrpLock, &irql);
+            minLen = (irpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_NOTIFY_CALLBACK_BATCH) ?
+                (ULONG)PROC_INFO_BATCH_SIZE(1) : (ULONG)sizeof(PROC_INFO);
+            if (irpSp->Parameters.DeviceIoControl.OutputBufferLength < minLen)
             {
-                gDriver.IrpCurrent = Irp;
-
-                IoMarkIrpPending(Irp);
-                irpStatus = STATUS_PENDING;
+                irpStatus = STATUS_BUFFER_TOO_SMALL;
+                Irp->IoStatus.Information = 0;
+                Irp->IoStatus.Status = irpStatus;
+                IoCompleteRequest(Irp, IO_NO_INCREMENT);
+                break;
+            }
 
-                IoSetCancelRoutine(Irp, CancelIrpRoutine);
+            // the shared ring takes every event, an IRP pended now would never
+            // be filled; unlocked, the notify thread turns away any that slip by
+            if (gDriver.SharedRing != NULL)
+            {
+                irpStatus = STATUS_INVALID_DEVICE_STATE;
+                Irp->IoStatus.Information = 0;
+                Irp->IoStatus.Status = irpStatus;
+                IoCompleteRequest(Irp, IO_NO_INCREMENT);
+                break;
             }
-            KeReleaseSpinLock(&gDriver.IrpLock, irql);
 
+            irpStatus = IrpQInsert(&gDriver.IrpQueue, Irp);
+
+            // Wake the notify thread in case events are already queued;
             // Will mark completion of IRP in ProcessIoctlNotifyRoutine
+            KeSetEvent(&gDriver.EventIrpQueued, IO_NO_INCREMENT, FALSE);
             
             break;
         }
+        case IOCTL_MAP_SHARED_RING:
+        {
+            irpStatus = ProcessIoctlMapRingRoutine(Irp);
+
+            // Will mark completion of IRP in ProcessIoctlMapRingRoutine
+
+            break;
+        }
+        case IOCTL_UNMAP_SHARED_RING:
+        {
+            UnmapSharedRing(irpSp->FileObject, NULL);
+
+            // Fill completion status
+            Irp->IoStatus.Information = 0;
+            Irp->IoStatus.Status = irpStatus;
+            IoCompleteRequest(Irp, IO_NO_INCREMENT);
+            break;
+        }
+        case IOCTL_QUERY_VERSION:
+        {
+            PPROC_INFO_VERSION_INFO version = (PPROC_INFO_VERSION_INFO)Irp->AssociatedIrp.SystemBuffer;
+
+            Irp->IoStatus.Information = 0;
+
+            if (irpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(*version) ||
+                irpSp->Parameters.DeviceIoControl.OutputBufferLength < sizeof(*version))
+            {
+                irpStatus = STATUS_BUFFER_TOO_SMALL;
+            }
+            else
+            {
+                // only one wire format so far, so whatever the caller asked for
+                // it gets v2 back and decides if it can decode it
+                LogInfo("client PROC_INFO v%u (%u bytes)", version->Version, version->RecordSize);
+
+                version->Version = PROC_INFO_VERSION;
+                version->RecordSize = sizeof(PROC_INFO);
+                Irp->IoStatus.Information = sizeof(*version);
+            }
+
+            // Fill completion status
+            Irp->IoStatus.Status = irpStatus;
+            IoCompleteRequest(Irp, IO_NO_INCREMENT);
+            break;
+        }
+        case IOCTL_QUERY_STATS:
+        {
+            PIOC_STATS  stats     = (PIOC_STATS)Irp->AssociatedIrp.SystemBuffer;
+            POOL_STATS  poolStats = { 0 };
+
+            Irp->IoStatus.Information = 0;
+
+            if (irpSp->Parameters.DeviceIoControl.OutputBufferLength < sizeof(*stats))
+            {
+                irpStatus = STATUS_BUFFER_TOO_SMALL;
+            }
+            else
+            {
+                PrcQueryPoolStats(&poolStats);
+
+                RtlZeroMemory(stats, sizeof(*stats));
+                EvqQueryStats(&gDriver.ProcessQueue, stats);
+                stats->PoolHits = poolStats.Hits;
+                stats->PoolMisses = poolStats.Misses;
+                stats->PoolOutstanding = poolStats.Outstanding;
+                PinQueryStats(stats);
+                Irp->IoStatus.Information = sizeof(*stats);
+            }
+
+            // Fill completion status
+            Irp->IoStatus.Status = irpStatus;
+            IoCompleteRequest(Irp, IO_NO_INCREMENT);
+            break;
+        }
+        case IOCTL_SET_QUEUE_POLICY:
+        {
+            PULONG policy = (PULONG)Irp->AssociatedIrp.SystemBuffer;
+
+            if (irpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(ULONG))
+            {
+                irpStatus = STATUS_BUFFER_TOO_SMALL;
+            }
+            else if (*policy >= QueuePolicyMax)
+            {
+                irpStatus = STATUS_INVALID_PARAMETER;
+            }
+            else
+            {
+                LogInfo("ProcessQueue policy -> %u", *policy);
+                EvqSetPolicy(&gDriver.ProcessQueue, (QUEUE_POLICY)*policy);
+            }
+
+            // Fill completion status
+            Irp->IoStatus.Information = 0;
+            Irp->IoStatus.Status = irpStatus;
+            IoCompleteRequest(Irp, IO_NO_INCREMENT);
+            break;
+        }
         case IOCTL_DUMP_PROCESS:
         {
             irpStatus = ProcessIoctlDumpRoutine(Irp);
@@ -339,10 +585,26 @@ IocDispatchDeviceControl(
 
             break;
         }
+        case IOCTL_DUMP_PROCESS_BATCH:
+        {
+            irpStatus = ProcessIoctlDumpBatchRoutine(Irp);
+
+            // Will mark completion of IRP in ProcessIoctlDumpBatchRoutine
+
+            break;
+        }
+        case IOCTL_READ_PROCESS_MEMORY:
+        {
+            irpStatus = ProcessIoctlReadRoutine(DeviceObject, Irp);
+
+            // Will mark completion of IRP in ProcessIoctlReadRoutine / ReadProcessMemoryWorker
+
+            break;
+        }
         case IOCTL_EXIT:
         {
             // unlock MDLs
-            PrcUnlockMdlList(&gDriver.ProcessList);
+            PinDetachAll();
 
             // Fill completion status
             Irp->IoStatus.Information = 0;
@@ -372,40 +634,53 @@ CreateProcessNotifyRoutine(
 )
 {
     PPROCESS_T process = NULL;
+    PROC_INFO  info    = { 0 };
 
     LogInfo("PPID:%p PID:%p %s", ParentId, ProcessId, Create ? "Create" : "Close");
     
     __try
     {
         //
-        //  NOTIFY proc queue
+        //  Exit runs in the exiting process, before its address space goes: the
+        //  last chance to drop a ring it mapped from its own context. Unlocked,
+        //  a process with no threads left cannot map one now
         //
-        process = PrcAlloc(ParentId, ProcessId, Create);
-        if (process != NULL)
+        if (!Create && gDriver.SharedRingProcess == PsGetCurrentProcess())
         {
-            PrcInsertProcess(&gDriver.ProcessQueue, process); 
+            UnmapSharedRing(NULL, PsGetCurrentProcess());
+        }
 
+        //
+        //  NOTIFY proc queue; the ring keeps its own copy so nothing is allocated here.
+        //  Sequence / Dropped are stamped when the record is delivered
+        //
+        info.ParentId = HandleToULong(ParentId);
+        info.ProcessId = HandleToULong(ProcessId);
+        info.Create = Create;
+
+        if (EvqEnqueue(&gDriver.ProcessQueue, &info))
+        {
             KeSetEvent(&gDriver.EventProcessCreateClose, IO_NO_INCREMENT, FALSE);
         }
 
         //
-        //  Internal proc list
+        //  Internal proc table; it owns the PrcAlloc reference
         //
         if (Create)
         {
-            process = PrcAlloc(ParentId, ProcessId, Create); 
+            process = PrcAlloc(ParentId, ProcessId); 
             if (process != NULL)
             {
-                PrcInsertProcess(&gDriver.ProcessList, process);
+                PrcTableInsert(&gDriver.ProcessTable, process);
                 process = NULL;
             }
         }
         else
         {
-            process = PrcRemoveProcessId(&gDriver.ProcessList, &ParentId, &ProcessId);
+            process = PrcTableRemove(&gDriver.ProcessTable, &ParentId, &ProcessId);
             if (process != NULL)
             {
-                PrcFree(process);
+                PrcDereference(process);
                 process = NULL;
             }
         }
@@ -429,18 +704,21 @@ Routine Description:
 
     Process all the PENDING IRPs.
 
+    Sleeps until either a process event or a new notify IRP shows up, then
+    hands queued records to pended IRPs until one of the two runs out.
+    While a client has the shared ring mapped, records go there instead and
+    whatever doesn't fit is retried every IOC_SHARED_RING_RETRY_MS.
+
 --*/
 {
     NTSTATUS    status          = STATUS_UNSUCCESSFUL;
-    PVOID       waitEvents[2]   = { 0 };
+    PVOID       waitEvents[3]   = { 0 };
     PIRP                irp = NULL;
-    PIO_STACK_LOCATION  irpSp = NULL;
-    PWCHAR              inBuffer = NULL;
-    PWCHAR              outBuffer = NULL;
-    ULONG               inBufferLen = 0;
-    ULONG               outBufferLen = 0;
-    KIRQL               irql = PASSIVE_LEVEL;
-    PPROCESS_T p = NULL;
+    ULONG               filled = 0;
+    BOOLEAN             bBacklog = FALSE;
+    LARGE_INTEGER       retry = { 0 };
+
+    retry.QuadPart = -10000LL * IOC_SHARED_RING_RETRY_MS;
 
 
     UNREFERENCED_PARAMETER(StartContext);
@@ -448,66 +726,66 @@ Routine Description:
     for (;;)
     {
         waitEvents[0] = &gDriver.EventProcessCreateClose;
-        waitEvents[1] = &gDriver.EventDriverUnload;
+        waitEvents[1] = &gDriver.EventIrpQueued;
+        waitEvents[2] = &gDriver.EventDriverUnload;
 
         status = KeWaitForMultipleObjects(
-            2,
+            3,
             waitEvents,
             WaitAny,
             Executive,
             KernelMode,
             FALSE,
-            NULL,        
+            bBacklog ? &retry : NULL,        
             NULL);
-        if (status == STATUS_WAIT_0)
+        if (status == STATUS_WAIT_0 || status == STATUS_WAIT_1 || status == STATUS_TIMEOUT)
         {
-            LogInfo("EventProcessCreate || EventProcessClose");
+            LogInfo("EventProcessCreate || EventProcessClose || EventIrpQueued");
 
-            while (gDriver.IrpCurrent == NULL && KeReadStateEvent(&gDriver.EventDriverUnload) == 0) {} 
-            if (KeReadStateEvent(&gDriver.EventDriverUnload) != 0)
-            {
-                //was signaled
-                break;
-            }
-            
-            KeAcquireSpinLock(&gDriver.IrpLock, &irql);
+            // shared ring mode, no IRPs involved
+            bBacklog = FALSE;
+            if (FillSharedRing())
             {
-                irp = gDriver.IrpCurrent;
+                bBacklog = !EvqIsEmpty(&gDriver.ProcessQueue);
+
+                // pended before the ring was mapped or raced past the dispatch check
+                while ((irp = IrpQRemoveNext(&gDriver.IrpQueue)) != NULL)
+                {
+                    irp->IoStatus.Information = 0;
+                    irp->IoStatus.Status = STATUS_INVALID_DEVICE_STATE;
+                    IoCompleteRequest(irp, IO_NO_INCREMENT);
+                }
+                irp = NULL;
+                continue;
             }
-            KeReleaseSpinLock(&gDriver.IrpLock, irql);
-
-            irpSp = IoGetCurrentIrpStackLocation(irp);
-
-            inBufferLen = irpSp->Parameters.DeviceIoControl.InputBufferLength;
-            outBufferLen = irpSp->Parameters.DeviceIoControl.OutputBufferLength;
-
-            inBuffer = (PWCHAR)irp->AssociatedIrp.SystemBuffer;
-            outBuffer = (PWCHAR)irp->AssociatedIrp.SystemBuffer;
-
-            p = PrcRemoveHeadProcess(&gDriver.ProcessQueue);
-                
-            ASSERT(outBufferLen == sizeof(p->Info));
-            RtlCopyMemory(outBuffer, &p->Info, sizeof(p->Info));
-            PrcFree(p);
-
-            // clean cancel stuff
-            IoSetCancelRoutine(irp, NULL);
 
-            // Fill completion status
-            irp->IoStatus.Information = sizeof(p->Info);
-            irp->IoStatus.Status = STATUS_SUCCESS;
-            IoCompleteRequest(irp, IO_NO_INCREMENT);
-
-
-            irql = PASSIVE_LEVEL;
-            KeAcquireSpinLock(&gDriver.IrpLock, &irql);
+            // events are auto reset, so drain everything queued since the last wake
+            while (!EvqIsEmpty(&gDriver.ProcessQueue))
             {
-                gDriver.IrpCurrent = NULL;
+                irp = IrpQRemoveNext(&gDriver.IrpQueue);
+                if (irp == NULL)
+                {
+                    // no client waiting; records stay queued until an IRP is pended
+                    break;
+                }
+
+                filled = FillNotifyIrp(irp);
+                if (filled == 0)
+                {
+                    // producer hasn't published yet, keep the IRP for the next event;
+                    // back in front, so the clients' requests are still served in order
+                    IrpQInsertHead(&gDriver.IrpQueue, irp);
+                    break;
+                }
+
+                // Fill completion status
+                irp->IoStatus.Information = filled;
+                irp->IoStatus.Status = STATUS_SUCCESS;
+                IoCompleteRequest(irp, IO_NO_INCREMENT);
+                irp = NULL;
             }
-            KeReleaseSpinLock(&gDriver.IrpLock, irql);
-                
         }
-        else if (status == STATUS_WAIT_1)
+        else if (status == STATUS_WAIT_2)
         {
             LogInfo("EventDriverUnload");
 
@@ -520,118 +798,402 @@ Routine Description:
         }
     }
 
+    // nobody will complete them from now on
+    IrpQFlush(&gDriver.IrpQueue);
 
     return;
 }
 
 
 
-VOID 
-CancelIrpRoutine(
-    _In_ PDEVICE_OBJECT DeviceObject,
-    _In_ PIRP           Irp
+ULONG
+FillNotifyIrp(
+    _Inout_ PIRP Irp
 )
+/*++
+
+Routine Description:
+
+    Moves queued PROC_INFO records in the output buffer of a pended
+    IOCTL_NOTIFY_CALLBACK (one record) or IOCTL_NOTIFY_CALLBACK_BATCH
+    (as many records as fit).
+
+Return Value:
+
+    Number of bytes written in the output buffer, 0 if nothing was queued.
+
+--*/
 {
-    PIRP cancelIrp = NULL;
-    KIRQL irql = PASSIVE_LEVEL;
+    PIO_STACK_LOCATION  irpSp        = NULL;
+    ULONG               outBufferLen = 0;
+    PVOID               outBuffer    = NULL;
 
-    IoReleaseCancelSpinLock(Irp->CancelIrql);
+    irpSp = IoGetCurrentIrpStackLocation(Irp);
 
-    UNREFERENCED_PARAMETER(DeviceObject);
+    outBufferLen = irpSp->Parameters.DeviceIoControl.OutputBufferLength;
+    outBuffer = Irp->AssociatedIrp.SystemBuffer;
 
-    KeAcquireSpinLock(&gDriver.IrpLock, &irql);
+    if (irpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_NOTIFY_CALLBACK_BATCH)
     {
-        cancelIrp = gDriver.IrpCurrent;
-        gDriver.IrpCurrent = NULL;
+        PPROC_INFO_BATCH batch = (PPROC_INFO_BATCH)outBuffer;
+        ULONG            maxCount = 0;
+
+        ASSERT(outBufferLen >= PROC_INFO_BATCH_SIZE(1));
+        maxCount = (ULONG)((outBufferLen - PROC_INFO_BATCH_HEADER_SIZE) / sizeof(PROC_INFO));
+
+        batch->Count = EvqDequeueBatch(&gDriver.ProcessQueue, batch->Records, maxCount);
+        if (batch->Count == 0)
+        {
+            return 0;
+        }
+        batch->Pending = EvqCount(&gDriver.ProcessQueue);
+
+        return (ULONG)PROC_INFO_BATCH_SIZE(batch->Count);
     }
-    KeReleaseSpinLock(&gDriver.IrpLock, irql);
 
-    if (cancelIrp->Cancel)
+    ASSERT(outBufferLen >= sizeof(PROC_INFO));
+    if (!EvqDequeue(&gDriver.ProcessQueue, (PPROC_INFO)outBuffer))
     {
-        cancelIrp->IoStatus.Information = 0;
-        cancelIrp->IoStatus.Status = STATUS_CANCELLED;
-        IoCompleteRequest(cancelIrp, IO_NO_INCREMENT);
+        return 0;
     }
 
-    return;
+    return sizeof(PROC_INFO);
 }
 
 
-NTSTATUS
-ProcessIoctlDumpRoutine(
-    _In_ PIRP Irp
+
+BOOLEAN
+FillSharedRing(
+    VOID
 )
-{
-    PIO_STACK_LOCATION irpSp = NULL;
-    PWCHAR inBuffer  = NULL;
-    PWCHAR outBuffer = NULL;
-    ULONG inBufferLen = 0;
-    ULONG outBufferLen = 0;
-    PMDL mdl = NULL;
-    
-    NTSTATUS irpStatus = STATUS_SUCCESS;
-    ULONG info = 0;
+/*++
 
-    PVOID systemBuffer = NULL;
+Routine Description:
 
-    
-    irpSp = IoGetCurrentIrpStackLocation(Irp);
+    Moves queued PROC_INFO records straight into the shared ring slots and
+    rings the client doorbell if it went to sleep on an empty ring.
 
-    inBuffer = irpSp->Parameters.DeviceIoControl.Type3InputBuffer;
-    outBuffer = Irp->UserBuffer;
+Return Value:
 
-    inBufferLen = irpSp->Parameters.DeviceIoControl.InputBufferLength;
-    outBufferLen = irpSp->Parameters.DeviceIoControl.OutputBufferLength;
+    FALSE if no shared ring is mapped.
 
-    //
-    // MDL stuff
-    //
+--*/
+{
+    PPROC_INFO  slot     = NULL;
+    ULONG       produced = 0;
+    KIRQL       irql     = PASSIVE_LEVEL;
+    BOOLEAN     bMapped  = FALSE;
+
+    KeAcquireSpinLock(&gDriver.SharedRingLock, &irql);
+    if (gDriver.SharedRing != NULL)
     {
-        __try
+        bMapped = TRUE;
+
+        while ((slot = ShrProducerSlot(gDriver.SharedRing, produced)) != NULL &&
+            EvqDequeue(&gDriver.ProcessQueue, slot))
         {
-            ProbeForRead(inBuffer, inBufferLen, sizeof(WCHAR));
+            ++produced;
         }
-        __except(EXCEPTION_EXECUTE_HANDLER)
+
+        gDriver.SharedRing->Dropped = EvqDropped(&gDriver.ProcessQueue);
+
+        if (produced != 0 && ShrProducerCommit(gDriver.SharedRing, produced))
         {
-            irpStatus = GetExceptionCode();
-            goto clean_up;
+            KeSetEvent(gDriver.SharedRingDoorbell, IO_NO_INCREMENT, FALSE);
         }
+    }
+    KeReleaseSpinLock(&gDriver.SharedRingLock, irql);
 
-        mdl = IoAllocateMdl(inBuffer, inBufferLen, FALSE, FALSE, NULL);
-        if (mdl == NULL)
-        {
+    return bMapped;
+}
 
-            irpStatus = STATUS_INSUFFICIENT_RESOURCES;
-            goto clean_up;
-        }
 
-        __try
-        {
-            MmProbeAndLockPages(mdl, UserMode, IoReadAccess); 
-        }
-        __except (EXCEPTION_EXECUTE_HANDLER)
-        {
-            IoFreeMdl(mdl);
-            mdl = NULL;
+NTSTATUS
+ProcessIoctlMapRingRoutine(
+    _In_ PIRP Irp
+)
+/*++
 
-            irpStatus = GetExceptionCode();            
-            goto clean_up;
-        }
+Routine Description:
 
-        systemBuffer = MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute);
-        if (systemBuffer == NULL)
-        {
-            MmUnlockPages(mdl);
-            IoFreeMdl(mdl);
-            mdl = NULL;
+    Maps a SHARED_RING in the calling process and switches event delivery
+    to it. Only one handle can have the ring mapped at a time; it is
+    unmapped through that handle or at its cleanup.
 
-            irpStatus = STATUS_INSUFFICIENT_RESOURCES;
-            goto clean_up;
+--*/
+{
+    NTSTATUS             irpStatus = STATUS_SUCCESS;
+    PIO_STACK_LOCATION   irpSp     = NULL;
+    PSHARED_RING_MAP_IN  in        = NULL;
+    PSHARED_RING_MAP_OUT out       = NULL;
+    ULONG                info      = 0;
+    ULONG                size      = (ULONG)ROUND_TO_PAGES(sizeof(SHARED_RING));
+    PKEVENT              doorbell  = NULL;
+    PMDL                 mdl       = NULL;
+    PSHARED_RING         ring      = NULL;
+    PVOID                userVA    = NULL;
+    PVOID                mappedVA  = NULL;
+    KIRQL                irql      = PASSIVE_LEVEL;
+
+    irpSp = IoGetCurrentIrpStackLocation(Irp);
+
+    in = (PSHARED_RING_MAP_IN)Irp->AssociatedIrp.SystemBuffer;
+    out = (PSHARED_RING_MAP_OUT)Irp->AssociatedIrp.SystemBuffer;
+
+    if (irpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(*in) ||
+        irpSp->Parameters.DeviceIoControl.OutputBufferLength < sizeof(*out))
+    {
+        irpStatus = STATUS_BUFFER_TOO_SMALL;
+        goto clean_up;
+    }
+
+    irpStatus = ObReferenceObjectByHandle(
+        (HANDLE)(ULONG_PTR)in->Doorbell,
+        EVENT_MODIFY_STATE,
+        *ExEventObjectType,
+        UserMode,
+        (PVOID*)&doorbell,
+        NULL);
+    if (!NT_SUCCESS(irpStatus))
+    {
+        LogErrorNt("ObReferenceObjectByHandle", irpStatus);
+        goto clean_up;
+    }
+
+    //
+    // whole pages straight from Mm, so nothing else ever shows up in the user view
+    //
+    {
+        PHYSICAL_ADDRESS low  = { 0 };
+        PHYSICAL_ADDRESS high = { 0 };
+        PHYSICAL_ADDRESS skip = { 0 };
+
+        high.QuadPart = -1;
+
+        mdl = MmAllocatePagesForMdl(low, high, skip, size);
+        if (mdl == NULL || MmGetMdlByteCount(mdl) != size)
+        {
+            irpStatus = STATUS_INSUFFICIENT_RESOURCES;
+            goto clean_up;
+        }
+    }
+
+    ring = (PSHARED_RING)MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute);
+    if (ring == NULL)
+    {
+        irpStatus = STATUS_INSUFFICIENT_RESOURCES;
+        goto clean_up;
+    }
+    ShrInit(ring);
+
+    __try
+    {
+        userVA = MmMapLockedPagesSpecifyCache(mdl, UserMode, MmCached, NULL, FALSE, NormalPagePriority | MdlMappingNoExecute);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        irpStatus = GetExceptionCode();
+        goto clean_up;
+    }
+
+    KeAcquireSpinLock(&gDriver.SharedRingLock, &irql);
+    if (gDriver.SharedRing == NULL)
+    {
+        gDriver.SharedRing = ring;
+        gDriver.SharedRingMdl = mdl;
+        gDriver.SharedRingUserVA = userVA;
+        gDriver.SharedRingOwner = irpSp->FileObject;
+        gDriver.SharedRingProcess = PsGetCurrentProcess();
+        gDriver.SharedRingDoorbell = doorbell;
+
+        ObReferenceObject(gDriver.SharedRingProcess);
+
+        mappedVA = userVA;
+        ring = NULL;
+        mdl = NULL;
+        userVA = NULL;
+        doorbell = NULL;
+    }
+    else
+    {
+        irpStatus = STATUS_DEVICE_BUSY;
+    }
+    KeReleaseSpinLock(&gDriver.SharedRingLock, irql);
+
+    if (NT_SUCCESS(irpStatus))
+    {
+        out->Ring = (ULONG64)(ULONG_PTR)mappedVA;
+        out->Size = size;
+        info = sizeof(*out);
+
+        // records may be waiting already
+        KeSetEvent(&gDriver.EventProcessCreateClose, IO_NO_INCREMENT, FALSE);
+    }
+
+clean_up:
+    if (userVA != NULL)
+    {
+        MmUnmapLockedPages(userVA, mdl);
+    }
+    if (ring != NULL)
+    {
+        MmUnmapLockedPages(ring, mdl);
+    }
+    if (mdl != NULL)
+    {
+        MmFreePagesFromMdl(mdl);
+        ExFreePool(mdl);
+    }
+    if (doorbell != NULL)
+    {
+        ObDereferenceObject(doorbell);
+    }
+
+    Irp->IoStatus.Information = info;
+    Irp->IoStatus.Status = irpStatus;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return irpStatus;
+}
+
+
+VOID
+UnmapSharedRing(
+    _In_opt_ PFILE_OBJECT FileObject,
+    _In_opt_ PEPROCESS    Process
+)
+/*++
+
+Routine Description:
+
+    Drops the shared ring if it was mapped through FileObject
+    (IOCTL_UNMAP_SHARED_RING or IRP_MJ_CLEANUP of that handle) or by Process
+    (its exit notification, in its own context).
+
+    The cleanup of a duplicated handle may come from another process. If the
+    owner is exiting, the ring is left to its exit notification rather than
+    attaching to an address space that is going away; otherwise the user
+    view is unmapped attached to the owner, which cannot get past its exit
+    notification while this holds SharedRingUnmapLock.
+
+--*/
+{
+    PSHARED_RING ring     = NULL;
+    PMDL         mdl      = NULL;
+    PVOID        userVA   = NULL;
+    PEPROCESS    process  = NULL;
+    PKEVENT      doorbell = NULL;
+    KIRQL        irql     = PASSIVE_LEVEL;
+    KAPC_STATE   apcState = { 0 };
+
+    ExAcquireFastMutex(&gDriver.SharedRingUnmapLock);
+
+    KeAcquireSpinLock(&gDriver.SharedRingLock, &irql);
+    if (gDriver.SharedRing != NULL && FileObject != NULL && gDriver.SharedRingOwner == FileObject &&
+        gDriver.SharedRingProcess != PsGetCurrentProcess() &&
+        PsGetProcessExitStatus(gDriver.SharedRingProcess) != STATUS_PENDING)
+    {
+        // owner on its way out, its exit notification drops the ring
+        gDriver.SharedRingOwner = NULL;
+    }
+    else if (gDriver.SharedRing != NULL &&
+        ((FileObject != NULL && gDriver.SharedRingOwner == FileObject) ||
+         (Process != NULL && gDriver.SharedRingProcess == Process)))
+    {
+        ring = gDriver.SharedRing;
+        mdl = gDriver.SharedRingMdl;
+        userVA = gDriver.SharedRingUserVA;
+        process = gDriver.SharedRingProcess;
+        doorbell = gDriver.SharedRingDoorbell;
+
+        gDriver.SharedRing = NULL;
+        gDriver.SharedRingMdl = NULL;
+        gDriver.SharedRingUserVA = NULL;
+        gDriver.SharedRingOwner = NULL;
+        gDriver.SharedRingProcess = NULL;
+        gDriver.SharedRingDoorbell = NULL;
+    }
+    KeReleaseSpinLock(&gDriver.SharedRingLock, irql);
+
+    if (ring == NULL)
+    {
+        ExReleaseFastMutex(&gDriver.SharedRingUnmapLock);
+        return;
+    }
+
+    LogInfo("SharedRing dropped:%I64d", ring->Dropped);
+
+    if (process == PsGetCurrentProcess())
+    {
+        MmUnmapLockedPages(userVA, mdl);
+    }
+    else
+    {
+        KeStackAttachProcess(process, &apcState);
+        MmUnmapLockedPages(userVA, mdl);
+        KeUnstackDetachProcess(&apcState);
+    }
+    ObDereferenceObject(process);
+
+    MmUnmapLockedPages(ring, mdl);
+    MmFreePagesFromMdl(mdl);
+    ExFreePool(mdl);
+    ObDereferenceObject(doorbell);
+
+    ExReleaseFastMutex(&gDriver.SharedRingUnmapLock);
+
+    return;
+}
+
+
+NTSTATUS
+ProcessIoctlDumpRoutine(
+    _In_ PIRP Irp
+)
+{
+    PIO_STACK_LOCATION irpSp = NULL;
+    PWCHAR inBuffer  = NULL;
+    PWCHAR outBuffer = NULL;
+    ULONG inBufferLen = 0;
+    ULONG outBufferLen = 0;
+    
+    NTSTATUS irpStatus = STATUS_SUCCESS;
+    ULONG info = 0;
+    WCHAR pidText[IOC_BUFFER_MAX_SIZE] = { 0 };
+    ULONG copyLen = 0;
+
+    
+    irpSp = IoGetCurrentIrpStackLocation(Irp);
+
+    inBuffer = irpSp->Parameters.DeviceIoControl.Type3InputBuffer;
+    outBuffer = Irp->UserBuffer;
+
+    inBufferLen = irpSp->Parameters.DeviceIoControl.InputBufferLength;
+    outBufferLen = irpSp->Parameters.DeviceIoControl.OutputBufferLength;
+
+    //
+    // METHOD_NEITHER: the caller can free or change its buffer at any time,
+    // so the PID string is copied (and terminated) under __try and only the
+    // copy is parsed
+    //
+    {
+        copyLen = min(inBufferLen, sizeof(pidText) - sizeof(WCHAR)) & ~(ULONG)(sizeof(WCHAR) - 1);
+
+        __try
+        {
+            ProbeForRead(inBuffer, inBufferLen, sizeof(WCHAR));
+            RtlCopyMemory(pidText, inBuffer, copyLen);
+        }
+        __except(EXCEPTION_EXECUTE_HANDLER)
+        {
+            irpStatus = GetExceptionCode();
+            goto clean_up;
         }
+        pidText[copyLen / sizeof(WCHAR)] = L'\0';
     }
     
     //
-    // check PROCESS_T list for PID
+    // check PROCESS_T table for PID
     //
     {
         PPROCESS_T p = NULL;
@@ -639,22 +1201,22 @@ ProcessIoctlDumpRoutine(
         PWCHAR endPrt = NULL;
 
 
-        pid = wcstoul(inBuffer, &endPrt, 10);
+        pid = wcstoul(pidText, &endPrt, 10);
         LogInfo(">>> %u", pid);
 
-        p = PrcFindProcessId(&gDriver.ProcessList, (HANDLE)pid);
-        if (p == NULL)
+        p = PrcTableFind(&gDriver.ProcessTable, (HANDLE)pid);
+        if (p != NULL)
         {
-            MmUnlockPages(mdl);
-            IoFreeMdl(mdl);
-            mdl = NULL;
+            // locked within the pinned memory budget, first MDL wins
+            irpStatus = PinAttach(p, inBuffer, inBufferLen);
 
-            //goto clean_up;
-        }
-        else
-        {
-            p->Mdl = mdl; // sync?
-            mdl = NULL;
+            PrcDereference(p);
+            p = NULL;
+
+            if (!NT_SUCCESS(irpStatus))
+            {
+                goto clean_up;
+            }
         }
     }
 
@@ -681,4 +1243,477 @@ clean_up:
 
 
     return irpStatus;
+}
+
+
+NTSTATUS
+ProcessIoctlDumpBatchRoutine(
+    _In_ PIRP Irp
+)
+/*++
+
+Routine Description:
+
+    IOCTL_DUMP_PROCESS_BATCH: the caller buffer (METHOD_NEITHER, input and
+    output are the same IOC_DUMP_BATCH) is probed and locked once, then every
+    entry is handled off the system mapping and gets its own Status. Fields
+    are read once each, the caller may still be scribbling over them.
+
+--*/
+{
+    PIO_STACK_LOCATION  irpSp       = IoGetCurrentIrpStackLocation(Irp);
+    PIOC_DUMP_BATCH     userBatch   = NULL;
+    PIOC_DUMP_BATCH     batch       = NULL;
+    PMDL                mdl         = NULL;
+    ULONG               length      = 0;
+    ULONG               count       = 0;
+    ULONG               found       = 0;
+    ULONG               i           = 0;
+    NTSTATUS            status      = STATUS_SUCCESS;
+    NTSTATUS            irpStatus   = STATUS_SUCCESS;
+    ULONG               info        = 0;
+
+
+    userBatch = (PIOC_DUMP_BATCH)irpSp->Parameters.DeviceIoControl.Type3InputBuffer;
+    length = irpSp->Parameters.DeviceIoControl.InputBufferLength;
+
+    if (userBatch != (PIOC_DUMP_BATCH)Irp->UserBuffer ||
+        length != irpSp->Parameters.DeviceIoControl.OutputBufferLength ||
+        length < IOC_DUMP_BATCH_SIZE(1) ||
+        length > IOC_DUMP_BATCH_SIZE(IOC_DUMP_BATCH_MAX))
+    {
+        irpStatus = STATUS_INVALID_PARAMETER;
+        goto clean_up;
+    }
+
+    mdl = IoAllocateMdl(userBatch, length, FALSE, FALSE, NULL);
+    if (mdl == NULL)
+    {
+        irpStatus = STATUS_INSUFFICIENT_RESOURCES;
+        goto clean_up;
+    }
+
+    __try
+    {
+        MmProbeAndLockPages(mdl, Irp->RequestorMode, IoModifyAccess);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        IoFreeMdl(mdl);
+        mdl = NULL;
+
+        irpStatus = GetExceptionCode();
+        goto clean_up;
+    }
+
+    batch = (PIOC_DUMP_BATCH)MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute);
+    if (batch == NULL)
+    {
+        irpStatus = STATUS_INSUFFICIENT_RESOURCES;
+        goto clean_up;
+    }
+
+    count = *(volatile ULONG *)&batch->Count;
+    if (count == 0 || IOC_DUMP_BATCH_SIZE(count) > length)
+    {
+        irpStatus = STATUS_INVALID_PARAMETER;
+        goto clean_up;
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        status = DumpBatchEntry(*(volatile ULONG *)&batch->Entries[i].ProcessId,
+            *(volatile ULONG *)&batch->Entries[i].Flags);
+
+        batch->Entries[i].Status = status;
+        if (NT_SUCCESS(status))
+        {
+            ++found;
+        }
+    }
+    batch->Found = found;
+
+    LogInfo(">>> batch of %u, %u found", count, found);
+    info = length;
+
+clean_up:
+    if (mdl != NULL)
+    {
+        MmUnlockPages(mdl);
+        IoFreeMdl(mdl);
+        mdl = NULL;
+    }
+
+    Irp->IoStatus.Information = info;
+    Irp->IoStatus.Status = irpStatus;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return irpStatus;
+}
+
+
+NTSTATUS
+DumpBatchEntry(
+    _In_ ULONG  ProcessId,
+    _In_ ULONG  Flags
+)
+/*++
+
+Routine Description:
+
+    One IOCTL_DUMP_PROCESS_BATCH entry: looks the PID up and, with
+    IOC_DUMP_FLAG_UNPIN, releases what IOCTL_DUMP_PROCESS locked for it.
+    Nothing is locked here; the entry is a request buffer, pinning it would
+    protect nothing and keep client pages locked past the IRP.
+
+--*/
+{
+    PPROCESS_T  p       = NULL;
+    NTSTATUS    status  = STATUS_SUCCESS;
+
+
+    if ((Flags & ~IOC_DUMP_FLAG_UNPIN) != 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    p = PrcTableFind(&gDriver.ProcessTable, ULongToHandle(ProcessId));
+    if (p == NULL)
+    {
+        return STATUS_NOT_FOUND;
+    }
+
+    if (Flags & IOC_DUMP_FLAG_UNPIN)
+    {
+        PinDetach(p);
+    }
+
+    PrcDereference(p);
+    p = NULL;
+
+    return status;
+}
+
+
+NTSTATUS
+ProcessIoctlReadRoutine(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP           Irp
+)
+/*++
+
+Routine Description:
+
+    Validates an IOCTL_READ_PROCESS_MEMORY request and hands it to a work
+    item, so the caller gets STATUS_PENDING back and can post the next one
+    while this one is copied. The I/O manager already locked the output
+    buffer (METHOD_OUT_DIRECT), the copy lands in the caller pages.
+
+    The target is opened here, in the caller context and with its previous
+    mode, for PROCESS_VM_READ: the object manager access check (protected
+    processes included) is the one OpenProcess would do. The work item only
+    uses the EPROCESS that open returned. One handle may have at most
+    IOC_READ_MAX_IN_FLIGHT requests queued, the system worker queue is shared.
+
+--*/
+{
+    PIO_STACK_LOCATION  irpSp       = IoGetCurrentIrpStackLocation(Irp);
+    PIOC_HANDLE         handle      = (PIOC_HANDLE)irpSp->FileObject->FsContext;
+    PIOC_READ_REQUEST   request     = (PIOC_READ_REQUEST)Irp->AssociatedIrp.SystemBuffer;
+    PIO_WORKITEM        workItem    = NULL;
+    PEPROCESS           lookup      = NULL;
+    PEPROCESS           process     = NULL;
+    HANDLE              processHandle = NULL;
+    BOOLEAN             counted     = FALSE;
+    NTSTATUS            irpStatus   = STATUS_SUCCESS;
+
+
+    if (irpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(IOC_READ_REQUEST) ||
+        irpSp->Parameters.DeviceIoControl.OutputBufferLength == 0 ||
+        irpSp->Parameters.DeviceIoControl.OutputBufferLength > IOC_READ_MAX_SIZE ||
+        Irp->MdlAddress == NULL)
+    {
+        irpStatus = STATUS_INVALID_PARAMETER;
+        goto clean_up;
+    }
+
+    // still in the caller context, it must be allowed to read any process
+    if (!SeSinglePrivilegeCheck(RtlConvertLongToLuid(SE_DEBUG_PRIVILEGE), Irp->RequestorMode))
+    {
+        irpStatus = STATUS_PRIVILEGE_NOT_HELD;
+        goto clean_up;
+    }
+
+    if (handle == NULL)
+    {
+        irpStatus = STATUS_INVALID_DEVICE_REQUEST;
+        goto clean_up;
+    }
+    if (InterlockedIncrement(&handle->ReadsInFlight) > IOC_READ_MAX_IN_FLIGHT)
+    {
+        InterlockedDecrement(&handle->ReadsInFlight);
+        irpStatus = STATUS_DEVICE_BUSY;
+        goto clean_up;
+    }
+    counted = TRUE;
+
+    // the access check OpenProcess does, protected processes included
+    irpStatus = PsLookupProcessByProcessId(ULongToHandle(request->ProcessId), &lookup);
+    if (!NT_SUCCESS(irpStatus))
+    {
+        goto clean_up;
+    }
+
+    irpStatus = ObOpenObjectByPointer(lookup, 0, NULL, PROCESS_VM_READ, *PsProcessType, Irp->RequestorMode, &processHandle);
+    if (!NT_SUCCESS(irpStatus))
+    {
+        goto clean_up;
+    }
+
+    irpStatus = ObReferenceObjectByHandle(processHandle, PROCESS_VM_READ, *PsProcessType, Irp->RequestorMode, (PVOID *)&process, NULL);
+    if (!NT_SUCCESS(irpStatus))
+    {
+        goto clean_up;
+    }
+
+    workItem = IoAllocateWorkItem(DeviceObject);
+    if (workItem == NULL)
+    {
+        irpStatus = STATUS_INSUFFICIENT_RESOURCES;
+        goto clean_up;
+    }
+
+    // the work item keeps the device (and us) loaded until it has run
+    Irp->Tail.Overlay.DriverContext[0] = workItem;
+    Irp->Tail.Overlay.DriverContext[1] = process;
+    process = NULL;
+
+    ObCloseHandle(processHandle, Irp->RequestorMode);
+    ObDereferenceObject(lookup);
+
+    IoMarkIrpPending(Irp);
+    IoQueueWorkItem(workItem, ReadProcessMemoryWorker, DelayedWorkQueue, Irp);
+
+    return STATUS_PENDING;
+
+clean_up:
+    if (process != NULL)
+    {
+        ObDereferenceObject(process);
+    }
+    if (processHandle != NULL)
+    {
+        ObCloseHandle(processHandle, Irp->RequestorMode);
+    }
+    if (lookup != NULL)
+    {
+        ObDereferenceObject(lookup);
+    }
+    if (counted)
+    {
+        InterlockedDecrement(&handle->ReadsInFlight);
+    }
+
+    Irp->IoStatus.Information = 0;
+    Irp->IoStatus.Status = irpStatus;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return irpStatus;
+}
+
+
+VOID
+ReadProcessMemoryWorker(
+    _In_     PDEVICE_OBJECT DeviceObject,
+    _In_opt_ PVOID          Context
+)
+/*++
+
+Routine Description:
+
+    Copies target memory straight into the locked output pages, a page at a
+    time while attached to the target, and stops at the first page that
+    faults. Completes the IRP with the number of bytes copied.
+    The target is the EPROCESS ProcessIoctlReadRoutine opened (DriverContext[1]).
+
+--*/
+{
+    PIRP                irp         = (PIRP)Context;
+    PIO_STACK_LOCATION  irpSp       = NULL;
+    PIOC_READ_REQUEST   request     = NULL;
+    PIOC_HANDLE         handle      = NULL;
+    PEPROCESS           process     = NULL;
+    KAPC_STATE          apcState    = { 0 };
+    PUCHAR              dest        = NULL;
+    ULONG_PTR           address     = 0;
+    ULONG               length      = 0;
+    ULONG               done        = 0;
+    ULONG               part        = 0;
+    NTSTATUS            irpStatus   = STATUS_SUCCESS;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+    ASSERT(irp != NULL);
+
+
+    irpSp = IoGetCurrentIrpStackLocation(irp);
+    request = (PIOC_READ_REQUEST)irp->AssociatedIrp.SystemBuffer;
+    handle = (PIOC_HANDLE)irpSp->FileObject->FsContext;
+    process = (PEPROCESS)irp->Tail.Overlay.DriverContext[1];
+    length = irpSp->Parameters.DeviceIoControl.OutputBufferLength;
+    address = (ULONG_PTR)request->Address;
+
+    if (request->Address != (ULONG64)address || address + length < address)
+    {
+        irpStatus = STATUS_INVALID_PARAMETER;
+        goto clean_up;
+    }
+
+    // system VA of the caller pages, valid in whatever process we attach to
+    dest = (PUCHAR)MmGetSystemAddressForMdlSafe(irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+    if (dest == NULL)
+    {
+        irpStatus = STATUS_INSUFFICIENT_RESOURCES;
+        goto clean_up;
+    }
+
+    KeStackAttachProcess(process, &apcState);
+    {
+        while (done < length)
+        {
+            part = min(length - done, PAGE_SIZE - (ULONG)((address + done) & (PAGE_SIZE - 1)));
+
+            __try
+            {
+                ProbeForRead((PVOID)(address + done), part, 1);
+                RtlCopyMemory(dest + done, (PVOID)(address + done), part);
+            }
+            __except (EXCEPTION_EXECUTE_HANDLER)
+            {
+                // not an error, the caller skips the page
+                break;
+            }
+
+            done += part;
+        }
+    }
+    KeUnstackDetachProcess(&apcState);
+
+clean_up:
+    ObDereferenceObject(process);
+    IoFreeWorkItem((PIO_WORKITEM)irp->Tail.Overlay.DriverContext[0]);
+    InterlockedDecrement(&handle->ReadsInFlight);
+
+    irp->IoStatus.Information = NT_SUCCESS(irpStatus) ? done : 0;
+    irp->IoStatus.Status = irpStatus;
+    IoCompleteRequest(irp, IO_NO_INCREMENT);
+
+    return;
+}
+
+
+VOID
+ReadParameters(
+    _In_  PUNICODE_STRING RegistryPath,
+    _Out_ PULONG          QueueCapacity,
+    _Out_ PQUEUE_POLICY   QueuePolicy,
+    _Out_ PULONG          PinnedLimitMb
+)
+/*++
+
+Routine Description:
+
+    Reads the optional QueueCapacity / QueuePolicy / PinnedMemoryMB values
+    from the service Parameters key. Missing or bad values keep the defaults.
+
+--*/
+{
+    NTSTATUS                        status      = STATUS_UNSUCCESSFUL;
+    HANDLE                          serviceKey  = NULL;
+    HANDLE                          paramsKey   = NULL;
+    OBJECT_ATTRIBUTES               objAtr      = { 0 };
+    UNICODE_STRING                  name        = { 0 };
+    UCHAR                           buffer[sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(ULONG)] = { 0 };
+    PKEY_VALUE_PARTIAL_INFORMATION  value       = (PKEY_VALUE_PARTIAL_INFORMATION)buffer;
+    ULONG                           resultLen   = 0;
+    ULONG                           capacity    = 0;
+
+    *QueueCapacity = RNG_DEFAULT_CAPACITY;
+    *QueuePolicy = QueuePolicyDropNewest;
+    *PinnedLimitMb = PIN_DEFAULT_LIMIT_MB;
+
+    __try
+    {
+        InitializeObjectAttributes(&objAtr, RegistryPath, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, NULL, NULL);
+        status = ZwOpenKey(&serviceKey, KEY_READ, &objAtr);
+        if (!NT_SUCCESS(status))
+        {
+            __leave;
+        }
+
+        RtlInitUnicodeString(&name, L"Parameters");
+        InitializeObjectAttributes(&objAtr, &name, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, serviceKey, NULL);
+        status = ZwOpenKey(&paramsKey, KEY_READ, &objAtr);
+        if (!NT_SUCCESS(status))
+        {
+            __leave;
+        }
+
+        RtlInitUnicodeString(&name, L"QueueCapacity");
+        status = ZwQueryValueKey(paramsKey, &name, KeyValuePartialInformation, value, sizeof(buffer), &resultLen);
+        if (NT_SUCCESS(status) && value->Type == REG_DWORD && value->DataLength == sizeof(ULONG))
+        {
+            capacity = *(PULONG)value->Data;
+            if (capacity < RNG_MIN_CAPACITY)
+            {
+                capacity = RNG_MIN_CAPACITY;
+            }
+            if (capacity > RNG_MAX_CAPACITY)
+            {
+                capacity = RNG_MAX_CAPACITY;
+            }
+
+            // round up to a power of 2
+            *QueueCapacity = RNG_MIN_CAPACITY;
+            while (*QueueCapacity < capacity)
+            {
+                *QueueCapacity <<= 1;
+            }
+        }
+
+        RtlInitUnicodeString(&name, L"QueuePolicy");
+        status = ZwQueryValueKey(paramsKey, &name, KeyValuePartialInformation, value, sizeof(buffer), &resultLen);
+        if (NT_SUCCESS(status) && value->Type == REG_DWORD && value->DataLength == sizeof(ULONG) &&
+            *(PULONG)value->Data < QueuePolicyMax)
+        {
+            *QueuePolicy = (QUEUE_POLICY)*(PULONG)value->Data;
+        }
+
+        RtlInitUnicodeString(&name, L"PinnedMemoryMB");
+        status = ZwQueryValueKey(paramsKey, &name, KeyValuePartialInformation, value, sizeof(buffer), &resultLen);
+        if (NT_SUCCESS(status) && value->Type == REG_DWORD && value->DataLength == sizeof(ULONG))
+        {
+            *PinnedLimitMb = *(PULONG)value->Data;
+            if (*PinnedLimitMb < PIN_MIN_LIMIT_MB)
+            {
+                *PinnedLimitMb = PIN_MIN_LIMIT_MB;
+            }
+            if (*PinnedLimitMb > PIN_MAX_LIMIT_MB)
+            {
+                *PinnedLimitMb = PIN_MAX_LIMIT_MB;
+            }
+        }
+    }
+    __finally
+    {
+        if (paramsKey != NULL)
+        {
+            ZwClose(paramsKey);
+        }
+        if (serviceKey != NULL)
+        {
+            ZwClose(serviceKey);
+        }
+    }
+
+    return;
 }
\ No newline at end of file
@@ -9,6 +9,7 @@
 
 
 #define IOC_TAG_NAME            'COI:'
+#define IOC_SHARED_RING_RETRY_MS 10          // Backlog retry period while the shared ring is full
 
 DRIVER_INITIALIZE   DriverEntry;
 DRIVER_UNLOAD       DriverUnload;
@@ -17,6 +18,9 @@ _Dispatch_type_(IRP_MJ_CREATE)
 _Dispatch_type_(IRP_MJ_CLOSE)
 DRIVER_DISPATCH     IocDispatchCreateClose;
 
+_Dispatch_type_(IRP_MJ_CLEANUP)
+DRIVER_DISPATCH     IocDispatchCleanup;
+
 _Dispatch_type_(IRP_MJ_DEVICE_CONTROL)
 DRIVER_DISPATCH     IocDispatchDeviceControl;
 
@@ -38,6 +42,12 @@ IocDispatchCreateClose(
     _Inout_ struct _IRP           *Irp
 );
 
+NTSTATUS
+IocDispatchCleanup(
+    _Inout_ struct _DEVICE_OBJECT *DeviceObject,
+    _Inout_ struct _IRP           *Irp
+);
+
 NTSTATUS
 IocDispatchDeviceControl(
     _Inout_ struct _DEVICE_OBJECT *DeviceObject,
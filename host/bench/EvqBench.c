@@ -0,0 +1,336 @@
+#include "EventQueue.h"
+
+#include <stdio.h>
+#include <pthread.h>
+
+
+//
+// EVENT_QUEUE ingestion against the number of CPUs, 1 to --cpus (x2 steps).
+// The shim makes the queue see that many processors and every producer
+// thread sits on its own one, so it queues on its own ring like
+// CreateProcessNotifyRoutine would; one consumer merges the rings like the
+// notify thread. Nothing is dropped: a producer that finds the queue full
+// yields and raises the event again, and counts it.
+//
+// per_cpu: one ring per simulated CPU (the driver)
+// shared:  the same producers on a queue that sees a single processor, so
+//          they all share one ring (every CPU on the same Tail)
+//
+// One JSON object (or CSV row) per layout and CPU count on stdout:
+//
+//   {"suite":"evq","layout":"per_cpu","cpus":8,"events":800000,"ns_per_event":40.1,"mevents":24.9,"merge_ns":31.2,"full_pct":0.1,"spilled":0,"reordered":0}
+//
+// ns_per_event is wall time per event from the first raise to the last
+// delivery, merge_ns the consumer's time in EvqDequeueBatch per record.
+// reordered counts records a producer raised earlier but that were delivered
+// after a later one of its own; only a spill may do that. Sequence - Dropped
+// must count the records delivered (a refused event counts as dropped, even
+// though it is raised again).
+//
+// Threads only run in parallel on as many cores as the host has: past that,
+// the numbers show the cost of the layout, not its scaling.
+//
+// usage: evq_bench [--cpus 1..64] [--events PerCpu] [--per-cpu RingSlots] [--batch N] [--csv]
+//
+
+#define EVQ_BENCH_MAX_CPUS          64
+#define EVQ_BENCH_DEFAULT_EVENTS    (1 << 17)
+#define EVQ_BENCH_DEFAULT_BATCH     1024    // WDM_NOTIFY_BATCH_COUNT
+#define EVQ_BENCH_MAX_BATCH         4096
+
+
+typedef enum _EVQ_LAYOUT
+{
+    EvqLayoutPerCpu,
+    EvqLayoutShared,
+    EvqLayoutMax
+
+}EVQ_LAYOUT;
+
+typedef struct _EVQ_BENCH
+{
+    EVQ_LAYOUT          Layout;
+    ULONG               Cpus;
+    ULONG               Events;             // Per CPU
+    ULONG               PerCpu;             // Ring slots per CPU
+    ULONG               Batch;
+    EVENT_QUEUE         Queue;
+    pthread_barrier_t   Start;
+    volatile LONG64     Full;               // EvqEnqueue calls refused
+
+}EVQ_BENCH, *PEVQ_BENCH;
+
+typedef struct _EVQ_THREAD
+{
+    PEVQ_BENCH  Bench;
+    ULONG       Index;
+
+}EVQ_THREAD, *PEVQ_THREAD;
+
+
+static const char *gLayouts[EvqLayoutMax] = { "per_cpu", "shared" };
+
+
+//
+// CreateProcessNotifyRoutine on CPU Index; ParentId is the CPU, ProcessId its event number
+static
+void *
+EvqBenchProducer(
+    void *Context
+)
+{
+    PEVQ_THREAD thread = (PEVQ_THREAD)Context;
+    PEVQ_BENCH  bench = thread->Bench;
+    PROC_INFO   info = { 0 };
+    LONG64      full = 0;
+    ULONG       i = 0;
+
+    ShimSetCurrentProcessor((LONG)thread->Index);
+
+    pthread_barrier_wait(&bench->Start);
+
+    for (i = 0; i < bench->Events; ++i)
+    {
+        info.ParentId = thread->Index;
+        info.ProcessId = i + 1;
+        info.Create = 1;
+
+        while (!EvqEnqueue(&bench->Queue, &info))
+        {
+            ++full;
+            sched_yield();
+        }
+    }
+
+    InterlockedExchangeAdd64(&bench->Full, full);
+
+    return NULL;
+}
+
+//
+// returns FALSE if the queue lost or reordered an event it shouldn't have
+static
+BOOLEAN
+EvqBenchRun(
+    _Inout_ PEVQ_BENCH Bench,
+    _In_    BOOLEAN    Csv
+)
+{
+    static PROC_INFO    infos[EVQ_BENCH_MAX_BATCH];
+    pthread_t           threads[EVQ_BENCH_MAX_CPUS];
+    EVQ_THREAD          contexts[EVQ_BENCH_MAX_CPUS];
+    ULONG               last[EVQ_BENCH_MAX_CPUS] = { 0 };
+    IOC_STATS           stats = { 0 };
+    ULONG64             events = (ULONG64)Bench->Cpus * Bench->Events;
+    ULONG64             delivered = 0;
+    LONG64              reordered = 0;
+    LONGLONG            start = 0;
+    LONGLONG            before = 0;
+    double              mergeNs = 0;
+    double              ns = 0;
+    ULONG               count = 0;
+    ULONG               started = 0;
+    ULONG               i = 0;
+    BOOLEAN             bOk = FALSE;
+
+    Bench->Full = 0;
+
+    // the queue sizes its rings off the processor count when it is created
+    ShimSetProcessorCount((Bench->Layout == EvqLayoutPerCpu) ? Bench->Cpus : 1);
+    if (!NT_SUCCESS(EvqInit(&Bench->Queue, Bench->PerCpu * Bench->Cpus, QueuePolicyDropNewest)))
+    {
+        fprintf(stderr, "EvqInit failed\n");
+        return FALSE;
+    }
+
+    pthread_barrier_init(&Bench->Start, NULL, Bench->Cpus + 1);
+    for (started = 0; started < Bench->Cpus; ++started)
+    {
+        contexts[started].Bench = Bench;
+        contexts[started].Index = started;
+        if (pthread_create(&threads[started], NULL, EvqBenchProducer, &contexts[started]) != 0)
+        {
+            // the barrier can't be met any more, nothing was timed
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+    pthread_barrier_wait(&Bench->Start);
+
+    // the notify thread
+    while (delivered < events)
+    {
+        before = KeQueryPerformanceCounter(NULL).QuadPart;
+        count = EvqDequeueBatch(&Bench->Queue, infos, Bench->Batch);
+        if (count == 0)
+        {
+            sched_yield();
+            continue;
+        }
+        mergeNs += (double)(KeQueryPerformanceCounter(NULL).QuadPart - before);
+
+        for (i = 0; i < count; ++i)
+        {
+            if (infos[i].Sequence - infos[i].Dropped != delivered + i + 1 || infos[i].ParentId >= Bench->Cpus)
+            {
+                // producers may be stuck on a full queue nobody drains any more
+                fprintf(stderr, "%s/%u: got Sequence %llu with %u dropped, expected %llu delivered\n", gLayouts[Bench->Layout], Bench->Cpus,
+                    (unsigned long long)infos[i].Sequence, infos[i].Dropped, (unsigned long long)(delivered + i + 1));
+                exit(1);
+            }
+            if (infos[i].ProcessId < last[infos[i].ParentId])
+            {
+                ++reordered;
+            }
+            else
+            {
+                last[infos[i].ParentId] = infos[i].ProcessId;
+            }
+        }
+        delivered += count;
+    }
+
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    ns = (double)(KeQueryPerformanceCounter(NULL).QuadPart - start);
+    pthread_barrier_destroy(&Bench->Start);
+
+    EvqQueryStats(&Bench->Queue, &stats);
+
+    if (!EvqIsEmpty(&Bench->Queue))
+    {
+        fprintf(stderr, "%s/%u: %u events left over\n", gLayouts[Bench->Layout], Bench->Cpus, EvqCount(&Bench->Queue));
+        goto clean_up;
+    }
+    if (reordered != 0 && stats.Spilled == 0)
+    {
+        fprintf(stderr, "%s/%u: %lld records out of order without a spill\n", gLayouts[Bench->Layout], Bench->Cpus, (long long)reordered);
+        goto clean_up;
+    }
+
+    if (Csv)
+    {
+        printf("evq,%s,%u,%llu,%.2f,%.2f,%.2f,%.2f,%lld,%lld\n",
+            gLayouts[Bench->Layout], Bench->Cpus, (unsigned long long)events, ns / events, events * 1000.0 / ns,
+            mergeNs / events, 100.0 * Bench->Full / (events + Bench->Full), (long long)stats.Spilled, (long long)reordered);
+    }
+    else
+    {
+        printf("{\"suite\":\"evq\",\"layout\":\"%s\",\"cpus\":%u,\"events\":%llu,\"ns_per_event\":%.2f,\"mevents\":%.2f,"
+            "\"merge_ns\":%.2f,\"full_pct\":%.2f,\"spilled\":%lld,\"reordered\":%lld}\n",
+            gLayouts[Bench->Layout], Bench->Cpus, (unsigned long long)events, ns / events, events * 1000.0 / ns,
+            mergeNs / events, 100.0 * Bench->Full / (events + Bench->Full), (long long)stats.Spilled, (long long)reordered);
+    }
+    fflush(stdout);
+
+    bOk = TRUE;
+
+clean_up:
+    EvqUninit(&Bench->Queue);
+    ShimSetProcessorCount(0);
+
+    return bOk;
+}
+
+static
+BOOLEAN
+ParseCount(
+    _In_  const char *Text,
+    _In_  ULONG      Max,
+    _Out_ PULONG     Value
+)
+{
+    char            *end = NULL;
+    unsigned long   value = strtoul(Text, &end, 0);
+
+    if (end == Text || *end != '\0' || value == 0 || value > Max)
+    {
+        return FALSE;
+    }
+    *Value = (ULONG)value;
+
+    return TRUE;
+}
+
+
+int
+main(
+    int  argc,
+    char *argv[]
+)
+{
+    static EVQ_BENCH    bench;
+    ULONG               maxCpus = 0;
+    ULONG               events = EVQ_BENCH_DEFAULT_EVENTS;
+    ULONG               perCpu = RNG_DEFAULT_CAPACITY;
+    ULONG               batch = EVQ_BENCH_DEFAULT_BATCH;
+    BOOLEAN             csv = FALSE;
+    ULONG               cpus = 0;
+    ULONG               layout = 0;
+    ULONG               i = 0;
+
+    maxCpus = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    if (maxCpus > EVQ_BENCH_MAX_CPUS)
+    {
+        maxCpus = EVQ_BENCH_MAX_CPUS;
+    }
+
+    for (i = 1; i < (ULONG)argc; ++i)
+    {
+        if (strcmp(argv[i], "--csv") == 0)
+        {
+            csv = TRUE;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--cpus") == 0 && ParseCount(argv[i + 1], EVQ_BENCH_MAX_CPUS, &maxCpus))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--events") == 0 && ParseCount(argv[i + 1], 1U << 30, &events))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--per-cpu") == 0 && ParseCount(argv[i + 1], RNG_MAX_CAPACITY, &perCpu) &&
+            perCpu >= RNG_MIN_CAPACITY && (perCpu & (perCpu - 1)) == 0)
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--batch") == 0 && ParseCount(argv[i + 1], EVQ_BENCH_MAX_BATCH, &batch))
+        {
+            ++i;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--cpus 1..%u] [--events PerCpu] [--per-cpu %u..%u, power of 2] [--batch 1..%u] [--csv]\n",
+                argv[0], EVQ_BENCH_MAX_CPUS, RNG_MIN_CAPACITY, RNG_MAX_CAPACITY, EVQ_BENCH_MAX_BATCH);
+            return 2;
+        }
+    }
+
+    if (csv)
+    {
+        printf("suite,layout,cpus,events,ns_per_event,mevents,merge_ns,full_pct,spilled,reordered\n");
+    }
+
+    for (layout = 0; layout < EvqLayoutMax; ++layout)
+    {
+        for (cpus = 1; cpus <= maxCpus; cpus = (cpus == maxCpus || cpus * 2 <= maxCpus) ? cpus * 2 : maxCpus)
+        {
+            bench.Layout = (EVQ_LAYOUT)layout;
+            bench.Cpus = cpus;
+            bench.Events = events;
+            bench.PerCpu = perCpu;
+            bench.Batch = batch;
+
+            if (!EvqBenchRun(&bench, csv))
+            {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,579 @@
+#include "IrpQueue.h"
+#include "Ring.h"
+#include "Latency.h"
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+
+//
+// Notify IRP handoff, the way the driver does it: --clients threads keep one
+// IOCTL_NOTIFY_CALLBACK IRP each pended in the real IrpQueue (IO_CSQ), a
+// producer raises --events events into an EVENT_RING and the notify thread
+// completes one pended IRP per event.
+//
+// event: the notify thread sleeps until an event or an IRP shows up
+//        (EventProcessCreateClose / EventIrpQueued)
+// poll:  the notify thread spins on the queue, what the single IrpCurrent
+//        busy-wait did
+//
+// With --cancel-pct some clients cancel their IRP right after pending it,
+// racing the notify thread for it. Every IRP must be completed exactly once,
+// either with an event or with STATUS_CANCELLED, and every event must reach
+// exactly one client. One JSON object per mode on stdout:
+//
+//   {"suite":"irp","mode":"event","clients":4,"events":20000,"cancelled":212,"lat_p50_ns":9215,"lat_p99_ns":40959,"lat_max_ns":88000,"notify_cpu_pct":31.0,"cpu_pct":95.2,"seconds":0.41}
+//
+// lat_* is from the event being raised to the client running with it,
+// notify_cpu_pct the notify thread's CPU time over the run's wall time,
+// cpu_pct that of the whole process.
+//
+// usage: irp_handoff [--clients 1..64] [--events N] [--rate PerSecond] [--cancel-pct 0..100] [--mode event|poll]
+//
+
+#define HANDOFF_MAX_CLIENTS         64
+#define HANDOFF_DEFAULT_CLIENTS     4
+#define HANDOFF_DEFAULT_EVENTS      20000
+
+
+typedef enum _HANDOFF_MODE
+{
+    HandoffModeEvent,
+    HandoffModePoll,
+    HandoffModeMax
+
+}HANDOFF_MODE;
+
+//
+// Auto reset event, KEVENT SynchronizationEvent
+//
+typedef struct _HANDOFF_EVENT
+{
+    pthread_mutex_t Lock;
+    pthread_cond_t  Cond;
+    BOOLEAN         Signaled;
+
+}HANDOFF_EVENT, *PHANDOFF_EVENT;
+
+typedef struct _HANDOFF         HANDOFF, *PHANDOFF;
+
+typedef struct _HANDOFF_CLIENT
+{
+    PHANDOFF        Handoff;
+    ULONG64         Seed;
+    IRP             Irp;
+    PROC_INFO       Buffer;
+    HANDOFF_EVENT   Done;
+    volatile LONG64 Completed;          // IoCompleteRequest calls on Irp
+    LONG64          Issued;
+
+}HANDOFF_CLIENT, *PHANDOFF_CLIENT;
+
+struct _HANDOFF
+{
+    HANDOFF_MODE        Mode;
+    ULONG               Clients;
+    ULONG               Events;
+    ULONG               Rate;               // Events per second, 0: flat out
+    ULONG               CancelPct;
+
+    IRP_QUEUE           IrpQueue;
+    EVENT_RING          Ring;
+    HANDOFF_EVENT       Wake;               // EventProcessCreateClose + EventIrpQueued
+    volatile LONG       Stop;               // EventDriverUnload
+    volatile LONG       ClientsLeft;
+
+    PUCHAR              Seen;               // Per event, set by the client it reached
+    volatile LONG64     Delivered;
+    volatile LONG64     Cancelled;
+    volatile LONG64     Violations;
+    LATENCY_HISTOGRAM   Latency;            // ns
+    double              NotifyCpuNs;
+
+    HANDOFF_CLIENT      Client[HANDOFF_MAX_CLIENTS];
+};
+
+
+static const char *gModes[HandoffModeMax] = { "event", "poll" };
+
+
+static
+VOID
+HandoffEventInit(
+    _Out_ PHANDOFF_EVENT Event
+)
+{
+    pthread_mutex_init(&Event->Lock, NULL);
+    pthread_cond_init(&Event->Cond, NULL);
+    Event->Signaled = FALSE;
+}
+
+static
+VOID
+HandoffEventUninit(
+    _Inout_ PHANDOFF_EVENT Event
+)
+{
+    pthread_cond_destroy(&Event->Cond);
+    pthread_mutex_destroy(&Event->Lock);
+}
+
+static
+VOID
+HandoffEventSet(
+    _Inout_ PHANDOFF_EVENT Event
+)
+{
+    pthread_mutex_lock(&Event->Lock);
+    Event->Signaled = TRUE;
+    pthread_cond_signal(&Event->Cond);
+    pthread_mutex_unlock(&Event->Lock);
+}
+
+static
+VOID
+HandoffEventWait(
+    _Inout_ PHANDOFF_EVENT Event
+)
+{
+    pthread_mutex_lock(&Event->Lock);
+    while (!Event->Signaled)
+    {
+        pthread_cond_wait(&Event->Cond, &Event->Lock);
+    }
+    Event->Signaled = FALSE;
+    pthread_mutex_unlock(&Event->Lock);
+}
+
+static
+ULONG64
+HandoffRandom(
+    _Inout_ PULONG64 Seed
+)
+{
+    *Seed ^= *Seed << 13;
+    *Seed ^= *Seed >> 7;
+    *Seed ^= *Seed << 17;
+
+    return *Seed;
+}
+
+static
+VOID
+HandoffViolation(
+    _Inout_ PHANDOFF   Handoff,
+    _In_    const char *What
+)
+{
+    // only the first few, a broken queue would flood stderr
+    if (InterlockedIncrement64(&Handoff->Violations) <= 10)
+    {
+        fprintf(stderr, "%s: %s\n", gModes[Handoff->Mode], What);
+    }
+}
+
+//
+// IoCompleteRequest, in place of the I/O manager completing the DeviceIoControl
+static
+VOID
+HandoffComplete(
+    _Inout_ PIRP Irp
+)
+{
+    PHANDOFF_CLIENT client = (PHANDOFF_CLIENT)Irp->ShimContext;
+
+    if (Irp->CancelRoutine != NULL)
+    {
+        HandoffViolation(client->Handoff, "IRP completed while still cancelable");
+    }
+    InterlockedIncrement64(&client->Completed);
+    HandoffEventSet(&client->Done);
+}
+
+//
+// IOCTL_NOTIFY_CALLBACK in a loop, one IRP outstanding per client
+static
+void *
+HandoffClient(
+    void *Context
+)
+{
+    PHANDOFF_CLIENT client = (PHANDOFF_CLIENT)Context;
+    PHANDOFF        handoff = client->Handoff;
+    PIRP            irp = &client->Irp;
+    ULONG64         sequence = 0;
+
+    while (!ReadNoFence(&handoff->Stop))
+    {
+        RtlZeroMemory(irp, sizeof(*irp));
+        irp->AssociatedIrp.SystemBuffer = &client->Buffer;
+        irp->ShimCompletion = HandoffComplete;
+        irp->ShimContext = client;
+        ++client->Issued;
+
+        // IocDispatchDeviceControl
+        IrpQInsert(&handoff->IrpQueue, irp);
+        if (handoff->Mode == HandoffModeEvent)
+        {
+            HandoffEventSet(&handoff->Wake);
+        }
+
+        if (HandoffRandom(&client->Seed) % 100 < handoff->CancelPct)
+        {
+            // CancelIoEx from another thread, a moment later
+            sched_yield();
+            IoCancelIrp(irp);
+        }
+
+        HandoffEventWait(&client->Done);
+        if (client->Completed != client->Issued)
+        {
+            HandoffViolation(handoff, "IRP completed more than once");
+        }
+
+        if (irp->IoStatus.Status == STATUS_CANCELLED)
+        {
+            InterlockedIncrement64(&handoff->Cancelled);
+            continue;
+        }
+        if (irp->IoStatus.Status != STATUS_SUCCESS || irp->IoStatus.Information != sizeof(PROC_INFO))
+        {
+            HandoffViolation(handoff, "IRP completed without an event");
+            continue;
+        }
+
+        LatRecord(&handoff->Latency, KeQueryPerformanceCounter(NULL).QuadPart - client->Buffer.Timestamp);
+
+        sequence = client->Buffer.Sequence;
+        if (sequence == 0 || sequence > handoff->Events || InterlockedExchange(&handoff->Seen[sequence - 1], 1) != 0)
+        {
+            HandoffViolation(handoff, "event delivered twice");
+            continue;
+        }
+        InterlockedIncrement64(&handoff->Delivered);
+    }
+
+    InterlockedDecrement(&handoff->ClientsLeft);
+
+    return NULL;
+}
+
+//
+// CreateProcessNotifyRoutine, paced to --rate
+static
+void *
+HandoffProducer(
+    void *Context
+)
+{
+    PHANDOFF        handoff = (PHANDOFF)Context;
+    PROC_INFO       info = { 0 };
+    LONGLONG        start = KeQueryPerformanceCounter(NULL).QuadPart;
+    LONGLONG        due = 0;
+    LONGLONG        now = 0;
+    struct timespec pause = { 0 };
+    ULONG           i = 0;
+
+    for (i = 0; i < handoff->Events; ++i)
+    {
+        if (handoff->Rate != 0)
+        {
+            due = start + (LONGLONG)i * 1000000000LL / handoff->Rate;
+            now = KeQueryPerformanceCounter(NULL).QuadPart;
+            if (due > now)
+            {
+                pause.tv_nsec = (long)(due - now);
+                nanosleep(&pause, NULL);
+            }
+        }
+
+        info.Sequence = i + 1;
+        info.ProcessId = (i + 1) * 4;
+        info.Create = 1;
+        info.Timestamp = KeQueryPerformanceCounter(NULL).QuadPart;
+
+        // nothing gets lost, so every event can be accounted for
+        while (!RngEnqueue(&handoff->Ring, &info))
+        {
+            sched_yield();
+        }
+        if (handoff->Mode == HandoffModeEvent)
+        {
+            HandoffEventSet(&handoff->Wake);
+        }
+    }
+
+    return NULL;
+}
+
+//
+// ProcessIoctlNotifyRoutine
+static
+void *
+HandoffNotify(
+    void *Context
+)
+{
+    PHANDOFF        handoff = (PHANDOFF)Context;
+    PIRP            irp = NULL;
+    struct rusage   usage = { 0 };
+
+    for (;;)
+    {
+        if (handoff->Mode == HandoffModeEvent)
+        {
+            HandoffEventWait(&handoff->Wake);
+        }
+        if (ReadNoFence(&handoff->Stop))
+        {
+            break;
+        }
+
+        while (!RngIsEmpty(&handoff->Ring))
+        {
+            irp = IrpQRemoveNext(&handoff->IrpQueue);
+            if (irp == NULL)
+            {
+                break;
+            }
+
+            if (!RngDequeue(&handoff->Ring, (PPROC_INFO)irp->AssociatedIrp.SystemBuffer))
+            {
+                // producer hasn't published yet
+                IrpQInsertHead(&handoff->IrpQueue, irp);
+                break;
+            }
+
+            irp->IoStatus.Information = sizeof(PROC_INFO);
+            irp->IoStatus.Status = STATUS_SUCCESS;
+            IoCompleteRequest(irp, IO_NO_INCREMENT);
+        }
+    }
+
+    IrpQFlush(&handoff->IrpQueue);
+
+    getrusage(RUSAGE_THREAD, &usage);
+    handoff->NotifyCpuNs = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e9 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e3;
+
+    return NULL;
+}
+
+static
+double
+HandoffProcessCpuNs(
+    VOID
+)
+{
+    struct rusage usage = { 0 };
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e9 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e3;
+}
+
+//
+// returns FALSE if an IRP or an event went missing or was handled twice
+static
+BOOLEAN
+HandoffRun(
+    _Inout_ PHANDOFF Handoff
+)
+{
+    pthread_t       clients[HANDOFF_MAX_CLIENTS];
+    pthread_t       producer;
+    pthread_t       notify;
+    struct timespec pause = { 0, 1000000 };
+    LONGLONG        start = 0;
+    double          cpu = 0;
+    double          ns = 0;
+    ULONG           started = 0;
+    ULONG           i = 0;
+    BOOLEAN         bOk = FALSE;
+
+    Handoff->Stop = 0;
+    Handoff->Delivered = 0;
+    Handoff->Cancelled = 0;
+    Handoff->Violations = 0;
+    Handoff->NotifyCpuNs = 0;
+    RtlZeroMemory(&Handoff->Latency, sizeof(Handoff->Latency));
+
+    Handoff->Seen = (PUCHAR)calloc(Handoff->Events, 1);
+    if (Handoff->Seen == NULL)
+    {
+        fprintf(stderr, "calloc failed\n");
+        return FALSE;
+    }
+    if (!NT_SUCCESS(RngInit(&Handoff->Ring, RNG_DEFAULT_CAPACITY)))
+    {
+        fprintf(stderr, "RngInit failed\n");
+        free(Handoff->Seen);
+        return FALSE;
+    }
+    IrpQInit(&Handoff->IrpQueue);
+    HandoffEventInit(&Handoff->Wake);
+
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+    cpu = HandoffProcessCpuNs();
+
+    Handoff->ClientsLeft = (LONG)Handoff->Clients;
+    if (pthread_create(&notify, NULL, HandoffNotify, Handoff) != 0)
+    {
+        fprintf(stderr, "pthread_create failed\n");
+        exit(1);
+    }
+    for (started = 0; started < Handoff->Clients; ++started)
+    {
+        Handoff->Client[started].Handoff = Handoff;
+        Handoff->Client[started].Seed = 0x9E3779B97F4A7C15ULL * (started + 1);
+        Handoff->Client[started].Completed = 0;
+        Handoff->Client[started].Issued = 0;
+        HandoffEventInit(&Handoff->Client[started].Done);
+        if (pthread_create(&clients[started], NULL, HandoffClient, &Handoff->Client[started]) != 0)
+        {
+            // clients would wait forever on a notify thread that exited
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+    if (pthread_create(&producer, NULL, HandoffProducer, Handoff) != 0)
+    {
+        fprintf(stderr, "pthread_create failed\n");
+        exit(1);
+    }
+
+    pthread_join(producer, NULL);
+    while (ReadNoFence(&Handoff->Delivered) + ReadNoFence(&Handoff->Violations) < Handoff->Events)
+    {
+        nanosleep(&pause, NULL);
+    }
+    ns = (double)(KeQueryPerformanceCounter(NULL).QuadPart - start);
+
+    // DriverUnload: the notify thread flushes whatever is pended on its way out;
+    // clients that pended after that are flushed here until they are all gone
+    InterlockedExchange(&Handoff->Stop, 1);
+    HandoffEventSet(&Handoff->Wake);
+    pthread_join(notify, NULL);
+    cpu = HandoffProcessCpuNs() - cpu;
+
+    while (ReadNoFence(&Handoff->ClientsLeft) != 0)
+    {
+        IrpQFlush(&Handoff->IrpQueue);
+        nanosleep(&pause, NULL);
+    }
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(clients[i], NULL);
+        if (Handoff->Client[i].Completed != Handoff->Client[i].Issued)
+        {
+            HandoffViolation(Handoff, "IRP lost or completed twice");
+        }
+        HandoffEventUninit(&Handoff->Client[i].Done);
+    }
+
+    if (Handoff->Violations != 0 || Handoff->Delivered != Handoff->Events || Handoff->IrpQueue.Count != 0)
+    {
+        fprintf(stderr, "%s: %lld violations, %lld of %u events delivered, %ld IRPs left pended\n",
+            gModes[Handoff->Mode], (long long)Handoff->Violations, (long long)Handoff->Delivered, Handoff->Events,
+            (long)Handoff->IrpQueue.Count);
+        goto clean_up;
+    }
+
+    printf("{\"suite\":\"irp\",\"mode\":\"%s\",\"clients\":%u,\"events\":%u,\"cancelled\":%lld,"
+        "\"lat_p50_ns\":%llu,\"lat_p99_ns\":%llu,\"lat_max_ns\":%lld,\"notify_cpu_pct\":%.1f,\"cpu_pct\":%.1f,\"seconds\":%.3f}\n",
+        gModes[Handoff->Mode], Handoff->Clients, Handoff->Events, (long long)Handoff->Cancelled,
+        (unsigned long long)LatPercentile(&Handoff->Latency, 500), (unsigned long long)LatPercentile(&Handoff->Latency, 990),
+        (long long)Handoff->Latency.MaxUs, 100.0 * Handoff->NotifyCpuNs / ns, 100.0 * cpu / ns, ns / 1e9);
+    fflush(stdout);
+
+    bOk = TRUE;
+
+clean_up:
+    HandoffEventUninit(&Handoff->Wake);
+    RngUninit(&Handoff->Ring);
+    free(Handoff->Seen);
+    Handoff->Seen = NULL;
+
+    return bOk;
+}
+
+static
+BOOLEAN
+ParseCount(
+    _In_  const char *Text,
+    _In_  ULONG      Min,
+    _In_  ULONG      Max,
+    _Out_ PULONG     Value
+)
+{
+    char            *end = NULL;
+    unsigned long   value = strtoul(Text, &end, 0);
+
+    if (end == Text || *end != '\0' || value < Min || value > Max)
+    {
+        return FALSE;
+    }
+    *Value = (ULONG)value;
+
+    return TRUE;
+}
+
+
+int
+main(
+    int  argc,
+    char *argv[]
+)
+{
+    static HANDOFF  handoff;
+    ULONG           firstMode = HandoffModeEvent;
+    ULONG           lastMode = HandoffModePoll;
+    ULONG           mode = 0;
+    ULONG           i = 0;
+
+    handoff.Clients = HANDOFF_DEFAULT_CLIENTS;
+    handoff.Events = HANDOFF_DEFAULT_EVENTS;
+
+    for (i = 1; i < (ULONG)argc; ++i)
+    {
+        if (i + 1 < (ULONG)argc && strcmp(argv[i], "--clients") == 0 && ParseCount(argv[i + 1], 1, HANDOFF_MAX_CLIENTS, &handoff.Clients))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--events") == 0 && ParseCount(argv[i + 1], 1, 1U << 30, &handoff.Events))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--rate") == 0 && ParseCount(argv[i + 1], 0, 1U << 30, &handoff.Rate))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--cancel-pct") == 0 && ParseCount(argv[i + 1], 0, 100, &handoff.CancelPct))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--mode") == 0 &&
+            (strcmp(argv[i + 1], "event") == 0 || strcmp(argv[i + 1], "poll") == 0))
+        {
+            firstMode = lastMode = (strcmp(argv[i + 1], "event") == 0) ? HandoffModeEvent : HandoffModePoll;
+            ++i;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--clients 1..%u] [--events N] [--rate PerSecond] [--cancel-pct 0..100] [--mode event|poll]\n",
+                argv[0], HANDOFF_MAX_CLIENTS);
+            return 2;
+        }
+    }
+
+    for (mode = firstMode; mode <= lastMode; ++mode)
+    {
+        handoff.Mode = (HANDOFF_MODE)mode;
+        if (!HandoffRun(&handoff))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,389 @@
+#include "Pool.h"
+#include "Process.h"
+
+#include <stdio.h>
+#include <pthread.h>
+
+
+//
+// POOL_T against plain malloc / free, for PROCESS_T sized objects, with 1 to
+// --threads threads (x2 steps). One JSON object (or CSV row) per allocator,
+// pattern and thread count on stdout:
+//
+//   {"suite":"pool","bench":"burst","allocator":"pool","threads":4,"ops":400000,"ns_per_op":21.3,"mops":187.7,"hit_pct":99.9}
+//
+// burst: every thread allocates --burst objects then frees them, a spawn
+//        storm followed by its exits on the same processor
+// churn: every thread replaces a random object of a table shared by all of
+//        them, so most frees happen on another processor than the alloc
+//
+// ns_per_op is wall time per alloc + free pair per thread. Every pool run
+// must hand every object back (PolQueryStats Outstanding == 0).
+//
+// usage: pool_bench [--threads Max] [--ops PerThread] [--burst Count] [--csv]
+//
+
+#define POOL_BENCH_MAX_THREADS      64
+#define POOL_BENCH_DEFAULT_OPS      (1 << 20)
+#define POOL_BENCH_DEFAULT_BURST    64
+#define POOL_BENCH_MAX_BURST        4096
+
+
+typedef enum _POOL_PATTERN
+{
+    PoolPatternBurst,
+    PoolPatternChurn,
+    PoolPatternMax
+
+}POOL_PATTERN;
+
+typedef struct _POOL_BENCH
+{
+    POOL_PATTERN        Pattern;
+    BOOLEAN             UsePool;
+    ULONG               Threads;
+    ULONG               Ops;                // Alloc + free pairs per thread
+    ULONG               Burst;
+    POOL_T              Pool;
+    PVOID volatile      *Table;             // Churn: Threads * Burst live objects
+    pthread_barrier_t   Start;
+    volatile LONG       Failed;
+
+}POOL_BENCH, *PPOOL_BENCH;
+
+typedef struct _POOL_THREAD
+{
+    PPOOL_BENCH Bench;
+    ULONG       Index;
+    ULONG64     Seed;
+
+}POOL_THREAD, *PPOOL_THREAD;
+
+
+static const char *gPatterns[PoolPatternMax] = { "burst", "churn" };
+
+
+static
+PVOID
+PoolBenchAlloc(
+    _In_ PPOOL_BENCH Bench
+)
+{
+    PPROCESS_T p = NULL;
+
+    p = (PPROCESS_T)(Bench->UsePool ? PolAlloc(&Bench->Pool) : malloc(sizeof(PROCESS_T)));
+    if (p != NULL)
+    {
+        // what PrcAlloc does with it, so both allocators pay for touching the lines
+        RtlZeroMemory(p, sizeof(*p));
+        p->RefCount = 1;
+    }
+
+    return p;
+}
+
+static
+VOID
+PoolBenchFree(
+    _In_ PPOOL_BENCH Bench,
+    _In_ PVOID       Object
+)
+{
+    if (Bench->UsePool)
+    {
+        PolFree(&Bench->Pool, Object);
+    }
+    else
+    {
+        free(Object);
+    }
+}
+
+static
+ULONG64
+PoolBenchRandom(
+    _Inout_ PULONG64 Seed
+)
+{
+    *Seed ^= *Seed << 13;
+    *Seed ^= *Seed >> 7;
+    *Seed ^= *Seed << 17;
+
+    return *Seed;
+}
+
+static
+void *
+PoolBenchThread(
+    void *Context
+)
+{
+    PPOOL_THREAD    thread = (PPOOL_THREAD)Context;
+    PPOOL_BENCH     bench = thread->Bench;
+    PVOID           objects[POOL_BENCH_MAX_BURST];
+    PVOID           obj = NULL;
+    ULONG           done = 0;
+    ULONG           i = 0;
+    ULONG64         slot = 0;
+
+    pthread_barrier_wait(&bench->Start);
+
+    if (bench->Pattern == PoolPatternBurst)
+    {
+        for (done = 0; done < bench->Ops; done += bench->Burst)
+        {
+            for (i = 0; i < bench->Burst; ++i)
+            {
+                objects[i] = PoolBenchAlloc(bench);
+                if (objects[i] == NULL)
+                {
+                    InterlockedExchange(&bench->Failed, 1);
+                    return NULL;
+                }
+            }
+            for (i = 0; i < bench->Burst; ++i)
+            {
+                PoolBenchFree(bench, objects[i]);
+            }
+        }
+    }
+    else
+    {
+        for (done = 0; done < bench->Ops; ++done)
+        {
+            obj = PoolBenchAlloc(bench);
+            if (obj == NULL)
+            {
+                InterlockedExchange(&bench->Failed, 1);
+                return NULL;
+            }
+
+            slot = PoolBenchRandom(&thread->Seed) % ((ULONG64)bench->Threads * bench->Burst);
+            obj = __atomic_exchange_n(&bench->Table[slot], obj, __ATOMIC_ACQ_REL);
+            if (obj != NULL)
+            {
+                PoolBenchFree(bench, obj);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+//
+// returns FALSE if an allocation failed or the pool lost track of an object
+static
+BOOLEAN
+PoolBenchRun(
+    _Inout_ PPOOL_BENCH Bench,
+    _In_    BOOLEAN     Csv
+)
+{
+    pthread_t   threads[POOL_BENCH_MAX_THREADS];
+    POOL_THREAD contexts[POOL_BENCH_MAX_THREADS];
+    POOL_STATS  stats = { 0 };
+    ULONG64     slots = (ULONG64)Bench->Threads * Bench->Burst;
+    ULONG64     ops = (ULONG64)Bench->Threads * Bench->Ops;
+    LONGLONG    start = 0;
+    double      ns = 0;
+    ULONG       started = 0;
+    ULONG64     i = 0;
+    BOOLEAN     bOk = FALSE;
+
+    Bench->Failed = 0;
+    Bench->Table = NULL;
+
+    if (Bench->UsePool &&
+        !NT_SUCCESS(PolInit(&Bench->Pool, sizeof(PROCESS_T), IOC_TAG_NAME, POL_DEFAULT_LOW_WATERMARK, POL_DEFAULT_HIGH_WATERMARK)))
+    {
+        fprintf(stderr, "PolInit failed\n");
+        return FALSE;
+    }
+
+    if (Bench->Pattern == PoolPatternChurn)
+    {
+        Bench->Table = (PVOID volatile *)calloc((size_t)slots, sizeof(PVOID));
+        if (Bench->Table == NULL)
+        {
+            fprintf(stderr, "calloc failed\n");
+            goto clean_up;
+        }
+    }
+
+    pthread_barrier_init(&Bench->Start, NULL, Bench->Threads + 1);
+    for (started = 0; started < Bench->Threads; ++started)
+    {
+        contexts[started].Bench = Bench;
+        contexts[started].Index = started;
+        contexts[started].Seed = 0x9E3779B97F4A7C15ULL * (started + 1);
+        if (pthread_create(&threads[started], NULL, PoolBenchThread, &contexts[started]) != 0)
+        {
+            // the barrier can't be met any more, nothing was timed
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+    pthread_barrier_wait(&Bench->Start);
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    ns = (double)(KeQueryPerformanceCounter(NULL).QuadPart - start);
+    pthread_barrier_destroy(&Bench->Start);
+
+    // untimed: what the churn table still holds
+    for (i = 0; Bench->Table != NULL && i < slots; ++i)
+    {
+        if (Bench->Table[i] != NULL)
+        {
+            PoolBenchFree(Bench, Bench->Table[i]);
+        }
+    }
+
+    if (Bench->Failed)
+    {
+        fprintf(stderr, "%s/%s/%u: allocation failed\n", gPatterns[Bench->Pattern], Bench->UsePool ? "pool" : "malloc", Bench->Threads);
+        goto clean_up;
+    }
+
+    if (Bench->UsePool)
+    {
+        PolQueryStats(&Bench->Pool, &stats);
+        if (stats.Outstanding != 0)
+        {
+            fprintf(stderr, "%s/pool/%u: %lld objects outstanding\n", gPatterns[Bench->Pattern], Bench->Threads, (long long)stats.Outstanding);
+            goto clean_up;
+        }
+    }
+
+    if (Csv)
+    {
+        printf("pool,%s,%s,%u,%llu,%.2f,%.2f,%.1f\n",
+            gPatterns[Bench->Pattern], Bench->UsePool ? "pool" : "malloc", Bench->Threads, (unsigned long long)ops,
+            ns * Bench->Threads / ops, ops * 1000.0 / ns,
+            Bench->UsePool ? 100.0 * stats.Hits / (stats.Hits + stats.Misses) : 0);
+    }
+    else
+    {
+        printf("{\"suite\":\"pool\",\"bench\":\"%s\",\"allocator\":\"%s\",\"threads\":%u,\"ops\":%llu,\"ns_per_op\":%.2f,\"mops\":%.2f,\"hit_pct\":%.1f}\n",
+            gPatterns[Bench->Pattern], Bench->UsePool ? "pool" : "malloc", Bench->Threads, (unsigned long long)ops,
+            ns * Bench->Threads / ops, ops * 1000.0 / ns,
+            Bench->UsePool ? 100.0 * stats.Hits / (stats.Hits + stats.Misses) : 0);
+    }
+    fflush(stdout);
+
+    bOk = TRUE;
+
+clean_up:
+    free((PVOID)Bench->Table);
+    Bench->Table = NULL;
+    if (Bench->UsePool)
+    {
+        PolUninit(&Bench->Pool);
+    }
+
+    return bOk;
+}
+
+static
+BOOLEAN
+ParseCount(
+    _In_  const char *Text,
+    _In_  ULONG      Max,
+    _Out_ PULONG     Value
+)
+{
+    char            *end = NULL;
+    unsigned long   value = strtoul(Text, &end, 0);
+
+    if (end == Text || *end != '\0' || value == 0 || value > Max)
+    {
+        return FALSE;
+    }
+    *Value = (ULONG)value;
+
+    return TRUE;
+}
+
+
+int
+main(
+    int  argc,
+    char *argv[]
+)
+{
+    POOL_BENCH  bench;
+    ULONG       maxThreads = 0;
+    ULONG       ops = POOL_BENCH_DEFAULT_OPS;
+    ULONG       burst = POOL_BENCH_DEFAULT_BURST;
+    BOOLEAN     csv = FALSE;
+    ULONG       threads = 0;
+    ULONG       pattern = 0;
+    ULONG       i = 0;
+
+    RtlZeroMemory(&bench, sizeof(bench));
+
+    maxThreads = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    if (maxThreads > POOL_BENCH_MAX_THREADS)
+    {
+        maxThreads = POOL_BENCH_MAX_THREADS;
+    }
+
+    for (i = 1; i < (ULONG)argc; ++i)
+    {
+        if (strcmp(argv[i], "--csv") == 0)
+        {
+            csv = TRUE;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--threads") == 0 && ParseCount(argv[i + 1], POOL_BENCH_MAX_THREADS, &maxThreads))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--ops") == 0 && ParseCount(argv[i + 1], 1U << 30, &ops))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--burst") == 0 && ParseCount(argv[i + 1], POOL_BENCH_MAX_BURST, &burst))
+        {
+            ++i;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--threads 1..%u] [--ops PerThread] [--burst 1..%u] [--csv]\n",
+                argv[0], POOL_BENCH_MAX_THREADS, POOL_BENCH_MAX_BURST);
+            return 2;
+        }
+    }
+
+    if (csv)
+    {
+        printf("suite,bench,allocator,threads,ops,ns_per_op,mops,hit_pct\n");
+    }
+
+    for (pattern = 0; pattern < PoolPatternMax; ++pattern)
+    {
+        for (threads = 1; threads <= maxThreads; threads = (threads == maxThreads || threads * 2 <= maxThreads) ? threads * 2 : maxThreads)
+        {
+            bench.Pattern = (POOL_PATTERN)pattern;
+            bench.Threads = threads;
+            bench.Ops = ops;
+            bench.Burst = burst;
+
+            bench.UsePool = TRUE;
+            if (!PoolBenchRun(&bench, csv))
+            {
+                return 1;
+            }
+
+            bench.UsePool = FALSE;
+            if (!PoolBenchRun(&bench, csv))
+            {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
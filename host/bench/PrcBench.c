@@ -0,0 +1,417 @@
+#include "Process.h"
+
+#include <stdio.h>
+
+
+//
+// PROCESS_T table / list microbenchmarks. One JSON object (or CSV row) per
+// benchmark and size on stdout, so runs can be collected and compared over time:
+//
+//   {"suite":"prc","bench":"find","entries":4096,"reps":3,"ns_per_op":41.2,"ns_per_op_min":40.7,"mops":24.27}
+//
+// usage: prc_bench [--min Entries] [--max Entries] [--reps Count] [--csv]
+//
+
+#define BENCH_MIN_ENTRIES       1024
+#define BENCH_MAX_ENTRIES       (1024 * 1024)
+#define BENCH_DEFAULT_REPS      3
+#define BENCH_MAX_REPS          64
+
+
+typedef struct _BENCH_STATE
+{
+    ULONG           Entries;
+    PHANDLE         Pids;           // Insert order
+    PHANDLE         Shuffled;       // Same PIDs, lookup / remove order
+    PROCESS_TABLE   Table;
+    KSPIN_LOCK      ListLock;
+    LIST_T          List;
+
+}BENCH_STATE, *PBENCH_STATE;
+
+//
+// Times one pass of Entries operations, after Setup (untimed)
+//
+typedef BOOLEAN BENCH_ROUTINE(PBENCH_STATE State);
+
+typedef struct _BENCH
+{
+    const char      *Name;
+    BENCH_ROUTINE   *Setup;         // NULL: nothing to set up
+    BENCH_ROUTINE   *Run;
+    BENCH_ROUTINE   *Teardown;      // Untimed, must leave no PROCESS_T behind
+
+}BENCH, *PBENCH;
+
+
+static ULONG64 gSeed = 0x9E3779B97F4A7C15ULL;
+
+static
+ULONG64
+BenchRandom(
+    VOID
+)
+{
+    gSeed ^= gSeed << 13;
+    gSeed ^= gSeed >> 7;
+    gSeed ^= gSeed << 17;
+
+    return gSeed;
+}
+
+static
+LONGLONG
+BenchNow(
+    VOID
+)
+{
+    return KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+
+/* Building blocks */
+
+static
+BOOLEAN
+BenchInsertAll(
+    _Inout_ PBENCH_STATE State
+)
+{
+    PPROCESS_T  p = NULL;
+    ULONG       i = 0;
+
+    for (i = 0; i < State->Entries; ++i)
+    {
+        p = PrcAlloc((HANDLE)(ULONG_PTR)4, State->Pids[i]);
+        if (p == NULL)
+        {
+            return FALSE;
+        }
+        PrcTableInsert(&State->Table, p);
+    }
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+BenchFreeTable(
+    _Inout_ PBENCH_STATE State
+)
+{
+    PrcTableFree(&State->Table);
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+BenchBuildList(
+    _Inout_ PBENCH_STATE State
+)
+{
+    PPROCESS_T  p = NULL;
+    ULONG       i = 0;
+
+    State->List.SpinLock = &State->ListLock;
+    LopInit(&State->List);
+
+    for (i = 0; i < State->Entries; ++i)
+    {
+        p = PrcAlloc((HANDLE)(ULONG_PTR)4, State->Pids[i]);
+        if (p == NULL)
+        {
+            return FALSE;
+        }
+        LopInsertHeadSync(&State->List, &p->ListEntry);
+    }
+
+    return TRUE;
+}
+
+
+/* Timed passes */
+
+static
+BOOLEAN
+BenchFind(
+    _Inout_ PBENCH_STATE State
+)
+{
+    PPROCESS_T  p = NULL;
+    ULONG       i = 0;
+
+    for (i = 0; i < State->Entries; ++i)
+    {
+        p = PrcTableFind(&State->Table, State->Shuffled[i]);
+        if (p == NULL || p->ProcessId != State->Shuffled[i])
+        {
+            return FALSE;
+        }
+        PrcDereference(p);
+    }
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+BenchRemoveByPid(
+    _Inout_ PBENCH_STATE State
+)
+{
+    PPROCESS_T  p = NULL;
+    ULONG       i = 0;
+
+    for (i = 0; i < State->Entries; ++i)
+    {
+        p = PrcTableRemove(&State->Table, NULL, &State->Shuffled[i]);
+        if (p == NULL || p->ProcessId != State->Shuffled[i])
+        {
+            return FALSE;
+        }
+        PrcDereference(p);
+    }
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+BenchFreeList(
+    _Inout_ PBENCH_STATE State
+)
+{
+    PrcFreeList(&State->List);
+
+    return LopIsListEmpty(&State->List);
+}
+
+static
+BOOLEAN
+BenchNothing(
+    _Inout_ PBENCH_STATE State
+)
+{
+    UNREFERENCED_PARAMETER(State);
+
+    return TRUE;
+}
+
+
+static const BENCH gBenches[] =
+{
+    // PrcAlloc + PrcTableInsert, what every process create costs
+    { "insert",         NULL,           BenchInsertAll,     BenchFreeTable },
+    { "find",           BenchInsertAll, BenchFind,          BenchFreeTable },
+    { "remove_by_pid",  BenchInsertAll, BenchRemoveByPid,   BenchNothing },
+    // PrcTableFree, every bucket emptied from its head
+    { "remove_head",    BenchInsertAll, BenchFreeTable,     BenchNothing },
+    { "free_list",      BenchBuildList, BenchFreeList,      BenchNothing },
+};
+
+
+static
+int
+BenchCompare(
+    const void *A,
+    const void *B
+)
+{
+    double a = *(const double *)A;
+    double b = *(const double *)B;
+
+    return (a > b) - (a < b);
+}
+
+//
+// returns FALSE if a pass didn't do what it should have, or leaked a PROCESS_T
+static
+BOOLEAN
+BenchRun(
+    _In_    const BENCH  *Bench,
+    _Inout_ PBENCH_STATE State,
+    _In_    ULONG        Reps,
+    _In_    BOOLEAN      Csv
+)
+{
+    double      nsPerOp[BENCH_MAX_REPS];
+    POOL_STATS  stats = { 0 };
+    LONGLONG    start = 0;
+    ULONG       rep = 0;
+    BOOLEAN     bOk = TRUE;
+
+    for (rep = 0; rep < Reps && bOk; ++rep)
+    {
+        PrcTableInit(&State->Table);
+
+        bOk = (Bench->Setup == NULL) || Bench->Setup(State);
+        if (bOk)
+        {
+            start = BenchNow();
+            bOk = Bench->Run(State);
+            nsPerOp[rep] = (double)(BenchNow() - start) / State->Entries;
+        }
+
+        // whatever a failed pass left behind goes too
+        Bench->Teardown(State);
+        PrcTableFree(&State->Table);
+
+        PrcQueryPoolStats(&stats);
+        if (stats.Outstanding != 0)
+        {
+            fprintf(stderr, "%s/%u: %lld PROCESS_T leaked\n", Bench->Name, State->Entries, (long long)stats.Outstanding);
+            bOk = FALSE;
+        }
+    }
+
+    if (!bOk)
+    {
+        fprintf(stderr, "%s/%u: failed\n", Bench->Name, State->Entries);
+        return FALSE;
+    }
+
+    qsort(nsPerOp, Reps, sizeof(nsPerOp[0]), BenchCompare);
+
+    if (Csv)
+    {
+        printf("prc,%s,%u,%u,%.2f,%.2f,%.2f\n",
+            Bench->Name, State->Entries, Reps, nsPerOp[Reps / 2], nsPerOp[0], 1000.0 / nsPerOp[Reps / 2]);
+    }
+    else
+    {
+        printf("{\"suite\":\"prc\",\"bench\":\"%s\",\"entries\":%u,\"reps\":%u,\"ns_per_op\":%.2f,\"ns_per_op_min\":%.2f,\"mops\":%.2f}\n",
+            Bench->Name, State->Entries, Reps, nsPerOp[Reps / 2], nsPerOp[0], 1000.0 / nsPerOp[Reps / 2]);
+    }
+    fflush(stdout);
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+ParseCount(
+    _In_  const char *Text,
+    _Out_ PULONG     Value
+)
+{
+    char            *end = NULL;
+    unsigned long   value = strtoul(Text, &end, 0);
+
+    if (end == Text || *end != '\0' || value == 0 || value > BENCH_MAX_ENTRIES * 16UL)
+    {
+        return FALSE;
+    }
+    *Value = (ULONG)value;
+
+    return TRUE;
+}
+
+
+int
+main(
+    int  argc,
+    char *argv[]
+)
+{
+    BENCH_STATE state;
+    ULONG       minEntries = BENCH_MIN_ENTRIES;
+    ULONG       maxEntries = BENCH_MAX_ENTRIES;
+    ULONG       reps = BENCH_DEFAULT_REPS;
+    BOOLEAN     csv = FALSE;
+    ULONG       entries = 0;
+    ULONG       i = 0;
+    ULONG       j = 0;
+    HANDLE      tmp = NULL;
+    int         ret = 1;
+
+    RtlZeroMemory(&state, sizeof(state));
+
+    for (i = 1; i < (ULONG)argc; ++i)
+    {
+        if (strcmp(argv[i], "--csv") == 0)
+        {
+            csv = TRUE;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--min") == 0 && ParseCount(argv[i + 1], &minEntries))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--max") == 0 && ParseCount(argv[i + 1], &maxEntries))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--reps") == 0 && ParseCount(argv[i + 1], &reps) && reps <= BENCH_MAX_REPS)
+        {
+            ++i;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--min Entries] [--max Entries] [--reps 1..%u] [--csv]\n", argv[0], BENCH_MAX_REPS);
+            return 2;
+        }
+    }
+    if (minEntries > maxEntries)
+    {
+        minEntries = maxEntries;
+    }
+
+    if (!NT_SUCCESS(PrcInitialize()))
+    {
+        fprintf(stderr, "PrcInitialize failed\n");
+        return 1;
+    }
+    PinInitialize(PIN_DEFAULT_LIMIT_MB);
+
+    state.Pids = (PHANDLE)malloc(maxEntries * sizeof(HANDLE));
+    state.Shuffled = (PHANDLE)malloc(maxEntries * sizeof(HANDLE));
+    if (state.Pids == NULL || state.Shuffled == NULL)
+    {
+        fprintf(stderr, "malloc failed\n");
+        goto clean_up;
+    }
+
+    if (csv)
+    {
+        printf("suite,bench,entries,reps,ns_per_op,ns_per_op_min,mops\n");
+    }
+
+    // x4 steps: 1k, 4k, 16k, 64k, 256k, 1M by default
+    for (entries = minEntries; entries <= maxEntries; entries = (entries > maxEntries / 4) ? maxEntries + 1 : entries * 4)
+    {
+        state.Entries = entries;
+
+        // PIDs are multiples of 4, handed out roughly in order
+        for (i = 0; i < entries; ++i)
+        {
+            state.Pids[i] = (HANDLE)(ULONG_PTR)(8 + (ULONG64)i * 4);
+            state.Shuffled[i] = state.Pids[i];
+        }
+        for (i = entries - 1; i > 0; --i)
+        {
+            j = (ULONG)(BenchRandom() % (i + 1));
+            tmp = state.Shuffled[i];
+            state.Shuffled[i] = state.Shuffled[j];
+            state.Shuffled[j] = tmp;
+        }
+
+        for (i = 0; i < sizeof(gBenches) / sizeof(gBenches[0]); ++i)
+        {
+            if (!BenchRun(&gBenches[i], &state, reps, csv))
+            {
+                goto clean_up;
+            }
+        }
+    }
+
+    ret = 0;
+
+clean_up:
+    free(state.Pids);
+    free(state.Shuffled);
+
+    PinUninitialize();
+    PrcUninitialize();
+
+    return ret;
+}
\ No newline at end of file
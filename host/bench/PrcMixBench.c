@@ -0,0 +1,374 @@
+#include "Process.h"
+
+#include <stdio.h>
+#include <pthread.h>
+
+
+//
+// PROCESS_TABLE under a read mostly mix, with 1 to --threads threads (x2
+// steps): out of every 100 operations --write-pct (5 by default) are process
+// creates or exits (PrcTableInsert / PrcTableRemove, bucket lock exclusive)
+// and the rest dump requests (PrcTableFind + PrcDereference, bucket lock
+// shared). Half of the --pids PIDs are live at any time; a thread only
+// creates and exits its own share of them, lookups go to any. One JSON
+// object (or CSV row) per thread count on stdout:
+//
+//   {"suite":"prc_mix","threads":4,"pids":4096,"write_pct":5,"ops":4000000,"ns_per_op":61.3,"mops":65.2,"hit_pct":50.1}
+//
+// ns_per_op is wall time per operation per thread. Every run must hand every
+// PROCESS_T back to the pool.
+//
+// usage: prc_mix_bench [--threads Max] [--ops PerThread] [--pids N] [--write-pct 0..100] [--csv]
+//
+
+#define MIX_BENCH_MAX_THREADS       64
+#define MIX_BENCH_DEFAULT_OPS       (1 << 20)
+#define MIX_BENCH_DEFAULT_PIDS      4096
+#define MIX_BENCH_DEFAULT_WRITE_PCT 5
+
+
+typedef struct _MIX_BENCH
+{
+    ULONG               Threads;
+    ULONG               Ops;                // Per thread
+    ULONG               Pids;
+    ULONG               WritePct;
+    PROCESS_TABLE       Table;
+    PBOOLEAN            Alive;              // Per PID, only written by the thread that owns it
+    pthread_barrier_t   Start;
+    volatile LONG64     Finds;
+    volatile LONG64     Hits;
+    volatile LONG       Failed;
+
+}MIX_BENCH, *PMIX_BENCH;
+
+typedef struct _MIX_THREAD
+{
+    PMIX_BENCH  Bench;
+    ULONG       Index;
+    ULONG64     Seed;
+
+}MIX_THREAD, *PMIX_THREAD;
+
+
+static
+ULONG64
+MixRandom(
+    _Inout_ PULONG64 Seed
+)
+{
+    *Seed ^= *Seed << 13;
+    *Seed ^= *Seed >> 7;
+    *Seed ^= *Seed << 17;
+
+    return *Seed;
+}
+
+static
+HANDLE
+MixPid(
+    _In_ ULONG Index
+)
+{
+    return (HANDLE)(ULONG_PTR)(8 + (ULONG64)Index * 4);
+}
+
+//
+// Creates or exits PID Index, whichever it isn't
+static
+BOOLEAN
+MixToggle(
+    _Inout_ PMIX_BENCH Bench,
+    _In_    ULONG      Index
+)
+{
+    PPROCESS_T  p = NULL;
+    HANDLE      pid = MixPid(Index);
+
+    if (!Bench->Alive[Index])
+    {
+        p = PrcAlloc(NULL, pid);
+        if (p == NULL)
+        {
+            return FALSE;
+        }
+        PrcTableInsert(&Bench->Table, p);
+        Bench->Alive[Index] = TRUE;
+    }
+    else
+    {
+        p = PrcTableRemove(&Bench->Table, NULL, &pid);
+        if (p == NULL)
+        {
+            return FALSE;
+        }
+        PrcDereference(p);
+        Bench->Alive[Index] = FALSE;
+    }
+
+    return TRUE;
+}
+
+static
+void *
+MixThread(
+    void *Context
+)
+{
+    PMIX_THREAD thread = (PMIX_THREAD)Context;
+    PMIX_BENCH  bench = thread->Bench;
+    PPROCESS_T  p = NULL;
+    ULONG64     r = 0;
+    ULONG       owned = (bench->Pids - thread->Index + bench->Threads - 1) / bench->Threads;
+    LONG64      finds = 0;
+    LONG64      hits = 0;
+    ULONG       i = 0;
+
+    pthread_barrier_wait(&bench->Start);
+
+    for (i = 0; i < bench->Ops; ++i)
+    {
+        r = MixRandom(&thread->Seed);
+
+        if (r % 100 < bench->WritePct && owned != 0)
+        {
+            // PIDs Index, Index + Threads, ...
+            if (!MixToggle(bench, thread->Index + (ULONG)((r >> 8) % owned) * bench->Threads))
+            {
+                InterlockedExchange(&bench->Failed, 1);
+                break;
+            }
+            continue;
+        }
+
+        ++finds;
+        p = PrcTableFind(&bench->Table, MixPid((ULONG)((r >> 8) % bench->Pids)));
+        if (p != NULL)
+        {
+            ++hits;
+            PrcDereference(p);
+        }
+    }
+
+    InterlockedExchangeAdd64(&bench->Finds, finds);
+    InterlockedExchangeAdd64(&bench->Hits, hits);
+
+    return NULL;
+}
+
+//
+// returns FALSE if a create or exit failed or a PROCESS_T leaked
+static
+BOOLEAN
+MixRun(
+    _Inout_ PMIX_BENCH Bench,
+    _In_    BOOLEAN    Csv
+)
+{
+    pthread_t   threads[MIX_BENCH_MAX_THREADS];
+    MIX_THREAD  contexts[MIX_BENCH_MAX_THREADS];
+    POOL_STATS  stats = { 0 };
+    ULONG64     ops = (ULONG64)Bench->Threads * Bench->Ops;
+    LONGLONG    start = 0;
+    double      ns = 0;
+    ULONG       started = 0;
+    ULONG       i = 0;
+    BOOLEAN     bOk = FALSE;
+
+    Bench->Finds = 0;
+    Bench->Hits = 0;
+    Bench->Failed = 0;
+    RtlZeroMemory(Bench->Alive, Bench->Pids * sizeof(BOOLEAN));
+    PrcTableInit(&Bench->Table);
+
+    // every other PID is running when the run starts
+    for (i = 0; i < Bench->Pids; i += 2)
+    {
+        if (!MixToggle(Bench, i))
+        {
+            fprintf(stderr, "PrcAlloc failed\n");
+            goto clean_up;
+        }
+    }
+
+    pthread_barrier_init(&Bench->Start, NULL, Bench->Threads + 1);
+    for (started = 0; started < Bench->Threads; ++started)
+    {
+        contexts[started].Bench = Bench;
+        contexts[started].Index = started;
+        contexts[started].Seed = 0x9E3779B97F4A7C15ULL * (started + 1);
+        if (pthread_create(&threads[started], NULL, MixThread, &contexts[started]) != 0)
+        {
+            // the barrier can't be met any more, nothing was timed
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+    pthread_barrier_wait(&Bench->Start);
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    ns = (double)(KeQueryPerformanceCounter(NULL).QuadPart - start);
+    pthread_barrier_destroy(&Bench->Start);
+
+    if (Bench->Failed)
+    {
+        fprintf(stderr, "%u threads: a live PID was not in the table\n", Bench->Threads);
+        goto clean_up;
+    }
+
+    if (Csv)
+    {
+        printf("prc_mix,%u,%u,%u,%llu,%.2f,%.2f,%.1f\n",
+            Bench->Threads, Bench->Pids, Bench->WritePct, (unsigned long long)ops,
+            ns * Bench->Threads / ops, ops * 1000.0 / ns,
+            Bench->Finds ? 100.0 * Bench->Hits / Bench->Finds : 0);
+    }
+    else
+    {
+        printf("{\"suite\":\"prc_mix\",\"threads\":%u,\"pids\":%u,\"write_pct\":%u,\"ops\":%llu,\"ns_per_op\":%.2f,\"mops\":%.2f,\"hit_pct\":%.1f}\n",
+            Bench->Threads, Bench->Pids, Bench->WritePct, (unsigned long long)ops,
+            ns * Bench->Threads / ops, ops * 1000.0 / ns,
+            Bench->Finds ? 100.0 * Bench->Hits / Bench->Finds : 0);
+    }
+    fflush(stdout);
+
+    bOk = TRUE;
+
+clean_up:
+    // the processes still running exit
+    for (i = 0; i < Bench->Pids; ++i)
+    {
+        if (Bench->Alive[i] && !MixToggle(Bench, i))
+        {
+            fprintf(stderr, "%u threads: a live PID was not in the table\n", Bench->Threads);
+            bOk = FALSE;
+        }
+    }
+    PrcTableFree(&Bench->Table);
+
+    PrcQueryPoolStats(&stats);
+    if (stats.Outstanding != 0)
+    {
+        fprintf(stderr, "%u threads: %lld PROCESS_T outstanding\n", Bench->Threads, (long long)stats.Outstanding);
+        bOk = FALSE;
+    }
+
+    return bOk;
+}
+
+static
+BOOLEAN
+ParseCount(
+    _In_  const char *Text,
+    _In_  ULONG      Min,
+    _In_  ULONG      Max,
+    _Out_ PULONG     Value
+)
+{
+    char            *end = NULL;
+    unsigned long   value = strtoul(Text, &end, 0);
+
+    if (end == Text || *end != '\0' || value < Min || value > Max)
+    {
+        return FALSE;
+    }
+    *Value = (ULONG)value;
+
+    return TRUE;
+}
+
+
+int
+main(
+    int  argc,
+    char *argv[]
+)
+{
+    static MIX_BENCH    bench;
+    ULONG               maxThreads = 0;
+    BOOLEAN             csv = FALSE;
+    ULONG               threads = 0;
+    ULONG               i = 0;
+    int                 ret = 1;
+
+    bench.Ops = MIX_BENCH_DEFAULT_OPS;
+    bench.Pids = MIX_BENCH_DEFAULT_PIDS;
+    bench.WritePct = MIX_BENCH_DEFAULT_WRITE_PCT;
+
+    maxThreads = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    if (maxThreads > MIX_BENCH_MAX_THREADS)
+    {
+        maxThreads = MIX_BENCH_MAX_THREADS;
+    }
+
+    for (i = 1; i < (ULONG)argc; ++i)
+    {
+        if (strcmp(argv[i], "--csv") == 0)
+        {
+            csv = TRUE;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--threads") == 0 && ParseCount(argv[i + 1], 1, MIX_BENCH_MAX_THREADS, &maxThreads))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--ops") == 0 && ParseCount(argv[i + 1], 1, 1U << 30, &bench.Ops))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--pids") == 0 && ParseCount(argv[i + 1], 2, 1U << 22, &bench.Pids))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--write-pct") == 0 && ParseCount(argv[i + 1], 0, 100, &bench.WritePct))
+        {
+            ++i;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--threads 1..%u] [--ops PerThread] [--pids N] [--write-pct 0..100] [--csv]\n",
+                argv[0], MIX_BENCH_MAX_THREADS);
+            return 2;
+        }
+    }
+
+    bench.Alive = (PBOOLEAN)calloc(bench.Pids, sizeof(BOOLEAN));
+    if (bench.Alive == NULL)
+    {
+        fprintf(stderr, "calloc failed\n");
+        return 1;
+    }
+    if (!NT_SUCCESS(PrcInitialize()))
+    {
+        fprintf(stderr, "PrcInitialize failed\n");
+        free(bench.Alive);
+        return 1;
+    }
+    PinInitialize(PIN_DEFAULT_LIMIT_MB);
+
+    if (csv)
+    {
+        printf("suite,threads,pids,write_pct,ops,ns_per_op,mops,hit_pct\n");
+    }
+
+    for (threads = 1; threads <= maxThreads; threads = (threads == maxThreads || threads * 2 <= maxThreads) ? threads * 2 : maxThreads)
+    {
+        bench.Threads = threads;
+        if (!MixRun(&bench, csv))
+        {
+            goto clean_up;
+        }
+    }
+
+    ret = 0;
+
+clean_up:
+    PinUninitialize();
+    PrcUninitialize();
+    free(bench.Alive);
+
+    return ret;
+}
\ No newline at end of file
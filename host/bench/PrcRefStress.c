@@ -0,0 +1,364 @@
+#include "Process.h"
+
+#include <stdio.h>
+#include <pthread.h>
+
+
+//
+// PROCESS_T reference counting under concurrent creates, exits and lookups,
+// the way the driver uses it: writer threads stand in for
+// CreateProcessNotifyRoutine (PrcAlloc + PrcTableInsert on create,
+// PrcTableRemove + PrcDereference on exit; a PID is only ever handled by one
+// writer, as the system never reports two creates of a live PID), reader
+// threads for IOCTL_DUMP_PROCESS (PrcTableFind, use, PrcDereference), often
+// holding their reference across the exit of the process.
+//
+// Every create stamps ParentId with a unique generation. A reader holding a
+// reference must see the record unchanged until it lets go: PolFree reuses
+// the first bytes of a freed record and the next PrcAlloc stamps another
+// generation, so a record freed under a reader shows up as a changed
+// ParentId or ProcessId. At the end every record must be back in the pool.
+//
+// Prints one JSON summary line; exits with 1 on any violation.
+//
+// usage: prc_ref_stress [--writers N] [--readers N] [--pids N] [--ops PerWriter]
+//
+
+#define REF_STRESS_MAX_THREADS      64
+#define REF_STRESS_DEFAULT_PIDS     256
+#define REF_STRESS_DEFAULT_OPS      200000
+#define REF_STRESS_HOLD_SPINS       64      // Reader work while it holds a reference
+
+
+typedef struct _REF_STRESS
+{
+    ULONG               Writers;
+    ULONG               Readers;
+    ULONG               Pids;               // PIDs 8, 12, ... shared out round robin between writers
+    ULONG               Ops;                // Creates + exits per writer
+    PROCESS_TABLE       Table;
+    volatile LONG64     Generation;
+    volatile LONG       WritersLeft;
+    pthread_barrier_t   Start;
+
+    volatile LONG64     Creates;
+    volatile LONG64     Exits;
+    volatile LONG64     Finds;
+    volatile LONG64     Hits;
+    volatile LONG64     HeldAcrossExit;     // Reader still had the record after the writer removed it
+    volatile LONG64     Violations;
+
+}REF_STRESS, *PREF_STRESS;
+
+typedef struct _REF_THREAD
+{
+    PREF_STRESS Stress;
+    ULONG       Index;
+    ULONG64     Seed;
+
+}REF_THREAD, *PREF_THREAD;
+
+
+static
+ULONG64
+RefRandom(
+    _Inout_ PULONG64 Seed
+)
+{
+    *Seed ^= *Seed << 13;
+    *Seed ^= *Seed >> 7;
+    *Seed ^= *Seed << 17;
+
+    return *Seed;
+}
+
+static
+HANDLE
+RefPid(
+    _In_ ULONG Index
+)
+{
+    return (HANDLE)(ULONG_PTR)(8 + (ULONG64)Index * 4);
+}
+
+static
+VOID
+RefViolation(
+    _Inout_ PREF_STRESS Stress,
+    _In_    const char  *What,
+    _In_    HANDLE      Pid
+)
+{
+    // only the first few, a broken build would flood stderr
+    if (InterlockedIncrement64(&Stress->Violations) <= 10)
+    {
+        fprintf(stderr, "pid %lu: %s\n", (unsigned long)(ULONG_PTR)Pid, What);
+    }
+}
+
+static
+void *
+RefWriter(
+    void *Context
+)
+{
+    PREF_THREAD     thread = (PREF_THREAD)Context;
+    PREF_STRESS     stress = thread->Stress;
+    PBOOLEAN        alive = NULL;
+    PPROCESS_T      p = NULL;
+    HANDLE          pid = NULL;
+    ULONG           owned = 0;
+    ULONG           slot = 0;
+    ULONG           op = 0;
+    ULONG           i = 0;
+
+    // PIDs Index, Index + Writers, ...
+    owned = (stress->Pids - thread->Index + stress->Writers - 1) / stress->Writers;
+    alive = (PBOOLEAN)calloc(owned ? owned : 1, sizeof(BOOLEAN));
+    if (alive == NULL)
+    {
+        RefViolation(stress, "calloc failed", NULL);
+        InterlockedDecrement(&stress->WritersLeft);
+        return NULL;
+    }
+
+    pthread_barrier_wait(&stress->Start);
+
+    for (op = 0; op < stress->Ops && owned != 0; ++op)
+    {
+        slot = (ULONG)(RefRandom(&thread->Seed) % owned);
+        pid = RefPid(thread->Index + slot * stress->Writers);
+
+        if (!alive[slot])
+        {
+            p = PrcAlloc((HANDLE)(ULONG_PTR)InterlockedIncrement64(&stress->Generation), pid);
+            if (p == NULL)
+            {
+                RefViolation(stress, "PrcAlloc failed", pid);
+                break;
+            }
+            PrcTableInsert(&stress->Table, p);
+            alive[slot] = TRUE;
+            InterlockedIncrement64(&stress->Creates);
+        }
+        else
+        {
+            p = PrcTableRemove(&stress->Table, NULL, &pid);
+            if (p == NULL || p->ProcessId != pid)
+            {
+                RefViolation(stress, "live record not in the table", pid);
+                break;
+            }
+            PrcDereference(p);
+            alive[slot] = FALSE;
+            InterlockedIncrement64(&stress->Exits);
+        }
+    }
+
+    // the processes still running exit too
+    for (i = 0; i < owned; ++i)
+    {
+        if (alive[i])
+        {
+            pid = RefPid(thread->Index + i * stress->Writers);
+            p = PrcTableRemove(&stress->Table, NULL, &pid);
+            if (p == NULL)
+            {
+                RefViolation(stress, "live record not in the table", pid);
+                continue;
+            }
+            PrcDereference(p);
+            InterlockedIncrement64(&stress->Exits);
+        }
+    }
+
+    free(alive);
+    InterlockedDecrement(&stress->WritersLeft);
+
+    return NULL;
+}
+
+static
+void *
+RefReader(
+    void *Context
+)
+{
+    PREF_THREAD     thread = (PREF_THREAD)Context;
+    PREF_STRESS     stress = thread->Stress;
+    PPROCESS_T      p = NULL;
+    HANDLE          pid = NULL;
+    HANDLE          generation = NULL;
+    ULONG           i = 0;
+
+    pthread_barrier_wait(&stress->Start);
+
+    while (ReadNoFence(&stress->WritersLeft) != 0)
+    {
+        pid = RefPid((ULONG)(RefRandom(&thread->Seed) % stress->Pids));
+
+        InterlockedIncrement64(&stress->Finds);
+        p = PrcTableFind(&stress->Table, pid);
+        if (p == NULL)
+        {
+            continue;
+        }
+        InterlockedIncrement64(&stress->Hits);
+
+        generation = p->ParentId;
+        if (p->ProcessId != pid || ReadNoFence(&p->RefCount) < 1)
+        {
+            RefViolation(stress, "found a record that is not the PID's", pid);
+        }
+
+        // give the writer time to remove it while we still hold it
+        for (i = 0; i < REF_STRESS_HOLD_SPINS; ++i)
+        {
+            YieldProcessor();
+        }
+        if ((RefRandom(&thread->Seed) & 15) == 0)
+        {
+            sched_yield();
+        }
+
+        if (ReadNoFence(&p->RefCount) == 1)
+        {
+            InterlockedIncrement64(&stress->HeldAcrossExit);
+        }
+        if (p->ParentId != generation || p->ProcessId != pid)
+        {
+            RefViolation(stress, "record freed while a reference was held", pid);
+        }
+
+        PrcDereference(p);
+    }
+
+    return NULL;
+}
+
+static
+BOOLEAN
+ParseCount(
+    _In_  const char *Text,
+    _In_  ULONG      Max,
+    _Out_ PULONG     Value
+)
+{
+    char            *end = NULL;
+    unsigned long   value = strtoul(Text, &end, 0);
+
+    if (end == Text || *end != '\0' || value == 0 || value > Max)
+    {
+        return FALSE;
+    }
+    *Value = (ULONG)value;
+
+    return TRUE;
+}
+
+
+int
+main(
+    int  argc,
+    char *argv[]
+)
+{
+    static REF_STRESS   stress;
+    pthread_t           threads[2 * REF_STRESS_MAX_THREADS];
+    REF_THREAD          contexts[2 * REF_STRESS_MAX_THREADS];
+    POOL_STATS          poolStats = { 0 };
+    LONGLONG            start = 0;
+    double              seconds = 0;
+    ULONG               started = 0;
+    ULONG               i = 0;
+    int                 ret = 1;
+
+    stress.Writers = 4;
+    stress.Readers = 4;
+    stress.Pids = REF_STRESS_DEFAULT_PIDS;
+    stress.Ops = REF_STRESS_DEFAULT_OPS;
+
+    for (i = 1; i < (ULONG)argc; ++i)
+    {
+        if (i + 1 < (ULONG)argc && strcmp(argv[i], "--writers") == 0 && ParseCount(argv[i + 1], REF_STRESS_MAX_THREADS, &stress.Writers))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--readers") == 0 && ParseCount(argv[i + 1], REF_STRESS_MAX_THREADS, &stress.Readers))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--pids") == 0 && ParseCount(argv[i + 1], 1U << 20, &stress.Pids))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--ops") == 0 && ParseCount(argv[i + 1], 1U << 30, &stress.Ops))
+        {
+            ++i;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--writers 1..%u] [--readers 1..%u] [--pids N] [--ops PerWriter]\n",
+                argv[0], REF_STRESS_MAX_THREADS, REF_STRESS_MAX_THREADS);
+            return 2;
+        }
+    }
+
+    if (!NT_SUCCESS(PrcInitialize()))
+    {
+        fprintf(stderr, "PrcInitialize failed\n");
+        return 1;
+    }
+    PinInitialize(PIN_DEFAULT_LIMIT_MB);
+    PrcTableInit(&stress.Table);
+
+    stress.WritersLeft = (LONG)stress.Writers;
+    pthread_barrier_init(&stress.Start, NULL, stress.Writers + stress.Readers + 1);
+
+    for (started = 0; started < stress.Writers + stress.Readers; ++started)
+    {
+        contexts[started].Stress = &stress;
+        contexts[started].Index = (started < stress.Writers) ? started : started - stress.Writers;
+        contexts[started].Seed = 0x9E3779B97F4A7C15ULL * (started + 1);
+        if (pthread_create(&threads[started], NULL, (started < stress.Writers) ? RefWriter : RefReader, &contexts[started]) != 0)
+        {
+            // the barrier can't be met any more
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+    pthread_barrier_wait(&stress.Start);
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    seconds = (KeQueryPerformanceCounter(NULL).QuadPart - start) / 1e9;
+    pthread_barrier_destroy(&stress.Start);
+
+    // every process exited, so the table must be empty already
+    PrcTableFree(&stress.Table);
+    PrcQueryPoolStats(&poolStats);
+
+    printf("{\"suite\":\"prc_ref\",\"writers\":%u,\"readers\":%u,\"pids\":%u,\"creates\":%lld,\"exits\":%lld,"
+        "\"finds\":%lld,\"hits\":%lld,\"held_across_exit\":%lld,\"violations\":%lld,\"leaked\":%lld,\"seconds\":%.3f}\n",
+        stress.Writers, stress.Readers, stress.Pids, (long long)stress.Creates, (long long)stress.Exits,
+        (long long)stress.Finds, (long long)stress.Hits, (long long)stress.HeldAcrossExit,
+        (long long)stress.Violations, (long long)poolStats.Outstanding, seconds);
+
+    if (stress.Violations != 0 || stress.Creates != stress.Exits || poolStats.Outstanding != 0)
+    {
+        fprintf(stderr, "reference counting broke: %lld violations, %lld creates, %lld exits, %lld PROCESS_T leaked\n",
+            (long long)stress.Violations, (long long)stress.Creates, (long long)stress.Exits, (long long)poolStats.Outstanding);
+        goto clean_up;
+    }
+
+    ret = 0;
+
+clean_up:
+    PinUninitialize();
+    PrcUninitialize();
+
+    return ret;
+}
\ No newline at end of file
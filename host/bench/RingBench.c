@@ -0,0 +1,307 @@
+#include "Ring.h"
+#include "Latency.h"
+
+#include <stdio.h>
+#include <pthread.h>
+
+
+//
+// One EVENT_RING, 1 to --producers producer threads (x2 steps) and one
+// consumer, the notify routines of that many CPUs sharing a ring against the
+// notify thread. Nothing is lost: a producer that finds the ring full yields
+// and tries again, and counts it. One JSON object (or CSV row) per producer
+// count on stdout:
+//
+//   {"suite":"ring","producers":8,"events":800000,"ns_per_event":41.2,"mevents":24.3,"full_pct":0.4,"high_water":4096,"lat_p50_ns":900,"lat_p99_ns":5100}
+//
+// ns_per_event is wall time per event through the ring, lat_* the time from
+// RngEnqueue to RngDequeueBatch. The consumer checks that it sees every event
+// of every producer exactly once and in the order that producer queued them.
+//
+// usage: ring_bench [--producers 1..64] [--events PerProducer] [--capacity Slots] [--batch N] [--csv]
+//
+
+#define RING_BENCH_MAX_PRODUCERS    64
+#define RING_BENCH_DEFAULT_EVENTS   (1 << 18)
+#define RING_BENCH_DEFAULT_BATCH    64
+#define RING_BENCH_MAX_BATCH        1024
+
+
+typedef struct _RING_BENCH
+{
+    ULONG               Producers;
+    ULONG               Events;             // Per producer
+    ULONG               Batch;
+    EVENT_RING          Ring;
+    pthread_barrier_t   Start;
+    volatile LONG64     Full;               // RngEnqueue calls refused
+    volatile LONG       Broken;             // An event was lost, duplicated or reordered
+    LATENCY_HISTOGRAM   Latency;            // ns
+
+}RING_BENCH, *PRING_BENCH;
+
+typedef struct _RING_THREAD
+{
+    PRING_BENCH Bench;
+    ULONG       Index;
+
+}RING_THREAD, *PRING_THREAD;
+
+
+static
+void *
+RingBenchProducer(
+    void *Context
+)
+{
+    PRING_THREAD    thread = (PRING_THREAD)Context;
+    PRING_BENCH     bench = thread->Bench;
+    PROC_INFO       info = { 0 };
+    LONG64          full = 0;
+    ULONG           i = 0;
+
+    info.ParentId = thread->Index;
+    info.Create = 1;
+
+    pthread_barrier_wait(&bench->Start);
+
+    for (i = 0; i < bench->Events; ++i)
+    {
+        info.Sequence = i + 1;
+        info.ProcessId = (i + 1) * 4;
+        info.Timestamp = KeQueryPerformanceCounter(NULL).QuadPart;
+
+        while (!RngEnqueue(&bench->Ring, &info))
+        {
+            ++full;
+            sched_yield();
+        }
+    }
+
+    InterlockedExchangeAdd64(&bench->Full, full);
+
+    return NULL;
+}
+
+//
+// Drains the ring until every producer's events came through
+static
+VOID
+RingBenchConsume(
+    _Inout_ PRING_BENCH Bench
+)
+{
+    PROC_INFO   infos[RING_BENCH_MAX_BATCH];
+    ULONG64     next[RING_BENCH_MAX_PRODUCERS] = { 0 };
+    ULONG64     left = (ULONG64)Bench->Producers * Bench->Events;
+    LONGLONG    now = 0;
+    ULONG       count = 0;
+    ULONG       i = 0;
+
+    for (i = 0; i < Bench->Producers; ++i)
+    {
+        next[i] = 1;
+    }
+
+    while (left != 0)
+    {
+        count = RngDequeueBatch(&Bench->Ring, infos, Bench->Batch);
+        if (count == 0)
+        {
+            sched_yield();
+            continue;
+        }
+
+        now = KeQueryPerformanceCounter(NULL).QuadPart;
+        for (i = 0; i < count; ++i)
+        {
+            if (infos[i].ParentId >= Bench->Producers || infos[i].Sequence != next[infos[i].ParentId])
+            {
+                // only the first one, everything after it is off too
+                if (InterlockedExchange(&Bench->Broken, 1) == 0)
+                {
+                    fprintf(stderr, "producer %u: got event %llu, expected %llu\n", infos[i].ParentId,
+                        (unsigned long long)infos[i].Sequence,
+                        (unsigned long long)(infos[i].ParentId < Bench->Producers ? next[infos[i].ParentId] : 0));
+                }
+                return;
+            }
+            ++next[infos[i].ParentId];
+            LatRecord(&Bench->Latency, now - infos[i].Timestamp);
+        }
+        left -= count;
+    }
+}
+
+//
+// returns FALSE if the ring lost, duplicated or reordered an event
+static
+BOOLEAN
+RingBenchRun(
+    _Inout_ PRING_BENCH Bench,
+    _In_    ULONG       Capacity,
+    _In_    BOOLEAN     Csv
+)
+{
+    pthread_t   threads[RING_BENCH_MAX_PRODUCERS];
+    RING_THREAD contexts[RING_BENCH_MAX_PRODUCERS];
+    ULONG64     events = (ULONG64)Bench->Producers * Bench->Events;
+    LONGLONG    start = 0;
+    double      ns = 0;
+    ULONG       started = 0;
+    ULONG       i = 0;
+
+    Bench->Full = 0;
+    Bench->Broken = 0;
+    RtlZeroMemory(&Bench->Latency, sizeof(Bench->Latency));
+
+    if (!NT_SUCCESS(RngInit(&Bench->Ring, Capacity)))
+    {
+        fprintf(stderr, "RngInit failed\n");
+        return FALSE;
+    }
+
+    pthread_barrier_init(&Bench->Start, NULL, Bench->Producers + 1);
+    for (started = 0; started < Bench->Producers; ++started)
+    {
+        contexts[started].Bench = Bench;
+        contexts[started].Index = started;
+        if (pthread_create(&threads[started], NULL, RingBenchProducer, &contexts[started]) != 0)
+        {
+            // the barrier can't be met any more, nothing was timed
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+    pthread_barrier_wait(&Bench->Start);
+    RingBenchConsume(Bench);
+    if (Bench->Broken)
+    {
+        // producers may be stuck on a full ring nobody drains any more
+        fprintf(stderr, "%u producers: the ring broke FIFO order\n", Bench->Producers);
+        exit(1);
+    }
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    ns = (double)(KeQueryPerformanceCounter(NULL).QuadPart - start);
+    pthread_barrier_destroy(&Bench->Start);
+
+    if (!RngIsEmpty(&Bench->Ring))
+    {
+        fprintf(stderr, "%u producers: %u events left over\n", Bench->Producers, RngCount(&Bench->Ring));
+        RngUninit(&Bench->Ring);
+        return FALSE;
+    }
+
+    if (Csv)
+    {
+        printf("ring,%u,%llu,%.2f,%.2f,%.2f,%ld,%llu,%llu\n",
+            Bench->Producers, (unsigned long long)events, ns / events, events * 1000.0 / ns,
+            100.0 * Bench->Full / (events + Bench->Full), (long)Bench->Ring.HighWater,
+            (unsigned long long)LatPercentile(&Bench->Latency, 500), (unsigned long long)LatPercentile(&Bench->Latency, 990));
+    }
+    else
+    {
+        printf("{\"suite\":\"ring\",\"producers\":%u,\"events\":%llu,\"ns_per_event\":%.2f,\"mevents\":%.2f,\"full_pct\":%.2f,"
+            "\"high_water\":%ld,\"lat_p50_ns\":%llu,\"lat_p99_ns\":%llu}\n",
+            Bench->Producers, (unsigned long long)events, ns / events, events * 1000.0 / ns,
+            100.0 * Bench->Full / (events + Bench->Full), (long)Bench->Ring.HighWater,
+            (unsigned long long)LatPercentile(&Bench->Latency, 500), (unsigned long long)LatPercentile(&Bench->Latency, 990));
+    }
+    fflush(stdout);
+
+    RngUninit(&Bench->Ring);
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+ParseCount(
+    _In_  const char *Text,
+    _In_  ULONG      Max,
+    _Out_ PULONG     Value
+)
+{
+    char            *end = NULL;
+    unsigned long   value = strtoul(Text, &end, 0);
+
+    if (end == Text || *end != '\0' || value == 0 || value > Max)
+    {
+        return FALSE;
+    }
+    *Value = (ULONG)value;
+
+    return TRUE;
+}
+
+
+int
+main(
+    int  argc,
+    char *argv[]
+)
+{
+    static RING_BENCH   bench;
+    ULONG               maxProducers = RING_BENCH_MAX_PRODUCERS;
+    ULONG               events = RING_BENCH_DEFAULT_EVENTS;
+    ULONG               capacity = RNG_DEFAULT_CAPACITY;
+    ULONG               batch = RING_BENCH_DEFAULT_BATCH;
+    BOOLEAN             csv = FALSE;
+    ULONG               producers = 0;
+    ULONG               i = 0;
+
+    for (i = 1; i < (ULONG)argc; ++i)
+    {
+        if (strcmp(argv[i], "--csv") == 0)
+        {
+            csv = TRUE;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--producers") == 0 && ParseCount(argv[i + 1], RING_BENCH_MAX_PRODUCERS, &maxProducers))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--events") == 0 && ParseCount(argv[i + 1], 1U << 30, &events))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--capacity") == 0 && ParseCount(argv[i + 1], RNG_MAX_CAPACITY, &capacity) &&
+            capacity >= RNG_MIN_CAPACITY && (capacity & (capacity - 1)) == 0)
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--batch") == 0 && ParseCount(argv[i + 1], RING_BENCH_MAX_BATCH, &batch))
+        {
+            ++i;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--producers 1..%u] [--events PerProducer] [--capacity %u..%u, power of 2] [--batch 1..%u] [--csv]\n",
+                argv[0], RING_BENCH_MAX_PRODUCERS, RNG_MIN_CAPACITY, RNG_MAX_CAPACITY, RING_BENCH_MAX_BATCH);
+            return 2;
+        }
+    }
+
+    if (csv)
+    {
+        printf("suite,producers,events,ns_per_event,mevents,full_pct,high_water,lat_p50_ns,lat_p99_ns\n");
+    }
+
+    for (producers = 1; producers <= maxProducers; producers = (producers == maxProducers || producers * 2 <= maxProducers) ? producers * 2 : maxProducers)
+    {
+        bench.Producers = producers;
+        bench.Events = events;
+        bench.Batch = batch;
+
+        if (!RingBenchRun(&bench, capacity, csv))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
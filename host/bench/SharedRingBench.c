@@ -0,0 +1,508 @@
+#include "EventQueue.h"
+#include "SharedRing.h"
+#include "Latency.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+
+
+//
+// The shared ring delivery path end to end, with SharedRing.h as the driver
+// and the client build it: --producers threads raise events into the real
+// EVENT_QUEUE (CreateProcessNotifyRoutine), a notify thread moves them into
+// the SHARED_RING like FillSharedRing and rings the doorbell, retrying every
+// IOC_SHARED_RING_RETRY_MS while the ring is full, and a consumer thread
+// reads them in place like SharedRingWatch.
+//
+// Checked: every event reaches the consumer once or is counted as dropped,
+// Sequence - Dropped counts the records read, and the consumer never sleeps
+// on records the driver published without ringing the doorbell (a lost
+// wakeup). One JSON object on stdout:
+//
+//   {"suite":"shared_ring","producers":4,"events":400000,"dropped":0,"ns_per_event":85.1,"doorbells":1234,"waits":1240,"full":3,"lat_p50_ns":20479,"lat_p99_ns":90111}
+//
+// doorbells is how often the notify thread signaled the consumer, waits how
+// often the consumer went to sleep, full how often the ring held the notify
+// thread back.
+//
+// usage: shared_ring_bench [--producers 1..64] [--events PerProducer] [--rate PerProducerPerSecond]
+//            [--capacity QueueSlots] [--slow NsPerRecord]
+//
+
+#define SHR_BENCH_MAX_PRODUCERS     64
+#define SHR_BENCH_DEFAULT_PRODUCERS 4
+#define SHR_BENCH_DEFAULT_EVENTS    100000
+#define SHR_BENCH_WATCHDOG_MS       500     // Consumer sleep after which a pending record means a lost doorbell
+
+
+//
+// Auto reset event
+//
+typedef struct _SHR_SIGNAL
+{
+    pthread_mutex_t Lock;
+    pthread_cond_t  Cond;
+    BOOLEAN         Set;
+
+}SHR_SIGNAL, *PSHR_SIGNAL;
+
+typedef struct _SHR_BENCH
+{
+    ULONG               Producers;
+    ULONG               Events;             // Per producer
+    ULONG               Rate;               // Events per second per producer, 0: flat out
+    ULONG               Capacity;           // EVENT_QUEUE slots
+    ULONG               SlowNs;             // Consumer work per record
+
+    EVENT_QUEUE         Queue;
+    PSHARED_RING        Ring;
+    SHR_SIGNAL          Wake;               // EventProcessCreateClose
+    SHR_SIGNAL          Doorbell;
+    volatile LONG       Stop;               // EventDriverUnload, and gTerminateThreadEvent for the consumer
+    volatile LONG       NextProducer;
+
+    PUCHAR              Seen;               // Per event, set when it is read
+    volatile LONG64     Consumed;
+    volatile LONG64     Violations;
+    LONG64              Doorbells;
+    LONG64              Full;
+    LONG64              Waits;
+    LATENCY_HISTOGRAM   Latency;            // ns
+
+}SHR_BENCH, *PSHR_BENCH;
+
+
+static
+VOID
+ShrSignalInit(
+    _Out_ PSHR_SIGNAL Signal
+)
+{
+    pthread_condattr_t attr;
+
+    // timed waits, measured like KeQueryPerformanceCounter
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&Signal->Lock, NULL);
+    pthread_cond_init(&Signal->Cond, &attr);
+    pthread_condattr_destroy(&attr);
+    Signal->Set = FALSE;
+}
+
+static
+VOID
+ShrSignalUninit(
+    _Inout_ PSHR_SIGNAL Signal
+)
+{
+    pthread_cond_destroy(&Signal->Cond);
+    pthread_mutex_destroy(&Signal->Lock);
+}
+
+static
+VOID
+ShrSignalSet(
+    _Inout_ PSHR_SIGNAL Signal
+)
+{
+    pthread_mutex_lock(&Signal->Lock);
+    Signal->Set = TRUE;
+    pthread_cond_signal(&Signal->Cond);
+    pthread_mutex_unlock(&Signal->Lock);
+}
+
+//
+// returns FALSE on timeout; TimeoutMs 0 waits forever
+static
+BOOLEAN
+ShrSignalWait(
+    _Inout_ PSHR_SIGNAL Signal,
+    _In_    ULONG       TimeoutMs
+)
+{
+    struct timespec due = { 0 };
+    LONGLONG        at = 0;
+    BOOLEAN         bSet = FALSE;
+
+    at = KeQueryPerformanceCounter(NULL).QuadPart + (LONGLONG)TimeoutMs * 1000000LL;
+    due.tv_sec = at / 1000000000LL;
+    due.tv_nsec = at % 1000000000LL;
+
+    pthread_mutex_lock(&Signal->Lock);
+    while (!Signal->Set)
+    {
+        if (TimeoutMs == 0)
+        {
+            pthread_cond_wait(&Signal->Cond, &Signal->Lock);
+        }
+        else if (pthread_cond_timedwait(&Signal->Cond, &Signal->Lock, &due) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    bSet = Signal->Set;
+    Signal->Set = FALSE;
+    pthread_mutex_unlock(&Signal->Lock);
+
+    return bSet;
+}
+
+static
+VOID
+ShrViolation(
+    _Inout_ PSHR_BENCH Bench,
+    _In_    const char *What
+)
+{
+    // only the first few, a broken protocol would flood stderr
+    if (InterlockedIncrement64(&Bench->Violations) <= 10)
+    {
+        fprintf(stderr, "%s\n", What);
+    }
+}
+
+//
+// CreateProcessNotifyRoutine; ParentId is the producer, ProcessId its event number
+static
+void *
+ShrProducer(
+    void *Context
+)
+{
+    PSHR_BENCH      bench = (PSHR_BENCH)Context;
+    PROC_INFO       info = { 0 };
+    ULONG           self = (ULONG)InterlockedIncrement(&bench->NextProducer) - 1;
+    LONGLONG        start = KeQueryPerformanceCounter(NULL).QuadPart;
+    LONGLONG        at = 0;
+    struct timespec due = { 0 };
+    ULONG           i = 0;
+
+    for (i = 0; i < bench->Events; ++i)
+    {
+        if (bench->Rate != 0)
+        {
+            at = start + (LONGLONG)i * 1000000000LL / bench->Rate;
+            due.tv_sec = at / 1000000000LL;
+            due.tv_nsec = at % 1000000000LL;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+            {
+            }
+        }
+
+        info.ParentId = self;
+        info.ProcessId = i + 1;
+        info.Create = 1;
+
+        if (EvqEnqueue(&bench->Queue, &info))
+        {
+            ShrSignalSet(&bench->Wake);
+        }
+    }
+
+    return NULL;
+}
+
+//
+// FillSharedRing
+static
+VOID
+ShrFill(
+    _Inout_ PSHR_BENCH Bench
+)
+{
+    PPROC_INFO  slot = NULL;
+    ULONG       produced = 0;
+
+    while ((slot = ShrProducerSlot(Bench->Ring, produced)) != NULL &&
+        EvqDequeue(&Bench->Queue, slot))
+    {
+        ++produced;
+    }
+    if (slot == NULL)
+    {
+        ++Bench->Full;
+    }
+
+    Bench->Ring->Dropped = EvqDropped(&Bench->Queue);
+
+    if (produced != 0 && ShrProducerCommit(Bench->Ring, produced))
+    {
+        ++Bench->Doorbells;
+        ShrSignalSet(&Bench->Doorbell);
+    }
+}
+
+//
+// ProcessIoctlNotifyRoutine with the shared ring mapped
+static
+void *
+ShrNotify(
+    void *Context
+)
+{
+    PSHR_BENCH  bench = (PSHR_BENCH)Context;
+    BOOLEAN     bBacklog = FALSE;
+
+    for (;;)
+    {
+        ShrSignalWait(&bench->Wake, bBacklog ? IOC_SHARED_RING_RETRY_MS : 0);
+        if (ReadNoFence(&bench->Stop))
+        {
+            break;
+        }
+
+        ShrFill(bench);
+        bBacklog = !EvqIsEmpty(&bench->Queue);
+    }
+
+    return NULL;
+}
+
+//
+// What ConsumeProcInfo would do with a record, plus the protocol checks
+static
+VOID
+ShrConsume(
+    _Inout_ PSHR_BENCH Bench,
+    _In_    PPROC_INFO Info,
+    _In_    LONGLONG   Now
+)
+{
+    LONGLONG    until = 0;
+    ULONG64     index = 0;
+    LONG64      consumed = 0;
+
+    consumed = InterlockedIncrement64(&Bench->Consumed);
+    if (Info->Sequence - Info->Dropped != (ULONG64)consumed)
+    {
+        ShrViolation(Bench, "Sequence - Dropped does not count the records read");
+    }
+
+    index = (ULONG64)Info->ParentId * Bench->Events + Info->ProcessId - 1;
+    if (Info->ParentId >= Bench->Producers || Info->ProcessId == 0 || Info->ProcessId > Bench->Events ||
+        InterlockedExchange(&Bench->Seen[index], 1) != 0)
+    {
+        ShrViolation(Bench, "record read twice or never raised");
+    }
+
+    LatRecord(&Bench->Latency, Now - Info->Timestamp);
+
+    if (Bench->SlowNs != 0)
+    {
+        until = Now + Bench->SlowNs;
+        while (KeQueryPerformanceCounter(NULL).QuadPart < until)
+        {
+            YieldProcessor();
+        }
+    }
+}
+
+//
+// SharedRingWatch
+static
+void *
+ShrConsumer(
+    void *Context
+)
+{
+    PSHR_BENCH  bench = (PSHR_BENCH)Context;
+    PPROC_INFO  records = NULL;
+    LONGLONG    now = 0;
+    ULONG       count = 0;
+    ULONG       i = 0;
+
+    for (;;)
+    {
+        // records are read in place, then handed back to the driver
+        records = ShrConsumerPeek(bench->Ring, &count);
+        if (count != 0)
+        {
+            now = KeQueryPerformanceCounter(NULL).QuadPart;
+            for (i = 0; i < count; ++i)
+            {
+                ShrConsume(bench, &records[i], now);
+            }
+            ShrConsumerRelease(bench->Ring, count);
+            continue;
+        }
+
+        if (ReadNoFence(&bench->Stop))
+        {
+            break;
+        }
+
+        // ring is empty, sleep until the driver rings the doorbell
+        if (!ShrConsumerPrepareWait(bench->Ring))
+        {
+            continue;
+        }
+
+        ++bench->Waits;
+        while (!ShrSignalWait(&bench->Doorbell, SHR_BENCH_WATCHDOG_MS) && !ReadNoFence(&bench->Stop))
+        {
+            // the driver clears Waiting when it publishes to a sleeping consumer
+            // and rings right after; published with Waiting still set, nobody will
+            if (ShrConsumerPending(bench->Ring) != 0 && ReadNoFence(&bench->Ring->Waiting) == 1)
+            {
+                ShrViolation(bench, "records published to a sleeping consumer without a doorbell");
+                InterlockedExchange(&bench->Ring->Waiting, 0);
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static
+BOOLEAN
+ParseCount(
+    _In_  const char *Text,
+    _In_  ULONG      Min,
+    _In_  ULONG      Max,
+    _Out_ PULONG     Value
+)
+{
+    char            *end = NULL;
+    unsigned long   value = strtoul(Text, &end, 0);
+
+    if (end == Text || *end != '\0' || value < Min || value > Max)
+    {
+        return FALSE;
+    }
+    *Value = (ULONG)value;
+
+    return TRUE;
+}
+
+
+int
+main(
+    int  argc,
+    char *argv[]
+)
+{
+    static SHR_BENCH    bench;
+    pthread_t           producers[SHR_BENCH_MAX_PRODUCERS];
+    pthread_t           notify;
+    pthread_t           consumer;
+    struct timespec     pause = { 0, 1000000 };
+    ULONG64             total = 0;
+    LONG64              dropped = 0;
+    LONGLONG            start = 0;
+    double              ns = 0;
+    ULONG               started = 0;
+    ULONG               i = 0;
+    int                 ret = 1;
+
+    bench.Producers = SHR_BENCH_DEFAULT_PRODUCERS;
+    bench.Events = SHR_BENCH_DEFAULT_EVENTS;
+    bench.Capacity = RNG_DEFAULT_CAPACITY;
+
+    for (i = 1; i < (ULONG)argc; ++i)
+    {
+        if (i + 1 < (ULONG)argc && strcmp(argv[i], "--producers") == 0 && ParseCount(argv[i + 1], 1, SHR_BENCH_MAX_PRODUCERS, &bench.Producers))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--events") == 0 && ParseCount(argv[i + 1], 1, 1U << 24, &bench.Events))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--rate") == 0 && ParseCount(argv[i + 1], 0, 1U << 30, &bench.Rate))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--capacity") == 0 && ParseCount(argv[i + 1], RNG_MIN_CAPACITY, RNG_MAX_CAPACITY, &bench.Capacity))
+        {
+            ++i;
+        }
+        else if (i + 1 < (ULONG)argc && strcmp(argv[i], "--slow") == 0 && ParseCount(argv[i + 1], 0, 1000000, &bench.SlowNs))
+        {
+            ++i;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--producers 1..%u] [--events PerProducer] [--rate PerProducerPerSecond] [--capacity %u..%u] [--slow NsPerRecord]\n",
+                argv[0], SHR_BENCH_MAX_PRODUCERS, RNG_MIN_CAPACITY, RNG_MAX_CAPACITY);
+            return 2;
+        }
+    }
+
+    total = (ULONG64)bench.Producers * bench.Events;
+    bench.Seen = (PUCHAR)calloc((size_t)total, 1);
+    bench.Ring = (PSHARED_RING)ExAllocatePoolWithTag(NonPagedPoolCacheAligned, sizeof(SHARED_RING), IOC_TAG_NAME);
+    if (bench.Seen == NULL || bench.Ring == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    if (!NT_SUCCESS(EvqInit(&bench.Queue, bench.Capacity, QueuePolicyDropNewest)))
+    {
+        fprintf(stderr, "EvqInit failed\n");
+        return 1;
+    }
+    ShrInit(bench.Ring);
+    ShrSignalInit(&bench.Wake);
+    ShrSignalInit(&bench.Doorbell);
+
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+    if (pthread_create(&notify, NULL, ShrNotify, &bench) != 0 ||
+        pthread_create(&consumer, NULL, ShrConsumer, &bench) != 0)
+    {
+        fprintf(stderr, "pthread_create failed\n");
+        exit(1);
+    }
+    for (started = 0; started < bench.Producers; ++started)
+    {
+        if (pthread_create(&producers[started], NULL, ShrProducer, &bench) != 0)
+        {
+            // the count to wait for is off, nothing would end the run
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(producers[i], NULL);
+    }
+
+    // everything raised is either read or dropped
+    while ((ULONG64)(ReadNoFence(&bench.Consumed) + EvqDropped(&bench.Queue)) < total && ReadNoFence(&bench.Violations) == 0)
+    {
+        nanosleep(&pause, NULL);
+    }
+    ns = (double)(KeQueryPerformanceCounter(NULL).QuadPart - start);
+
+    InterlockedExchange(&bench.Stop, 1);
+    ShrSignalSet(&bench.Wake);
+    ShrSignalSet(&bench.Doorbell);
+    pthread_join(notify, NULL);
+    pthread_join(consumer, NULL);
+
+    dropped = EvqDropped(&bench.Queue);
+    printf("{\"suite\":\"shared_ring\",\"producers\":%u,\"events\":%llu,\"dropped\":%lld,\"ns_per_event\":%.2f,"
+        "\"doorbells\":%lld,\"waits\":%lld,\"full\":%lld,\"lat_p50_ns\":%llu,\"lat_p99_ns\":%llu}\n",
+        bench.Producers, (unsigned long long)total, (long long)dropped, ns / total,
+        (long long)bench.Doorbells, (long long)bench.Waits, (long long)bench.Full,
+        (unsigned long long)LatPercentile(&bench.Latency, 500), (unsigned long long)LatPercentile(&bench.Latency, 990));
+
+    if (bench.Violations != 0 || (ULONG64)(bench.Consumed + dropped) != total)
+    {
+        fprintf(stderr, "shared ring protocol broke: %lld violations, %lld read + %lld dropped of %llu\n",
+            (long long)bench.Violations, (long long)bench.Consumed, (long long)dropped, (unsigned long long)total);
+        goto clean_up;
+    }
+
+    ret = 0;
+
+clean_up:
+    ShrSignalUninit(&bench.Doorbell);
+    ShrSignalUninit(&bench.Wake);
+    EvqUninit(&bench.Queue);
+    ExFreePoolWithTag(bench.Ring, IOC_TAG_NAME);
+    free(bench.Seen);
+
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "Latency.h"
+
+
+static
+ULONG
+LatBucket(
+    ULONG64 Value
+)
+{
+    ULONG msb = 0;
+
+    if (Value < LAT_SUB_BUCKETS)
+    {
+        return (ULONG)Value;
+    }
+
+    msb = 63 - (ULONG)__builtin_clzll(Value);
+
+    return (msb - LAT_SUB_BUCKET_BITS + 1) * LAT_SUB_BUCKETS + (ULONG)((Value >> (msb - LAT_SUB_BUCKET_BITS)) & (LAT_SUB_BUCKETS - 1));
+}
+
+static
+ULONG64
+LatBucketUpperBound(
+    ULONG Bucket
+)
+{
+    ULONG shift = 0;
+
+    if (Bucket < LAT_SUB_BUCKETS)
+    {
+        return Bucket;
+    }
+
+    shift = Bucket / LAT_SUB_BUCKETS - 1;
+
+    return ((ULONG64)(LAT_SUB_BUCKETS + Bucket % LAT_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+VOID
+LatRecord(
+    _Inout_ PLATENCY_HISTOGRAM Histogram,
+    _In_    LONG64             LatencyUs
+)
+{
+    LONG64 max = 0;
+
+    if (LatencyUs < 0)
+    {
+        LatencyUs = 0;
+    }
+
+    InterlockedIncrement64(&Histogram->Buckets[LatBucket((ULONG64)LatencyUs)]);
+    InterlockedIncrement64(&Histogram->Count);
+
+    max = ReadNoFence64(&Histogram->MaxUs);
+    while (LatencyUs > max && InterlockedCompareExchange64(&Histogram->MaxUs, LatencyUs, max) != max)
+    {
+        max = ReadNoFence64(&Histogram->MaxUs);
+    }
+}
+
+ULONG64
+LatPercentile(
+    _In_ PLATENCY_HISTOGRAM Histogram,
+    _In_ ULONG              PerThousand
+)
+{
+    LONG64  target = (ReadNoFence64(&Histogram->Count) * PerThousand + 999) / 1000;
+    LONG64  seen = 0;
+    ULONG64 max = (ULONG64)ReadNoFence64(&Histogram->MaxUs);
+    ULONG   i = 0;
+
+    for (i = 0; i < LAT_BUCKETS; ++i)
+    {
+        seen += ReadNoFence64(&Histogram->Buckets[i]);
+        if (seen >= target)
+        {
+            // the top bucket is only as wide as the largest value seen
+            return min(LatBucketUpperBound(i), max);
+        }
+    }
+
+    return max;
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "KmShim.h"
+
+
+//
+// Delivery latency histogram, the same one the client keeps: values below
+// LAT_SUB_BUCKETS get their own bucket, above that every power of 2 is split
+// in LAT_SUB_BUCKETS, so a bucket is at most 1/LAT_SUB_BUCKETS wide relative
+// to its value
+//
+#define LAT_SUB_BUCKET_BITS     3
+#define LAT_SUB_BUCKETS         (1 << LAT_SUB_BUCKET_BITS)
+#define LAT_BUCKETS             ((64 - LAT_SUB_BUCKET_BITS + 1) * LAT_SUB_BUCKETS)
+
+
+typedef struct _LATENCY_HISTOGRAM
+{
+    volatile LONG64 Count;
+    volatile LONG64 MaxUs;
+    volatile LONG64 Buckets[LAT_BUCKETS];
+
+}LATENCY_HISTOGRAM, *PLATENCY_HISTOGRAM;
+
+
+//
+// Any number of concurrent callers; negative values count as 0
+//
+VOID
+LatRecord(
+    _Inout_ PLATENCY_HISTOGRAM Histogram,
+    _In_    LONG64             LatencyUs
+);
+
+//
+// Returns the upper bound of the bucket holding the PerThousand-th value
+//
+ULONG64
+LatPercentile(
+    _In_ PLATENCY_HISTOGRAM Histogram,
+    _In_ ULONG              PerThousand
+);
\ No newline at end of file
@@ -0,0 +1,368 @@
+#include "ProcConnector.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+
+//
+// Older kernels send a shorter proc_event, check every field before reading it
+//
+#define PCN_HAS_FIELD(Length, Field) \
+    ((Length) >= offsetof(struct proc_event, Field) + sizeof(((struct proc_event *)0)->Field))
+
+
+struct _PCN_SOURCE
+{
+    int             Socket;
+    ULONG           RcvBuf;
+    PCN_STATS       Stats;
+
+    BOOLEAN         SeqValid[PCN_MAX_CPUS];
+    ULONG           LastSeq[PCN_MAX_CPUS];
+
+    struct mmsghdr  Headers[PCN_BATCH];
+    struct iovec    Vectors[PCN_BATCH];
+    ULONG64         Buffers[PCN_BATCH][PCN_MSG_SIZE / sizeof(ULONG64)];
+};
+
+
+static
+int
+PcnSubscribe(
+    _In_ PPCN_SOURCE Source
+)
+/*++
+
+Routine Description:
+
+    Sends PROC_CN_MCAST_LISTEN without a filter (the 4 byte form every kernel
+    takes), so the socket gets every event the kernel numbers and a hole in
+    the sequence numbers is a real loss.
+
+--*/
+{
+    struct
+    {
+        struct nlmsghdr Header;
+        struct cn_msg   Message;
+        ULONG           Op;
+
+    }request;
+
+    C_ASSERT(sizeof(request) == NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(ULONG)));
+
+    RtlZeroMemory(&request, sizeof(request));
+
+    request.Header.nlmsg_len = sizeof(request);
+    request.Header.nlmsg_type = NLMSG_DONE;
+    request.Header.nlmsg_pid = (__u32)getpid();
+    request.Message.id.idx = CN_IDX_PROC;
+    request.Message.id.val = CN_VAL_PROC;
+    request.Message.len = sizeof(ULONG);
+    request.Op = PROC_CN_MCAST_LISTEN;
+
+    if (send(Source->Socket, &request, sizeof(request), 0) != sizeof(request))
+    {
+        return errno;
+    }
+
+    return 0;
+}
+
+int
+PcnOpen(
+    _In_  ULONG        RcvBuf,
+    _Out_ PPCN_SOURCE *Source
+)
+{
+    int                 err = 0;
+    PPCN_SOURCE         source = NULL;
+    struct sockaddr_nl  addr = { 0 };
+    struct timeval      timeout = { 0 };
+    int                 size = 0;
+    socklen_t           sizeLength = sizeof(size);
+    ULONG               i = 0;
+
+    *Source = NULL;
+
+    source = (PPCN_SOURCE)calloc(1, sizeof(*source));
+    if (!source)
+    {
+        return ENOMEM;
+    }
+    source->Socket = -1;
+
+    source->Socket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (source->Socket < 0)
+    {
+        err = errno;
+        goto clean_up;
+    }
+
+    // the buffer is what rides out a fork storm while the consumer is busy;
+    // SO_RCVBUFFORCE goes past net.core.rmem_max but needs CAP_NET_ADMIN
+    size = (int)((RcvBuf != 0) ? RcvBuf : PCN_DEFAULT_RCVBUF);
+    if (setsockopt(source->Socket, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0)
+    {
+        setsockopt(source->Socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    if (getsockopt(source->Socket, SOL_SOCKET, SO_RCVBUF, &size, &sizeLength) == 0)
+    {
+        source->RcvBuf = (ULONG)size;
+    }
+
+    timeout.tv_usec = PCN_RECV_TIMEOUT_MS * 1000;
+    if (setsockopt(source->Socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0)
+    {
+        err = errno;
+        goto clean_up;
+    }
+
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    addr.nl_pid = 0;                        // let the kernel pick the port id
+    if (bind(source->Socket, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        err = errno;
+        goto clean_up;
+    }
+
+    err = PcnSubscribe(source);
+    if (err != 0)
+    {
+        goto clean_up;
+    }
+
+    for (i = 0; i < PCN_BATCH; ++i)
+    {
+        source->Vectors[i].iov_base = source->Buffers[i];
+        source->Vectors[i].iov_len = sizeof(source->Buffers[i]);
+        source->Headers[i].msg_hdr.msg_iov = &source->Vectors[i];
+        source->Headers[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    *Source = source;
+    source = NULL;
+
+clean_up:
+    if (source)
+    {
+        PcnClose(source);
+    }
+
+    return err;
+}
+
+VOID
+PcnClose(
+    _In_ PPCN_SOURCE Source
+)
+{
+    if (Source->Socket >= 0)
+    {
+        close(Source->Socket);
+    }
+
+    free(Source);
+}
+
+static
+VOID
+PcnTrackSequence(
+    _Inout_ PPCN_SOURCE Source,
+    _In_    ULONG       Cpu,
+    _In_    ULONG       Seq
+)
+{
+    LONG distance = 0;
+
+    if (Cpu >= PCN_MAX_CPUS)
+    {
+        return;
+    }
+
+    if (!Source->SeqValid[Cpu])
+    {
+        Source->SeqValid[Cpu] = TRUE;
+        Source->LastSeq[Cpu] = Seq;
+        return;
+    }
+
+    // signed distance, the counter wraps
+    distance = (LONG)(Seq - Source->LastSeq[Cpu]);
+    if (distance > 0)
+    {
+        Source->Stats.Lost += (ULONG64)(distance - 1);
+        Source->LastSeq[Cpu] = Seq;
+    }
+}
+
+static
+BOOLEAN
+PcnTranslate(
+    _Inout_ PPCN_SOURCE         Source,
+    _In_    const struct cn_msg *Message,
+    _Out_   PPROC_INFO          Info
+)
+{
+    const struct proc_event *event = (const struct proc_event *)Message->data;
+    ULONG                    length = Message->len;
+
+    if (Message->id.idx != CN_IDX_PROC || Message->id.val != CN_VAL_PROC || !PCN_HAS_FIELD(length, timestamp_ns))
+    {
+        return FALSE;
+    }
+
+    // the subscribe acknowledgement is not numbered like the events
+    if (event->what == PROC_EVENT_NONE)
+    {
+        return FALSE;
+    }
+
+    PcnTrackSequence(Source, event->cpu, Message->seq);
+
+    RtlZeroMemory(Info, sizeof(*Info));
+
+    switch (event->what)
+    {
+    case PROC_EVENT_FORK:
+        if (!PCN_HAS_FIELD(length, event_data.fork))
+        {
+            Source->Stats.Ignored++;
+            return FALSE;
+        }
+        if (event->event_data.fork.child_pid != event->event_data.fork.child_tgid)
+        {
+            Source->Stats.Threads++;
+            return FALSE;
+        }
+        Info->ParentId = (ULONG)event->event_data.fork.parent_tgid;
+        Info->ProcessId = (ULONG)event->event_data.fork.child_tgid;
+        Info->Create = 1;
+        break;
+
+    case PROC_EVENT_EXIT:
+        if (!PCN_HAS_FIELD(length, event_data.exit.process_tgid))
+        {
+            Source->Stats.Ignored++;
+            return FALSE;
+        }
+        // the thread group leader, the exit the driver's notify routine sees
+        if (event->event_data.exit.process_pid != event->event_data.exit.process_tgid)
+        {
+            Source->Stats.Threads++;
+            return FALSE;
+        }
+        if (PCN_HAS_FIELD(length, event_data.exit.parent_tgid))
+        {
+            Info->ParentId = (ULONG)event->event_data.exit.parent_tgid;
+        }
+        Info->ProcessId = (ULONG)event->event_data.exit.process_tgid;
+        Info->Create = 0;
+        break;
+
+    case PROC_EVENT_EXEC:
+        Source->Stats.Execs++;
+        return FALSE;
+
+    default:
+        Source->Stats.Ignored++;
+        return FALSE;
+    }
+
+    Source->Stats.Delivered++;
+
+    Info->Sequence = Source->Stats.Delivered + Source->Stats.Lost;
+    Info->Timestamp = (LONG64)event->timestamp_ns;
+    Info->Dropped = (ULONG)Source->Stats.Lost;
+
+    return TRUE;
+}
+
+int
+PcnRead(
+    _In_                                PPCN_SOURCE Source,
+    _Out_writes_to_(MaxRecords, return) PPROC_INFO  Records,
+    _In_                                ULONG       MaxRecords
+)
+{
+    int              received = 0;
+    int              count = 0;
+    int              i = 0;
+    ULONG            length = 0;
+    struct nlmsghdr *header = NULL;
+
+    if (MaxRecords == 0)
+    {
+        return 0;
+    }
+
+    // every datagram carries one event, so a batch never yields more records than datagrams
+    received = recvmmsg(Source->Socket, Source->Headers, min(MaxRecords, PCN_BATCH), MSG_WAITFORONE, NULL);
+    if (received < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+            return 0;
+        }
+        if (errno == ENOBUFS)
+        {
+            // the lost events show up as sequence holes
+            Source->Stats.Overruns++;
+            return 0;
+        }
+        return -errno;
+    }
+
+    for (i = 0; i < received; ++i)
+    {
+        Source->Stats.Messages++;
+
+        if (Source->Headers[i].msg_hdr.msg_flags & MSG_TRUNC)
+        {
+            Source->Stats.Ignored++;
+            continue;
+        }
+
+        length = Source->Headers[i].msg_len;
+        for (header = (struct nlmsghdr *)Source->Buffers[i]; NLMSG_OK(header, length); header = NLMSG_NEXT(header, length))
+        {
+            if (header->nlmsg_type == NLMSG_ERROR || header->nlmsg_type == NLMSG_NOOP ||
+                header->nlmsg_len < NLMSG_LENGTH(sizeof(struct cn_msg)) ||
+                ((const struct cn_msg *)NLMSG_DATA(header))->len > header->nlmsg_len - NLMSG_LENGTH(sizeof(struct cn_msg)))
+            {
+                continue;
+            }
+
+            if ((ULONG)count < MaxRecords && PcnTranslate(Source, (const struct cn_msg *)NLMSG_DATA(header), &Records[count]))
+            {
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+VOID
+PcnQueryStats(
+    _In_  PPCN_SOURCE Source,
+    _Out_ PPCN_STATS  Stats
+)
+{
+    *Stats = Source->Stats;
+}
+
+ULONG
+PcnReceiveBuffer(
+    _In_ PPCN_SOURCE Source
+)
+{
+    return Source->RcvBuf;
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "KmShim.h"
+#include "Public.h"
+
+
+//
+// Linux process events from the netlink proc connector (CN_IDX_PROC),
+// translated into the PROC_INFO records IOCTL_NOTIFY_CALLBACK produces:
+//   PROC_EVENT_FORK of a new thread group -> Create = 1, ParentId = parent tgid
+//   PROC_EVENT_EXIT of a thread group     -> Create = 0
+//   PROC_EVENT_EXEC                       -> counted only, PROC_INFO has no exec kind
+// Thread forks and exits are counted and skipped, the driver only sees processes.
+//
+// Timestamp is proc_event.timestamp_ns (CLOCK_MONOTONIC, the shim KeQueryPerformanceCounter
+// clock). Sequence and Dropped follow the driver rules: a gap in Sequence is an
+// event lost before this one, Dropped is the cumulative loss.
+//
+// The kernel numbers the messages it sends per CPU (cn_msg.seq), so a hole in
+// a CPU's numbers is an event the socket did not get; ENOBUFS from the socket
+// (receive buffer overrun) is counted in Overruns, the events it cost show up
+// as holes.
+//
+#define PCN_BATCH               256                 // Datagrams per recvmmsg
+#define PCN_MSG_SIZE            256                 // nlmsghdr + cn_msg + proc_event with room to spare
+#define PCN_MAX_CPUS            4096
+#define PCN_DEFAULT_RCVBUF      (16 * 1024 * 1024)
+#define PCN_RECV_TIMEOUT_MS     100                 // PcnRead returns 0 after this long without events
+
+
+typedef struct _PCN_STATS
+{
+    ULONG64 Messages;                       // Datagrams received
+    ULONG64 Delivered;                      // PROC_INFO records produced
+    ULONG64 Lost;                           // Holes in the per CPU sequence numbers
+    ULONG64 Overruns;                       // ENOBUFS reported by the socket
+    ULONG64 Execs;
+    ULONG64 Threads;                        // Thread forks and exits skipped
+    ULONG64 Ignored;                        // uid/gid/sid/comm/... events
+
+}PCN_STATS, *PPCN_STATS;
+
+typedef struct _PCN_SOURCE PCN_SOURCE, *PPCN_SOURCE;
+
+
+//
+// Opens the connector socket with a RcvBuf bytes receive buffer (0 for
+// PCN_DEFAULT_RCVBUF) and subscribes to the process events.
+// Returns 0 or an errno value; EPERM/EPROTONOSUPPORT/ECONNREFUSED mean the
+// connector is not available to this process.
+//
+int
+PcnOpen(
+    _In_  ULONG        RcvBuf,
+    _Out_ PPCN_SOURCE *Source
+);
+
+VOID
+PcnClose(
+    _In_ PPCN_SOURCE Source
+);
+
+//
+// Receives up to one recvmmsg batch and translates it into at most MaxRecords
+// records. Returns the number of records (0 after PCN_RECV_TIMEOUT_MS without
+// events or when the batch had only skipped events) or -errno.
+//
+int
+PcnRead(
+    _In_                                PPCN_SOURCE Source,
+    _Out_writes_to_(MaxRecords, return) PPROC_INFO  Records,
+    _In_                                ULONG       MaxRecords
+);
+
+VOID
+PcnQueryStats(
+    _In_  PPCN_SOURCE Source,
+    _Out_ PPCN_STATS  Stats
+);
+
+//
+// Bytes the kernel actually gave the receive buffer
+//
+ULONG
+PcnReceiveBuffer(
+    _In_ PPCN_SOURCE Source
+);
\ No newline at end of file
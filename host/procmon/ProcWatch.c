@@ -0,0 +1,399 @@
+#include "ProcConnector.h"
+#include "Latency.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+
+//
+// NotificationWatch for Linux: reads process events from the proc connector
+// and hands every PROC_INFO to the same consumer steps as the Windows client
+// (latency from the event timestamp, the "#seq pid create" line). Reports
+// throughput, loss and receive buffer overruns as JSON lines, one "sample" per
+// interval and a "summary".
+//
+// --spawn N is the self test: a thread forks N children that exit at once while
+// the consumer runs, and every one of their creates and exits has to arrive.
+//
+// Exit code: 0, 1 on lost events or an error, 77 when the connector is not
+// available (no CAP_NET_ADMIN, not the initial network namespace, ...).
+//
+// usage: proc_watch [--duration S] [--spawn N] [--rcvbuf Bytes] [--interval Ms] [--quiet]
+//
+
+#define PW_DEFAULT_INTERVAL_MS  1000
+#define PW_MAX_OUTSTANDING      64          // Spawned children not yet reaped
+#define PW_SETTLE_MS            2000        // How long to wait for the last events of --spawn
+#define PW_SKIP                 77
+
+#define PW_CREATE_SEEN          0x01
+#define PW_EXIT_SEEN            0x02
+
+
+typedef struct _PW_OPTIONS
+{
+    ULONG   DurationS;                      // 0: until interrupted, or until --spawn is done
+    ULONG   Spawn;
+    ULONG   RcvBuf;
+    ULONG   IntervalMs;
+    BOOLEAN Quiet;
+
+}PW_OPTIONS, *PPW_OPTIONS;
+
+
+static PW_OPTIONS        gOptions;
+static LATENCY_HISTOGRAM gLatency;
+static ULONG64           gLastSequence;
+static ULONG64           gOutOfOrder;
+
+// --spawn bookkeeping
+static pid_t             gSelf;
+static ULONG             gPidMax;
+static PUCHAR            gSeen;             // PW_*_SEEN by pid, consumer thread only
+static pid_t             *gSpawned;
+static volatile LONG     gSpawnedCount;
+static volatile LONG     gSpawnDone;
+static volatile LONG64   gSpawnEndTime;
+
+
+/* Helpers */
+
+static
+LONGLONG
+PwNow(
+    VOID
+)
+{
+    return KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+/* Consumer */
+
+static
+VOID
+PwConsumeProcInfo(
+    _In_ const PROC_INFO *Info
+)
+{
+    LONGLONG latencyUs = (PwNow() - Info->Timestamp) / 1000;
+
+    LatRecord(&gLatency, latencyUs);
+
+    if (Info->Sequence <= gLastSequence)
+    {
+        gOutOfOrder++;
+    }
+    gLastSequence = Info->Sequence;
+
+    if (gSeen && Info->ParentId == (ULONG)gSelf && Info->ProcessId < gPidMax)
+    {
+        gSeen[Info->ProcessId] |= Info->Create ? PW_CREATE_SEEN : PW_EXIT_SEEN;
+    }
+
+    if (!gOptions.Quiet)
+    {
+        printf("#%llu %u %u (%lld us, %u dropped)\n",
+            (unsigned long long)Info->Sequence, Info->ProcessId, Info->Create, (long long)latencyUs, Info->Dropped);
+    }
+}
+
+/* Self test */
+
+static
+void *
+PwSpawner(
+    void *Context
+)
+{
+    LONG    outstanding = 0;
+    pid_t   pid = 0;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    while ((ULONG)gSpawnedCount < gOptions.Spawn)
+    {
+        // keep the zombies few, a process limit would stop the storm early
+        while (outstanding > 0 && waitpid(-1, NULL, (outstanding >= PW_MAX_OUTSTANDING) ? 0 : WNOHANG) > 0)
+        {
+            outstanding--;
+        }
+
+        pid = fork();
+        if (pid == 0)
+        {
+            _exit(0);
+        }
+        if (pid < 0)
+        {
+            perror("fork");
+            break;
+        }
+
+        gSpawned[gSpawnedCount] = pid;
+        InterlockedIncrement(&gSpawnedCount);
+        outstanding++;
+    }
+
+    while (outstanding > 0 && waitpid(-1, NULL, 0) > 0)
+    {
+        outstanding--;
+    }
+
+    InterlockedExchange64(&gSpawnEndTime, PwNow());
+    InterlockedExchange(&gSpawnDone, 1);
+
+    return NULL;
+}
+
+static
+BOOLEAN
+PwSpawnComplete(
+    VOID
+)
+{
+    LONG i = 0;
+
+    for (i = 0; i < gSpawnedCount; ++i)
+    {
+        if ((gSeen[gSpawned[i]] & (PW_CREATE_SEEN | PW_EXIT_SEEN)) != (PW_CREATE_SEEN | PW_EXIT_SEEN))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static
+ULONG
+PwReadPidMax(
+    VOID
+)
+{
+    FILE            *file = fopen("/proc/sys/kernel/pid_max", "r");
+    unsigned long   value = 0;
+
+    if (!file)
+    {
+        return 1 << 22;
+    }
+    if (fscanf(file, "%lu", &value) != 1 || value == 0)
+    {
+        value = 1 << 22;
+    }
+    fclose(file);
+
+    return (ULONG)value;
+}
+
+/* Main */
+
+static
+BOOLEAN
+PwParseCount(
+    _In_  const char *Text,
+    _In_  ULONG      Max,
+    _Out_ PULONG     Value
+)
+{
+    char            *end = NULL;
+    unsigned long   value = strtoul(Text, &end, 0);
+
+    if (end == Text || *end != '\0' || value == 0 || value > Max)
+    {
+        return FALSE;
+    }
+    *Value = (ULONG)value;
+
+    return TRUE;
+}
+
+static
+VOID
+PwUsage(
+    _In_ const char *Name
+)
+{
+    fprintf(stderr,
+        "usage: %s [--duration S] [--spawn N] [--rcvbuf Bytes] [--interval Ms] [--quiet]\n",
+        Name);
+}
+
+int
+main(
+    int  argc,
+    char *argv[]
+)
+{
+    PPCN_SOURCE source = NULL;
+    PROC_INFO   records[PCN_BATCH];
+    PCN_STATS   stats = { 0 };
+    pthread_t   spawner;
+    BOOLEAN     spawnStarted = FALSE;
+    BOOLEAN     spawnComplete = FALSE;
+    LONGLONG    start = 0;
+    LONGLONG    now = 0;
+    LONGLONG    lastSample = 0;
+    ULONG64     lastDelivered = 0;
+    double      seconds = 0;
+    int         count = 0;
+    int         err = 0;
+    int         i = 0;
+    int         ret = 1;
+
+    gOptions.IntervalMs = PW_DEFAULT_INTERVAL_MS;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--quiet") == 0)
+        {
+            gOptions.Quiet = TRUE;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--duration") == 0 && PwParseCount(argv[i + 1], 86400, &gOptions.DurationS))
+        {
+            ++i;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--spawn") == 0 && PwParseCount(argv[i + 1], 1 << 20, &gOptions.Spawn))
+        {
+            ++i;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--rcvbuf") == 0 && PwParseCount(argv[i + 1], 1 << 30, &gOptions.RcvBuf))
+        {
+            ++i;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--interval") == 0 && PwParseCount(argv[i + 1], 60000, &gOptions.IntervalMs))
+        {
+            ++i;
+        }
+        else
+        {
+            PwUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    err = PcnOpen(gOptions.RcvBuf, &source);
+    if (err != 0)
+    {
+        fprintf(stderr, "proc connector: %s\n", strerror(err));
+        return (err == EPERM || err == EACCES || err == EPROTONOSUPPORT || err == EAFNOSUPPORT || err == ECONNREFUSED) ? PW_SKIP : 1;
+    }
+
+    __try
+    {
+        if (gOptions.Spawn)
+        {
+            gSelf = getpid();
+            gPidMax = PwReadPidMax();
+            gSeen = (PUCHAR)calloc(gPidMax, sizeof(UCHAR));
+            gSpawned = (pid_t *)calloc(gOptions.Spawn, sizeof(pid_t));
+            if (!gSeen || !gSpawned)
+            {
+                fprintf(stderr, "calloc failed\n");
+                __leave;
+            }
+        }
+
+        start = PwNow();
+        lastSample = start;
+
+        if (gOptions.Spawn)
+        {
+            if (pthread_create(&spawner, NULL, PwSpawner, NULL) != 0)
+            {
+                fprintf(stderr, "pthread_create failed\n");
+                __leave;
+            }
+            spawnStarted = TRUE;
+        }
+
+        for (;;)
+        {
+            count = PcnRead(source, records, PCN_BATCH);
+            if (count < 0)
+            {
+                fprintf(stderr, "recvmmsg: %s\n", strerror(-count));
+                __leave;
+            }
+
+            for (i = 0; i < count; ++i)
+            {
+                PwConsumeProcInfo(&records[i]);
+            }
+
+            now = PwNow();
+            if (now - lastSample >= (LONGLONG)gOptions.IntervalMs * 1000000)
+            {
+                PcnQueryStats(source, &stats);
+                fprintf(stderr, "{\"type\":\"sample\",\"t_ms\":%lld,\"delivered\":%llu,\"lost\":%llu,\"overruns\":%llu,\"events_per_sec\":%.0f}\n",
+                    (long long)((now - start) / 1000000),
+                    (unsigned long long)stats.Delivered,
+                    (unsigned long long)stats.Lost,
+                    (unsigned long long)stats.Overruns,
+                    (double)(stats.Delivered - lastDelivered) * 1e9 / (double)(now - lastSample));
+                lastSample = now;
+                lastDelivered = stats.Delivered;
+            }
+
+            if (gOptions.DurationS && now - start >= (LONGLONG)gOptions.DurationS * 1000000000)
+            {
+                break;
+            }
+            if (gOptions.Spawn && ReadNoFence(&gSpawnDone))
+            {
+                spawnComplete = PwSpawnComplete();
+                if (spawnComplete || now - ReadNoFence64(&gSpawnEndTime) >= (LONGLONG)PW_SETTLE_MS * 1000000)
+                {
+                    break;
+                }
+            }
+        }
+
+        seconds = (double)(PwNow() - start) / 1e9;
+        PcnQueryStats(source, &stats);
+
+        // subscribed but nothing comes: a network namespace the connector does not serve
+        if (gOptions.Spawn && gSpawnedCount != 0 && stats.Messages == 0)
+        {
+            fprintf(stderr, "proc connector: no events\n");
+            ret = PW_SKIP;
+            __leave;
+        }
+
+        fprintf(stderr, "{\"type\":\"summary\",\"delivered\":%llu,\"lost\":%llu,\"overruns\":%llu,\"out_of_order\":%llu,"
+            "\"execs\":%llu,\"threads\":%llu,\"ignored\":%llu,\"rcvbuf\":%u,\"seconds\":%.3f,\"events_per_sec\":%.0f,"
+            "\"latency_us\":{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%lld},\"spawned\":%d,\"spawn_complete\":%s}\n",
+            (unsigned long long)stats.Delivered, (unsigned long long)stats.Lost, (unsigned long long)stats.Overruns,
+            (unsigned long long)gOutOfOrder, (unsigned long long)stats.Execs, (unsigned long long)stats.Threads,
+            (unsigned long long)stats.Ignored, PcnReceiveBuffer(source),
+            seconds, seconds > 0 ? stats.Delivered / seconds : 0,
+            (unsigned long long)LatPercentile(&gLatency, 500), (unsigned long long)LatPercentile(&gLatency, 990),
+            (unsigned long long)LatPercentile(&gLatency, 999), (long long)gLatency.MaxUs,
+            (int)gSpawnedCount, (gOptions.Spawn && !spawnComplete) ? "false" : "true");
+
+        if (stats.Lost != 0 || stats.Overruns != 0 || gOutOfOrder != 0 || (gOptions.Spawn && !spawnComplete))
+        {
+            fprintf(stderr, "events lost: %llu lost, %llu overruns, %llu out of order, spawn %s\n",
+                (unsigned long long)stats.Lost, (unsigned long long)stats.Overruns, (unsigned long long)gOutOfOrder,
+                (gOptions.Spawn && !spawnComplete) ? "incomplete" : "complete");
+            __leave;
+        }
+
+        ret = 0;
+    }
+    __finally
+    {
+        if (spawnStarted)
+        {
+            pthread_join(spawner, NULL);
+        }
+        PcnClose(source);
+        free(gSpawned);
+        free(gSeen);
+    }
+
+    return ret;
+}
\ No newline at end of file
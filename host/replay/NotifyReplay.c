@@ -0,0 +1,836 @@
+#include "EventQueue.h"
+#include "Process.h"
+#include "Latency.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+
+
+//
+// Replays a recorded process event trace through the driver notify pipeline,
+// in process: producer threads stand in for CreateProcessNotifyRoutine (real
+// EVENT_QUEUE and PROCESS_TABLE), one thread for ProcessIoctlNotifyRoutine
+// filling pended batch requests like FillNotifyIrp, and client threads for
+// NotificationWatch. Reports throughput, queue depth over time and delivery
+// latency percentiles as JSON lines, one "sample" per interval and a "summary".
+//
+// Trace: one event per line, '#' starts a comment
+//
+//   <time us> <parent pid> <pid> <create | exit>
+//
+// usage: notify_replay (--trace File | --synthetic Processes) [--speed X]
+//            [--producers N] [--clients N] [--batch N] [--capacity N]
+//            [--policy drop-newest | drop-oldest | coalesce] [--interval Ms]
+//
+
+#define RPL_DEFAULT_BATCH       1024        // WDM_NOTIFY_BATCH_COUNT, what the client asks for
+#define RPL_DEFAULT_INTERVAL_MS 100
+#define RPL_MAX_THREADS         256
+
+
+typedef struct _RPL_EVENT
+{
+    ULONG64 TimeUs;                         // From the first event of the trace
+    ULONG   ParentId;
+    ULONG   ProcessId;
+    BOOLEAN Create;
+
+}RPL_EVENT, *PRPL_EVENT;
+
+//
+// Auto reset event
+//
+typedef struct _RPL_SIGNAL
+{
+    pthread_mutex_t Lock;
+    pthread_cond_t  Cond;
+    BOOLEAN         Set;
+
+}RPL_SIGNAL, *PRPL_SIGNAL;
+
+//
+// A pended IOCTL_NOTIFY_CALLBACK_BATCH
+//
+typedef struct _RPL_REQUEST
+{
+    struct _RPL_REQUEST *Next;
+    PPROC_INFO_BATCH    Batch;
+    ULONG               MaxCount;
+    ULONG               Filled;             // Records, 0: flushed
+    BOOLEAN             Done;
+    pthread_cond_t      Completed;          // Under gRequestLock
+
+}RPL_REQUEST, *PRPL_REQUEST;
+
+typedef struct _RPL_OPTIONS
+{
+    double          Speed;                  // 1: trace pace, 0: as fast as possible
+    ULONG           Producers;
+    ULONG           Clients;
+    ULONG           Batch;
+    ULONG           Capacity;
+    QUEUE_POLICY    Policy;
+    ULONG           IntervalMs;
+
+}RPL_OPTIONS, *PRPL_OPTIONS;
+
+
+static RPL_OPTIONS      gOptions;
+static PRPL_EVENT       gEvents;
+static ULONG            gEventCount;
+static LONGLONG         gStart;             // KeQueryPerformanceCounter (ns) at replay start
+
+static EVENT_QUEUE      gQueue;
+static PROCESS_TABLE    gTable;
+static RPL_SIGNAL       gWake;              // EventProcessCreateClose / EventIrpQueued
+static volatile LONG    gStop;
+
+static pthread_mutex_t  gRequestLock = PTHREAD_MUTEX_INITIALIZER;
+static PRPL_REQUEST     gRequests;          // FIFO, the IRP queue
+static PRPL_REQUEST     *gRequestsTail = &gRequests;
+
+static volatile LONG64  gRaised;            // Events through the notify routine
+static volatile LONG64  gDelivered;
+static volatile LONG64  gOutOfOrder;        // Sequence not above the previous one of the same client
+static LATENCY_HISTOGRAM gLatency;
+static volatile LONG    gMaxPending;
+
+
+/* Helpers */
+
+static
+LONGLONG
+RplNow(
+    VOID
+)
+{
+    return KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+static
+VOID
+RplSignalInit(
+    _Out_ PRPL_SIGNAL Signal
+)
+{
+    pthread_mutex_init(&Signal->Lock, NULL);
+    pthread_cond_init(&Signal->Cond, NULL);
+    Signal->Set = FALSE;
+}
+
+static
+VOID
+RplSignalSet(
+    _Inout_ PRPL_SIGNAL Signal
+)
+{
+    pthread_mutex_lock(&Signal->Lock);
+    Signal->Set = TRUE;
+    pthread_cond_signal(&Signal->Cond);
+    pthread_mutex_unlock(&Signal->Lock);
+}
+
+static
+VOID
+RplSignalWait(
+    _Inout_ PRPL_SIGNAL Signal
+)
+{
+    pthread_mutex_lock(&Signal->Lock);
+    while (!Signal->Set)
+    {
+        pthread_cond_wait(&Signal->Cond, &Signal->Lock);
+    }
+    Signal->Set = FALSE;
+    pthread_mutex_unlock(&Signal->Lock);
+}
+
+/* Driver side */
+
+//
+// CreateProcessNotifyRoutine, minus the logging
+//
+static
+VOID
+RplNotify(
+    _In_ HANDLE  ParentId,
+    _In_ HANDLE  ProcessId,
+    _In_ BOOLEAN Create
+)
+{
+    PPROCESS_T process = NULL;
+    PROC_INFO  info    = { 0 };
+
+    info.ParentId = (ULONG)(ULONG_PTR)ParentId;
+    info.ProcessId = (ULONG)(ULONG_PTR)ProcessId;
+    info.Create = Create;
+
+    if (EvqEnqueue(&gQueue, &info))
+    {
+        RplSignalSet(&gWake);
+    }
+
+    if (Create)
+    {
+        process = PrcAlloc(ParentId, ProcessId);
+        if (process != NULL)
+        {
+            PrcTableInsert(&gTable, process);
+        }
+    }
+    else
+    {
+        process = PrcTableRemove(&gTable, &ParentId, &ProcessId);
+        if (process != NULL)
+        {
+            PrcDereference(process);
+        }
+    }
+
+    InterlockedIncrement64(&gRaised);
+}
+
+//
+// Raises every trace event whose PID maps to this thread, so a process
+// always has its create and exit raised in order, on the trace schedule
+//
+static
+void *
+RplProducer(
+    void *Context
+)
+{
+    ULONG           self = (ULONG)(ULONG_PTR)Context;
+    struct timespec due = { 0 };
+    LONGLONG        at = 0;
+    ULONG           i = 0;
+
+    for (i = 0; i < gEventCount; ++i)
+    {
+        if ((gEvents[i].ProcessId >> 2) % gOptions.Producers != self)
+        {
+            continue;
+        }
+
+        if (gOptions.Speed > 0)
+        {
+            at = gStart + (LONGLONG)((double)gEvents[i].TimeUs * 1000.0 / gOptions.Speed);
+            due.tv_sec = at / 1000000000LL;
+            due.tv_nsec = at % 1000000000LL;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+            {
+            }
+        }
+
+        RplNotify((HANDLE)(ULONG_PTR)gEvents[i].ParentId, (HANDLE)(ULONG_PTR)gEvents[i].ProcessId, gEvents[i].Create);
+    }
+
+    return NULL;
+}
+
+//
+// FillNotifyIrp for IOCTL_NOTIFY_CALLBACK_BATCH; returns records filled
+//
+static
+ULONG
+RplFill(
+    _Inout_ PRPL_REQUEST Request
+)
+{
+    Request->Batch->Count = EvqDequeueBatch(&gQueue, Request->Batch->Records, Request->MaxCount);
+    if (Request->Batch->Count != 0)
+    {
+        Request->Batch->Pending = EvqCount(&gQueue);
+    }
+
+    return Request->Batch->Count;
+}
+
+static
+VOID
+RplComplete(
+    _Inout_ PRPL_REQUEST Request,
+    _In_    ULONG        Filled
+)
+{
+    pthread_mutex_lock(&gRequestLock);
+    Request->Filled = Filled;
+    Request->Done = TRUE;
+    pthread_cond_signal(&Request->Completed);
+    pthread_mutex_unlock(&gRequestLock);
+}
+
+//
+// ProcessIoctlNotifyRoutine, batch IRP path
+//
+static
+void *
+RplNotifyThread(
+    void *Context
+)
+{
+    PRPL_REQUEST request = NULL;
+    ULONG        filled = 0;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    for (;;)
+    {
+        RplSignalWait(&gWake);
+        if (ReadNoFence(&gStop))
+        {
+            break;
+        }
+
+        while (!EvqIsEmpty(&gQueue))
+        {
+            pthread_mutex_lock(&gRequestLock);
+            request = gRequests;
+            if (request != NULL)
+            {
+                gRequests = request->Next;
+                if (gRequests == NULL)
+                {
+                    gRequestsTail = &gRequests;
+                }
+            }
+            pthread_mutex_unlock(&gRequestLock);
+
+            if (request == NULL)
+            {
+                break;
+            }
+
+            filled = RplFill(request);
+            if (filled == 0)
+            {
+                // not published yet; it stays first in line
+                pthread_mutex_lock(&gRequestLock);
+                request->Next = gRequests;
+                gRequests = request;
+                if (request->Next == NULL)
+                {
+                    gRequestsTail = &request->Next;
+                }
+                pthread_mutex_unlock(&gRequestLock);
+                break;
+            }
+
+            RplComplete(request, filled);
+        }
+    }
+
+    // IrpQFlush
+    pthread_mutex_lock(&gRequestLock);
+    while ((request = gRequests) != NULL)
+    {
+        gRequests = request->Next;
+        request->Filled = 0;
+        request->Done = TRUE;
+        pthread_cond_signal(&request->Completed);
+    }
+    gRequestsTail = &gRequests;
+    pthread_mutex_unlock(&gRequestLock);
+
+    return NULL;
+}
+
+
+/* Client side */
+
+//
+// NotificationWatch: keeps one batch request pended, accounts what comes back
+//
+static
+void *
+RplClient(
+    void *Context
+)
+{
+    RPL_REQUEST request;
+    ULONG64     lastSequence = 0;
+    LONGLONG    now = 0;
+    LONG        pending = 0;
+    ULONG       i = 0;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    RtlZeroMemory(&request, sizeof(request));
+    pthread_cond_init(&request.Completed, NULL);
+    request.MaxCount = gOptions.Batch;
+    request.Batch = (PPROC_INFO_BATCH)malloc(PROC_INFO_BATCH_SIZE(gOptions.Batch));
+    if (request.Batch == NULL)
+    {
+        fprintf(stderr, "malloc failed\n");
+        return NULL;
+    }
+
+    for (;;)
+    {
+        pthread_mutex_lock(&gRequestLock);
+        if (ReadNoFence(&gStop))
+        {
+            pthread_mutex_unlock(&gRequestLock);
+            break;
+        }
+        request.Next = NULL;
+        request.Done = FALSE;
+        *gRequestsTail = &request;
+        gRequestsTail = &request.Next;
+        pthread_mutex_unlock(&gRequestLock);
+
+        RplSignalSet(&gWake);
+
+        pthread_mutex_lock(&gRequestLock);
+        while (!request.Done)
+        {
+            pthread_cond_wait(&request.Completed, &gRequestLock);
+        }
+        pthread_mutex_unlock(&gRequestLock);
+
+        if (request.Filled == 0)
+        {
+            break;
+        }
+
+        now = RplNow();
+        for (i = 0; i < request.Filled; ++i)
+        {
+            if (request.Batch->Records[i].Sequence <= lastSequence)
+            {
+                InterlockedIncrement64(&gOutOfOrder);
+            }
+            lastSequence = request.Batch->Records[i].Sequence;
+
+            LatRecord(&gLatency, (now - request.Batch->Records[i].Timestamp) / 1000);
+        }
+        InterlockedExchangeAdd64(&gDelivered, (LONG64)request.Filled);
+
+        pending = ReadNoFence(&gMaxPending);
+        while ((LONG)request.Batch->Pending > pending &&
+            InterlockedCompareExchange(&gMaxPending, (LONG)request.Batch->Pending, pending) != pending)
+        {
+            pending = ReadNoFence(&gMaxPending);
+        }
+    }
+
+    free(request.Batch);
+    pthread_cond_destroy(&request.Completed);
+
+    return NULL;
+}
+
+
+/* Trace */
+
+static
+int
+RplCompareEvents(
+    const void *A,
+    const void *B
+)
+{
+    const RPL_EVENT *a = (const RPL_EVENT *)A;
+    const RPL_EVENT *b = (const RPL_EVENT *)B;
+
+    if (a->TimeUs != b->TimeUs)
+    {
+        return (a->TimeUs > b->TimeUs) - (a->TimeUs < b->TimeUs);
+    }
+
+    // a process is created before it exits, even in the same microsecond
+    return (int)b->Create - (int)a->Create;
+}
+
+static
+BOOLEAN
+RplAddEvent(
+    _Inout_ PULONG  Capacity,
+    _In_    ULONG64 TimeUs,
+    _In_    ULONG   ParentId,
+    _In_    ULONG   ProcessId,
+    _In_    BOOLEAN Create
+)
+{
+    PRPL_EVENT events = NULL;
+
+    if (gEventCount == *Capacity)
+    {
+        *Capacity = (*Capacity == 0) ? 4096 : *Capacity * 2;
+        events = (PRPL_EVENT)realloc(gEvents, *Capacity * sizeof(RPL_EVENT));
+        if (events == NULL)
+        {
+            fprintf(stderr, "realloc failed\n");
+            return FALSE;
+        }
+        gEvents = events;
+    }
+
+    gEvents[gEventCount].TimeUs = TimeUs;
+    gEvents[gEventCount].ParentId = ParentId;
+    gEvents[gEventCount].ProcessId = ProcessId;
+    gEvents[gEventCount].Create = Create;
+    ++gEventCount;
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+RplLoadTrace(
+    _In_ const char *FileName
+)
+{
+    FILE                *file = NULL;
+    char                line[256];
+    char                kind[16];
+    unsigned long long  timeUs = 0;
+    unsigned long       ppid = 0;
+    unsigned long       pid = 0;
+    ULONG               capacity = 0;
+    ULONG               lineNumber = 0;
+    ULONG               i = 0;
+    ULONG64             first = 0;
+    char                *hash = NULL;
+    BOOLEAN             bOk = FALSE;
+
+    file = (strcmp(FileName, "-") == 0) ? stdin : fopen(FileName, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "can't open %s: %s\n", FileName, strerror(errno));
+        return FALSE;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        ++lineNumber;
+
+        hash = strchr(line, '#');
+        if (hash != NULL)
+        {
+            *hash = '\0';
+        }
+        if (strspn(line, " \t\r\n") == strlen(line))
+        {
+            continue;
+        }
+
+        if (sscanf(line, "%llu %lu %lu %15s", &timeUs, &ppid, &pid, kind) != 4 ||
+            (strcmp(kind, "create") != 0 && strcmp(kind, "exit") != 0))
+        {
+            fprintf(stderr, "%s:%u: expected <time us> <parent pid> <pid> <create | exit>\n", FileName, lineNumber);
+            goto clean_up;
+        }
+
+        if (!RplAddEvent(&capacity, timeUs, (ULONG)ppid, (ULONG)pid, (BOOLEAN)(strcmp(kind, "create") == 0)))
+        {
+            goto clean_up;
+        }
+    }
+
+    if (gEventCount == 0)
+    {
+        fprintf(stderr, "%s: no events\n", FileName);
+        goto clean_up;
+    }
+
+    qsort(gEvents, gEventCount, sizeof(RPL_EVENT), RplCompareEvents);
+
+    first = gEvents[0].TimeUs;
+    for (i = 0; i < gEventCount; ++i)
+    {
+        gEvents[i].TimeUs -= first;
+    }
+
+    bOk = TRUE;
+
+clean_up:
+    if (file != stdin)
+    {
+        fclose(file);
+    }
+
+    return bOk;
+}
+
+//
+// A spawn storm: bursts of 500 processes every 50 ms, each living 1..200 ms
+//
+static
+BOOLEAN
+RplSynthesize(
+    _In_ ULONG Processes
+)
+{
+    ULONG64 seed = 0x2545F4914F6CDD1DULL;
+    ULONG64 start = 0;
+    ULONG   capacity = 0;
+    ULONG   i = 0;
+    ULONG   pid = 0;
+    ULONG   ppid = 0;
+
+    for (i = 0; i < Processes; ++i)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+
+        pid = 8 + i * 4;
+        ppid = (i == 0) ? 4 : 8 + (ULONG)(seed % i) * 4;
+        start = (ULONG64)(i / 500) * 50000 + (seed >> 20) % 1000;
+
+        if (!RplAddEvent(&capacity, start, ppid, pid, TRUE) ||
+            !RplAddEvent(&capacity, start + 1000 + (seed >> 40) % 199000, ppid, pid, FALSE))
+        {
+            return FALSE;
+        }
+    }
+
+    qsort(gEvents, gEventCount, sizeof(RPL_EVENT), RplCompareEvents);
+
+    return TRUE;
+}
+
+
+/* Main */
+
+static
+BOOLEAN
+RplParseCount(
+    _In_  const char *Text,
+    _In_  ULONG      Max,
+    _Out_ PULONG     Value
+)
+{
+    char            *end = NULL;
+    unsigned long   value = strtoul(Text, &end, 0);
+
+    if (end == Text || *end != '\0' || value == 0 || value > Max)
+    {
+        return FALSE;
+    }
+    *Value = (ULONG)value;
+
+    return TRUE;
+}
+
+static
+VOID
+RplUsage(
+    _In_ const char *Name
+)
+{
+    fprintf(stderr,
+        "usage: %s (--trace File | --synthetic Processes) [--speed X (0: flat out)]\n"
+        "           [--producers N] [--clients N] [--batch N] [--capacity N]\n"
+        "           [--policy drop-newest | drop-oldest | coalesce] [--interval Ms]\n",
+        Name);
+}
+
+int
+main(
+    int  argc,
+    char *argv[]
+)
+{
+    const char  *traceName = NULL;
+    ULONG       synthetic = 0;
+    pthread_t   producers[RPL_MAX_THREADS];
+    pthread_t   clients[RPL_MAX_THREADS];
+    pthread_t   notifyThread;
+    LONGLONG    now = 0;
+    LONGLONG    lastSample = 0;
+    LONG64      lastDelivered = 0;
+    LONG64      delivered = 0;
+    LONG64      dropped = 0;
+    POOL_STATS  poolStats = { 0 };
+    IOC_STATS   queueStats = { 0 };
+    double      seconds = 0;
+    char        *end = NULL;
+    ULONG       i = 0;
+    int         ret = 1;
+
+    gOptions.Speed = 1.0;
+    gOptions.Producers = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    gOptions.Clients = 1;
+    gOptions.Batch = RPL_DEFAULT_BATCH;
+    gOptions.Capacity = RNG_DEFAULT_CAPACITY;
+    gOptions.Policy = QueuePolicyDropNewest;
+    gOptions.IntervalMs = RPL_DEFAULT_INTERVAL_MS;
+
+    for (i = 1; i < (ULONG)argc; ++i)
+    {
+        if (i + 1 >= (ULONG)argc)
+        {
+            RplUsage(argv[0]);
+            return 2;
+        }
+
+        if (strcmp(argv[i], "--trace") == 0)
+        {
+            traceName = argv[++i];
+        }
+        else if (strcmp(argv[i], "--synthetic") == 0 && RplParseCount(argv[i + 1], 1 << 26, &synthetic))
+        {
+            ++i;
+        }
+        else if (strcmp(argv[i], "--speed") == 0 && (gOptions.Speed = strtod(argv[i + 1], &end)) >= 0 && *end == '\0')
+        {
+            ++i;
+        }
+        else if (strcmp(argv[i], "--producers") == 0 && RplParseCount(argv[i + 1], RPL_MAX_THREADS, &gOptions.Producers))
+        {
+            ++i;
+        }
+        else if (strcmp(argv[i], "--clients") == 0 && RplParseCount(argv[i + 1], RPL_MAX_THREADS, &gOptions.Clients))
+        {
+            ++i;
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && RplParseCount(argv[i + 1], 1 << 20, &gOptions.Batch))
+        {
+            ++i;
+        }
+        else if (strcmp(argv[i], "--capacity") == 0 && RplParseCount(argv[i + 1], RNG_MAX_CAPACITY, &gOptions.Capacity))
+        {
+            ++i;
+        }
+        else if (strcmp(argv[i], "--interval") == 0 && RplParseCount(argv[i + 1], 60000, &gOptions.IntervalMs))
+        {
+            ++i;
+        }
+        else if (strcmp(argv[i], "--policy") == 0 && strcmp(argv[i + 1], "drop-newest") == 0)
+        {
+            gOptions.Policy = QueuePolicyDropNewest;
+            ++i;
+        }
+        else if (strcmp(argv[i], "--policy") == 0 && strcmp(argv[i + 1], "drop-oldest") == 0)
+        {
+            gOptions.Policy = QueuePolicyDropOldest;
+            ++i;
+        }
+        else if (strcmp(argv[i], "--policy") == 0 && strcmp(argv[i + 1], "coalesce") == 0)
+        {
+            gOptions.Policy = QueuePolicyCoalesce;
+            ++i;
+        }
+        else
+        {
+            RplUsage(argv[0]);
+            return 2;
+        }
+    }
+    if ((traceName == NULL) == (synthetic == 0))
+    {
+        RplUsage(argv[0]);
+        return 2;
+    }
+    gOptions.Producers = min(gOptions.Producers, RPL_MAX_THREADS);
+
+    if (!((traceName != NULL) ? RplLoadTrace(traceName) : RplSynthesize(synthetic)))
+    {
+        return 1;
+    }
+
+    // the driver's own start up
+    if (!NT_SUCCESS(PrcInitialize()) || !NT_SUCCESS(EvqInit(&gQueue, gOptions.Capacity, gOptions.Policy)))
+    {
+        fprintf(stderr, "driver state init failed\n");
+        return 1;
+    }
+    PinInitialize(PIN_DEFAULT_LIMIT_MB);
+    PrcTableInit(&gTable);
+    RplSignalInit(&gWake);
+
+    gStart = RplNow();
+    lastSample = gStart;
+
+    pthread_create(&notifyThread, NULL, RplNotifyThread, NULL);
+    for (i = 0; i < gOptions.Clients; ++i)
+    {
+        pthread_create(&clients[i], NULL, RplClient, NULL);
+    }
+    for (i = 0; i < gOptions.Producers; ++i)
+    {
+        pthread_create(&producers[i], NULL, RplProducer, (void *)(ULONG_PTR)i);
+    }
+
+    // every event either reaches a client or is counted as dropped
+    for (;;)
+    {
+        usleep(min(gOptions.IntervalMs * 1000, 10000));
+
+        now = RplNow();
+        delivered = ReadNoFence64(&gDelivered);
+        dropped = EvqDropped(&gQueue);
+
+        if (now - lastSample >= (LONGLONG)gOptions.IntervalMs * 1000000)
+        {
+            printf("{\"type\":\"sample\",\"t_ms\":%lld,\"raised\":%lld,\"delivered\":%lld,\"dropped\":%lld,\"depth\":%u,\"events_per_sec\":%.0f}\n",
+                (long long)((now - gStart) / 1000000),
+                (long long)ReadNoFence64(&gRaised),
+                (long long)delivered,
+                (long long)dropped,
+                EvqCount(&gQueue),
+                (double)(delivered - lastDelivered) * 1e9 / (double)(now - lastSample));
+            fflush(stdout);
+
+            lastSample = now;
+            lastDelivered = delivered;
+        }
+
+        if (ReadNoFence64(&gRaised) == (LONG64)gEventCount && delivered + dropped >= (LONG64)gEventCount)
+        {
+            break;
+        }
+    }
+    seconds = (double)(RplNow() - gStart) / 1e9;
+
+    for (i = 0; i < gOptions.Producers; ++i)
+    {
+        pthread_join(producers[i], NULL);
+    }
+
+    InterlockedExchange(&gStop, 1);
+    RplSignalSet(&gWake);
+    pthread_join(notifyThread, NULL);
+    for (i = 0; i < gOptions.Clients; ++i)
+    {
+        pthread_join(clients[i], NULL);
+    }
+
+    EvqQueryStats(&gQueue, &queueStats);
+    delivered = gDelivered;
+    dropped = EvqDropped(&gQueue);
+
+    printf("{\"type\":\"summary\",\"events\":%u,\"delivered\":%lld,\"dropped\":%lld,\"out_of_order\":%lld,"
+        "\"seconds\":%.3f,\"events_per_sec\":%.0f,\"p50_us\":%llu,\"p99_us\":%llu,\"p999_us\":%llu,\"max_us\":%lld,"
+        "\"queue_high_water\":%u,\"spilled\":%lld,\"max_pending\":%d,\"producers\":%u,\"clients\":%u,\"batch\":%u,\"capacity\":%u,\"policy\":%u,\"speed\":%g}\n",
+        gEventCount, (long long)delivered, (long long)dropped, (long long)gOutOfOrder,
+        seconds, seconds > 0 ? delivered / seconds : 0,
+        (unsigned long long)LatPercentile(&gLatency, 500), (unsigned long long)LatPercentile(&gLatency, 990),
+        (unsigned long long)LatPercentile(&gLatency, 999), (long long)gLatency.MaxUs,
+        queueStats.QueueHighWater, (long long)queueStats.Spilled, gMaxPending, gOptions.Producers, gOptions.Clients, gOptions.Batch,
+        queueStats.QueueCapacity, (ULONG)gOptions.Policy, gOptions.Speed);
+
+    // the driver's unload
+    PrcTableFree(&gTable);
+    PrcQueryPoolStats(&poolStats);
+    EvqUninit(&gQueue);
+    PinUninitialize();
+    PrcUninitialize();
+
+    if (delivered + dropped != (LONG64)gEventCount || gOutOfOrder != 0 || poolStats.Outstanding != 0)
+    {
+        fprintf(stderr, "replay lost track: %u events, %lld delivered, %lld dropped, %lld out of order, %lld PROCESS_T leaked\n",
+            gEventCount, (long long)delivered, (long long)dropped, (long long)gOutOfOrder, (long long)poolStats.Outstanding);
+        goto clean_up;
+    }
+
+    ret = 0;
+
+clean_up:
+    free(gEvents);
+
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include "KmShim.h"
+
+
+ULONG           gShimProcessorCount;
+__thread LONG   gShimCurrentProcessor = -1;
+
+static KSPIN_LOCK gCancelSpinLock;
+
+#define IO_TYPE_CSQ_EX          4
+
+
+VOID
+ShimSetProcessorCount(
+    _In_ ULONG Count
+)
+{
+    gShimProcessorCount = Count;
+}
+
+
+VOID
+ShimSetCurrentProcessor(
+    _In_ LONG Number
+)
+{
+    gShimCurrentProcessor = Number;
+}
+
+
+VOID
+IoAcquireCancelSpinLock(
+    _Out_ PKIRQL Irql
+)
+{
+    KeAcquireSpinLock(&gCancelSpinLock, Irql);
+}
+
+
+VOID
+IoReleaseCancelSpinLock(
+    _In_ KIRQL Irql
+)
+{
+    KeReleaseSpinLock(&gCancelSpinLock, Irql);
+}
+
+
+BOOLEAN
+IoCancelIrp(
+    _Inout_ PIRP Irp
+)
+{
+    PDRIVER_CANCEL  routine = NULL;
+    KIRQL           irql = PASSIVE_LEVEL;
+
+    IoAcquireCancelSpinLock(&irql);
+
+    // whoever takes the routine off the IRP owns it, Cancel has to be visible first
+    __atomic_store_n(&Irp->Cancel, TRUE, __ATOMIC_SEQ_CST);
+    routine = IoSetCancelRoutine(Irp, NULL);
+    if (routine == NULL)
+    {
+        IoReleaseCancelSpinLock(irql);
+        return FALSE;
+    }
+
+    Irp->CancelIrql = irql;
+    routine(NULL, Irp);
+
+    return TRUE;
+}
+
+
+//
+// The cancel routine IoCsqInsertIrpEx puts on every queued IRP
+static
+VOID
+CsqCancelRoutine(
+    _In_    struct _DEVICE_OBJECT *DeviceObject,
+    _Inout_ PIRP                  Irp
+)
+{
+    PIO_CSQ csq = NULL;
+    KIRQL   irql = PASSIVE_LEVEL;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    IoReleaseCancelSpinLock(Irp->CancelIrql);
+
+    csq = (PIO_CSQ)Irp->Tail.Overlay.DriverContext[3];
+
+    csq->CsqAcquireLock(csq, &irql);
+    csq->CsqRemoveIrp(csq, Irp);
+    Irp->Tail.Overlay.DriverContext[3] = NULL;
+    csq->CsqReleaseLock(csq, irql);
+
+    csq->CsqCompleteCanceledIrp(csq, Irp);
+}
+
+
+NTSTATUS
+IoCsqInitializeEx(
+    _Out_ PIO_CSQ                       Csq,
+    _In_  PIO_CSQ_INSERT_IRP_EX         CsqInsertIrp,
+    _In_  PIO_CSQ_REMOVE_IRP            CsqRemoveIrp,
+    _In_  PIO_CSQ_PEEK_NEXT_IRP         CsqPeekNextIrp,
+    _In_  PIO_CSQ_ACQUIRE_LOCK          CsqAcquireLock,
+    _In_  PIO_CSQ_RELEASE_LOCK          CsqReleaseLock,
+    _In_  PIO_CSQ_COMPLETE_CANCELED_IRP CsqCompleteCanceledIrp
+)
+{
+    Csq->Type = IO_TYPE_CSQ_EX;
+    Csq->CsqInsertIrp = CsqInsertIrp;
+    Csq->CsqRemoveIrp = CsqRemoveIrp;
+    Csq->CsqPeekNextIrp = CsqPeekNextIrp;
+    Csq->CsqAcquireLock = CsqAcquireLock;
+    Csq->CsqReleaseLock = CsqReleaseLock;
+    Csq->CsqCompleteCanceledIrp = CsqCompleteCanceledIrp;
+    Csq->ReservePointer = NULL;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+IoCsqInsertIrpEx(
+    _Inout_  PIO_CSQ             Csq,
+    _Inout_  PIRP                Irp,
+    _In_opt_ PIO_CSQ_IRP_CONTEXT Context,
+    _In_opt_ PVOID               InsertContext
+)
+{
+    NTSTATUS    status = STATUS_UNSUCCESSFUL;
+    KIRQL       irql = PASSIVE_LEVEL;
+
+    ASSERT(Context == NULL);
+    UNREFERENCED_PARAMETER(Context);
+
+    Csq->CsqAcquireLock(Csq, &irql);
+
+    status = Csq->CsqInsertIrp(Csq, Irp, InsertContext);
+    if (!NT_SUCCESS(status))
+    {
+        Csq->CsqReleaseLock(Csq, irql);
+        return status;
+    }
+
+    IoMarkIrpPending(Irp);
+    Irp->Tail.Overlay.DriverContext[3] = Csq;
+
+    // routine first, then Cancel: IoCancelIrp does it the other way round, so
+    // either it finds the routine or we find Cancel set
+    IoSetCancelRoutine(Irp, CsqCancelRoutine);
+    if (__atomic_load_n(&Irp->Cancel, __ATOMIC_SEQ_CST) && IoSetCancelRoutine(Irp, NULL) != NULL)
+    {
+        Csq->CsqRemoveIrp(Csq, Irp);
+        Irp->Tail.Overlay.DriverContext[3] = NULL;
+        Csq->CsqReleaseLock(Csq, irql);
+
+        Csq->CsqCompleteCanceledIrp(Csq, Irp);
+        return status;
+    }
+
+    Csq->CsqReleaseLock(Csq, irql);
+
+    return status;
+}
+
+
+PIRP
+IoCsqRemoveNextIrp(
+    _Inout_  PIO_CSQ Csq,
+    _In_opt_ PVOID   PeekContext
+)
+{
+    PIRP    irp = NULL;
+    KIRQL   irql = PASSIVE_LEVEL;
+
+    Csq->CsqAcquireLock(Csq, &irql);
+
+    irp = Csq->CsqPeekNextIrp(Csq, NULL, PeekContext);
+    while (irp != NULL)
+    {
+        if (IoSetCancelRoutine(irp, NULL) != NULL)
+        {
+            Csq->CsqRemoveIrp(Csq, irp);
+            irp->Tail.Overlay.DriverContext[3] = NULL;
+            break;
+        }
+
+        // being cancelled; its cancel routine takes it out once the lock is free
+        irp = Csq->CsqPeekNextIrp(Csq, irp, PeekContext);
+    }
+
+    Csq->CsqReleaseLock(Csq, irql);
+
+    return irp;
+}
\ No newline at end of file
@@ -0,0 +1,933 @@
+#pragma once
+
+//
+// User mode stand-ins for the part of the WDK the driver data structures
+// (ListOp, Pool, Pin, Process, Ring, EventQueue, IrpQueue) use, so they build
+// and run on a Linux host.
+// Only what those modules need is here; anything they start using has to be
+// added. Semantics follow the WDK documentation, not its implementation:
+// spin locks spin, IRQLs don't exist, pool is malloc, MDLs lock nothing and
+// completed IRPs go to a host callback instead of an I/O manager.
+// What can't be inline lives in KmShim.c
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+
+
+/* Types */
+
+#define VOID                    void
+
+typedef char                    CHAR, *PCHAR;
+typedef unsigned char           UCHAR, *PUCHAR;
+typedef UCHAR                   BOOLEAN, *PBOOLEAN;
+typedef short                   SHORT, *PSHORT;
+typedef unsigned short          USHORT, *PUSHORT;
+typedef uint16_t                WCHAR, *PWCHAR;
+typedef int32_t                 LONG, *PLONG;
+typedef uint32_t                ULONG, *PULONG;
+typedef int64_t                 LONG64, *PLONG64;
+typedef int64_t                 LONGLONG, *PLONGLONG;
+typedef uint64_t                ULONG64, *PULONG64;
+typedef uint64_t                ULONGLONG, *PULONGLONG;
+typedef intptr_t                LONG_PTR, *PLONG_PTR;
+typedef uintptr_t               ULONG_PTR, *PULONG_PTR;
+typedef uintptr_t               SIZE_T, *PSIZE_T;
+typedef void                    *PVOID;
+typedef void                    *HANDLE, **PHANDLE;
+typedef int32_t                 NTSTATUS;
+typedef UCHAR                   KIRQL, *PKIRQL;
+typedef CHAR                    KPROCESSOR_MODE;
+
+typedef union _LARGE_INTEGER
+{
+    struct
+    {
+        ULONG   LowPart;
+        LONG    HighPart;
+    };
+    LONGLONG    QuadPart;
+
+}LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _UNICODE_STRING
+{
+    USHORT  Length;
+    USHORT  MaximumLength;
+    PWCHAR  Buffer;
+
+}UNICODE_STRING, *PUNICODE_STRING;
+
+struct _DRIVER_OBJECT;
+struct _DEVICE_OBJECT;
+struct _IRP;
+
+typedef struct _DRIVER_OBJECT   *PDRIVER_OBJECT;
+typedef struct _DEVICE_OBJECT   *PDEVICE_OBJECT;
+typedef struct _IRP             *PIRP;
+
+typedef NTSTATUS DRIVER_INITIALIZE(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath);
+typedef VOID DRIVER_UNLOAD(PDRIVER_OBJECT DriverObject);
+typedef NTSTATUS DRIVER_DISPATCH(struct _DEVICE_OBJECT *DeviceObject, struct _IRP *Irp);
+
+
+/* Compiler */
+
+#define TRUE                    1
+#define FALSE                   0
+
+#define MAXULONG                0xFFFFFFFFUL
+
+#define min(a, b)               (((a) < (b)) ? (a) : (b))
+#define max(a, b)               (((a) > (b)) ? (a) : (b))
+
+#define FORCEINLINE             static inline
+#define FASTCALL
+#define DECLSPEC_CACHEALIGN     __attribute__((aligned(64)))
+#define DECLSPEC_ALIGN(x)       __attribute__((aligned(x)))
+#define ANYSIZE_ARRAY           1
+
+#define C_ASSERT(e)             _Static_assert(e, #e)
+#define ASSERT(e)               assert(e)
+#define UNREFERENCED_PARAMETER(P)   ((void)(P))
+
+#define FIELD_OFFSET(Type, Field)   ((LONG)offsetof(Type, Field))
+#define CONTAINING_RECORD(Address, Type, Field) \
+    ((Type *)((PUCHAR)(Address) - offsetof(Type, Field)))
+
+// SEH: the shimmed calls never raise, so a handler is dead code; __leave
+// jumps to the __finally block (one __try / __finally per function)
+#define __try                   if (1)
+#define __except(Filter)        else
+#define __leave                 goto __seh_leave
+#define __finally               __seh_leave: __attribute__((unused));
+#define GetExceptionCode()      ((NTSTATUS)0)
+#define EXCEPTION_EXECUTE_HANDLER   1
+
+// SAL
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#define _Out_writes_to_(Size, Count)
+#define _Use_decl_annotations_
+#define _Dispatch_type_(Major)
+#define _IRQL_requires_(Irql)
+#define _IRQL_requires_max_(Irql)
+
+
+/* Status */
+
+#define NT_SUCCESS(Status)              (((NTSTATUS)(Status)) >= 0)
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_PENDING                  ((NTSTATUS)0x00000103L)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_QUOTA_EXCEEDED           ((NTSTATUS)0xC0000044L)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_CANCELLED                ((NTSTATUS)0xC0000120L)
+#define STATUS_NOT_FOUND                ((NTSTATUS)0xC0000225L)
+
+
+/* IOCTL codes, for Public.h */
+
+#define FILE_DEVICE_UNKNOWN     0x00000022
+#define METHOD_BUFFERED         0
+#define METHOD_IN_DIRECT        1
+#define METHOD_OUT_DIRECT       2
+#define METHOD_NEITHER          3
+#define FILE_ANY_ACCESS         0
+#define FILE_READ_ACCESS        1
+#define FILE_WRITE_ACCESS       2
+
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+    (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+
+/* Memory */
+
+#define PAGE_SIZE               0x1000
+#define PAGE_SHIFT              12
+#define BYTE_OFFSET(Va)         ((ULONG)((ULONG_PTR)(Va) & (PAGE_SIZE - 1)))
+#define ADDRESS_AND_SIZE_TO_SPAN_PAGES(Va, Size) \
+    ((ULONG)((((ULONG_PTR)(Size)) >> PAGE_SHIFT) + ((BYTE_OFFSET(Va) + BYTE_OFFSET(Size) + PAGE_SIZE - 1) >> PAGE_SHIFT)))
+
+#define RtlZeroMemory(Destination, Length)          memset((Destination), 0, (Length))
+#define RtlCopyMemory(Destination, Source, Length)  memcpy((Destination), (Source), (Length))
+
+typedef enum _POOL_TYPE
+{
+    NonPagedPool = 0,
+    PagedPool = 1,
+    NonPagedPoolCacheAligned = 4,
+
+}POOL_TYPE;
+
+FORCEINLINE
+PVOID
+ExAllocatePoolWithTag(
+    _In_ POOL_TYPE PoolType,
+    _In_ SIZE_T    NumberOfBytes,
+    _In_ ULONG     Tag
+)
+{
+    UNREFERENCED_PARAMETER(Tag);
+
+    if (PoolType == NonPagedPoolCacheAligned)
+    {
+        return aligned_alloc(64, (NumberOfBytes + 63) & ~(SIZE_T)63);
+    }
+
+    // the real pool is 16 byte aligned, SLIST entries depend on it
+    return aligned_alloc(16, (NumberOfBytes + 15) & ~(SIZE_T)15);
+}
+
+FORCEINLINE
+VOID
+ExFreePoolWithTag(
+    _In_ PVOID P,
+    _In_ ULONG Tag
+)
+{
+    UNREFERENCED_PARAMETER(Tag);
+
+    free(P);
+}
+
+#define ExFreePool(P)           free(P)
+
+
+/* MDL; nothing is probed or locked, only the bookkeeping is real */
+
+typedef enum _LOCK_OPERATION
+{
+    IoReadAccess,
+    IoWriteAccess,
+    IoModifyAccess
+
+}LOCK_OPERATION;
+
+#define KernelMode              0
+#define UserMode                1
+
+typedef struct _MDL
+{
+    struct _MDL *Next;
+    PVOID       StartVa;
+    ULONG       ByteCount;
+    ULONG       ByteOffset;
+
+}MDL, *PMDL;
+
+FORCEINLINE
+PMDL
+IoAllocateMdl(
+    _In_opt_ PVOID   VirtualAddress,
+    _In_     ULONG   Length,
+    _In_     BOOLEAN SecondaryBuffer,
+    _In_     BOOLEAN ChargeQuota,
+    _In_opt_ PIRP    Irp
+)
+{
+    PMDL mdl = (PMDL)calloc(1, sizeof(MDL));
+
+    UNREFERENCED_PARAMETER(SecondaryBuffer);
+    UNREFERENCED_PARAMETER(ChargeQuota);
+    UNREFERENCED_PARAMETER(Irp);
+
+    if (mdl != NULL)
+    {
+        mdl->StartVa = (PVOID)((ULONG_PTR)VirtualAddress & ~(ULONG_PTR)(PAGE_SIZE - 1));
+        mdl->ByteOffset = BYTE_OFFSET(VirtualAddress);
+        mdl->ByteCount = Length;
+    }
+
+    return mdl;
+}
+
+#define IoFreeMdl(Mdl)                                  free(Mdl)
+#define MmProbeAndLockPages(Mdl, AccessMode, Operation) ((void)(Mdl), (void)(AccessMode), (void)(Operation))
+#define MmUnlockPages(Mdl)                              ((void)(Mdl))
+
+
+/* Interlocked */
+
+#define InterlockedIncrement(Addend)        __atomic_add_fetch((Addend), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(Addend)        __atomic_sub_fetch((Addend), 1, __ATOMIC_SEQ_CST)
+#define InterlockedIncrement64(Addend)      __atomic_add_fetch((Addend), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement64(Addend)      __atomic_sub_fetch((Addend), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(Addend, Value)   __atomic_fetch_add((Addend), (Value), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd64(Addend, Value) __atomic_fetch_add((Addend), (Value), __ATOMIC_SEQ_CST)
+#define InterlockedExchange(Target, Value)      __atomic_exchange_n((Target), (Value), __ATOMIC_SEQ_CST)
+#define InterlockedExchange64(Target, Value)    __atomic_exchange_n((Target), (Value), __ATOMIC_SEQ_CST)
+
+FORCEINLINE
+LONG
+InterlockedCompareExchange(
+    _Inout_ volatile LONG *Destination,
+    _In_    LONG          Exchange,
+    _In_    LONG          Comperand
+)
+{
+    __atomic_compare_exchange_n(Destination, &Comperand, Exchange, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+    return Comperand;
+}
+
+FORCEINLINE
+LONG64
+InterlockedCompareExchange64(
+    _Inout_ volatile LONG64 *Destination,
+    _In_    LONG64          Exchange,
+    _In_    LONG64          Comperand
+)
+{
+    __atomic_compare_exchange_n(Destination, &Comperand, Exchange, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+    return Comperand;
+}
+
+#define ReadNoFence(Source)             __atomic_load_n((Source), __ATOMIC_RELAXED)
+#define ReadNoFence64(Source)           __atomic_load_n((Source), __ATOMIC_RELAXED)
+#define ReadAcquire64(Source)           __atomic_load_n((Source), __ATOMIC_ACQUIRE)
+#define WriteRelease64(Destination, Value)  __atomic_store_n((Destination), (Value), __ATOMIC_RELEASE)
+
+FORCEINLINE
+VOID
+YieldProcessor(
+    VOID
+)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+
+/* IRQL, there is only one */
+
+#define PASSIVE_LEVEL           0
+#define APC_LEVEL               1
+#define DISPATCH_LEVEL          2
+
+#define KeGetCurrentIrql()      ((KIRQL)PASSIVE_LEVEL)
+#define KeRaiseIrql(NewIrql, OldIrql)   (*(OldIrql) = (KIRQL)PASSIVE_LEVEL, (void)(NewIrql))
+#define KeLowerIrql(NewIrql)            ((void)(NewIrql))
+
+
+/* Processors */
+
+#define ALL_PROCESSOR_GROUPS    0xFFFF
+
+//
+// Host only: a benchmark can make the modules see Count processors
+// (0: the real ones) and put a thread on one of them (-1: wherever it runs)
+//
+extern ULONG            gShimProcessorCount;
+extern __thread LONG    gShimCurrentProcessor;
+
+VOID
+ShimSetProcessorCount(
+    _In_ ULONG Count
+);
+
+VOID
+ShimSetCurrentProcessor(
+    _In_ LONG Number
+);
+
+typedef struct _PROCESSOR_NUMBER
+{
+    USHORT  Group;
+    UCHAR   Number;
+    UCHAR   Reserved;
+
+}PROCESSOR_NUMBER, *PPROCESSOR_NUMBER;
+
+FORCEINLINE
+ULONG
+KeGetCurrentProcessorNumberEx(
+    _Out_ PPROCESSOR_NUMBER ProcNumber
+)
+{
+    int cpu = (gShimCurrentProcessor >= 0) ? gShimCurrentProcessor : sched_getcpu();
+
+    if (ProcNumber != NULL)
+    {
+        RtlZeroMemory(ProcNumber, sizeof(*ProcNumber));
+        ProcNumber->Number = (UCHAR)((cpu < 0) ? 0 : cpu);
+    }
+
+    return (ULONG)((cpu < 0) ? 0 : cpu);
+}
+
+FORCEINLINE
+ULONG
+KeQueryMaximumProcessorCountEx(
+    _In_ USHORT GroupNumber
+)
+{
+    long count = (gShimProcessorCount != 0) ? (long)gShimProcessorCount : sysconf(_SC_NPROCESSORS_CONF);
+
+    UNREFERENCED_PARAMETER(GroupNumber);
+
+    return (ULONG)((count < 1) ? 1 : count);
+}
+
+FORCEINLINE
+LARGE_INTEGER
+KeQueryPerformanceCounter(
+    _Out_ PLARGE_INTEGER PerformanceFrequency
+)
+{
+    struct timespec now;
+    LARGE_INTEGER   counter;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    counter.QuadPart = (LONGLONG)now.tv_sec * 1000000000LL + now.tv_nsec;
+    if (PerformanceFrequency != NULL)
+    {
+        PerformanceFrequency->QuadPart = 1000000000LL;
+    }
+
+    return counter;
+}
+
+
+/* Spin locks */
+
+typedef ULONG_PTR           KSPIN_LOCK, *PKSPIN_LOCK;
+
+#define SHIM_SPIN_YIELD     128     // Spins before a waiter gives its CPU up
+
+//
+// A holder can't be preempted at DISPATCH_LEVEL, a host thread can: rather
+// than spin out its time slice while the holder waits for a CPU, a waiter
+// yields once it spun for a while
+//
+FORCEINLINE
+VOID
+ShimSpinWait(
+    _Inout_ PULONG Spins
+)
+{
+    if (++*Spins % SHIM_SPIN_YIELD == 0)
+    {
+        sched_yield();
+    }
+    else
+    {
+        YieldProcessor();
+    }
+}
+
+FORCEINLINE
+VOID
+KeInitializeSpinLock(
+    _Out_ PKSPIN_LOCK SpinLock
+)
+{
+    *SpinLock = 0;
+}
+
+FORCEINLINE
+KIRQL
+KeAcquireSpinLockRaiseToDpc(
+    _Inout_ PKSPIN_LOCK SpinLock
+)
+{
+    ULONG spins = 0;
+
+    while (__atomic_exchange_n(SpinLock, 1, __ATOMIC_ACQUIRE) != 0)
+    {
+        while (__atomic_load_n(SpinLock, __ATOMIC_RELAXED) != 0)
+        {
+            ShimSpinWait(&spins);
+        }
+    }
+
+    return PASSIVE_LEVEL;
+}
+
+FORCEINLINE
+VOID
+KeReleaseSpinLock(
+    _Inout_ PKSPIN_LOCK SpinLock,
+    _In_    KIRQL       NewIrql
+)
+{
+    UNREFERENCED_PARAMETER(NewIrql);
+
+    __atomic_store_n(SpinLock, 0, __ATOMIC_RELEASE);
+}
+
+#define KeAcquireSpinLock(SpinLock, OldIrql)    (*(OldIrql) = KeAcquireSpinLockRaiseToDpc(SpinLock))
+
+//
+// Reader / writer spin lock; a waiting writer holds off new readers
+//
+typedef volatile LONG       EX_SPIN_LOCK, *PEX_SPIN_LOCK;
+
+#define EX_SPIN_LOCK_WRITER ((LONG)0x80000000)
+
+FORCEINLINE
+KIRQL
+ExAcquireSpinLockShared(
+    _Inout_ PEX_SPIN_LOCK SpinLock
+)
+{
+    LONG  value = 0;
+    ULONG spins = 0;
+
+    for (;;)
+    {
+        value = __atomic_load_n(SpinLock, __ATOMIC_RELAXED);
+        if ((value & EX_SPIN_LOCK_WRITER) == 0 &&
+            __atomic_compare_exchange_n(SpinLock, &value, value + 1, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            return PASSIVE_LEVEL;
+        }
+        ShimSpinWait(&spins);
+    }
+}
+
+FORCEINLINE
+VOID
+ExReleaseSpinLockShared(
+    _Inout_ PEX_SPIN_LOCK SpinLock,
+    _In_    KIRQL         OldIrql
+)
+{
+    UNREFERENCED_PARAMETER(OldIrql);
+
+    __atomic_sub_fetch(SpinLock, 1, __ATOMIC_RELEASE);
+}
+
+FORCEINLINE
+KIRQL
+ExAcquireSpinLockExclusive(
+    _Inout_ PEX_SPIN_LOCK SpinLock
+)
+{
+    LONG  value = 0;
+    ULONG spins = 0;
+
+    for (;;)
+    {
+        value = __atomic_load_n(SpinLock, __ATOMIC_RELAXED);
+        if ((value & EX_SPIN_LOCK_WRITER) == 0 &&
+            __atomic_compare_exchange_n(SpinLock, &value, value | EX_SPIN_LOCK_WRITER, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+        ShimSpinWait(&spins);
+    }
+
+    // readers already in finish first
+    while ((__atomic_load_n(SpinLock, __ATOMIC_ACQUIRE) & ~EX_SPIN_LOCK_WRITER) != 0)
+    {
+        ShimSpinWait(&spins);
+    }
+
+    return PASSIVE_LEVEL;
+}
+
+FORCEINLINE
+VOID
+ExReleaseSpinLockExclusive(
+    _Inout_ PEX_SPIN_LOCK SpinLock,
+    _In_    KIRQL         OldIrql
+)
+{
+    UNREFERENCED_PARAMETER(OldIrql);
+
+    __atomic_store_n(SpinLock, 0, __ATOMIC_RELEASE);
+}
+
+
+/* Doubly linked lists, as in wdm.h */
+
+typedef struct _LIST_ENTRY
+{
+    struct _LIST_ENTRY *Flink;
+    struct _LIST_ENTRY *Blink;
+
+}LIST_ENTRY, *PLIST_ENTRY;
+
+FORCEINLINE
+VOID
+InitializeListHead(
+    _Out_ PLIST_ENTRY ListHead
+)
+{
+    ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+FORCEINLINE
+BOOLEAN
+IsListEmpty(
+    _In_ const LIST_ENTRY *ListHead
+)
+{
+    return (BOOLEAN)(ListHead->Flink == ListHead);
+}
+
+FORCEINLINE
+BOOLEAN
+RemoveEntryList(
+    _In_ PLIST_ENTRY Entry
+)
+{
+    PLIST_ENTRY flink = Entry->Flink;
+    PLIST_ENTRY blink = Entry->Blink;
+
+    blink->Flink = flink;
+    flink->Blink = blink;
+
+    return (BOOLEAN)(flink == blink);
+}
+
+FORCEINLINE
+PLIST_ENTRY
+RemoveHeadList(
+    _Inout_ PLIST_ENTRY ListHead
+)
+{
+    PLIST_ENTRY entry = ListHead->Flink;
+    PLIST_ENTRY flink = entry->Flink;
+
+    ListHead->Flink = flink;
+    flink->Blink = ListHead;
+
+    return entry;
+}
+
+FORCEINLINE
+PLIST_ENTRY
+RemoveTailList(
+    _Inout_ PLIST_ENTRY ListHead
+)
+{
+    PLIST_ENTRY entry = ListHead->Blink;
+    PLIST_ENTRY blink = entry->Blink;
+
+    ListHead->Blink = blink;
+    blink->Flink = ListHead;
+
+    return entry;
+}
+
+FORCEINLINE
+VOID
+InsertHeadList(
+    _Inout_ PLIST_ENTRY ListHead,
+    _Out_   PLIST_ENTRY Entry
+)
+{
+    PLIST_ENTRY flink = ListHead->Flink;
+
+    Entry->Flink = flink;
+    Entry->Blink = ListHead;
+    flink->Blink = Entry;
+    ListHead->Flink = Entry;
+}
+
+FORCEINLINE
+VOID
+InsertTailList(
+    _Inout_ PLIST_ENTRY ListHead,
+    _Out_   PLIST_ENTRY Entry
+)
+{
+    PLIST_ENTRY blink = ListHead->Blink;
+
+    Entry->Flink = ListHead;
+    Entry->Blink = blink;
+    blink->Flink = Entry;
+    ListHead->Blink = Entry;
+}
+
+
+/* Interlocked singly linked lists; depth and an ABA sequence share the CAS with the head */
+
+typedef struct _SLIST_ENTRY
+{
+    struct _SLIST_ENTRY *Next;
+
+}SLIST_ENTRY, *PSLIST_ENTRY;
+
+typedef union __attribute__((aligned(16))) _SLIST_HEADER
+{
+    struct
+    {
+        PSLIST_ENTRY    Next;
+        ULONG64         Depth : 16;
+        ULONG64         Sequence : 48;
+    };
+    unsigned __int128   Value;
+
+}SLIST_HEADER, *PSLIST_HEADER;
+
+FORCEINLINE
+VOID
+InitializeSListHead(
+    _Out_ PSLIST_HEADER SListHead
+)
+{
+    SListHead->Value = 0;
+}
+
+FORCEINLINE
+USHORT
+QueryDepthSList(
+    _In_ PSLIST_HEADER SListHead
+)
+{
+    SLIST_HEADER head;
+
+    head.Value = __atomic_load_n(&SListHead->Value, __ATOMIC_RELAXED);
+
+    return (USHORT)head.Depth;
+}
+
+FORCEINLINE
+PSLIST_ENTRY
+InterlockedPushEntrySList(
+    _Inout_ PSLIST_HEADER SListHead,
+    _Inout_ PSLIST_ENTRY  SListEntry
+)
+{
+    SLIST_HEADER old;
+    SLIST_HEADER new;
+
+    old.Value = __atomic_load_n(&SListHead->Value, __ATOMIC_RELAXED);
+    do
+    {
+        SListEntry->Next = old.Next;
+        new.Next = SListEntry;
+        new.Depth = old.Depth + 1;
+        new.Sequence = old.Sequence + 1;
+    } while (!__atomic_compare_exchange_n(&SListHead->Value, &old.Value, new.Value, FALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    return old.Next;
+}
+
+FORCEINLINE
+PSLIST_ENTRY
+InterlockedPushListSListEx(
+    _Inout_ PSLIST_HEADER SListHead,
+    _Inout_ PSLIST_ENTRY  List,
+    _Inout_ PSLIST_ENTRY  ListEnd,
+    _In_    ULONG         Count
+)
+{
+    SLIST_HEADER old;
+    SLIST_HEADER new;
+
+    old.Value = __atomic_load_n(&SListHead->Value, __ATOMIC_RELAXED);
+    do
+    {
+        ListEnd->Next = old.Next;
+        new.Next = List;
+        new.Depth = old.Depth + Count;
+        new.Sequence = old.Sequence + 1;
+    } while (!__atomic_compare_exchange_n(&SListHead->Value, &old.Value, new.Value, FALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    return old.Next;
+}
+
+FORCEINLINE
+PSLIST_ENTRY
+InterlockedPopEntrySList(
+    _Inout_ PSLIST_HEADER SListHead
+)
+{
+    SLIST_HEADER old;
+    SLIST_HEADER new;
+
+    old.Value = __atomic_load_n(&SListHead->Value, __ATOMIC_ACQUIRE);
+    do
+    {
+        if (old.Next == NULL)
+        {
+            return NULL;
+        }
+        new.Next = old.Next->Next;
+        new.Depth = old.Depth - 1;
+        new.Sequence = old.Sequence + 1;
+    } while (!__atomic_compare_exchange_n(&SListHead->Value, &old.Value, new.Value, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    return old.Next;
+}
+
+
+/* IRPs and cancel safe queues, as much as IrpQueue uses */
+
+#define IO_NO_INCREMENT         0
+
+typedef struct _IO_STATUS_BLOCK
+{
+    union
+    {
+        NTSTATUS    Status;
+        PVOID       Pointer;
+    };
+    ULONG_PTR       Information;
+
+}IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+typedef VOID DRIVER_CANCEL(struct _DEVICE_OBJECT *DeviceObject, struct _IRP *Irp);
+typedef DRIVER_CANCEL *PDRIVER_CANCEL;
+
+//
+// Host only: IoCompleteRequest hands the IRP to ShimCompletion, where the
+// I/O manager would complete it to the requester
+//
+typedef VOID IO_SHIM_COMPLETION(struct _IRP *Irp);
+
+typedef struct _IRP
+{
+    IO_STATUS_BLOCK                 IoStatus;
+    union
+    {
+        PVOID                       SystemBuffer;
+    }AssociatedIrp;
+    BOOLEAN                         PendingReturned;
+    volatile BOOLEAN                Cancel;
+    KIRQL                           CancelIrql;
+    PDRIVER_CANCEL volatile         CancelRoutine;
+    union
+    {
+        struct
+        {
+            PVOID                   DriverContext[4];
+            LIST_ENTRY              ListEntry;
+        }Overlay;
+    }Tail;
+
+    IO_SHIM_COMPLETION              *ShimCompletion;
+    PVOID                           ShimContext;
+
+}IRP;
+
+#define IoMarkIrpPending(Irp)   ((Irp)->PendingReturned = TRUE)
+
+FORCEINLINE
+PDRIVER_CANCEL
+IoSetCancelRoutine(
+    _Inout_  PIRP           Irp,
+    _In_opt_ PDRIVER_CANCEL CancelRoutine
+)
+{
+    return __atomic_exchange_n(&Irp->CancelRoutine, CancelRoutine, __ATOMIC_SEQ_CST);
+}
+
+FORCEINLINE
+VOID
+IoCompleteRequest(
+    _Inout_ PIRP   Irp,
+    _In_    CHAR   PriorityBoost
+)
+{
+    UNREFERENCED_PARAMETER(PriorityBoost);
+
+    // completing an IRP that is still cancelable is a driver bug
+    ASSERT(Irp->CancelRoutine == NULL);
+
+    if (Irp->ShimCompletion != NULL)
+    {
+        Irp->ShimCompletion(Irp);
+    }
+}
+
+VOID
+IoAcquireCancelSpinLock(
+    _Out_ PKIRQL Irql
+);
+
+VOID
+IoReleaseCancelSpinLock(
+    _In_ KIRQL Irql
+);
+
+//
+// Sets Irp->Cancel and runs its cancel routine if it has one (the routine
+// releases the cancel spin lock)
+//
+BOOLEAN
+IoCancelIrp(
+    _Inout_ PIRP Irp
+);
+
+typedef struct _IO_CSQ IO_CSQ, *PIO_CSQ;
+
+typedef struct _IO_CSQ_IRP_CONTEXT
+{
+    ULONG   Type;
+    PIRP    Irp;
+    PIO_CSQ Csq;
+
+}IO_CSQ_IRP_CONTEXT, *PIO_CSQ_IRP_CONTEXT;
+
+typedef NTSTATUS IO_CSQ_INSERT_IRP_EX(PIO_CSQ Csq, PIRP Irp, PVOID InsertContext);
+typedef VOID IO_CSQ_REMOVE_IRP(PIO_CSQ Csq, PIRP Irp);
+typedef PIRP IO_CSQ_PEEK_NEXT_IRP(PIO_CSQ Csq, PIRP Irp, PVOID PeekContext);
+typedef VOID IO_CSQ_ACQUIRE_LOCK(PIO_CSQ Csq, PKIRQL Irql);
+typedef VOID IO_CSQ_RELEASE_LOCK(PIO_CSQ Csq, KIRQL Irql);
+typedef VOID IO_CSQ_COMPLETE_CANCELED_IRP(PIO_CSQ Csq, PIRP Irp);
+
+typedef IO_CSQ_INSERT_IRP_EX            *PIO_CSQ_INSERT_IRP_EX;
+typedef IO_CSQ_REMOVE_IRP               *PIO_CSQ_REMOVE_IRP;
+typedef IO_CSQ_PEEK_NEXT_IRP            *PIO_CSQ_PEEK_NEXT_IRP;
+typedef IO_CSQ_ACQUIRE_LOCK             *PIO_CSQ_ACQUIRE_LOCK;
+typedef IO_CSQ_RELEASE_LOCK             *PIO_CSQ_RELEASE_LOCK;
+typedef IO_CSQ_COMPLETE_CANCELED_IRP    *PIO_CSQ_COMPLETE_CANCELED_IRP;
+
+struct _IO_CSQ
+{
+    ULONG                           Type;
+    PIO_CSQ_INSERT_IRP_EX           CsqInsertIrp;
+    PIO_CSQ_REMOVE_IRP              CsqRemoveIrp;
+    PIO_CSQ_PEEK_NEXT_IRP           CsqPeekNextIrp;
+    PIO_CSQ_ACQUIRE_LOCK            CsqAcquireLock;
+    PIO_CSQ_RELEASE_LOCK            CsqReleaseLock;
+    PIO_CSQ_COMPLETE_CANCELED_IRP   CsqCompleteCanceledIrp;
+    PVOID                           ReservePointer;
+
+};
+
+NTSTATUS
+IoCsqInitializeEx(
+    _Out_ PIO_CSQ                       Csq,
+    _In_  PIO_CSQ_INSERT_IRP_EX         CsqInsertIrp,
+    _In_  PIO_CSQ_REMOVE_IRP            CsqRemoveIrp,
+    _In_  PIO_CSQ_PEEK_NEXT_IRP         CsqPeekNextIrp,
+    _In_  PIO_CSQ_ACQUIRE_LOCK          CsqAcquireLock,
+    _In_  PIO_CSQ_RELEASE_LOCK          CsqReleaseLock,
+    _In_  PIO_CSQ_COMPLETE_CANCELED_IRP CsqCompleteCanceledIrp
+);
+
+//
+// Context (an IO_CSQ_IRP_CONTEXT for IoCsqRemoveIrp) is not supported, it must be NULL
+//
+NTSTATUS
+IoCsqInsertIrpEx(
+    _Inout_  PIO_CSQ             Csq,
+    _Inout_  PIRP                Irp,
+    _In_opt_ PIO_CSQ_IRP_CONTEXT Context,
+    _In_opt_ PVOID               InsertContext
+);
+
+PIRP
+IoCsqRemoveNextIrp(
+    _Inout_  PIO_CSQ Csq,
+    _In_opt_ PVOID   PeekContext
+);
\ No newline at end of file
@@ -0,0 +1,4 @@
+#pragma once
+
+// WDK header, see KmShim.h
+#include "KmShim.h"
\ No newline at end of file
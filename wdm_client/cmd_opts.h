@@ -1,9 +1,25 @@
 #pragma once
 
-#define CMD_MAX_ARGS     5
+#define CMD_MAX_ARGS     12
 #define CMD_DELIMITER    L" \n"    // Space delimiter
 
 #define CMD_OPT_EXIT     L"exit"   // Exit command
 #define CMD_OPT_HELP     L"help"   // Help command
-#define CMD_OPT_DUMP     L"dump"   // Dump EPROCESS structure 
+#define CMD_OPT_DUMP     L"dump"   // Dump process memory to a minidump
+#define CMD_OPT_STATS    L"stats"  // Driver queue / pool counters
+#define CMD_OPT_POLICY   L"policy" // Driver queue overflow policy
+#define CMD_OPT_MERGE    L"merge"  // DMPZ (delta) file to plain minidump
+#define CMD_OPT_READ     L"read"   // Process memory out of a dump, by address
+#define CMD_OPT_SWEEP    L"sweep"  // Dump every process running an image, one driver round trip
+#define CMD_SWEEP_ALL    L"*"      // sweep: any image
+
+#define CMD_DUMP_COMPRESS   L"-z"    // dump option: compressed DMPZ container
+#define CMD_DUMP_INCREMENTAL L"-i"   // dump option: -i <base.dmpz>, delta against an earlier dump
+#define CMD_DUMP_LIVE       L"-l"    // dump option: -l <ms>, dump a clone, warn when the freeze took longer (0: never)
+#define CMD_DUMP_BUFFER     L"-b"    // dump option: -b <KB>, memory buffer per dump thread
+#define CMD_DUMP_KERNEL     L"-k"    // dump option: read memory through the driver
+
+#define CMD_POLICY_NEWEST   L"newest"
+#define CMD_POLICY_OLDEST   L"oldest"
+#define CMD_POLICY_COALESCE L"coalesce"
 
@@ -1,6 +1,15 @@
 #include "comm.h"
 
 extern HANDLE gTerminateThreadEvent;
+extern PSHARED_RING gSharedRing;
+extern HANDLE gSharedRingDoorbell;
+extern LARGE_INTEGER gQpcFrequency;
+
+static
+DWORD
+SharedRingWatch(
+    VOID
+);
 
 VOID
 SendExitToDrv(
@@ -25,38 +34,307 @@ SendExitToDrv(
 BOOLEAN
 SendDumpToDrv(
     HANDLE Device,
-    PWCHAR Pid
+    DWORD  Pid
+)
+{
+    IOC_DUMP_BATCH batch = { 0 };
+
+    batch.Count = 1;
+    batch.Entries[0].ProcessId = Pid;
+
+    // a PID the driver does not track is still dumped, as before
+    return SendDumpBatchToDrv(Device, &batch);
+}
+
+BOOLEAN
+SendDumpBatchToDrv(
+    HANDLE          Device,
+    PIOC_DUMP_BATCH Batch
+)
+{
+    BOOL    bSuccess = FALSE;
+    DWORD   noBytesReturned = 0;
+    DWORD   size = (DWORD)IOC_DUMP_BATCH_SIZE(Batch->Count);
+
+    bSuccess = DeviceIoControl(
+        Device,                             // device to be queried
+        (DWORD)IOCTL_DUMP_PROCESS_BATCH,    // operation to perform
+        Batch, size,                        // input buffer
+        Batch, size,                        // output buffer, the same one
+        &noBytesReturned,                   // # bytes returned
+        NULL);                              // synchronous I/O
+    if (!bSuccess)
+    {
+        LOG_ERROR(GetLastError(), L"DeviceIoControl failed");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+QueryDriverStats(
+    HANDLE Device
+)
+{
+    static const PWCHAR policies[QueuePolicyMax] = { CMD_POLICY_NEWEST, CMD_POLICY_OLDEST, CMD_POLICY_COALESCE };
+    BOOL        bSuccess = FALSE;
+    DWORD       noBytesReturned = 0;
+    IOC_STATS   stats = { 0 };
+
+    bSuccess = DeviceIoControl(
+        Device,                             // device to be queried
+        (DWORD)IOCTL_QUERY_STATS,           // operation to perform
+        NULL, 0,                            // no input
+        &stats, sizeof(stats),              // output buffer
+        &noBytesReturned,                   // # bytes returned
+        NULL);                              // synchronous I/O
+    if (!bSuccess)
+    {
+        LOG_ERROR(GetLastError(), L"DeviceIoControl failed");
+        return FALSE;
+    }
+
+    LOG_INFO(L"queue: %u/%u high water:%u policy:%s",
+        stats.QueueDepth, stats.QueueCapacity, stats.QueueHighWater,
+        stats.QueuePolicy < QueuePolicyMax ? policies[stats.QueuePolicy] : L"?");
+    LOG_INFO(L"dropped newest:%I64d oldest:%I64d coalesced pairs:%I64d spilled:%I64d",
+        stats.DroppedNewest, stats.DroppedOldest, stats.Coalesced, stats.Spilled);
+    LOG_INFO(L"PROCESS_T pool hits:%I64d misses:%I64d outstanding:%I64d",
+        stats.PoolHits, stats.PoolMisses, stats.PoolOutstanding);
+    LOG_INFO(L"pinned: %I64d/%I64d KB high water:%I64d KB evictions:%I64d refused:%I64d",
+        stats.PinnedBytes >> 10, stats.PinnedLimit >> 10, stats.PinnedHighWater >> 10, stats.PinEvictions, stats.PinRefused);
+
+    return TRUE;
+}
+
+BOOLEAN
+SetQueuePolicy(
+    HANDLE Device,
+    PWCHAR Policy
 )
 {
     BOOL    bSuccess = FALSE;
     DWORD   noBytesReturned = 0;
-    WCHAR   inBuf[IOC_BUFFER_MAX_SIZE] = L"";
-    WCHAR   outBuf[IOC_BUFFER_MAX_SIZE] = L"";
+    ULONG   policy = 0;
+
+    if (!wcscmp(Policy, CMD_POLICY_NEWEST))
+    {
+        policy = QueuePolicyDropNewest;
+    }
+    else if (!wcscmp(Policy, CMD_POLICY_OLDEST))
+    {
+        policy = QueuePolicyDropOldest;
+    }
+    else if (!wcscmp(Policy, CMD_POLICY_COALESCE))
+    {
+        policy = QueuePolicyCoalesce;
+    }
+    else
+    {
+        LOG_WARN(L"unknown policy [%s]", Policy);
+        return FALSE;
+    }
+
+    bSuccess = DeviceIoControl(
+        Device,                             // device to be queried
+        (DWORD)IOCTL_SET_QUEUE_POLICY,      // operation to perform
+        &policy, sizeof(policy),            // input buffer
+        NULL, 0,                            // no output
+        &noBytesReturned,                   // # bytes returned
+        NULL);                              // synchronous I/O
+    if (!bSuccess)
+    {
+        LOG_ERROR(GetLastError(), L"DeviceIoControl failed");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+QueryDriverVersion(
+    HANDLE Device
+)
+{
+    BOOL                    bSuccess = FALSE;
+    DWORD                   noBytesReturned = 0;
+    PROC_INFO_VERSION_INFO  version = { 0 };
+
+    version.Version = PROC_INFO_VERSION;
+    version.RecordSize = sizeof(PROC_INFO);
+
+    bSuccess = DeviceIoControl(
+        Device,                             // device to be queried
+        (DWORD)IOCTL_QUERY_VERSION,         // operation to perform
+        &version, sizeof(version),          // what we speak
+        &version, sizeof(version),          // what the driver speaks
+        &noBytesReturned,                   // # bytes returned
+        NULL);                              // synchronous I/O
+    if (!bSuccess)
+    {
+        LOG_ERROR(GetLastError(), L"DeviceIoControl failed");
+        return FALSE;
+    }
+
+    if (version.Version != PROC_INFO_VERSION || version.RecordSize != sizeof(PROC_INFO))
+    {
+        LOG_ERROR(0, L"driver speaks PROC_INFO v%u (%u bytes), we need v%u (%u bytes)",
+            version.Version, version.RecordSize, PROC_INFO_VERSION, (DWORD)sizeof(PROC_INFO));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID
+ConsumeProcInfo(
+    _In_ const PROC_INFO *Info
+)
+{
+    LARGE_INTEGER now = { 0 };
+    LONGLONG      latencyUs = 0;
+
+    // driver and client read the same performance counter
+    QueryPerformanceCounter(&now);
+    latencyUs = ((now.QuadPart - Info->Timestamp) * 1000000) / gQpcFrequency.QuadPart;
+
+    DlvRecord(Info, latencyUs);
+
+    LOG_INFO(L"#%I64u %u %u (%I64d us, %u dropped)", Info->Sequence, Info->ProcessId, Info->Create, latencyUs, Info->Dropped);
+}
+
+BOOLEAN
+MapSharedRing(
+    HANDLE Device
+)
+{
+    BOOL                bSuccess = FALSE;
+    DWORD               noBytesReturned = 0;
+    SHARED_RING_MAP_IN  in = { 0 };
+    SHARED_RING_MAP_OUT out = { 0 };
+
+    gSharedRingDoorbell = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!gSharedRingDoorbell)
+    {
+        LOG_ERROR(GetLastError(), L"CreateEvent failed");
+        return FALSE;
+    }
+
+    in.Doorbell = (ULONG64)(ULONG_PTR)gSharedRingDoorbell;
 
-    swprintf_s(inBuf, IOC_BUFFER_MAX_SIZE, L"%s", Pid);
-    
     bSuccess = DeviceIoControl(
-        Device,                                        // device to be queried
-        (DWORD)IOCTL_DUMP_PROCESS,                     // operation to perform
-        inBuf, IOC_BUFFER_MAX_SIZE * sizeof(WCHAR),    // input buffer
-        outBuf, IOC_BUFFER_MAX_SIZE * sizeof(WCHAR),   // output buffer
-        &noBytesReturned,                              // # bytes returned
-        NULL);                                         // synchronous I/O        
+        Device,                             // device to be queried
+        (DWORD)IOCTL_MAP_SHARED_RING,       // operation to perform
+        &in, sizeof(in),                    // doorbell event
+        &out, sizeof(out),                  // ring address
+        &noBytesReturned,                   // # bytes returned
+        NULL);                              // synchronous I/O
     if (!bSuccess)
     {
         LOG_ERROR(GetLastError(), L"DeviceIoControl failed");
+        CloseHandle(gSharedRingDoorbell);
+        gSharedRingDoorbell = NULL;
         return FALSE;
     }
 
+    gSharedRing = (PSHARED_RING)(ULONG_PTR)out.Ring;
+    assert(gSharedRing->Capacity == SHR_CAPACITY);
+
     return TRUE;
 }
 
+VOID
+UnmapSharedRing(
+    HANDLE Device
+)
+{
+    BOOL bSuccess = FALSE;
+
+    if (gSharedRing == NULL)
+    {
+        return;
+    }
+
+    LOG_INFO(L"shared ring: %I64d events dropped by driver", gSharedRing->Dropped);
+
+    bSuccess = DeviceIoControl(
+        Device,                             // device to be queried
+        (DWORD)IOCTL_UNMAP_SHARED_RING,     // operation to perform
+        NULL, 0,                            // no input
+        NULL, 0,                            // no output
+        NULL,                               // # bytes returned
+        NULL);                              // synchronous I/O
+    if (!bSuccess)
+    {
+        LOG_ERROR(GetLastError(), L"DeviceIoControl failed");
+    }
+    gSharedRing = NULL;
+
+    CloseHandle(gSharedRingDoorbell);
+    gSharedRingDoorbell = NULL;
+}
+
+static
+DWORD
+SharedRingWatch(
+    VOID
+)
+{
+    PPROC_INFO  records = NULL;
+    ULONG       count = 0;
+    ULONG       i = 0;
+    HANDLE      events[2];
+    DWORD       waitRes = 0;
+
+    events[0] = gTerminateThreadEvent;
+    events[1] = gSharedRingDoorbell;
+
+    for EVER
+    {
+        // records are read in place, then handed back to the driver
+        records = ShrConsumerPeek(gSharedRing, &count);
+        if (count != 0)
+        {
+            for (i = 0; i < count; ++i)
+            {
+                ConsumeProcInfo(&records[i]);
+            }
+            ShrConsumerRelease(gSharedRing, count);
+            DlvRecordPending(ShrConsumerPending(gSharedRing));
+            continue;
+        }
+
+        // ring is empty, sleep until the driver rings the doorbell
+        if (!ShrConsumerPrepareWait(gSharedRing))
+        {
+            continue;
+        }
+
+        waitRes = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+        if (waitRes == WAIT_OBJECT_0)
+        {
+            // Terminate Event was triggered
+            break;
+        }
+        else if (waitRes != WAIT_OBJECT_0 + 1)
+        {
+            LOG_ERROR(GetLastError(), L"WaitForMultipleObjects failed. waitRes:%d", waitRes);
+            break;
+        }
+    }
+
+    return 0;
+}
+
 DWORD WINAPI
 NotificationWatch(
     LPVOID lpParam
 )
 {
-    PPROC_INFO              outBuf = NULL;
+    PPROC_INFO_BATCH        outBuf = NULL;
+    DWORD                   outBufSize = (DWORD)PROC_INFO_BATCH_SIZE(WDM_NOTIFY_BATCH_COUNT);
+    DWORD                   i = 0;
     PNOTIFICATION_CONTEXT   context = NULL;
     BOOL                    bSuccess = FALSE;
     HANDLE                  events[MAXIMUM_WAIT_OBJECTS];
@@ -66,12 +344,19 @@ NotificationWatch(
     assert(lpParam != NULL);
 
     context = (PNOTIFICATION_CONTEXT)lpParam;
+
+    if (gSharedRing != NULL)
+    {
+        // no IOCTLs in shared ring mode
+        return SharedRingWatch();
+    }
+
     events[0] = gTerminateThreadEvent;
     events[1] = context->Ovlp.hEvent;
 
     __try
     {
-        outBuf = (PPROC_INFO)malloc(sizeof(*outBuf));
+        outBuf = (PPROC_INFO_BATCH)malloc(outBufSize);
         if (outBuf == NULL)
         {
             LOG_ERROR(GetLastError(), L"malloc failed");
@@ -80,15 +365,15 @@ NotificationWatch(
 
         for EVER
         {
-            ZeroMemory(outBuf, sizeof(*outBuf));
+            outBuf->Count = 0;
 
             bSuccess = DeviceIoControl(
-                gDevice,                        // device to be queried
-                (DWORD)IOCTL_NOTIFY_CALLBACK,   // operation to perform
-                NULL, 0,                        // no input buffer
-                outBuf, sizeof(*outBuf),        // output buffer
-                NULL,                           // # bytes returned
-                &context->Ovlp);                // synchronous I/O        
+                gDevice,                            // device to be queried
+                (DWORD)IOCTL_NOTIFY_CALLBACK_BATCH, // operation to perform
+                NULL, 0,                            // no input buffer
+                outBuf, outBufSize,                 // output buffer
+                NULL,                               // # bytes returned
+                &context->Ovlp);                    // synchronous I/O        
             if (bSuccess)
             {
                 LOG_ERROR(0, L"DeviceIoControl shoud have returned ERROR_IO_PENDING");
@@ -127,7 +412,11 @@ NotificationWatch(
                 __leave;
             }
 
-            LOG_INFO(L"%p %u", outBuf->ProcessId, outBuf->Create);
+            for (i = 0; i < outBuf->Count; ++i)
+            {
+                ConsumeProcInfo(&outBuf->Records[i]);
+            }
+            DlvRecordPending(outBuf->Pending);
 
         } // <!> for EVER
     }
@@ -1,5 +1,6 @@
 #pragma once
 #include "main.h"
+#include "delivery.h"
 
 VOID
 SendExitToDrv(
@@ -9,7 +10,48 @@ SendExitToDrv(
 BOOLEAN
 SendDumpToDrv(
     HANDLE Device,
-    PWCHAR Pid
+    DWORD  Pid
+);
+
+//
+// One round trip for the whole batch; Batch->Entries[].Status says how each
+// PID went
+//
+BOOLEAN
+SendDumpBatchToDrv(
+    HANDLE          Device,
+    PIOC_DUMP_BATCH Batch
+);
+
+BOOLEAN
+QueryDriverStats(
+    HANDLE Device
+);
+
+BOOLEAN
+SetQueuePolicy(
+    HANDLE Device,
+    PWCHAR Policy
+);
+
+BOOLEAN
+QueryDriverVersion(
+    HANDLE Device
+);
+
+VOID
+ConsumeProcInfo(
+    _In_ const PROC_INFO *Info
+);
+
+BOOLEAN
+MapSharedRing(
+    HANDLE Device
+);
+
+VOID
+UnmapSharedRing(
+    HANDLE Device
 );
 
 DWORD WINAPI
@@ -0,0 +1,153 @@
+#include "delivery.h"
+
+extern LARGE_INTEGER gQpcFrequency;
+
+static DELIVERY_STATS gDelivery;
+
+
+static
+ULONG
+DlvBucket(
+    ULONG64 Value
+)
+{
+    ULONG msb = 0;
+
+    if (Value < DLV_SUB_BUCKETS)
+    {
+        return (ULONG)Value;
+    }
+
+    _BitScanReverse64(&msb, Value);
+
+    return (msb - DLV_SUB_BUCKET_BITS + 1) * DLV_SUB_BUCKETS + (ULONG)((Value >> (msb - DLV_SUB_BUCKET_BITS)) & (DLV_SUB_BUCKETS - 1));
+}
+
+static
+ULONG64
+DlvBucketUpperBound(
+    ULONG Bucket
+)
+{
+    ULONG shift = 0;
+
+    if (Bucket < DLV_SUB_BUCKETS)
+    {
+        return Bucket;
+    }
+
+    shift = Bucket / DLV_SUB_BUCKETS - 1;
+
+    return ((ULONG64)(DLV_SUB_BUCKETS + Bucket % DLV_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+static
+ULONG64
+DlvPercentile(
+    LONG64 Total,
+    ULONG  PerThousand
+)
+{
+    LONG64 target = 0;
+    LONG64 seen = 0;
+    ULONG  i = 0;
+
+    target = (Total * PerThousand + 999) / 1000;
+    for (i = 0; i < DLV_BUCKETS; ++i)
+    {
+        seen += gDelivery.Latency[i];
+        if (seen >= target)
+        {
+            return DlvBucketUpperBound(i);
+        }
+    }
+
+    return (ULONG64)gDelivery.MaxLatencyUs;
+}
+
+VOID
+DlvInit(
+    VOID
+)
+{
+    ZeroMemory(&gDelivery, sizeof(gDelivery));
+
+    QueryPerformanceCounter(&gDelivery.Start);
+    gDelivery.LastPrint = gDelivery.Start;
+}
+
+VOID
+DlvRecord(
+    _In_ const PROC_INFO *Info,
+    _In_ LONGLONG        LatencyUs
+)
+{
+    LONG64 max = 0;
+    LONG   dropped = 0;
+
+    if (LatencyUs < 0)
+    {
+        LatencyUs = 0;
+    }
+
+    InterlockedIncrement64(&gDelivery.Delivered);
+    InterlockedIncrement64(&gDelivery.Latency[DlvBucket((ULONG64)LatencyUs)]);
+
+    max = gDelivery.MaxLatencyUs;
+    while (LatencyUs > max && InterlockedCompareExchange64(&gDelivery.MaxLatencyUs, LatencyUs, max) != max)
+    {
+        max = gDelivery.MaxLatencyUs;
+    }
+
+    dropped = gDelivery.Dropped;
+    while ((LONG)Info->Dropped > dropped && InterlockedCompareExchange(&gDelivery.Dropped, (LONG)Info->Dropped, dropped) != dropped)
+    {
+        dropped = gDelivery.Dropped;
+    }
+}
+
+VOID
+DlvRecordPending(
+    _In_ ULONG Pending
+)
+{
+    LONG max = 0;
+
+    InterlockedExchange(&gDelivery.Pending, (LONG)Pending);
+
+    max = gDelivery.MaxPending;
+    while ((LONG)Pending > max && InterlockedCompareExchange(&gDelivery.MaxPending, (LONG)Pending, max) != max)
+    {
+        max = gDelivery.MaxPending;
+    }
+}
+
+VOID
+DlvPrint(
+    VOID
+)
+{
+    LARGE_INTEGER now = { 0 };
+    LONG64        delivered = 0;
+    double        totalSec = 0;
+    double        lastSec = 0;
+
+    QueryPerformanceCounter(&now);
+    delivered = gDelivery.Delivered;
+
+    totalSec = (double)(now.QuadPart - gDelivery.Start.QuadPart) / gQpcFrequency.QuadPart;
+    lastSec = (double)(now.QuadPart - gDelivery.LastPrint.QuadPart) / gQpcFrequency.QuadPart;
+
+    LOG_INFO(L"delivered:%I64d (%.0f/s overall, %.0f/s since last stats) dropped:%d",
+        delivered,
+        totalSec > 0 ? delivered / totalSec : 0,
+        lastSec > 0 ? (delivered - gDelivery.LastDelivered) / lastSec : 0,
+        gDelivery.Dropped);
+    LOG_INFO(L"latency us p50:%I64u p99:%I64u p999:%I64u max:%I64d",
+        DlvPercentile(delivered, 500), DlvPercentile(delivered, 990), DlvPercentile(delivered, 999),
+        gDelivery.MaxLatencyUs);
+    LOG_INFO(L"driver backlog:%d max:%d", gDelivery.Pending, gDelivery.MaxPending);
+
+    gDelivery.LastPrint = now;
+    gDelivery.LastDelivered = delivered;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+#include "main.h"
+
+//
+// Delivery latency histogram: values below DLV_SUB_BUCKETS get their own bucket,
+// above that every power of 2 is split in DLV_SUB_BUCKETS, so a bucket is at
+// most 1/DLV_SUB_BUCKETS wide relative to its value
+//
+#define DLV_SUB_BUCKET_BITS     3
+#define DLV_SUB_BUCKETS         (1 << DLV_SUB_BUCKET_BITS)
+#define DLV_BUCKETS             ((64 - DLV_SUB_BUCKET_BITS + 1) * DLV_SUB_BUCKETS)
+
+
+//
+// What the client has seen of the driver event stream; updated by every
+// notification thread, read by the "stats" command
+//
+typedef struct _DELIVERY_STATS
+{
+    volatile LONG64 Delivered;                  // PROC_INFO consumed
+    volatile LONG64 MaxLatencyUs;
+    volatile LONG64 Latency[DLV_BUCKETS];       // PROC_INFO count per latency bucket (us)
+    volatile LONG   Pending;                    // Driver backlog at the last delivery
+    volatile LONG   MaxPending;
+    volatile LONG   Dropped;                    // Highest PROC_INFO.Dropped seen
+    LARGE_INTEGER   Start;                      // QueryPerformanceCounter at DlvInit
+    LARGE_INTEGER   LastPrint;                  // ... at the previous DlvPrint
+    LONG64          LastDelivered;              // Delivered at the previous DlvPrint
+
+}DELIVERY_STATS, *PDELIVERY_STATS;
+
+
+VOID
+DlvInit(
+    VOID
+);
+
+//
+// Accounts one delivered record, LatencyUs after the driver stamped it
+//
+VOID
+DlvRecord(
+    _In_ const PROC_INFO *Info,
+    _In_ LONGLONG        LatencyUs
+);
+
+//
+// Records still queued in the driver after a delivery (batch Pending or shared ring depth)
+//
+VOID
+DlvRecordPending(
+    _In_ ULONG Pending
+);
+
+//
+// Prints throughput (overall and since the previous call), latency percentiles and backlog
+//
+VOID
+DlvPrint(
+    VOID
+);
\ No newline at end of file
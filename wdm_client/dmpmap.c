@@ -0,0 +1,533 @@
+#include "dmpmap.h"
+#include "dmpz.h"
+
+
+static
+int __cdecl
+DmmCompareRanges(
+    const void *Left,
+    const void *Right
+)
+{
+    const DMM_RANGE *l = (const DMM_RANGE *)Left;
+    const DMM_RANGE *r = (const DMM_RANGE *)Right;
+
+    return (l->Va > r->Va) - (l->Va < r->Va);
+}
+
+//
+// Maps the sidecar index if it was built from this very file and every
+// range in it lies inside the file, in ascending Va order; anything else
+// is rebuilt from the dump
+//
+static
+BOOLEAN
+DmmLoadIndex(
+    _Inout_ PDMM_READER                 Reader,
+    _In_    PCWSTR                      IndexName,
+    _In_    PBY_HANDLE_FILE_INFORMATION Info
+)
+{
+    PDMM_INDEX_HEADER   header = NULL;
+    PDMM_RANGE          ranges = NULL;
+    LARGE_INTEGER       size = { 0 };
+    ULONG64             i = 0;
+
+    Reader->IndexFile = CreateFile(IndexName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (Reader->IndexFile == INVALID_HANDLE_VALUE)
+    {
+        Reader->IndexFile = NULL;
+        return FALSE;
+    }
+
+    if (!GetFileSizeEx(Reader->IndexFile, &size) || (ULONG64)size.QuadPart < sizeof(DMM_INDEX_HEADER))
+    {
+        return FALSE;
+    }
+
+    Reader->IndexMapping = CreateFileMapping(Reader->IndexFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (Reader->IndexMapping == NULL)
+    {
+        return FALSE;
+    }
+
+    Reader->IndexView = (PBYTE)MapViewOfFile(Reader->IndexMapping, FILE_MAP_READ, 0, 0, 0);
+    if (Reader->IndexView == NULL)
+    {
+        return FALSE;
+    }
+
+    header = (PDMM_INDEX_HEADER)Reader->IndexView;
+    if (header->Signature != DMM_INDEX_SIGNATURE ||
+        header->Version != DMM_INDEX_VERSION ||
+        header->FileSize != Reader->Size ||
+        CompareFileTime(&header->LastWriteTime, &Info->ftLastWriteTime) != 0 ||
+        header->RangeCount > ((ULONG64)size.QuadPart - sizeof(DMM_INDEX_HEADER)) / sizeof(DMM_RANGE))
+    {
+        // stale, the dump was rewritten since
+        return FALSE;
+    }
+
+    // the sidecar is just another file, lookups must not read past the dump on its word
+    ranges = (PDMM_RANGE)(Reader->IndexView + sizeof(DMM_INDEX_HEADER));
+    for (i = 0; i < header->RangeCount; ++i)
+    {
+        if (ranges[i].FileOffset > Reader->Size ||
+            ranges[i].Size > Reader->Size - ranges[i].FileOffset ||
+            ranges[i].Va + ranges[i].Size < ranges[i].Va ||
+            (i != 0 && ranges[i].Va < ranges[i - 1].Va + ranges[i - 1].Size))
+        {
+            LOG_WARN(L"%s is corrupt at range %I64u, rebuilding it", IndexName, i);
+            return FALSE;
+        }
+    }
+
+    Reader->Ranges = ranges;
+    Reader->RangeCount = header->RangeCount;
+
+    return TRUE;
+}
+
+static
+VOID
+DmmUnloadIndex(
+    _Inout_ PDMM_READER Reader
+)
+{
+    if (Reader->IndexView != NULL)
+    {
+        UnmapViewOfFile(Reader->IndexView);
+        Reader->IndexView = NULL;
+        Reader->Ranges = NULL;
+        Reader->RangeCount = 0;
+    }
+    if (Reader->IndexMapping != NULL)
+    {
+        CloseHandle(Reader->IndexMapping);
+        Reader->IndexMapping = NULL;
+    }
+    if (Reader->IndexFile != NULL)
+    {
+        CloseHandle(Reader->IndexFile);
+        Reader->IndexFile = NULL;
+    }
+}
+
+//
+// Ranges out of the Memory64 list, sorted and merged; overlapping ranges
+// are refused, DmmLoadIndex would refuse the sidecar built from them
+//
+static
+BOOLEAN
+DmmBuildIndex(
+    _Inout_ PDMM_READER Reader
+)
+{
+    PMINIDUMP_HEADER        header = (PMINIDUMP_HEADER)Reader->View;
+    PMINIDUMP_DIRECTORY     dir = NULL;
+    PMINIDUMP_MEMORY64_LIST list = NULL;
+    ULONG64                 listRva = 0;
+    ULONG64                 fileOffset = 0;
+    ULONG64                 count = 0;
+    ULONG64                 i = 0;
+    DWORD                   s = 0;
+
+    if (Reader->Size < sizeof(MINIDUMP_HEADER) || header->Signature != MINIDUMP_SIGNATURE ||
+        header->StreamDirectoryRva + (ULONG64)header->NumberOfStreams * sizeof(MINIDUMP_DIRECTORY) > Reader->Size)
+    {
+        LOG_ERROR(0, L"no minidump header");
+        return FALSE;
+    }
+
+    dir = (PMINIDUMP_DIRECTORY)(Reader->View + header->StreamDirectoryRva);
+    for (s = 0; s < header->NumberOfStreams && dir[s].StreamType != Memory64ListStream; ++s);
+    if (s == header->NumberOfStreams ||
+        dir[s].Location.Rva + (ULONG64)FIELD_OFFSET(MINIDUMP_MEMORY64_LIST, MemoryRanges) > Reader->Size)
+    {
+        LOG_ERROR(0, L"no Memory64ListStream");
+        return FALSE;
+    }
+
+    listRva = dir[s].Location.Rva;
+    list = (PMINIDUMP_MEMORY64_LIST)(Reader->View + listRva);
+    if (list->NumberOfMemoryRanges >
+        (Reader->Size - (listRva + FIELD_OFFSET(MINIDUMP_MEMORY64_LIST, MemoryRanges))) / sizeof(MINIDUMP_MEMORY_DESCRIPTOR64))
+    {
+        LOG_ERROR(0, L"Memory64ListStream is truncated");
+        return FALSE;
+    }
+
+    Reader->Ranges = (PDMM_RANGE)malloc((size_t)list->NumberOfMemoryRanges * sizeof(DMM_RANGE));
+    if (Reader->Ranges == NULL && list->NumberOfMemoryRanges != 0)
+    {
+        LOG_ERROR(0, L"malloc failed");
+        return FALSE;
+    }
+
+    fileOffset = list->BaseRva;
+    for (i = 0; i < list->NumberOfMemoryRanges; ++i)
+    {
+        // compared before adding, a huge DataSize must not wrap fileOffset back into the file
+        if (fileOffset > Reader->Size || list->MemoryRanges[i].DataSize > Reader->Size - fileOffset)
+        {
+            LOG_ERROR(0, L"memory data is truncated");
+            return FALSE;
+        }
+        if (list->MemoryRanges[i].StartOfMemoryRange + list->MemoryRanges[i].DataSize < list->MemoryRanges[i].StartOfMemoryRange)
+        {
+            LOG_ERROR(0, L"memory range %I64u wraps the address space", i);
+            return FALSE;
+        }
+
+        Reader->Ranges[i].Va = list->MemoryRanges[i].StartOfMemoryRange;
+        Reader->Ranges[i].Size = list->MemoryRanges[i].DataSize;
+        Reader->Ranges[i].FileOffset = fileOffset;
+        fileOffset += list->MemoryRanges[i].DataSize;
+    }
+
+    // ours are already in order, other writers' may not be
+    qsort(Reader->Ranges, (size_t)list->NumberOfMemoryRanges, sizeof(DMM_RANGE), DmmCompareRanges);
+
+    // one range per run that is contiguous both in memory and in the file
+    for (i = 0; i < list->NumberOfMemoryRanges; ++i)
+    {
+        if (count != 0 &&
+            Reader->Ranges[count - 1].Va + Reader->Ranges[count - 1].Size == Reader->Ranges[i].Va &&
+            Reader->Ranges[count - 1].FileOffset + Reader->Ranges[count - 1].Size == Reader->Ranges[i].FileOffset)
+        {
+            Reader->Ranges[count - 1].Size += Reader->Ranges[i].Size;
+            continue;
+        }
+        if (count != 0 && Reader->Ranges[i].Va < Reader->Ranges[count - 1].Va + Reader->Ranges[count - 1].Size)
+        {
+            LOG_ERROR(0, L"memory range at 0x%I64x overlaps the one before", Reader->Ranges[i].Va);
+            return FALSE;
+        }
+        Reader->Ranges[count++] = Reader->Ranges[i];
+    }
+    Reader->RangeCount = count;
+
+    return TRUE;
+}
+
+//
+// Best effort, the next open just builds it again
+//
+static
+VOID
+DmmSaveIndex(
+    _In_ PDMM_READER                 Reader,
+    _In_ PCWSTR                      IndexName,
+    _In_ PBY_HANDLE_FILE_INFORMATION Info
+)
+{
+    DMM_INDEX_HEADER    header = { 0 };
+    HANDLE              file = INVALID_HANDLE_VALUE;
+    DWORD               written = 0;
+    ULONG64             size = Reader->RangeCount * sizeof(DMM_RANGE);
+
+    if (size > MAXDWORD)
+    {
+        return;
+    }
+
+    header.Signature = DMM_INDEX_SIGNATURE;
+    header.Version = DMM_INDEX_VERSION;
+    header.FileSize = Reader->Size;
+    header.LastWriteTime = Info->ftLastWriteTime;
+    header.RangeCount = Reader->RangeCount;
+
+    file = CreateFile(IndexName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        LOG_WARN(L"CreateFile(%s) failed: 0x%08x", IndexName, GetLastError());
+        return;
+    }
+
+    if (!WriteFile(file, &header, sizeof(header), &written, NULL) || written != sizeof(header) ||
+        !WriteFile(file, Reader->Ranges, (DWORD)size, &written, NULL) || written != (DWORD)size)
+    {
+        LOG_WARN(L"WriteFile(%s) failed: 0x%08x", IndexName, GetLastError());
+        CloseHandle(file);
+        DeleteFile(IndexName);
+        return;
+    }
+
+    CloseHandle(file);
+}
+
+BOOLEAN
+DmmOpen(
+    _In_  PCWSTR      FileName,
+    _Out_ PDMM_READER *Reader
+)
+{
+    PDMM_READER                 reader = NULL;
+    BY_HANDLE_FILE_INFORMATION  info = { 0 };
+    WCHAR                       indexName[MAX_PATH];
+    BOOLEAN                     bOk = FALSE;
+
+    __try
+    {
+        if (swprintf_s(indexName, MAX_PATH, DMM_INDEX_FILE_FMT, FileName) < 0)
+        {
+            LOG_ERROR(0, L"file name too long: %s", FileName);
+            __leave;
+        }
+
+        reader = (PDMM_READER)calloc(1, sizeof(DMM_READER));
+        if (reader == NULL)
+        {
+            LOG_ERROR(0, L"calloc failed");
+            __leave;
+        }
+
+        reader->File = CreateFile(FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (reader->File == INVALID_HANDLE_VALUE)
+        {
+            reader->File = NULL;
+            LOG_ERROR(GetLastError(), L"CreateFile(%s) failed", FileName);
+            __leave;
+        }
+
+        if (!GetFileInformationByHandle(reader->File, &info))
+        {
+            LOG_ERROR(GetLastError(), L"GetFileInformationByHandle failed");
+            __leave;
+        }
+        reader->Size = ((ULONG64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+
+        // nothing is read here, pages come in as DmmRead callers touch them
+        reader->Mapping = CreateFileMapping(reader->File, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (reader->Mapping == NULL)
+        {
+            LOG_ERROR(GetLastError(), L"CreateFileMapping failed");
+            __leave;
+        }
+
+        reader->View = (PBYTE)MapViewOfFile(reader->Mapping, FILE_MAP_READ, 0, 0, 0);
+        if (reader->View == NULL)
+        {
+            LOG_ERROR(GetLastError(), L"MapViewOfFile failed");
+            __leave;
+        }
+
+        if (reader->Size >= sizeof(ULONG) && *(PULONG)reader->View == DMPZ_SIGNATURE)
+        {
+            LOG_ERROR(0, L"%s is compressed, it can't be mapped", FileName);
+            __leave;
+        }
+
+        if (!DmmLoadIndex(reader, indexName, &info))
+        {
+            DmmUnloadIndex(reader);
+
+            if (!DmmBuildIndex(reader))
+            {
+                __leave;
+            }
+            DmmSaveIndex(reader, indexName, &info);
+        }
+
+        *Reader = reader;
+        reader = NULL;
+        bOk = TRUE;
+    }
+    __finally
+    {
+        DmmClose(reader);
+    }
+
+    return bOk;
+}
+
+VOID
+DmmClose(
+    _In_opt_ PDMM_READER Reader
+)
+{
+    if (Reader == NULL)
+    {
+        return;
+    }
+
+    if (Reader->IndexView == NULL && Reader->Ranges != NULL)
+    {
+        free(Reader->Ranges);
+    }
+    DmmUnloadIndex(Reader);
+
+    if (Reader->View != NULL)
+    {
+        UnmapViewOfFile(Reader->View);
+    }
+    if (Reader->Mapping != NULL)
+    {
+        CloseHandle(Reader->Mapping);
+    }
+    if (Reader->File != NULL)
+    {
+        CloseHandle(Reader->File);
+    }
+    free(Reader);
+}
+
+const BYTE *
+DmmRead(
+    _In_ PDMM_READER Reader,
+    _In_ ULONG64     Va,
+    _In_ ULONG64     Size
+)
+{
+    PDMM_RANGE  range = NULL;
+    ULONG64     lo = 0;
+    ULONG64     hi = Reader->RangeCount;
+    ULONG64     mid = 0;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        range = &Reader->Ranges[mid];
+
+        if (Va < range->Va)
+        {
+            hi = mid;
+        }
+        else if (Va - range->Va >= range->Size)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            if (Size > range->Size - (Va - range->Va))
+            {
+                return NULL;
+            }
+            return Reader->View + range->FileOffset + (Va - range->Va);
+        }
+    }
+
+    return NULL;
+}
+
+static
+VOID
+DmmPrintHex(
+    _In_ ULONG64      Va,
+    _In_ const BYTE   *Data,
+    _In_ DWORD        Size
+)
+{
+    DWORD i = 0;
+    DWORD j = 0;
+
+    for (i = 0; i < Size; i += 16)
+    {
+        wprintf_s(L"%016I64x ", Va + i);
+        for (j = i; j < i + 16; ++j)
+        {
+            if (j < Size)
+            {
+                wprintf_s(L" %02x", Data[j]);
+            }
+            else
+            {
+                wprintf_s(L"   ");
+            }
+        }
+        wprintf_s(L"  ");
+        for (j = i; j < i + 16 && j < Size; ++j)
+        {
+            wprintf_s(L"%c", (Data[j] >= 0x20 && Data[j] < 0x7F) ? Data[j] : L'.');
+        }
+        wprintf_s(L"\n");
+    }
+}
+
+BOOLEAN
+DmmPrintVa(
+    _In_ PCWSTR  FileName,
+    _In_ ULONG64 Va,
+    _In_ DWORD   Size
+)
+{
+    PDMM_READER     mapped = NULL;
+    PDMZ_READER     packed = NULL;
+    PBYTE           buffer = NULL;
+    const BYTE      *data = NULL;
+    HANDLE          file = INVALID_HANDLE_VALUE;
+    ULONG           signature = 0;
+    DWORD           read = 0;
+    BOOLEAN         bOk = FALSE;
+
+    if (Size == 0 || Size > DMM_PRINT_MAX)
+    {
+        LOG_WARN(L"size %u not in 1..%u", Size, DMM_PRINT_MAX);
+        return FALSE;
+    }
+
+    __try
+    {
+        file = CreateFile(FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            LOG_ERROR(GetLastError(), L"CreateFile(%s) failed", FileName);
+            __leave;
+        }
+        if (!ReadFile(file, &signature, sizeof(signature), &read, NULL))
+        {
+            LOG_ERROR(GetLastError(), L"ReadFile failed");
+            __leave;
+        }
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+
+        if (read == sizeof(signature) && signature == DMPZ_SIGNATURE)
+        {
+            // frames have to be inflated, so this one copies
+            buffer = (PBYTE)malloc(Size);
+            if (buffer == NULL)
+            {
+                LOG_ERROR(0, L"malloc failed");
+                __leave;
+            }
+            if (!DmzOpen(FileName, &packed) || !DmzReadVa(packed, Va, buffer, Size))
+            {
+                __leave;
+            }
+            data = buffer;
+        }
+        else
+        {
+            if (!DmmOpen(FileName, &mapped))
+            {
+                __leave;
+            }
+            data = DmmRead(mapped, Va, Size);
+            if (data == NULL)
+            {
+                LOG_ERROR(0, L"0x%I64x..0x%I64x is not in the dump", Va, Va + Size);
+                __leave;
+            }
+        }
+
+        DmmPrintHex(Va, data, Size);
+
+        bOk = TRUE;
+    }
+    __finally
+    {
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+        }
+        if (buffer != NULL)
+        {
+            free(buffer);
+        }
+        DmzClose(packed);
+        DmmClose(mapped);
+    }
+
+    return bOk;
+}
\ No newline at end of file
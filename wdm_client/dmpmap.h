@@ -0,0 +1,88 @@
+#pragma once
+#include "dump.h"
+
+
+#define DMM_INDEX_SIGNATURE     'XDMD'
+#define DMM_INDEX_VERSION       1
+#define DMM_INDEX_FILE_FMT      L"%s.idx"           // Sidecar next to the dump
+#define DMM_PRINT_MAX           0x10000             // Bytes the read command prints at most
+
+
+//
+// Memory of the dumped process at Va..Va+Size is at FileOffset in the dump
+//
+typedef struct _DMM_RANGE
+{
+    ULONG64     Va;
+    ULONG64     Size;
+    ULONG64     FileOffset;
+
+}DMM_RANGE, *PDMM_RANGE;
+
+//
+// Sidecar index, DMM_RANGE[RangeCount] follow; only used while the dump
+// still has the size and write time it was built from
+//
+typedef struct _DMM_INDEX_HEADER
+{
+    ULONG       Signature;      // DMM_INDEX_SIGNATURE
+    ULONG       Version;        // DMM_INDEX_VERSION
+    ULONG64     FileSize;
+    FILETIME    LastWriteTime;
+    ULONG64     RangeCount;
+
+}DMM_INDEX_HEADER, *PDMM_INDEX_HEADER;
+
+//
+// Plain minidump mapped read only; the range index is either the mapped
+// sidecar or built from the Memory64 list, so opening touches neither the
+// memory data nor (with a sidecar) the minidump headers
+//
+typedef struct _DMM_READER
+{
+    HANDLE      File;
+    HANDLE      Mapping;
+    PBYTE       View;
+    ULONG64     Size;
+    HANDLE      IndexFile;
+    HANDLE      IndexMapping;
+    PBYTE       IndexView;      // NULL: Ranges was built and is ours to free
+    PDMM_RANGE  Ranges;         // Ascending Va, adjacent ones merged
+    ULONG64     RangeCount;
+
+}DMM_READER, *PDMM_READER;
+
+
+BOOLEAN
+DmmOpen(
+    _In_  PCWSTR      FileName,
+    _Out_ PDMM_READER *Reader
+);
+
+VOID
+DmmClose(
+    _In_opt_ PDMM_READER Reader
+);
+
+//
+// O(log ranges), no copy; the pointer is good until DmmClose
+//
+// returns:
+//      - NULL  - Va..Va+Size is not all in the dump
+//      - the bytes at Va, in the mapped view
+const BYTE *
+DmmRead(
+    _In_ PDMM_READER Reader,
+    _In_ ULONG64     Va,
+    _In_ ULONG64     Size
+);
+
+//
+// Hex dump of Size bytes at Va of a dump command output, plain or DMPZ
+//
+BOOLEAN
+DmmPrintVa(
+    _In_ PCWSTR  FileName,
+    _In_ ULONG64 Va,
+    _In_ DWORD   Size
+);
\ No newline at end of file
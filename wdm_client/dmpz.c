@@ -0,0 +1,701 @@
+#include "dmpz.h"
+
+
+#define DMZ_MAX_CHAIN           64      // Deltas on top of one full dump
+
+
+static
+BOOLEAN
+DmzReadAt(
+    _In_  HANDLE  File,
+    _In_  ULONG64 Offset,
+    _Out_ PVOID   Buffer,
+    _In_  DWORD   Size
+)
+{
+    OVERLAPPED  ovlp = { 0 };
+    DWORD       read = 0;
+
+    ovlp.Offset = (DWORD)Offset;
+    ovlp.OffsetHigh = (DWORD)(Offset >> 32);
+
+    if (!ReadFile(File, Buffer, Size, &read, &ovlp) || read != Size)
+    {
+        LOG_ERROR(GetLastError(), L"ReadFile at %I64u failed", Offset);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// returns index of the frame holding RawOffset, MAXDWORD if none
+static
+DWORD
+DmzFindFrame(
+    _In_ PDMZ_READER Reader,
+    _In_ ULONG64     RawOffset
+)
+{
+    DWORD lo = 0;
+    DWORD hi = Reader->Header.FrameCount;
+    DWORD mid = 0;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (RawOffset < Reader->Frames[mid].RawOffset)
+        {
+            hi = mid;
+        }
+        else if (RawOffset >= Reader->Frames[mid].RawOffset + Reader->Frames[mid].RawSize)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            return mid;
+        }
+    }
+
+    return MAXDWORD;
+}
+
+//
+// Ranges are ascending both by Va and by RawOffset
+//
+// returns the range holding Va (ByVa) or RawOffset, NULL if none
+static
+PDMZ_RANGE
+DmzFindRange(
+    _In_ PDMZ_READER Reader,
+    _In_ ULONG64     Value,
+    _In_ BOOLEAN     ByVa
+)
+{
+    PDMZ_RANGE  range = NULL;
+    ULONG64     start = 0;
+    DWORD       lo = 0;
+    DWORD       hi = Reader->RangeCount;
+    DWORD       mid = 0;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        range = &Reader->Ranges[mid];
+        start = ByVa ? range->Va : range->RawOffset;
+
+        if (Value < start)
+        {
+            hi = mid;
+        }
+        else if (Value - start >= range->Size)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            return range;
+        }
+    }
+
+    return NULL;
+}
+
+static
+BOOLEAN
+DmzLoadFrame(
+    _Inout_ PDMZ_READER Reader,
+    _In_    DWORD       Frame,
+    _In_    DWORD       Slot
+)
+{
+    PDMPZ_FRAME frame = &Reader->Frames[Frame];
+    PBYTE       payload = Reader->Payload[Slot];
+    PULONG64    map = (PULONG64)payload;
+    SIZE_T      size = 0;
+    ULONG64     dataPages = 0;
+    DWORD       i = 0;
+
+    if (Reader->CachedFrame[Slot] == Frame)
+    {
+        return TRUE;
+    }
+    Reader->CachedFrame[Slot] = MAXDWORD;
+
+    if (frame->RawSize > DMP_IO_CHUNK_SIZE || frame->RawSize % DMP_PAGE_SIZE != 0 ||
+        frame->PayloadSize > DMPZ_PAYLOAD_MAX || frame->PayloadSize < DMPZ_MAP_SIZE(frame->RawSize) ||
+        frame->PackedSize > frame->PayloadSize)
+    {
+        LOG_ERROR(0, L"frame %u is corrupt", Frame);
+        return FALSE;
+    }
+
+    if (frame->PackedSize == frame->PayloadSize)
+    {
+        if (!DmzReadAt(Reader->File, frame->FileOffset, payload, frame->PayloadSize))
+        {
+            return FALSE;
+        }
+    }
+    else
+    {
+        if (!DmzReadAt(Reader->File, frame->FileOffset, Reader->Packed, frame->PackedSize))
+        {
+            return FALSE;
+        }
+        if (!Decompress(Reader->Decompressor, Reader->Packed, frame->PackedSize, payload, frame->PayloadSize, &size) ||
+            size != frame->PayloadSize)
+        {
+            LOG_ERROR(GetLastError(), L"Decompress of frame %u failed", Frame);
+            return FALSE;
+        }
+    }
+
+    // DmzReadPage trusts the map to point inside the payload
+    for (i = 0; i < frame->RawSize / DMP_PAGE_SIZE; ++i)
+    {
+        dataPages += (map[i] == DMPZ_PAGE_DATA);
+    }
+    if (DMPZ_MAP_SIZE(frame->RawSize) + dataPages * DMP_PAGE_SIZE > frame->PayloadSize)
+    {
+        LOG_ERROR(0, L"frame %u has more data pages than its payload holds", Frame);
+        return FALSE;
+    }
+
+    Reader->CachedFrame[Slot] = Frame;
+
+    return TRUE;
+}
+
+//
+// Resolves one page of the minidump, down the base chain if it has to;
+// duplicates are read through the second cache slot so a frame full of
+// them doesn't inflate its own frame again for every page
+//
+static
+BOOLEAN
+DmzReadPage(
+    _Inout_ PDMZ_READER Reader,
+    _In_    ULONG64     RawOffset,
+    _In_    DWORD       Slot,
+    _Out_   PBYTE       Page
+)
+{
+    PDMPZ_FRAME frame = NULL;
+    PDMZ_RANGE  range = NULL;
+    PULONG64    map = NULL;
+    ULONG64     entry = 0;
+    DWORD       index = 0;
+    DWORD       data = 0;
+    DWORD       i = 0;
+
+    index = DmzFindFrame(Reader, RawOffset);
+    if (index == MAXDWORD || !DmzLoadFrame(Reader, index, Slot))
+    {
+        LOG_ERROR(0, L"raw offset %I64u is not in the dump", RawOffset);
+        return FALSE;
+    }
+
+    frame = &Reader->Frames[index];
+    map = (PULONG64)Reader->Payload[Slot];
+    i = (DWORD)((RawOffset - frame->RawOffset) / DMP_PAGE_SIZE);
+    entry = map[i];
+
+    if (entry == DMPZ_PAGE_ZERO)
+    {
+        ZeroMemory(Page, DMP_PAGE_SIZE);
+        return TRUE;
+    }
+
+    if (entry == DMPZ_PAGE_BASE)
+    {
+        range = DmzFindRange(Reader, RawOffset, FALSE);
+        if (range == NULL || Reader->Base == NULL)
+        {
+            LOG_ERROR(0, L"base page at raw offset %I64u has no base", RawOffset);
+            return FALSE;
+        }
+        return DmzReadVa(Reader->Base, range->Va + (RawOffset - range->RawOffset), Page, DMP_PAGE_SIZE);
+    }
+
+    if (entry != DMPZ_PAGE_DATA)
+    {
+        // always a DMPZ_PAGE_DATA page, so this goes one level down at most
+        if (Slot != 0)
+        {
+            LOG_ERROR(0, L"page at raw offset %I64u refers to a duplicate", RawOffset);
+            return FALSE;
+        }
+        return DmzReadPage(Reader, entry, 1, Page);
+    }
+
+    // data pages are packed after the map in page order
+    for (data = 0; i != 0; --i)
+    {
+        data += (map[i - 1] == DMPZ_PAGE_DATA);
+    }
+    CopyMemory(Page, Reader->Payload[Slot] + DMPZ_MAP_SIZE(frame->RawSize) + (SIZE_T)data * DMP_PAGE_SIZE, DMP_PAGE_SIZE);
+
+    return TRUE;
+}
+
+//
+// Memory64 descriptors out of the minidump header
+//
+static
+BOOLEAN
+DmzLoadRanges(
+    _Inout_ PDMZ_READER Reader
+)
+{
+    MINIDUMP_HEADER                 header = { 0 };
+    MINIDUMP_DIRECTORY              dir = { 0 };
+    MINIDUMP_MEMORY64_LIST          list = { 0 };
+    MINIDUMP_MEMORY_DESCRIPTOR64    desc = { 0 };
+    ULONG64                         rawOffset = 0;
+    ULONG64                         page = 0;
+    DWORD                           i = 0;
+
+    if (!DmzReadRaw(Reader, 0, &header, sizeof(header)) || header.Signature != MINIDUMP_SIGNATURE)
+    {
+        LOG_ERROR(0, L"no minidump header");
+        return FALSE;
+    }
+
+    for (i = 0; i < header.NumberOfStreams; ++i)
+    {
+        if (!DmzReadRaw(Reader, header.StreamDirectoryRva + (ULONG64)i * sizeof(dir), &dir, sizeof(dir)))
+        {
+            return FALSE;
+        }
+        if (dir.StreamType == Memory64ListStream)
+        {
+            break;
+        }
+    }
+    if (i == header.NumberOfStreams)
+    {
+        LOG_ERROR(0, L"no Memory64ListStream");
+        return FALSE;
+    }
+
+    if (!DmzReadRaw(Reader, dir.Location.Rva, &list, FIELD_OFFSET(MINIDUMP_MEMORY64_LIST, MemoryRanges)))
+    {
+        return FALSE;
+    }
+    if (list.NumberOfMemoryRanges > MAXDWORD / sizeof(DMZ_RANGE))
+    {
+        LOG_ERROR(0, L"too many ranges: %I64u", list.NumberOfMemoryRanges);
+        return FALSE;
+    }
+
+    Reader->Ranges = (PDMZ_RANGE)malloc((size_t)list.NumberOfMemoryRanges * sizeof(DMZ_RANGE));
+    if (Reader->Ranges == NULL && list.NumberOfMemoryRanges != 0)
+    {
+        LOG_ERROR(0, L"malloc failed");
+        return FALSE;
+    }
+
+    // one small read each, the header is a frame or two and stays cached
+    rawOffset = list.BaseRva;
+    for (i = 0; i < (DWORD)list.NumberOfMemoryRanges; ++i)
+    {
+        if (!DmzReadRaw(Reader, dir.Location.Rva + FIELD_OFFSET(MINIDUMP_MEMORY64_LIST, MemoryRanges) + (ULONG64)i * sizeof(desc),
+            &desc, sizeof(desc)))
+        {
+            return FALSE;
+        }
+
+        Reader->Ranges[i].Va = desc.StartOfMemoryRange;
+        Reader->Ranges[i].Size = desc.DataSize;
+        Reader->Ranges[i].RawOffset = rawOffset;
+        Reader->Ranges[i].FirstPage = page;
+        rawOffset += desc.DataSize;
+        page += desc.DataSize / DMP_PAGE_SIZE;
+    }
+    Reader->RangeCount = (DWORD)list.NumberOfMemoryRanges;
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+DmzOpenChain(
+    _In_  PCWSTR      FileName,
+    _In_  DWORD       Depth,
+    _Out_ PDMZ_READER *Reader
+)
+{
+    PDMZ_READER reader = NULL;
+    BOOLEAN     bOk = FALSE;
+
+    __try
+    {
+        if (Depth > DMZ_MAX_CHAIN)
+        {
+            LOG_ERROR(0, L"more than %u deltas chained", DMZ_MAX_CHAIN);
+            __leave;
+        }
+
+        reader = (PDMZ_READER)calloc(1, sizeof(DMZ_READER));
+        if (reader == NULL)
+        {
+            LOG_ERROR(0, L"calloc failed");
+            __leave;
+        }
+        reader->CachedFrame[0] = MAXDWORD;
+        reader->CachedFrame[1] = MAXDWORD;
+
+        reader->File = CreateFile(FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (reader->File == INVALID_HANDLE_VALUE)
+        {
+            LOG_ERROR(GetLastError(), L"CreateFile(%s) failed", FileName);
+            __leave;
+        }
+
+        if (!DmzReadAt(reader->File, 0, &reader->Header, sizeof(reader->Header)))
+        {
+            __leave;
+        }
+        if (reader->Header.Signature != DMPZ_SIGNATURE ||
+            reader->Header.Version != DMPZ_VERSION ||
+            reader->Header.Algorithm != DMPZ_ALGORITHM)
+        {
+            LOG_ERROR(0, L"%s is not a version %u DMPZ file", FileName, DMPZ_VERSION);
+            __leave;
+        }
+        if ((ULONG64)reader->Header.FrameCount * sizeof(DMPZ_FRAME) > MAXDWORD)
+        {
+            LOG_ERROR(0, L"too many frames: %u", reader->Header.FrameCount);
+            __leave;
+        }
+
+        reader->Frames = (PDMPZ_FRAME)malloc(reader->Header.FrameCount * sizeof(DMPZ_FRAME));
+        reader->Packed = (PBYTE)VirtualAlloc(NULL, DMPZ_PAYLOAD_MAX, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        reader->Payload[0] = (PBYTE)VirtualAlloc(NULL, DMPZ_PAYLOAD_MAX, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        reader->Payload[1] = (PBYTE)VirtualAlloc(NULL, DMPZ_PAYLOAD_MAX, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (reader->Frames == NULL || reader->Packed == NULL || reader->Payload[0] == NULL || reader->Payload[1] == NULL)
+        {
+            LOG_ERROR(GetLastError(), L"allocation failed");
+            __leave;
+        }
+
+        if (!DmzReadAt(reader->File, reader->Header.IndexOffset, reader->Frames, reader->Header.FrameCount * sizeof(DMPZ_FRAME)))
+        {
+            __leave;
+        }
+
+        if (!CreateDecompressor(DMPZ_ALGORITHM | COMPRESS_RAW, NULL, &reader->Decompressor))
+        {
+            LOG_ERROR(GetLastError(), L"CreateDecompressor failed");
+            __leave;
+        }
+
+        if (reader->Header.BaseId != 0)
+        {
+            reader->Header.BaseName[MAX_PATH - 1] = L'\0';
+            if (!DmzOpenChain(reader->Header.BaseName, Depth + 1, &reader->Base))
+            {
+                LOG_ERROR(0, L"base of %s can't be opened", FileName);
+                __leave;
+            }
+
+            // the base was replaced since the delta was taken
+            if (reader->Base->Header.DumpId != reader->Header.BaseId)
+            {
+                LOG_ERROR(0, L"%s is not the base %s was taken against", reader->Header.BaseName, FileName);
+                __leave;
+            }
+        }
+
+        if (!DmzLoadRanges(reader))
+        {
+            __leave;
+        }
+
+        *Reader = reader;
+        reader = NULL;
+        bOk = TRUE;
+    }
+    __finally
+    {
+        DmzClose(reader);
+    }
+
+    return bOk;
+}
+
+BOOLEAN
+DmzOpen(
+    _In_  PCWSTR      FileName,
+    _Out_ PDMZ_READER *Reader
+)
+{
+    return DmzOpenChain(FileName, 0, Reader);
+}
+
+VOID
+DmzClose(
+    _In_opt_ PDMZ_READER Reader
+)
+{
+    if (Reader == NULL)
+    {
+        return;
+    }
+
+    DmzClose(Reader->Base);
+
+    if (Reader->Decompressor != NULL)
+    {
+        CloseDecompressor(Reader->Decompressor);
+    }
+    if (Reader->Payload[0] != NULL)
+    {
+        VirtualFree(Reader->Payload[0], 0, MEM_RELEASE);
+    }
+    if (Reader->Payload[1] != NULL)
+    {
+        VirtualFree(Reader->Payload[1], 0, MEM_RELEASE);
+    }
+    if (Reader->Packed != NULL)
+    {
+        VirtualFree(Reader->Packed, 0, MEM_RELEASE);
+    }
+    if (Reader->Hashes != NULL)
+    {
+        free(Reader->Hashes);
+    }
+    if (Reader->Ranges != NULL)
+    {
+        free(Reader->Ranges);
+    }
+    if (Reader->Frames != NULL)
+    {
+        free(Reader->Frames);
+    }
+    if (Reader->File != NULL && Reader->File != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(Reader->File);
+    }
+    free(Reader);
+}
+
+BOOLEAN
+DmzLoadHashes(
+    _Inout_ PDMZ_READER Reader
+)
+{
+    ULONG64 size = Reader->Header.HashCount * sizeof(PAGE_HASH);
+    ULONG64 offset = 0;
+    DWORD   part = 0;
+
+    if (Reader->Hashes != NULL)
+    {
+        return TRUE;
+    }
+
+    Reader->Hashes = (PPAGE_HASH)malloc((size_t)size);
+    if (Reader->Hashes == NULL && size != 0)
+    {
+        LOG_ERROR(0, L"malloc failed");
+        return FALSE;
+    }
+
+    for (offset = 0; offset < size; offset += part)
+    {
+        part = (DWORD)min(size - offset, DMP_IO_CHUNK_SIZE);
+        if (!DmzReadAt(Reader->File, Reader->Header.HashOffset + offset, (PBYTE)Reader->Hashes + offset, part))
+        {
+            free(Reader->Hashes);
+            Reader->Hashes = NULL;
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+DmzPageHash(
+    _In_  PDMZ_READER Reader,
+    _In_  ULONG64     Va,
+    _Out_ PPAGE_HASH  Hash
+)
+{
+    PDMZ_RANGE  range = NULL;
+    ULONG64     page = 0;
+
+    range = DmzFindRange(Reader, Va, TRUE);
+    if (range == NULL || Reader->Hashes == NULL)
+    {
+        return FALSE;
+    }
+
+    page = range->FirstPage + (Va - range->Va) / DMP_PAGE_SIZE;
+    if (page >= Reader->Header.HashCount)
+    {
+        return FALSE;
+    }
+
+    *Hash = Reader->Hashes[page];
+
+    return TRUE;
+}
+
+BOOLEAN
+DmzReadRaw(
+    _Inout_ PDMZ_READER Reader,
+    _In_    ULONG64     RawOffset,
+    _Out_   PVOID       Buffer,
+    _In_    DWORD       Size
+)
+{
+    BYTE    page[DMP_PAGE_SIZE];
+    PBYTE   out = (PBYTE)Buffer;
+    DWORD   offset = 0;
+    DWORD   part = 0;
+
+    while (Size != 0)
+    {
+        offset = (DWORD)(RawOffset % DMP_PAGE_SIZE);
+        part = min(Size, DMP_PAGE_SIZE - offset);
+
+        if (offset == 0 && part == DMP_PAGE_SIZE)
+        {
+            if (!DmzReadPage(Reader, RawOffset, 0, out))
+            {
+                return FALSE;
+            }
+        }
+        else
+        {
+            if (!DmzReadPage(Reader, RawOffset - offset, 0, page))
+            {
+                return FALSE;
+            }
+            CopyMemory(out, page + offset, part);
+        }
+
+        RawOffset += part;
+        out += part;
+        Size -= part;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+DmzReadVa(
+    _Inout_ PDMZ_READER Reader,
+    _In_    ULONG64     Va,
+    _Out_   PVOID       Buffer,
+    _In_    DWORD       Size
+)
+{
+    PDMZ_RANGE  range = NULL;
+    PBYTE       out = (PBYTE)Buffer;
+    DWORD       part = 0;
+
+    while (Size != 0)
+    {
+        range = DmzFindRange(Reader, Va, TRUE);
+        if (range == NULL)
+        {
+            LOG_ERROR(0, L"address 0x%I64x is not in the dump", Va);
+            return FALSE;
+        }
+
+        part = (DWORD)min(Size, range->Va + range->Size - Va);
+        if (!DmzReadRaw(Reader, range->RawOffset + (Va - range->Va), out, part))
+        {
+            return FALSE;
+        }
+
+        Va += part;
+        out += part;
+        Size -= part;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+DmzMerge(
+    _In_ PCWSTR FileName,
+    _In_ PCWSTR OutFileName
+)
+{
+    PDMZ_READER reader = NULL;
+    HANDLE      file = INVALID_HANDLE_VALUE;
+    PBYTE       buffer = NULL;
+    ULONG64     offset = 0;
+    DWORD       part = 0;
+    DWORD       written = 0;
+    DWORD       depth = 0;
+    PDMZ_READER r = NULL;
+    BOOLEAN     bOk = FALSE;
+
+    __try
+    {
+        if (!DmzOpen(FileName, &reader))
+        {
+            __leave;
+        }
+
+        buffer = (PBYTE)VirtualAlloc(NULL, DMP_IO_CHUNK_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (buffer == NULL)
+        {
+            LOG_ERROR(GetLastError(), L"VirtualAlloc failed");
+            __leave;
+        }
+
+        file = CreateFile(OutFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            LOG_ERROR(GetLastError(), L"CreateFile(%s) failed", OutFileName);
+            __leave;
+        }
+
+        for (offset = 0; offset < reader->Header.RawSize; offset += part)
+        {
+            part = (DWORD)min(reader->Header.RawSize - offset, DMP_IO_CHUNK_SIZE);
+            if (!DmzReadRaw(reader, offset, buffer, part))
+            {
+                __leave;
+            }
+            if (!WriteFile(file, buffer, part, &written, NULL) || written != part)
+            {
+                LOG_ERROR(GetLastError(), L"WriteFile failed");
+                __leave;
+            }
+        }
+
+        for (r = reader->Base; r != NULL; r = r->Base)
+        {
+            ++depth;
+        }
+        LOG_INFO(L"%s: %I64u MB minidump from %s and %u base file(s)", OutFileName, reader->Header.RawSize >> 20, FileName, depth);
+
+        bOk = TRUE;
+    }
+    __finally
+    {
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+            if (!bOk)
+            {
+                DeleteFile(OutFileName);
+            }
+        }
+        if (buffer != NULL)
+        {
+            VirtualFree(buffer, 0, MEM_RELEASE);
+        }
+        DmzClose(reader);
+    }
+
+    return bOk;
+}
\ No newline at end of file
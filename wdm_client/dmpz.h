@@ -0,0 +1,103 @@
+#pragma once
+#include "dump.h"
+
+
+//
+// Memory64 range of the minidump a DMPZ file holds
+//
+typedef struct _DMZ_RANGE
+{
+    ULONG64     Va;
+    ULONG64     Size;
+    ULONG64     RawOffset;          // Where its bytes are in the minidump
+    ULONG64     FirstPage;          // Index of its first page in the hash array
+
+}DMZ_RANGE, *PDMZ_RANGE;
+
+//
+// Random access over a DMPZ file; a delta has its base opened too, and so on
+// down the chain. Not thread safe.
+//
+typedef struct _DMZ_READER
+{
+    HANDLE              File;
+    DMPZ_HEADER         Header;
+    PDMPZ_FRAME         Frames;         // Header.FrameCount, ascending RawOffset
+    DWORD               RangeCount;
+    PDMZ_RANGE          Ranges;         // Ascending Va
+    PPAGE_HASH          Hashes;         // Header.HashCount, NULL until DmzLoadHashes
+    struct _DMZ_READER  *Base;          // Header.BaseId != 0
+    DECOMPRESSOR_HANDLE Decompressor;
+    PBYTE               Packed;         // DMPZ_PAYLOAD_MAX
+    PBYTE               Payload[2];     // DMPZ_PAYLOAD_MAX, inflated Frames[CachedFrame[]]
+    DWORD               CachedFrame[2]; // [0] frame being read, [1] frame its duplicates refer to; MAXDWORD: none
+
+}DMZ_READER, *PDMZ_READER;
+
+
+//
+// Opens FileName and, for a delta, the whole chain under it
+//
+BOOLEAN
+DmzOpen(
+    _In_  PCWSTR      FileName,
+    _Out_ PDMZ_READER *Reader
+);
+
+VOID
+DmzClose(
+    _In_opt_ PDMZ_READER Reader
+);
+
+//
+// Reads the per page hashes (needed by DmzPageHash)
+//
+BOOLEAN
+DmzLoadHashes(
+    _Inout_ PDMZ_READER Reader
+);
+
+//
+// Only reads the hashes and ranges, so any number of threads may call it
+//
+// returns:
+//      - FALSE - Va is not in the dump
+//      - TRUE  - Hash of the page at Va ({0, 0} for a zero page)
+BOOLEAN
+DmzPageHash(
+    _In_  PDMZ_READER Reader,
+    _In_  ULONG64     Va,
+    _Out_ PPAGE_HASH  Hash
+);
+
+//
+// Copies Size bytes of the dumped process memory at Va; fails if any of it
+// is not in the dump
+//
+BOOLEAN
+DmzReadVa(
+    _Inout_ PDMZ_READER Reader,
+    _In_    ULONG64     Va,
+    _Out_   PVOID       Buffer,
+    _In_    DWORD       Size
+);
+
+//
+// Copies Size bytes at RawOffset of the minidump the DMPZ file holds
+//
+BOOLEAN
+DmzReadRaw(
+    _Inout_ PDMZ_READER Reader,
+    _In_    ULONG64     RawOffset,
+    _Out_   PVOID       Buffer,
+    _In_    DWORD       Size
+);
+
+//
+// Writes the plain minidump FileName (DMPZ, possibly a delta) stands for to OutFileName
+//
+BOOLEAN
+DmzMerge(
+    _In_ PCWSTR FileName,
+    _In_ PCWSTR OutFileName
+);
\ No newline at end of file
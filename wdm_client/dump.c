@@ -0,0 +1,1932 @@
+#include "dump.h"
+#include "dmpz.h"
+
+#include <time.h>
+
+
+VOID
+DmpInitOptions(
+    _Out_ PDMP_OPTIONS Options
+)
+{
+    ZeroMemory(Options, sizeof(*Options));
+    Options->ThreadCount = DMP_DEFAULT_THREADS;
+    Options->BufferSize = DMP_DEFAULT_BUFFER_SIZE;
+}
+
+static
+BOOLEAN
+DmpAddRange(
+    _Inout_ PDMP_RANGES Ranges,
+    _In_    ULONG64     Base,
+    _In_    ULONG64     Size
+)
+{
+    PDMP_RANGE last = NULL;
+    PDMP_RANGE grown = NULL;
+
+    if (Ranges->Count != 0)
+    {
+        last = &Ranges->Ranges[Ranges->Count - 1];
+        if (last->Base + last->Size == Base)
+        {
+            last->Size += Size;
+            Ranges->TotalSize += Size;
+            return TRUE;
+        }
+    }
+
+    if (Ranges->Count == Ranges->Capacity)
+    {
+        grown = (PDMP_RANGE)realloc(Ranges->Ranges, (Ranges->Capacity ? Ranges->Capacity * 2 : 256) * sizeof(DMP_RANGE));
+        if (grown == NULL)
+        {
+            LOG_ERROR(0, L"realloc failed");
+            return FALSE;
+        }
+        Ranges->Ranges = grown;
+        Ranges->Capacity = Ranges->Capacity ? Ranges->Capacity * 2 : 256;
+    }
+
+    Ranges->Ranges[Ranges->Count].Base = Base;
+    Ranges->Ranges[Ranges->Count].Size = Size;
+    Ranges->Count++;
+    Ranges->TotalSize += Size;
+
+    return TRUE;
+}
+
+static
+VOID
+DmpFreeRanges(
+    _Inout_ PDMP_RANGES Ranges
+)
+{
+    if (Ranges->Ranges != NULL)
+    {
+        free(Ranges->Ranges);
+    }
+    ZeroMemory(Ranges, sizeof(*Ranges));
+}
+
+static
+BOOLEAN
+DmpCollectRanges(
+    _In_  HANDLE      Process,
+    _Out_ PDMP_RANGES Ranges
+)
+{
+    MEMORY_BASIC_INFORMATION mbi = { 0 };
+    ULONG_PTR                address = 0;
+
+    ZeroMemory(Ranges, sizeof(*Ranges));
+
+    while (VirtualQueryEx(Process, (LPCVOID)address, &mbi, sizeof(mbi)) == sizeof(mbi))
+    {
+        if (mbi.State == MEM_COMMIT &&
+            mbi.Protect != 0 &&
+            !(mbi.Protect & (PAGE_NOACCESS | PAGE_GUARD)))
+        {
+            if (!DmpAddRange(Ranges, (ULONG64)(ULONG_PTR)mbi.BaseAddress, mbi.RegionSize))
+            {
+                DmpFreeRanges(Ranges);
+                return FALSE;
+            }
+        }
+
+        address = (ULONG_PTR)mbi.BaseAddress + mbi.RegionSize;
+        if (address < (ULONG_PTR)mbi.BaseAddress)
+        {
+            // wrapped at the top of the address space
+            break;
+        }
+    }
+
+    return TRUE;
+}
+
+//
+// Captures the threads of the target with their contexts and, with
+// DMP_FLAG_LIVE, a copy on write clone of it that replaces Job->Process.
+// The target is suspended only for the capture (page tables, not data);
+// every copy after that is from the clone, which nothing writes to, so the
+// contexts match the memory. A live capture that froze the target for more
+// than FreezeWarning ms (0: never) is only reported: the freeze is over by
+// the time it can be measured, and the clone it paid for is still good
+//
+static
+BOOLEAN
+DmpCaptureProcess(
+    _Inout_ PDMP_JOB     Job,
+    _In_    DWORD        FreezeWarning,
+    _Out_   PDMP_STREAMS Streams
+)
+{
+    PSS_VA_CLONE_INFORMATION    clone = { 0 };
+    PSS_THREAD_INFORMATION      threads = { 0 };
+    PSS_THREAD_ENTRY            entry = { 0 };
+    PSS_CAPTURE_FLAGS           flags = PSS_CAPTURE_THREADS | PSS_CAPTURE_THREAD_CONTEXT;
+    HPSSWALK                    walk = NULL;
+    PDMP_THREAD                 thread = NULL;
+    NT_TIB                      tib = { 0 };
+    SIZE_T                      read = 0;
+    LARGE_INTEGER               start = { 0 };
+    LARGE_INTEGER               end = { 0 };
+    LARGE_INTEGER               freq = { 0 };
+    DWORD                       status = ERROR_SUCCESS;
+    double                      ms = 0;
+
+    if (Job->Flags & DMP_FLAG_LIVE)
+    {
+        flags |= PSS_CAPTURE_VA_CLONE;
+    }
+
+    QueryPerformanceFrequency(&freq);
+
+    QueryPerformanceCounter(&start);
+    status = PssCaptureSnapshot(Job->Target, flags, CONTEXT_ALL, &Job->Snapshot);
+    QueryPerformanceCounter(&end);
+    if (status != ERROR_SUCCESS)
+    {
+        Job->Snapshot = NULL;
+        LOG_ERROR(status, L"PssCaptureSnapshot failed");
+        return FALSE;
+    }
+
+    if (Job->Flags & DMP_FLAG_LIVE)
+    {
+        status = PssQuerySnapshot(Job->Snapshot, PSS_QUERY_VA_CLONE_INFORMATION, &clone, sizeof(clone));
+        if (status != ERROR_SUCCESS)
+        {
+            LOG_ERROR(status, L"PssQuerySnapshot failed");
+            return FALSE;
+        }
+        Job->Process = clone.VaCloneHandle;
+
+        // the freeze is all of the capture call, there is nothing else to stop for
+        ms = 1000.0 * (end.QuadPart - start.QuadPart) / freq.QuadPart;
+        if (FreezeWarning != 0 && ms > FreezeWarning)
+        {
+            LOG_WARN(L"target frozen for %.2f ms, over the %u ms warning", ms, FreezeWarning);
+        }
+        else
+        {
+            LOG_INFO(L"target frozen for %.2f ms", ms);
+        }
+    }
+
+    // from here on a failure only costs the thread list
+    status = PssQuerySnapshot(Job->Snapshot, PSS_QUERY_THREAD_INFORMATION, &threads, sizeof(threads));
+    if (status != ERROR_SUCCESS || threads.ThreadsCaptured == 0)
+    {
+        LOG_WARN(L"no threads captured: 0x%08x", status);
+        return TRUE;
+    }
+
+    Streams->Threads = (PDMP_THREAD)calloc(threads.ThreadsCaptured, sizeof(DMP_THREAD));
+    if (Streams->Threads == NULL)
+    {
+        LOG_ERROR(0, L"calloc failed");
+        return TRUE;
+    }
+
+    status = PssWalkMarkerCreate(NULL, &walk);
+    if (status != ERROR_SUCCESS)
+    {
+        LOG_WARN(L"PssWalkMarkerCreate failed: 0x%08x", status);
+        return TRUE;
+    }
+
+    while (Streams->ThreadCount < threads.ThreadsCaptured &&
+        PssWalkSnapshot(Job->Snapshot, PSS_WALK_THREADS, walk, &entry, sizeof(entry)) == ERROR_SUCCESS)
+    {
+        if ((entry.Flags & PSS_THREAD_FLAGS_TERMINATED) || entry.ContextRecord == NULL)
+        {
+            continue;
+        }
+
+        thread = &Streams->Threads[Streams->ThreadCount++];
+        thread->ThreadId = entry.ThreadId;
+        thread->SuspendCount = entry.SuspendCount;
+        thread->Priority = (DWORD)entry.Priority;
+        thread->Teb = (ULONG64)(ULONG_PTR)entry.TebBaseAddress;
+        thread->Context = entry.ContextRecord;
+        thread->ContextSize = entry.SizeOfContextRecord;
+
+        // where the stack ends, for the thread stack descriptor
+        if (ReadProcessMemory(Job->Process, entry.TebBaseAddress, &tib, sizeof(tib), &read) && read == sizeof(tib))
+        {
+            thread->StackBase = (ULONG64)(ULONG_PTR)tib.StackBase;
+        }
+    }
+
+    PssWalkMarkerFree(walk);
+
+    return TRUE;
+}
+
+//
+// Timestamp, checksum and CodeView record out of the in memory PE headers,
+// what a debugger needs to find the image and its symbols
+//
+static
+VOID
+DmpReadImageInfo(
+    _In_    HANDLE      Process,
+    _Inout_ PDMP_MODULE Module
+)
+{
+    IMAGE_DOS_HEADER        dos = { 0 };
+    union
+    {
+        IMAGE_NT_HEADERS32  Pe32;
+        IMAGE_NT_HEADERS64  Pe64;
+    }                       nt = { 0 };
+    IMAGE_DEBUG_DIRECTORY   debug = { 0 };
+    IMAGE_DATA_DIRECTORY    *dir = NULL;
+    DWORD                   dirCount = 0;
+    SIZE_T                  read = 0;
+    DWORD                   i = 0;
+
+    // Signature, FileHeader and OptionalHeader.Magic sit at the same offsets in both
+    if (!ReadProcessMemory(Process, (LPCVOID)(ULONG_PTR)Module->Base, &dos, sizeof(dos), &read) ||
+        dos.e_magic != IMAGE_DOS_SIGNATURE ||
+        !ReadProcessMemory(Process, (LPCVOID)(ULONG_PTR)(Module->Base + dos.e_lfanew), &nt, sizeof(nt), &read) ||
+        nt.Pe32.Signature != IMAGE_NT_SIGNATURE)
+    {
+        return;
+    }
+
+    Module->TimeDateStamp = nt.Pe32.FileHeader.TimeDateStamp;
+
+    // a WOW64 target maps PE32 images, their optional header is laid out differently
+    switch (nt.Pe32.OptionalHeader.Magic)
+    {
+    case IMAGE_NT_OPTIONAL_HDR32_MAGIC:
+        Module->CheckSum = nt.Pe32.OptionalHeader.CheckSum;
+        dirCount = nt.Pe32.OptionalHeader.NumberOfRvaAndSizes;
+        dir = &nt.Pe32.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG];
+        break;
+
+    case IMAGE_NT_OPTIONAL_HDR64_MAGIC:
+        Module->CheckSum = nt.Pe64.OptionalHeader.CheckSum;
+        dirCount = nt.Pe64.OptionalHeader.NumberOfRvaAndSizes;
+        dir = &nt.Pe64.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG];
+        break;
+
+    default:
+        return;
+    }
+    if (dirCount <= IMAGE_DIRECTORY_ENTRY_DEBUG)
+    {
+        return;
+    }
+
+    for (i = 0; i < min(dir->Size / sizeof(debug), 16); ++i)
+    {
+        if (!ReadProcessMemory(Process, (LPCVOID)(ULONG_PTR)(Module->Base + dir->VirtualAddress + i * sizeof(debug)), &debug, sizeof(debug), &read))
+        {
+            return;
+        }
+        if (debug.Type != IMAGE_DEBUG_TYPE_CODEVIEW)
+        {
+            continue;
+        }
+
+        if (debug.SizeOfData <= DMP_MAX_CV_SIZE &&
+            ReadProcessMemory(Process, (LPCVOID)(ULONG_PTR)(Module->Base + debug.AddressOfRawData), Module->Cv, debug.SizeOfData, &read))
+        {
+            Module->CvSize = debug.SizeOfData;
+        }
+        return;
+    }
+}
+
+//
+// Best effort, a dump without a module list is still a dump
+//
+static
+VOID
+DmpCollectModules(
+    _In_    HANDLE       Process,
+    _Inout_ PDMP_STREAMS Streams
+)
+{
+    HMODULE     *modules = NULL;
+    MODULEINFO  info = { 0 };
+    PDMP_MODULE module = NULL;
+    DWORD       needed = 0;
+    DWORD       count = 0;
+    DWORD       i = 0;
+
+    __try
+    {
+        modules = (HMODULE *)malloc(DMP_MAX_MODULES * sizeof(HMODULE));
+        if (modules == NULL)
+        {
+            LOG_ERROR(0, L"malloc failed");
+            __leave;
+        }
+
+        if (!EnumProcessModulesEx(Process, modules, DMP_MAX_MODULES * sizeof(HMODULE), &needed, LIST_MODULES_ALL))
+        {
+            LOG_WARN(L"EnumProcessModulesEx failed: 0x%08x", GetLastError());
+            __leave;
+        }
+        count = min(needed / sizeof(HMODULE), DMP_MAX_MODULES);
+
+        Streams->Modules = (PDMP_MODULE)calloc(count, sizeof(DMP_MODULE));
+        if (Streams->Modules == NULL)
+        {
+            LOG_ERROR(0, L"calloc failed");
+            __leave;
+        }
+
+        for (i = 0; i < count; ++i)
+        {
+            if (!GetModuleInformation(Process, modules[i], &info, sizeof(info)))
+            {
+                continue;
+            }
+
+            module = &Streams->Modules[Streams->ModuleCount++];
+            module->Base = (ULONG64)(ULONG_PTR)info.lpBaseOfDll;
+            module->Size = info.SizeOfImage;
+            if (!GetModuleFileNameExW(Process, modules[i], module->Name, MAX_PATH))
+            {
+                module->Name[0] = L'\0';
+            }
+            DmpReadImageInfo(Process, module);
+        }
+    }
+    __finally
+    {
+        if (modules != NULL)
+        {
+            free(modules);
+        }
+    }
+}
+
+static
+VOID
+DmpFreeStreams(
+    _Inout_ PDMP_STREAMS Streams
+)
+{
+    if (Streams->Threads != NULL)
+    {
+        free(Streams->Threads);
+    }
+    if (Streams->Modules != NULL)
+    {
+        free(Streams->Modules);
+    }
+    ZeroMemory(Streams, sizeof(*Streams));
+}
+
+//
+// Stack descriptor of a thread: from its stack pointer up to its stack base,
+// pointing into the memory data that already holds it
+//
+static
+VOID
+DmpFindStack(
+    _In_  PDMP_RANGES                   Ranges,
+    _In_  ULONG64                       DataRva,
+    _In_  PDMP_THREAD                   Thread,
+    _Out_ PMINIDUMP_MEMORY_DESCRIPTOR   Stack
+)
+{
+    ULONG64 sp = 0;
+    ULONG64 end = 0;
+    ULONG64 offset = DataRva;
+    DWORD   i = 0;
+
+    ZeroMemory(Stack, sizeof(*Stack));
+
+    if (Thread->ContextSize < sizeof(CONTEXT))
+    {
+        return;
+    }
+    sp = DMP_CONTEXT_SP(Thread->Context);
+    Stack->StartOfMemoryRange = sp;
+
+    for (i = 0; i < Ranges->Count; offset += Ranges->Ranges[i].Size, ++i)
+    {
+        if (sp < Ranges->Ranges[i].Base || sp - Ranges->Ranges[i].Base >= Ranges->Ranges[i].Size)
+        {
+            continue;
+        }
+
+        end = Ranges->Ranges[i].Base + Ranges->Ranges[i].Size;
+        if (Thread->StackBase > sp && Thread->StackBase < end)
+        {
+            end = Thread->StackBase;
+        }
+
+        // only the first 4 GB of a minidump can be pointed at with an RVA,
+        // past that the stack is still in the Memory64 list
+        if (offset + (sp - Ranges->Ranges[i].Base) + (end - sp) <= MAXULONG32)
+        {
+            Stack->Memory.Rva = (RVA)(offset + (sp - Ranges->Ranges[i].Base));
+            Stack->Memory.DataSize = (ULONG32)(end - sp);
+        }
+        return;
+    }
+}
+
+//
+// Header, stream directory, system info, threads, modules and the Memory64
+// descriptors, padded up to where memory data starts (HeaderSize); caller
+// frees Header
+//
+static
+BOOLEAN
+DmpBuildHeader(
+    _In_  PDMP_RANGES  Ranges,
+    _In_  PDMP_STREAMS Streams,
+    _Out_ PBYTE        *Header,
+    _Out_ PDWORD       HeaderSize
+)
+{
+    PBYTE                   buffer = NULL;
+    ULONG64                 size = 0;
+    PMINIDUMP_HEADER        header = NULL;
+    PMINIDUMP_DIRECTORY     dir = NULL;
+    PMINIDUMP_SYSTEM_INFO   sysInfo = NULL;
+    PMINIDUMP_STRING        csdVersion = NULL;
+    PMINIDUMP_THREAD_LIST   threadList = NULL;
+    PMINIDUMP_MODULE_LIST   moduleList = NULL;
+    PMINIDUMP_MEMORY64_LIST memList = NULL;
+    PMINIDUMP_STRING        name = NULL;
+    PDMP_THREAD             thread = NULL;
+    PDMP_MODULE             module = NULL;
+    SYSTEM_INFO             si = { 0 };
+    OSVERSIONINFOEXW        ver = { 0 };
+    RVA                     rva = 0;
+    ULONG64                 tail = 0;
+    DWORD                   i = 0;
+    BOOLEAN                 bOk = FALSE;
+
+    // fixed size parts first, contexts, names and CodeView records after them
+    rva = sizeof(MINIDUMP_HEADER) + DMP_STREAM_COUNT * sizeof(MINIDUMP_DIRECTORY);
+    size = rva + sizeof(MINIDUMP_SYSTEM_INFO) + sizeof(MINIDUMP_STRING) + sizeof(WCHAR) +
+        FIELD_OFFSET(MINIDUMP_THREAD_LIST, Threads) + (ULONG64)Streams->ThreadCount * sizeof(MINIDUMP_THREAD) +
+        FIELD_OFFSET(MINIDUMP_MODULE_LIST, Modules) + (ULONG64)Streams->ModuleCount * sizeof(MINIDUMP_MODULE) +
+        FIELD_OFFSET(MINIDUMP_MEMORY64_LIST, MemoryRanges) + (ULONG64)Ranges->Count * sizeof(MINIDUMP_MEMORY_DESCRIPTOR64);
+    tail = size;
+    for (i = 0; i < Streams->ThreadCount; ++i)
+    {
+        size = DMP_ALIGN(size, 16) + Streams->Threads[i].ContextSize;
+    }
+    for (i = 0; i < Streams->ModuleCount; ++i)
+    {
+        size = DMP_ALIGN(size, 8) + sizeof(MINIDUMP_STRING) + (wcslen(Streams->Modules[i].Name) + 1) * sizeof(WCHAR);
+        size = DMP_ALIGN(size, 8) + Streams->Modules[i].CvSize;
+    }
+    size = DMP_ALIGN(size, DMP_DATA_ALIGNMENT);
+
+    __try
+    {
+        if (size > MAXDWORD)
+        {
+            LOG_ERROR(0, L"header too big: %u ranges, %u threads, %u modules", Ranges->Count, Streams->ThreadCount, Streams->ModuleCount);
+            __leave;
+        }
+
+        buffer = (PBYTE)calloc(1, (size_t)size);
+        if (buffer == NULL)
+        {
+            LOG_ERROR(0, L"calloc failed");
+            __leave;
+        }
+
+        header = (PMINIDUMP_HEADER)buffer;
+        header->Signature = MINIDUMP_SIGNATURE;
+        header->Version = MINIDUMP_VERSION;
+        header->NumberOfStreams = DMP_STREAM_COUNT;
+        header->StreamDirectoryRva = sizeof(MINIDUMP_HEADER);
+        header->TimeDateStamp = (ULONG32)time(NULL);
+        header->Flags = MiniDumpWithFullMemory;
+
+        dir = (PMINIDUMP_DIRECTORY)(buffer + sizeof(MINIDUMP_HEADER));
+
+        // system info, the debugger picks the target architecture from it
+        sysInfo = (PMINIDUMP_SYSTEM_INFO)(buffer + rva);
+        dir[0].StreamType = SystemInfoStream;
+        dir[0].Location.Rva = rva;
+        dir[0].Location.DataSize = sizeof(MINIDUMP_SYSTEM_INFO);
+        rva += sizeof(MINIDUMP_SYSTEM_INFO);
+
+        GetNativeSystemInfo(&si);
+        ver.dwOSVersionInfoSize = sizeof(ver);
+#pragma warning(suppress: 4996)
+        GetVersionExW((LPOSVERSIONINFOW)&ver);
+
+        sysInfo->ProcessorArchitecture = si.wProcessorArchitecture;
+        sysInfo->ProcessorLevel = si.wProcessorLevel;
+        sysInfo->ProcessorRevision = si.wProcessorRevision;
+        sysInfo->NumberOfProcessors = (UCHAR)min(si.dwNumberOfProcessors, MAXUCHAR);
+        sysInfo->ProductType = ver.wProductType;
+        sysInfo->MajorVersion = ver.dwMajorVersion;
+        sysInfo->MinorVersion = ver.dwMinorVersion;
+        sysInfo->BuildNumber = ver.dwBuildNumber;
+        sysInfo->PlatformId = ver.dwPlatformId;
+        sysInfo->SuiteMask = ver.wSuiteMask;
+
+        // empty service pack string
+        csdVersion = (PMINIDUMP_STRING)(buffer + rva);
+        csdVersion->Length = 0;
+        sysInfo->CSDVersionRva = rva;
+        rva += sizeof(MINIDUMP_STRING) + sizeof(WCHAR);
+
+        // threads, their contexts go to the tail
+        threadList = (PMINIDUMP_THREAD_LIST)(buffer + rva);
+        dir[1].StreamType = ThreadListStream;
+        dir[1].Location.Rva = rva;
+        dir[1].Location.DataSize = (ULONG32)(FIELD_OFFSET(MINIDUMP_THREAD_LIST, Threads) + Streams->ThreadCount * sizeof(MINIDUMP_THREAD));
+        rva += dir[1].Location.DataSize;
+
+        threadList->NumberOfThreads = Streams->ThreadCount;
+        for (i = 0; i < Streams->ThreadCount; ++i)
+        {
+            thread = &Streams->Threads[i];
+
+            tail = DMP_ALIGN(tail, 16);
+            CopyMemory(buffer + tail, thread->Context, thread->ContextSize);
+
+            threadList->Threads[i].ThreadId = thread->ThreadId;
+            threadList->Threads[i].SuspendCount = thread->SuspendCount;
+            threadList->Threads[i].Priority = thread->Priority;
+            threadList->Threads[i].Teb = thread->Teb;
+            threadList->Threads[i].ThreadContext.Rva = (RVA)tail;
+            threadList->Threads[i].ThreadContext.DataSize = thread->ContextSize;
+            DmpFindStack(Ranges, size, thread, &threadList->Threads[i].Stack);
+
+            tail += thread->ContextSize;
+        }
+
+        // modules, names and CodeView records go to the tail
+        moduleList = (PMINIDUMP_MODULE_LIST)(buffer + rva);
+        dir[2].StreamType = ModuleListStream;
+        dir[2].Location.Rva = rva;
+        dir[2].Location.DataSize = (ULONG32)(FIELD_OFFSET(MINIDUMP_MODULE_LIST, Modules) + Streams->ModuleCount * sizeof(MINIDUMP_MODULE));
+        rva += dir[2].Location.DataSize;
+
+        moduleList->NumberOfModules = Streams->ModuleCount;
+        for (i = 0; i < Streams->ModuleCount; ++i)
+        {
+            module = &Streams->Modules[i];
+
+            tail = DMP_ALIGN(tail, 8);
+            name = (PMINIDUMP_STRING)(buffer + tail);
+            name->Length = (ULONG32)(wcslen(module->Name) * sizeof(WCHAR));
+            CopyMemory(name->Buffer, module->Name, name->Length + sizeof(WCHAR));
+
+            moduleList->Modules[i].BaseOfImage = module->Base;
+            moduleList->Modules[i].SizeOfImage = module->Size;
+            moduleList->Modules[i].CheckSum = module->CheckSum;
+            moduleList->Modules[i].TimeDateStamp = module->TimeDateStamp;
+            moduleList->Modules[i].ModuleNameRva = (RVA)tail;
+            tail += sizeof(MINIDUMP_STRING) + name->Length + sizeof(WCHAR);
+
+            tail = DMP_ALIGN(tail, 8);
+            if (module->CvSize != 0)
+            {
+                CopyMemory(buffer + tail, module->Cv, module->CvSize);
+                moduleList->Modules[i].CvRecord.Rva = (RVA)tail;
+                moduleList->Modules[i].CvRecord.DataSize = module->CvSize;
+                tail += module->CvSize;
+            }
+        }
+
+        // memory, data for all ranges follows back to back starting at BaseRva
+        memList = (PMINIDUMP_MEMORY64_LIST)(buffer + rva);
+        dir[3].StreamType = Memory64ListStream;
+        dir[3].Location.Rva = rva;
+        dir[3].Location.DataSize = (ULONG32)(FIELD_OFFSET(MINIDUMP_MEMORY64_LIST, MemoryRanges) + Ranges->Count * sizeof(MINIDUMP_MEMORY_DESCRIPTOR64));
+
+        memList->NumberOfMemoryRanges = Ranges->Count;
+        memList->BaseRva = size;
+        for (i = 0; i < Ranges->Count; ++i)
+        {
+            memList->MemoryRanges[i].StartOfMemoryRange = Ranges->Ranges[i].Base;
+            memList->MemoryRanges[i].DataSize = Ranges->Ranges[i].Size;
+        }
+
+        *Header = buffer;
+        *HeaderSize = (DWORD)size;
+        buffer = NULL;
+        bOk = TRUE;
+    }
+    __finally
+    {
+        if (buffer != NULL)
+        {
+            free(buffer);
+        }
+    }
+
+    return bOk;
+}
+
+//
+// Reads Size bytes at Base; pages that went away since DmpCollectRanges are zero filled
+//
+// returns number of unreadable pages
+static
+DWORD
+DmpReadMemory(
+    _In_  HANDLE  Process,
+    _In_  ULONG64 Base,
+    _Out_ PBYTE   Buffer,
+    _In_  DWORD   Size
+)
+{
+    SIZE_T  read = 0;
+    DWORD   offset = 0;
+    DWORD   missing = 0;
+
+    if (ReadProcessMemory(Process, (LPCVOID)(ULONG_PTR)Base, Buffer, Size, &read) && read == Size)
+    {
+        return 0;
+    }
+
+    // partial copy, go page by page
+    for (offset = 0; offset < Size; offset += DMP_PAGE_SIZE)
+    {
+        if (!ReadProcessMemory(Process, (LPCVOID)(ULONG_PTR)(Base + offset), Buffer + offset, DMP_PAGE_SIZE, &read) ||
+            read != DMP_PAGE_SIZE)
+        {
+            ZeroMemory(Buffer + offset, DMP_PAGE_SIZE);
+            ++missing;
+        }
+    }
+
+    return missing;
+}
+
+static
+BOOLEAN
+DmpWriteAt(
+    _In_ HANDLE  File,
+    _In_ ULONG64 Offset,
+    _In_ PVOID   Buffer,
+    _In_ DWORD   Size
+)
+{
+    OVERLAPPED  ovlp = { 0 };
+    DWORD       written = 0;
+    BOOLEAN     bOk = FALSE;
+
+    // the file is overlapped so the workers' writes don't queue up behind
+    // each other on the handle; an event of its own per call keeps the waits apart
+    ovlp.Offset = (DWORD)Offset;
+    ovlp.OffsetHigh = (DWORD)(Offset >> 32);
+    ovlp.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (ovlp.hEvent == NULL)
+    {
+        LOG_ERROR(GetLastError(), L"CreateEvent failed");
+        return FALSE;
+    }
+
+    if ((WriteFile(File, Buffer, Size, NULL, &ovlp) || GetLastError() == ERROR_IO_PENDING) &&
+        GetOverlappedResult(File, &ovlp, &written, TRUE) && written == Size)
+    {
+        bOk = TRUE;
+    }
+    else
+    {
+        LOG_ERROR(GetLastError(), L"WriteFile at %I64u failed", Offset);
+    }
+
+    CloseHandle(ovlp.hEvent);
+
+    return bOk;
+}
+
+//
+// Best effort, on a file system without sparse files zero pages just get written
+//
+static
+BOOLEAN
+DmpSetSparse(
+    _In_ HANDLE File
+)
+{
+    OVERLAPPED  ovlp = { 0 };
+    DWORD       bytes = 0;
+    BOOLEAN     bOk = FALSE;
+
+    ovlp.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (ovlp.hEvent == NULL)
+    {
+        return FALSE;
+    }
+
+    if (DeviceIoControl(File, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, NULL, &ovlp) || GetLastError() == ERROR_IO_PENDING)
+    {
+        bOk = (BOOLEAN)GetOverlappedResult(File, &ovlp, &bytes, TRUE);
+    }
+
+    CloseHandle(ovlp.hEvent);
+
+    return bOk;
+}
+
+//
+// Builds the DMPZ payload of Size bytes of Data (raw minidump offset RawOffset,
+// process address Va, 0 for the minidump header) in Worker->Payload; records
+// the hash of every memory page
+//
+// returns payload size
+static
+DWORD
+DmpBuildPayload(
+    _Inout_ PDMP_WORKER Worker,
+    _In_    ULONG64     RawOffset,
+    _In_    ULONG64     Va,
+    _In_    PBYTE       Data,
+    _In_    DWORD       Size
+)
+{
+    PDMP_JOB        job = Worker->Job;
+    PULONG64        map = (PULONG64)Worker->Payload;
+    PBYTE           out = Worker->Payload + DMPZ_MAP_SIZE(Size);
+    PBYTE           page = NULL;
+    PPAGE_HASH      hashes = NULL;
+    PAGE_HASH       baseHash = { 0 };
+    BYTE            basePage[DMP_PAGE_SIZE];
+    PAGE_DIGEST     digest = { 0 };
+    BOOLEAN         bDigest = FALSE;
+    ULONG64         ref = 0;
+    DWORD           i = 0;
+
+    if (Va != 0)
+    {
+        hashes = &job->Hashes[(RawOffset - job->DataRva) / DMP_PAGE_SIZE];
+    }
+
+    for (i = 0; i < Size / DMP_PAGE_SIZE; ++i)
+    {
+        page = Data + i * DMP_PAGE_SIZE;
+
+        if (PgIsZero(page))
+        {
+            map[i] = DMPZ_PAGE_ZERO;
+            Worker->ZeroPages++;
+            if (hashes != NULL)
+            {
+                ZeroMemory(&hashes[i], sizeof(PAGE_HASH));
+            }
+            continue;
+        }
+
+        // one hash per page: the digest finds duplicates, its first half is
+        // the page hash deltas look the base up by
+        bDigest = PgDigest(page, &digest);
+
+        if (hashes != NULL)
+        {
+            // keep {0, 0} for zero pages; without a digest the page gets {1, 0},
+            // a candidate only for base pages that had no digest either
+            hashes[i].Lo = (bDigest ? digest.Words[0] : 0) | 1;
+            hashes[i].Hi = bDigest ? digest.Words[1] : 0;
+
+            // the hash only finds the candidate, the bytes decide
+            if (job->Base != NULL &&
+                DmzPageHash(job->Base, Va + i * DMP_PAGE_SIZE, &baseHash) &&
+                baseHash.Lo == hashes[i].Lo && baseHash.Hi == hashes[i].Hi &&
+                DmzReadVa(Worker->Base, Va + i * DMP_PAGE_SIZE, basePage, DMP_PAGE_SIZE) &&
+                memcmp(basePage, page, DMP_PAGE_SIZE) == 0)
+            {
+                map[i] = DMPZ_PAGE_BASE;
+                Worker->BasePages++;
+                continue;
+            }
+        }
+
+        // raw offset 0 can't be a reference, it reads as DMPZ_PAGE_ZERO;
+        // the page hash isn't enough to stand for the bytes, the digest is
+        ref = 0;
+        if (RawOffset + i * DMP_PAGE_SIZE != 0 && bDigest)
+        {
+            ref = PgTableFindOrInsert(&job->Pages, &digest, RawOffset + i * DMP_PAGE_SIZE);
+        }
+        if (ref != 0)
+        {
+            map[i] = ref;
+            Worker->DupPages++;
+            continue;
+        }
+
+        map[i] = DMPZ_PAGE_DATA;
+        CopyMemory(out, page, DMP_PAGE_SIZE);
+        out += DMP_PAGE_SIZE;
+    }
+
+    return (DWORD)(out - Worker->Payload);
+}
+
+//
+// Compresses Size bytes of Data (raw minidump offset RawOffset, address Va)
+// into the next free spot of the file and fills its index entry
+//
+static
+BOOLEAN
+DmpWriteFrame(
+    _Inout_ PDMP_WORKER Worker,
+    _In_    DWORD       Frame,
+    _In_    ULONG64     RawOffset,
+    _In_    ULONG64     Va,
+    _In_    PBYTE       Data,
+    _In_    DWORD       Size
+)
+{
+    PDMP_JOB        job = Worker->Job;
+    PDMPZ_FRAME     frame = &job->Frames[Frame];
+    PBYTE           out = Worker->Payload;
+    DWORD           payload = 0;
+    SIZE_T          packed = 0;
+    LARGE_INTEGER   start = { 0 };
+    LARGE_INTEGER   end = { 0 };
+
+    QueryPerformanceCounter(&start);
+    payload = DmpBuildPayload(Worker, RawOffset, Va, Data, Size);
+    QueryPerformanceCounter(&end);
+    Worker->ScanTicks += end.QuadPart - start.QuadPart;
+
+    QueryPerformanceCounter(&start);
+
+    // keep it raw if it doesn't get smaller (or doesn't fit, which is the same)
+    if (Compress(Worker->Compressor, Worker->Payload, payload, Worker->Packed, payload, &packed) && packed < payload)
+    {
+        out = Worker->Packed;
+    }
+    else
+    {
+        packed = payload;
+    }
+
+    QueryPerformanceCounter(&end);
+    Worker->CompressTicks += end.QuadPart - start.QuadPart;
+
+    frame->RawOffset = RawOffset;
+    frame->RawSize = Size;
+    frame->PayloadSize = payload;
+    frame->PackedSize = (ULONG)packed;
+    frame->FileOffset = (ULONG64)InterlockedExchangeAdd64(&job->FileTail, (LONG64)packed);
+
+    QueryPerformanceCounter(&start);
+    if (!DmpWriteAt(job->File, frame->FileOffset, out, (DWORD)packed))
+    {
+        return FALSE;
+    }
+    QueryPerformanceCounter(&end);
+    Worker->WriteTicks += end.QuadPart - start.QuadPart;
+
+    Worker->PackedBytes += packed;
+
+    return TRUE;
+}
+
+//
+// Plain minidump on a sparse file: writes the runs of non zero pages of a
+// chunk, zero pages stay holes (the file was sized up front, holes read as zero)
+//
+static
+BOOLEAN
+DmpWriteSparse(
+    _Inout_ PDMP_WORKER Worker,
+    _In_    ULONG64     FileOffset,
+    _In_    PBYTE       Data,
+    _In_    DWORD       Size
+)
+{
+    LARGE_INTEGER   start = { 0 };
+    LARGE_INTEGER   end = { 0 };
+    DWORD           run = 0;
+    DWORD           i = 0;
+    DWORD           pages = Size / DMP_PAGE_SIZE;
+
+    for (i = 0; i <= pages; ++i)
+    {
+        QueryPerformanceCounter(&start);
+        if (i < pages && !PgIsZero(Data + i * DMP_PAGE_SIZE))
+        {
+            QueryPerformanceCounter(&end);
+            Worker->ScanTicks += end.QuadPart - start.QuadPart;
+            continue;
+        }
+        QueryPerformanceCounter(&end);
+        Worker->ScanTicks += end.QuadPart - start.QuadPart;
+
+        // page i is zero (or past the end), flush [run, i)
+        if (i > run)
+        {
+            QueryPerformanceCounter(&start);
+            if (!DmpWriteAt(Worker->Job->File, FileOffset + run * DMP_PAGE_SIZE, Data + run * DMP_PAGE_SIZE, (i - run) * DMP_PAGE_SIZE))
+            {
+                return FALSE;
+            }
+            QueryPerformanceCounter(&end);
+            Worker->WriteTicks += end.QuadPart - start.QuadPart;
+            Worker->PackedBytes += (i - run) * DMP_PAGE_SIZE;
+        }
+        if (i < pages)
+        {
+            Worker->ZeroPages++;
+        }
+        run = i + 1;
+    }
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+DmpBuildChunks(
+    _In_  PDMP_RANGES Ranges,
+    _In_  ULONG64     DataRva,
+    _Out_ PDMP_JOB    Job
+)
+{
+    ULONG64 chunkCount = 0;
+    ULONG64 offset = 0;
+    ULONG64 fileOffset = DataRva;
+    DWORD   i = 0;
+    DWORD   c = 0;
+
+    for (i = 0; i < Ranges->Count; ++i)
+    {
+        chunkCount += (Ranges->Ranges[i].Size + Job->BufferSize - 1) / Job->BufferSize;
+    }
+    if (chunkCount > MAXLONG)
+    {
+        LOG_ERROR(0, L"too many chunks: %I64u", chunkCount);
+        return FALSE;
+    }
+
+    Job->Chunks = (PDMP_CHUNK)malloc((size_t)chunkCount * sizeof(DMP_CHUNK));
+    if (Job->Chunks == NULL && chunkCount != 0)
+    {
+        LOG_ERROR(0, L"malloc failed");
+        return FALSE;
+    }
+    Job->ChunkCount = (DWORD)chunkCount;
+
+    for (i = 0; i < Ranges->Count; ++i)
+    {
+        for (offset = 0; offset < Ranges->Ranges[i].Size; offset += Job->BufferSize, ++c)
+        {
+            Job->Chunks[c].Base = Ranges->Ranges[i].Base + offset;
+            Job->Chunks[c].Size = (DWORD)min(Ranges->Ranges[i].Size - offset, Job->BufferSize);
+            Job->Chunks[c].FileOffset = fileOffset;
+            fileOffset += Job->Chunks[c].Size;
+        }
+    }
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+DmpTakeChunk(
+    _Inout_ PDMP_WORKER Worker,
+    _Out_   PDWORD      Chunk
+)
+{
+    LONG64 work = 0;
+
+    for EVER
+    {
+        work = Worker->Work;
+        if (DMP_WORK_NEXT(work) >= DMP_WORK_END(work))
+        {
+            return FALSE;
+        }
+
+        if (InterlockedCompareExchange64(&Worker->Work, DMP_WORK(DMP_WORK_NEXT(work) + 1, DMP_WORK_END(work)), work) == work)
+        {
+            *Chunk = DMP_WORK_NEXT(work);
+            return TRUE;
+        }
+    }
+}
+
+//
+// Moves the back half of the busiest worker interval to Worker
+//
+// returns FALSE once there is nothing left anywhere
+static
+BOOLEAN
+DmpSteal(
+    _Inout_ PDMP_WORKER Worker
+)
+{
+    PDMP_JOB    job = Worker->Job;
+    PDMP_WORKER victim = NULL;
+    LONG64      work = 0;
+    DWORD       left = 0;
+    DWORD       most = 0;
+    DWORD       half = 0;
+    DWORD       i = 0;
+
+    for EVER
+    {
+        victim = NULL;
+        most = 0;
+        for (i = 0; i < job->WorkerCount; ++i)
+        {
+            work = job->Workers[i].Work;
+            left = DMP_WORK_END(work) - min(DMP_WORK_NEXT(work), DMP_WORK_END(work));
+            if (left > most)
+            {
+                most = left;
+                victim = &job->Workers[i];
+            }
+        }
+
+        if (victim == NULL)
+        {
+            return FALSE;
+        }
+
+        work = victim->Work;
+        if (DMP_WORK_NEXT(work) >= DMP_WORK_END(work))
+        {
+            continue;
+        }
+
+        half = (DMP_WORK_END(work) - DMP_WORK_NEXT(work) + 1) / 2;
+        if (InterlockedCompareExchange64(&victim->Work, DMP_WORK(DMP_WORK_NEXT(work), DMP_WORK_END(work) - half), work) == work)
+        {
+            // ours is empty, so nobody else is trying to steal from it
+            InterlockedExchange64(&Worker->Work, DMP_WORK(DMP_WORK_END(work) - half, DMP_WORK_END(work)));
+            Worker->Steals++;
+            return TRUE;
+        }
+    }
+}
+
+static
+BOOLEAN
+DmpStoreChunk(
+    _Inout_ PDMP_WORKER Worker,
+    _In_    DWORD       Index,
+    _In_    PBYTE       Data
+)
+{
+    PDMP_JOB        job = Worker->Job;
+    PDMP_CHUNK      chunk = &job->Chunks[Index];
+    LARGE_INTEGER   start = { 0 };
+    LARGE_INTEGER   end = { 0 };
+    BOOLEAN         bOk = FALSE;
+
+    if (job->Flags & DMP_FLAG_COMPRESS)
+    {
+        bOk = DmpWriteFrame(Worker, job->HeaderFrames + Index, chunk->FileOffset, chunk->Base, Data, chunk->Size);
+    }
+    else if (job->Sparse)
+    {
+        bOk = DmpWriteSparse(Worker, chunk->FileOffset, Data, chunk->Size);
+    }
+    else
+    {
+        QueryPerformanceCounter(&start);
+        bOk = DmpWriteAt(job->File, chunk->FileOffset, Data, chunk->Size);
+        QueryPerformanceCounter(&end);
+        Worker->WriteTicks += end.QuadPart - start.QuadPart;
+        Worker->PackedBytes += chunk->Size;
+    }
+    if (!bOk)
+    {
+        InterlockedExchange(&job->Failed, TRUE);
+        return FALSE;
+    }
+
+    Worker->Bytes += chunk->Size;
+    Worker->Chunks++;
+
+    return TRUE;
+}
+
+static
+DWORD WINAPI
+DmpWorker(
+    LPVOID lpParam
+)
+{
+    PDMP_WORKER     worker = (PDMP_WORKER)lpParam;
+    PDMP_JOB        job = worker->Job;
+    PDMP_CHUNK      chunk = NULL;
+    DWORD           index = 0;
+    LARGE_INTEGER   start = { 0 };
+    LARGE_INTEGER   end = { 0 };
+
+    while (!job->Failed)
+    {
+        if (!DmpTakeChunk(worker, &index))
+        {
+            if (!DmpSteal(worker))
+            {
+                break;
+            }
+            continue;
+        }
+
+        chunk = &job->Chunks[index];
+
+        QueryPerformanceCounter(&start);
+        worker->Missing += DmpReadMemory(job->Process, chunk->Base, worker->Buffer, chunk->Size);
+        QueryPerformanceCounter(&end);
+        worker->ReadTicks += end.QuadPart - start.QuadPart;
+
+        if (!DmpStoreChunk(worker, index, worker->Buffer))
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static
+BOOLEAN
+DmpInitSlots(
+    _Inout_ PDMP_WORKER Worker
+)
+{
+    DWORD   i = 0;
+    DWORD   j = 0;
+
+    // the first slot reuses the worker buffer
+    Worker->Slots[0].Buffer = Worker->Buffer;
+    Worker->Slots[1].Buffer = (PBYTE)VirtualAlloc(NULL, Worker->Job->BufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (Worker->Slots[1].Buffer == NULL)
+    {
+        LOG_ERROR(GetLastError(), L"VirtualAlloc failed");
+        return FALSE;
+    }
+
+    for (i = 0; i < ARRAYSIZE(Worker->Slots); ++i)
+    {
+        Worker->Slots[i].Chunk = MAXDWORD;
+        for (j = 0; j < DMP_DRV_MAX_READS; ++j)
+        {
+            Worker->Slots[i].Ovlp[j].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+            if (Worker->Slots[i].Ovlp[j].hEvent == NULL)
+            {
+                LOG_ERROR(GetLastError(), L"CreateEvent failed");
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+DmpFreeSlots(
+    _Inout_ PDMP_WORKER Worker
+)
+{
+    DWORD   i = 0;
+    DWORD   j = 0;
+
+    for (i = 0; i < ARRAYSIZE(Worker->Slots); ++i)
+    {
+        for (j = 0; j < DMP_DRV_MAX_READS; ++j)
+        {
+            if (Worker->Slots[i].Ovlp[j].hEvent != NULL)
+            {
+                CloseHandle(Worker->Slots[i].Ovlp[j].hEvent);
+            }
+        }
+    }
+    if (Worker->Slots[1].Buffer != NULL)
+    {
+        VirtualFree(Worker->Slots[1].Buffer, 0, MEM_RELEASE);
+    }
+
+    return;
+}
+
+static
+BOOLEAN
+DmpPostRead(
+    _In_    PDMP_JOB    Job,
+    _Inout_ POVERLAPPED Ovlp,
+    _In_    ULONG64     Va,
+    _Out_   PBYTE       Buffer,
+    _In_    DWORD       Size
+)
+{
+    IOC_READ_REQUEST    request = { 0 };
+
+    // the request is copied by the I/O manager, the buffer is locked in place
+    // until the IRP completes
+    request.ProcessId = Job->ProcessId;
+    request.Address = Va;
+
+    if (!DeviceIoControl(Job->Device, IOCTL_READ_PROCESS_MEMORY, &request, sizeof(request), Buffer, Size, NULL, Ovlp) &&
+        GetLastError() != ERROR_IO_PENDING)
+    {
+        LOG_ERROR(GetLastError(), L"DeviceIoControl(IOCTL_READ_PROCESS_MEMORY) failed");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+DmpPostSlot(
+    _Inout_ PDMP_WORKER    Worker,
+    _Inout_ PDMP_READ_SLOT Slot,
+    _In_    DWORD          Index
+)
+{
+    PDMP_JOB    job = Worker->Job;
+    PDMP_CHUNK  chunk = &job->Chunks[Index];
+    DWORD       offset = 0;
+    DWORD       i = 0;
+
+    Slot->Chunk = Index;
+    Slot->Reads = (chunk->Size + DMP_DRV_READ_SIZE - 1) / DMP_DRV_READ_SIZE;
+
+    for (i = 0; i < Slot->Reads; ++i)
+    {
+        offset = i * DMP_DRV_READ_SIZE;
+        Slot->Posted[i] = DmpPostRead(job, &Slot->Ovlp[i], chunk->Base + offset, Slot->Buffer + offset,
+            min(DMP_DRV_READ_SIZE, chunk->Size - offset));
+        if (!Slot->Posted[i])
+        {
+            InterlockedExchange(&job->Failed, TRUE);
+        }
+    }
+
+    return;
+}
+
+static
+BOOLEAN
+DmpWaitSlot(
+    _Inout_ PDMP_WORKER    Worker,
+    _Inout_ PDMP_READ_SLOT Slot
+)
+{
+    PDMP_JOB    job = Worker->Job;
+    PDMP_CHUNK  chunk = &job->Chunks[Slot->Chunk];
+    DWORD       offset = 0;
+    DWORD       size = 0;
+    DWORD       done = 0;
+    DWORD       i = 0;
+    BOOLEAN     bOk = TRUE;
+
+    // every posted read is waited for, even after a failure, the driver
+    // writes into Slot->Buffer until it completes
+    for (i = 0; i < Slot->Reads; ++i)
+    {
+        offset = i * DMP_DRV_READ_SIZE;
+        size = min(DMP_DRV_READ_SIZE, chunk->Size - offset);
+
+        while (Slot->Posted[i])
+        {
+            Slot->Posted[i] = FALSE;
+
+            if (!GetOverlappedResult(job->Device, &Slot->Ovlp[i], &done, TRUE))
+            {
+                LOG_ERROR(GetLastError(), L"IOCTL_READ_PROCESS_MEMORY(%I64x) failed", chunk->Base + offset);
+                bOk = FALSE;
+                break;
+            }
+            if (done >= size || job->Failed)
+            {
+                break;
+            }
+
+            // the driver stopped at a page it could not read, skip it and
+            // ask again for the rest
+            ZeroMemory(Slot->Buffer + offset + done, DMP_PAGE_SIZE);
+            ++Worker->Missing;
+
+            offset += done + DMP_PAGE_SIZE;
+            size -= done + DMP_PAGE_SIZE;
+            if (size != 0)
+            {
+                Slot->Posted[i] = DmpPostRead(job, &Slot->Ovlp[i], chunk->Base + offset, Slot->Buffer + offset, size);
+                bOk = bOk && Slot->Posted[i];
+            }
+        }
+    }
+
+    Slot->Chunk = MAXDWORD;
+    if (!bOk)
+    {
+        InterlockedExchange(&job->Failed, TRUE);
+    }
+
+    return bOk;
+}
+
+static
+DWORD WINAPI
+DmpDriverWorker(
+    LPVOID lpParam
+)
+{
+    PDMP_WORKER     worker = (PDMP_WORKER)lpParam;
+    PDMP_JOB        job = worker->Job;
+    PDMP_READ_SLOT  slot = NULL;
+    DWORD           current = 0;
+    DWORD           index = 0;
+    DWORD           chunk = 0;
+    LARGE_INTEGER   start = { 0 };
+    LARGE_INTEGER   end = { 0 };
+
+    //
+    // Double buffered: the driver fills the next chunk while the current one
+    // is compressed and written, so neither the disk nor the target waits on
+    // the other. ReadTicks is only the time spent blocked on the driver.
+    //
+    for EVER
+    {
+        if (!job->Failed && worker->Slots[current ^ 1].Chunk == MAXDWORD)
+        {
+            while (!DmpTakeChunk(worker, &index))
+            {
+                if (!DmpSteal(worker))
+                {
+                    index = MAXDWORD;
+                    break;
+                }
+            }
+            if (index != MAXDWORD)
+            {
+                DmpPostSlot(worker, &worker->Slots[current ^ 1], index);
+            }
+        }
+
+        slot = &worker->Slots[current];
+        current ^= 1;
+
+        if (slot->Chunk == MAXDWORD)
+        {
+            if (worker->Slots[current].Chunk == MAXDWORD)
+            {
+                break;
+            }
+            continue;
+        }
+
+        chunk = slot->Chunk;
+
+        QueryPerformanceCounter(&start);
+        if (!DmpWaitSlot(worker, slot))
+        {
+            continue;
+        }
+        QueryPerformanceCounter(&end);
+        worker->ReadTicks += end.QuadPart - start.QuadPart;
+
+        if (!job->Failed)
+        {
+            DmpStoreChunk(worker, chunk, slot->Buffer);
+        }
+    }
+
+    return 0;
+}
+
+static
+VOID
+DmpReportWorkers(
+    _In_ PDMP_JOB Job,
+    _In_ double   Seconds
+)
+{
+    LARGE_INTEGER   freq = { 0 };
+    PDMP_WORKER     worker = NULL;
+    double          busy = 0;
+    double          sum = 0;
+    double          readSec = 0;
+    double          scanSec = 0;
+    double          compressSec = 0;
+    double          writeSec = 0;
+    ULONG64         bytes = 0;
+    ULONG64         packed = 0;
+    ULONG64         zero = 0;
+    ULONG64         dup = 0;
+    ULONG64         base = 0;
+    DWORD           i = 0;
+
+    QueryPerformanceFrequency(&freq);
+
+    for (i = 0; i < Job->WorkerCount; ++i)
+    {
+        worker = &Job->Workers[i];
+        busy = (double)(worker->ReadTicks + worker->ScanTicks + worker->CompressTicks + worker->WriteTicks) / freq.QuadPart;
+        sum += busy > 0 ? (worker->Bytes >> 20) / busy : 0;
+
+        readSec += (double)worker->ReadTicks / freq.QuadPart;
+        scanSec += (double)worker->ScanTicks / freq.QuadPart;
+        compressSec += (double)worker->CompressTicks / freq.QuadPart;
+        writeSec += (double)worker->WriteTicks / freq.QuadPart;
+        bytes += worker->Bytes;
+        packed += worker->PackedBytes;
+        zero += worker->ZeroPages;
+        dup += worker->DupPages;
+        base += worker->BasePages;
+
+        LOG_INFO(L"  thread %u: %I64u MB, %u chunks, %u steals, %.0f MB/s busy, %.0f%% busy",
+            i, worker->Bytes >> 20, worker->Chunks, worker->Steals,
+            busy > 0 ? (worker->Bytes >> 20) / busy : 0,
+            Seconds > 0 ? 100 * busy / Seconds : 0);
+    }
+
+    // how far the total is from every thread running at its own speed
+    LOG_INFO(L"  sum of thread rates: %.0f MB/s", sum);
+
+    // per thread rate of every stage; compress is raw MB in, write is MB out
+    LOG_INFO(L"  stage MB/s: read %.0f, scan %.0f, compress %.0f, write %.0f",
+        readSec > 0 ? (bytes >> 20) / readSec : 0,
+        scanSec > 0 ? (bytes >> 20) / scanSec : 0,
+        compressSec > 0 ? (bytes >> 20) / compressSec : 0,
+        writeSec > 0 ? (packed >> 20) / writeSec : 0);
+
+    // the page check (zero test, digest, base lookup) only pays when it costs
+    // less per raw MB than writing the pages it saves would
+    LOG_INFO(L"  page check %.0f MB/s vs write %.0f MB/s: %.2f s checking, %.2f s writing",
+        scanSec > 0 ? (bytes >> 20) / scanSec : 0,
+        writeSec > 0 ? (packed >> 20) / writeSec : 0,
+        scanSec, writeSec);
+
+    LOG_INFO(L"  %I64u zero pages, %I64u duplicate pages (%I64u MB not written)",
+        zero, dup, ((zero + dup) * DMP_PAGE_SIZE) >> 20);
+
+    if (Job->Base != NULL)
+    {
+        LOG_INFO(L"  %I64u pages unchanged since the base (%I64u MB not written)",
+            base, (base * DMP_PAGE_SIZE) >> 20);
+    }
+
+    if (Job->Flags & DMP_FLAG_COMPRESS)
+    {
+        LOG_INFO(L"  compressed %I64u MB -> %I64u MB (%.2f:1)",
+            bytes >> 20, packed >> 20, packed > 0 ? (double)bytes / packed : 0);
+    }
+}
+
+//
+// DMPZ only: frames the minidump header, then after the workers are done,
+// writes the page hashes, the frame index and the container header
+//
+static
+BOOLEAN
+DmpWriteHeaderFrames(
+    _Inout_ PDMP_JOB Job,
+    _In_    PBYTE    Header,
+    _In_    DWORD    HeaderSize
+)
+{
+    DWORD offset = 0;
+    DWORD frame = 0;
+
+    for (offset = 0; offset < HeaderSize; offset += Job->BufferSize, ++frame)
+    {
+        if (!DmpWriteFrame(&Job->Workers[0], frame, offset, 0, Header + offset, min(HeaderSize - offset, Job->BufferSize)))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+DmpWriteIndex(
+    _Inout_ PDMP_JOB Job,
+    _In_    ULONG64  RawSize
+)
+{
+    PDMPZ_HEADER header = &Job->Header;
+    DWORD        frameCount = Job->HeaderFrames + Job->ChunkCount;
+    ULONG64      offset = 0;
+    ULONG64      size = Job->HashCount * sizeof(PAGE_HASH);
+    DWORD        part = 0;
+
+    header->Signature = DMPZ_SIGNATURE;
+    header->Version = DMPZ_VERSION;
+    header->Algorithm = DMPZ_ALGORITHM;
+    header->FrameCount = frameCount;
+    header->RawSize = RawSize;
+    header->HashCount = Job->HashCount;
+    header->HashOffset = (ULONG64)Job->FileTail;
+    header->IndexOffset = header->HashOffset + size;
+
+    if ((ULONG64)frameCount * sizeof(DMPZ_FRAME) > MAXDWORD)
+    {
+        LOG_ERROR(0, L"too many frames: %u", frameCount);
+        return FALSE;
+    }
+
+    for (offset = 0; offset < size; offset += part)
+    {
+        part = (DWORD)min(size - offset, DMP_IO_CHUNK_SIZE);
+        if (!DmpWriteAt(Job->File, header->HashOffset + offset, (PBYTE)Job->Hashes + offset, part))
+        {
+            return FALSE;
+        }
+    }
+
+    return DmpWriteAt(Job->File, header->IndexOffset, Job->Frames, frameCount * sizeof(DMPZ_FRAME)) &&
+        DmpWriteAt(Job->File, 0, header, sizeof(*header));
+}
+
+//
+// Opens the base of a delta and fills the header fields naming it
+//
+static
+BOOLEAN
+DmpOpenBase(
+    _Inout_ PDMP_JOB Job,
+    _In_    DWORD    ProcessId,
+    _In_    PCWSTR   BaseFileName
+)
+{
+    if (!GetFullPathName(BaseFileName, MAX_PATH, Job->Header.BaseName, NULL))
+    {
+        LOG_ERROR(GetLastError(), L"GetFullPathName(%s) failed", BaseFileName);
+        return FALSE;
+    }
+
+    if (!DmzOpen(Job->Header.BaseName, &Job->Base) || !DmzLoadHashes(Job->Base))
+    {
+        return FALSE;
+    }
+
+    // a delta against another process is still right, just not much smaller
+    if (Job->Base->Header.ProcessId != ProcessId)
+    {
+        LOG_WARN(L"%s is a dump of pid %u, not %u", BaseFileName, Job->Base->Header.ProcessId, ProcessId);
+    }
+
+    Job->Header.BaseId = Job->Base->Header.DumpId;
+
+    return TRUE;
+}
+
+BOOLEAN
+DmpDumpProcess(
+    _In_ DWORD        ProcessId,
+    _In_ PCWSTR       FileName,
+    _In_ PDMP_OPTIONS Options
+)
+{
+    HANDLE          file = INVALID_HANDLE_VALUE;
+    HANDLE          threads[DMP_MAX_THREADS];
+    DWORD           threadCount = 0;
+    DMP_RANGES      ranges = { 0 };
+    DMP_STREAMS     streams = { 0 };
+    DMP_JOB         job = { 0 };
+    DWORD           flags = Options->Flags;
+    PBYTE           header = NULL;
+    DWORD           headerSize = 0;
+    ULONG64         missing = 0;
+    ULONG64         written = 0;
+    DWORD           share = 0;
+    DWORD           i = 0;
+    LARGE_INTEGER   start = { 0 };
+    LARGE_INTEGER   end = { 0 };
+    LARGE_INTEGER   freq = { 0 };
+    FILE_END_OF_FILE_INFO fileSize = { 0 };
+    FILETIME        now = { 0 };
+    double          seconds = 0;
+    BOOLEAN         bOk = FALSE;
+
+    if (Options->ThreadCount == 0 || Options->ThreadCount > DMP_MAX_THREADS)
+    {
+        LOG_WARN(L"thread count %u not in 1..%u", Options->ThreadCount, DMP_MAX_THREADS);
+        return FALSE;
+    }
+
+    // chunks never straddle a page, nor a DMPZ frame limit
+    if (Options->BufferSize < DMP_MIN_BUFFER_SIZE || Options->BufferSize > DMP_IO_CHUNK_SIZE ||
+        (Options->BufferSize & (Options->BufferSize - 1)) != 0)
+    {
+        LOG_WARN(L"buffer size %u KB not a power of 2 in %u..%u KB",
+            Options->BufferSize >> 10, DMP_MIN_BUFFER_SIZE >> 10, DMP_IO_CHUNK_SIZE >> 10);
+        return FALSE;
+    }
+
+    // the driver reads the target itself, there is no clone for it to read
+    if (Options->Device != NULL && (Options->Flags & DMP_FLAG_LIVE))
+    {
+        LOG_WARN(L"a live dump cannot be read through the driver");
+        return FALSE;
+    }
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    if (Options->BaseFileName != NULL)
+    {
+        flags |= DMP_FLAG_COMPRESS;
+    }
+    job.Flags = flags;
+    job.BufferSize = Options->BufferSize;
+    job.Device = Options->Device;
+    job.ProcessId = ProcessId;
+
+    __try
+    {
+        if (Options->BaseFileName != NULL && !DmpOpenBase(&job, ProcessId, Options->BaseFileName))
+        {
+            __leave;
+        }
+
+        job.Target = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ | ((flags & DMP_FLAG_LIVE) ? PROCESS_CREATE_PROCESS : 0),
+            FALSE, ProcessId);
+        if (job.Target == NULL)
+        {
+            LOG_ERROR(GetLastError(), L"OpenProcess(%u) failed", ProcessId);
+            __leave;
+        }
+        job.Process = job.Target;
+
+        // without a clone to read from, threads are just not listed
+        if (!DmpCaptureProcess(&job, Options->FreezeWarning, &streams) && (flags & DMP_FLAG_LIVE))
+        {
+            __leave;
+        }
+        DmpCollectModules(job.Process, &streams);
+
+        if (!DmpCollectRanges(job.Process, &ranges))
+        {
+            __leave;
+        }
+
+        if (!DmpBuildHeader(&ranges, &streams, &header, &headerSize))
+        {
+            __leave;
+        }
+
+        if (!DmpBuildChunks(&ranges, headerSize, &job))
+        {
+            __leave;
+        }
+        job.DataRva = headerSize;
+
+        file = CreateFile(FileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            LOG_ERROR(GetLastError(), L"CreateFile(%s) failed", FileName);
+            __leave;
+        }
+        job.File = file;
+
+        job.WorkerCount = min(Options->ThreadCount, max(job.ChunkCount, 1));
+        if (job.Device != NULL && job.WorkerCount > DMP_DRV_MAX_WORKERS)
+        {
+            // they all share the one handle, the driver refuses reads past IOC_READ_MAX_IN_FLIGHT
+            LOG_INFO(L"%u threads reading through the driver, not %u", DMP_DRV_MAX_WORKERS, job.WorkerCount);
+            job.WorkerCount = DMP_DRV_MAX_WORKERS;
+        }
+        job.Workers = (PDMP_WORKER)calloc(job.WorkerCount, sizeof(DMP_WORKER));
+        if (job.Workers == NULL)
+        {
+            LOG_ERROR(0, L"calloc failed");
+            __leave;
+        }
+
+        // contiguous shares first, neighbours in memory stay neighbours in the file
+        share = job.ChunkCount / job.WorkerCount;
+        for (i = 0; i < job.WorkerCount; ++i)
+        {
+            job.Workers[i].Job = &job;
+            job.Workers[i].Index = i;
+            job.Workers[i].Work = DMP_WORK(i * share, (i == job.WorkerCount - 1) ? job.ChunkCount : (i + 1) * share);
+            job.Workers[i].Buffer = (PBYTE)VirtualAlloc(NULL, job.BufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+            if (job.Workers[i].Buffer == NULL)
+            {
+                LOG_ERROR(GetLastError(), L"VirtualAlloc failed");
+                __leave;
+            }
+
+            if (job.Device != NULL)
+            {
+                if (!DmpInitSlots(&job.Workers[i]))
+                {
+                    __leave;
+                }
+            }
+
+            if (flags & DMP_FLAG_COMPRESS)
+            {
+                job.Workers[i].Payload = (PBYTE)VirtualAlloc(NULL, DMPZ_PAYLOAD_SIZE(job.BufferSize), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+                job.Workers[i].Packed = (PBYTE)VirtualAlloc(NULL, DMPZ_PAYLOAD_SIZE(job.BufferSize), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+                if (job.Workers[i].Payload == NULL || job.Workers[i].Packed == NULL)
+                {
+                    LOG_ERROR(GetLastError(), L"VirtualAlloc failed");
+                    __leave;
+                }
+                if (!CreateCompressor(DMPZ_ALGORITHM | COMPRESS_RAW, NULL, &job.Workers[i].Compressor))
+                {
+                    LOG_ERROR(GetLastError(), L"CreateCompressor failed");
+                    __leave;
+                }
+            }
+
+            // a reader caches inflated frames, so it can't be shared
+            if (job.Base != NULL && !DmzOpen(job.Header.BaseName, &job.Workers[i].Base))
+            {
+                __leave;
+            }
+        }
+
+        if (flags & DMP_FLAG_COMPRESS)
+        {
+            // every worker holds at most one raw and one packed chunk, that is the whole pipeline
+            job.HeaderFrames = (headerSize + job.BufferSize - 1) / job.BufferSize;
+            job.Frames = (PDMPZ_FRAME)calloc(job.HeaderFrames + job.ChunkCount, sizeof(DMPZ_FRAME));
+            if (job.Frames == NULL)
+            {
+                LOG_ERROR(0, L"calloc failed");
+                __leave;
+            }
+            job.FileTail = sizeof(DMPZ_HEADER);
+
+            job.HashCount = ranges.TotalSize / DMP_PAGE_SIZE;
+            job.Hashes = (PPAGE_HASH)malloc((size_t)job.HashCount * sizeof(PAGE_HASH));
+            if (job.Hashes == NULL && job.HashCount != 0)
+            {
+                LOG_ERROR(0, L"malloc failed");
+                __leave;
+            }
+
+            // any two dumps taken on this machine get different ids
+            GetSystemTimeAsFileTime(&now);
+            job.Header.DumpId = (((ULONG64)now.dwHighDateTime << 32) | now.dwLowDateTime) ^ ((ULONG64)ProcessId << 48);
+            job.Header.ProcessId = ProcessId;
+
+            if (!PgTableInit(&job.Pages, (headerSize + ranges.TotalSize) / DMP_PAGE_SIZE))
+            {
+                __leave;
+            }
+
+            if (!DmpWriteHeaderFrames(&job, header, headerSize))
+            {
+                __leave;
+            }
+        }
+        else
+        {
+            if (!DmpWriteAt(file, 0, header, headerSize))
+            {
+                __leave;
+            }
+
+            job.Sparse = DmpSetSparse(file);
+
+            // size the file once, so parallel writes never extend it; an
+            // overlapped handle has no file pointer to SetEndOfFile with
+            fileSize.EndOfFile.QuadPart = (LONGLONG)(headerSize + ranges.TotalSize);
+            if (!SetFileInformationByHandle(file, FileEndOfFileInfo, &fileSize, sizeof(fileSize)))
+            {
+                LOG_ERROR(GetLastError(), L"SetFileInformationByHandle(FileEndOfFileInfo) failed");
+                __leave;
+            }
+        }
+
+        for (i = 1; i < job.WorkerCount; ++i)
+        {
+            job.Workers[i].Thread = CreateThread(NULL, 0, (job.Device != NULL) ? DmpDriverWorker : DmpWorker, &job.Workers[i], 0, NULL);
+            if (job.Workers[i].Thread == NULL)
+            {
+                // the others steal its share
+                LOG_ERROR(GetLastError(), L"CreateThread failed");
+                continue;
+            }
+            threads[threadCount++] = job.Workers[i].Thread;
+        }
+
+        if (job.Device != NULL)
+        {
+            DmpDriverWorker(&job.Workers[0]);
+        }
+        else
+        {
+            DmpWorker(&job.Workers[0]);
+        }
+
+        if (threadCount != 0)
+        {
+            WaitForMultipleObjects(threadCount, threads, TRUE, INFINITE);
+        }
+
+        if (job.Failed)
+        {
+            __leave;
+        }
+
+        if ((flags & DMP_FLAG_COMPRESS) && !DmpWriteIndex(&job, headerSize + ranges.TotalSize))
+        {
+            __leave;
+        }
+
+        QueryPerformanceCounter(&end);
+        seconds = (double)(end.QuadPart - start.QuadPart) / freq.QuadPart;
+
+        for (i = 0; i < job.WorkerCount; ++i)
+        {
+            missing += job.Workers[i].Missing;
+            written += job.Workers[i].PackedBytes;
+        }
+
+        LOG_INFO(L"%s: %u ranges, %I64u MB (%I64u MB written) in %.2f s (%.0f MB/s, %u threads), %I64u pages unreadable",
+            FileName, ranges.Count, ranges.TotalSize >> 20, written >> 20, seconds,
+            seconds > 0 ? (ranges.TotalSize >> 20) / seconds : 0, job.WorkerCount, missing);
+        LOG_INFO(L"  %u threads, %u modules, %u KB of buffers per worker",
+            streams.ThreadCount, streams.ModuleCount,
+            (job.BufferSize * ((job.Device != NULL) ? 2 : 1) +
+             ((flags & DMP_FLAG_COMPRESS) ? 2 * (DWORD)DMPZ_PAYLOAD_SIZE(job.BufferSize) : 0)) >> 10);
+        DmpReportWorkers(&job, seconds);
+
+        bOk = TRUE;
+    }
+    __finally
+    {
+        if (job.Workers != NULL)
+        {
+            for (i = 0; i < job.WorkerCount; ++i)
+            {
+                if (job.Workers[i].Thread != NULL)
+                {
+                    CloseHandle(job.Workers[i].Thread);
+                }
+                if (job.Workers[i].Buffer != NULL)
+                {
+                    VirtualFree(job.Workers[i].Buffer, 0, MEM_RELEASE);
+                }
+                if (job.Workers[i].Payload != NULL)
+                {
+                    VirtualFree(job.Workers[i].Payload, 0, MEM_RELEASE);
+                }
+                if (job.Workers[i].Packed != NULL)
+                {
+                    VirtualFree(job.Workers[i].Packed, 0, MEM_RELEASE);
+                }
+                if (job.Workers[i].Compressor != NULL)
+                {
+                    CloseCompressor(job.Workers[i].Compressor);
+                }
+                DmzClose(job.Workers[i].Base);
+                DmpFreeSlots(&job.Workers[i]);
+            }
+            free(job.Workers);
+        }
+        if (job.Frames != NULL)
+        {
+            free(job.Frames);
+        }
+        if (job.Hashes != NULL)
+        {
+            free(job.Hashes);
+        }
+        DmzClose(job.Base);
+        PgTableUninit(&job.Pages);
+        if (job.Chunks != NULL)
+        {
+            free(job.Chunks);
+        }
+        if (header != NULL)
+        {
+            free(header);
+        }
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+            if (!bOk)
+            {
+                DeleteFile(FileName);
+            }
+        }
+        if (job.Snapshot != NULL)
+        {
+            // also ends the clone
+            PssFreeSnapshot(GetCurrentProcess(), job.Snapshot);
+        }
+        if (job.Target != NULL)
+        {
+            CloseHandle(job.Target);
+        }
+        DmpFreeRanges(&ranges);
+        DmpFreeStreams(&streams);
+    }
+
+    return bOk;
+}
\ No newline at end of file
@@ -0,0 +1,294 @@
+#pragma once
+#include "main.h"
+#include "page.h"
+
+#include <DbgHelp.h>
+#include <compressapi.h>
+#include <ProcessSnapshot.h>
+#include <Psapi.h>
+
+
+#define DMP_PAGE_SIZE           PG_SIZE
+#define DMP_IO_CHUNK_SIZE       (4 * 1024 * 1024)   // Most bytes per ReadProcessMemory / WriteFile
+#define DMP_MIN_BUFFER_SIZE     (64 * 1024)
+#define DMP_DRV_READ_SIZE       IOC_READ_MAX_SIZE   // Bytes per IOCTL_READ_PROCESS_MEMORY
+#define DMP_DRV_MAX_READS       (DMP_IO_CHUNK_SIZE / DMP_DRV_READ_SIZE)
+#define DMP_DRV_MAX_WORKERS     (IOC_READ_MAX_IN_FLIGHT / (2 * DMP_DRV_MAX_READS))  // Two slots each, within the driver's per handle cap
+#define DMP_DEFAULT_BUFFER_SIZE DMP_IO_CHUNK_SIZE   // dump <pid> without -b
+#define DMP_DATA_ALIGNMENT      DMP_PAGE_SIZE       // Memory data starts page aligned in the file
+#define DMP_DEFAULT_FILE_FMT    L"%s.dmp"           // dump <pid> without a file name
+#define DMP_STREAM_COUNT        4                   // SystemInfo, ThreadList, ModuleList, Memory64List
+#define DMP_MAX_CV_SIZE         0x400               // CodeView record (RSDS + pdb path) kept per module
+#define DMP_MAX_MODULES         4096
+#define DMP_ALIGN(Value, Alignment)     (((Value) + (Alignment) - 1) & ~(ULONG64)((Alignment) - 1))
+
+#if defined(_M_AMD64)
+#define DMP_CONTEXT_SP(Context) ((Context)->Rsp)
+#elif defined(_M_ARM64)
+#define DMP_CONTEXT_SP(Context) ((Context)->Sp)
+#else
+#define DMP_CONTEXT_SP(Context) ((Context)->Esp)
+#endif
+#define DMP_MAX_THREADS         MAXIMUM_WAIT_OBJECTS
+#define DMP_DEFAULT_THREADS     1                   // dump <pid> [file] without a thread count
+
+#define DMP_FLAG_COMPRESS       0x00000001          // Write a DMPZ container instead of a plain minidump
+#define DMP_FLAG_LIVE           0x00000002          // Dump a copy on write clone, the target only stops while it is made
+
+#define DMPZ_SIGNATURE          'ZPMD'
+#define DMPZ_VERSION            4                   // 4: page hashes are SHA-256 prefixes
+#define DMPZ_ALGORITHM          COMPRESS_ALGORITHM_XPRESS
+#define DMPZ_DEFAULT_FILE_FMT   L"%s.dmpz"
+
+
+//
+// DMPZ container: the minidump cut in frames of at most DMP_IO_CHUNK_SIZE raw
+// bytes, each compressed on its own (COMPRESS_RAW) so any of them can be
+// inflated alone. Frames sit in the file in whatever order workers finished
+// them; the index at IndexOffset is sorted by RawOffset.
+//
+// A frame inflates to its payload: one ULONG64 per raw page (the page map),
+// followed by the DMPZ_PAGE_DATA pages in order. The other pages are either
+// all zero or a copy of the page at the given raw offset, which is always a
+// DMPZ_PAGE_DATA page of some frame.
+//
+// A delta (BaseId != 0) also has DMPZ_PAGE_BASE pages: same contents as the
+// page at the same address in the base dump, which may be a delta itself.
+// Candidates are found by content, from the page hashes every DMPZ file
+// carries at HashOffset (one per memory page, Memory64 order); a candidate
+// is only taken after its bytes are read back from the base and compared,
+// so a hash collision costs a stored page, never a wrong one.
+//
+typedef struct _DMPZ_HEADER
+{
+    ULONG       Signature;              // DMPZ_SIGNATURE
+    ULONG       Version;                // DMPZ_VERSION
+    ULONG       Algorithm;              // COMPRESS_ALGORITHM_*
+    ULONG       FrameCount;
+    ULONG64     RawSize;                // Size of the minidump the frames add up to
+    ULONG64     IndexOffset;            // DMPZ_FRAME[FrameCount]
+    ULONG64     HashOffset;             // PAGE_HASH[HashCount]
+    ULONG64     HashCount;              // Memory pages of the minidump
+    ULONG64     DumpId;                 // Unique per file, what a delta names its base by
+    ULONG64     BaseId;                 // 0: not a delta
+    ULONG       ProcessId;
+    ULONG       Reserved;
+    WCHAR       BaseName[MAX_PATH];     // Full path of the base file, BaseId != 0 only
+
+}DMPZ_HEADER, *PDMPZ_HEADER;
+
+typedef struct _DMPZ_FRAME
+{
+    ULONG64     RawOffset;              // Offset in the minidump
+    ULONG64     FileOffset;             // Offset of the packed bytes in the DMPZ file
+    ULONG       RawSize;                // Multiple of DMP_PAGE_SIZE
+    ULONG       PayloadSize;            // Page map + data pages
+    ULONG       PackedSize;             // == PayloadSize: stored as is, it didn't compress
+    ULONG       Reserved;
+
+}DMPZ_FRAME, *PDMPZ_FRAME;
+
+#define DMPZ_PAGE_ZERO          0                   // Page map entries; anything else is a raw offset
+#define DMPZ_PAGE_DATA          1
+#define DMPZ_PAGE_BASE          2                   // Delta only
+#define DMPZ_HASH_ZERO(Hash)    ((Hash)->Lo == 0 && (Hash)->Hi == 0)    // Zero pages hash to {0, 0}, no other page does
+#define DMPZ_MAP_SIZE(RawSize)  (((RawSize) / DMP_PAGE_SIZE) * sizeof(ULONG64))
+#define DMPZ_PAYLOAD_SIZE(Raw)  (DMPZ_MAP_SIZE(Raw) + (Raw))
+#define DMPZ_PAYLOAD_MAX        DMPZ_PAYLOAD_SIZE(DMP_IO_CHUNK_SIZE)
+
+
+//
+// One run of committed, readable memory; adjacent regions are merged so a
+// run can be read with as few calls as possible
+//
+typedef struct _DMP_RANGE
+{
+    ULONG64     Base;
+    ULONG64     Size;
+
+}DMP_RANGE, *PDMP_RANGE;
+
+typedef struct _DMP_RANGES
+{
+    DWORD       Count;
+    DWORD       Capacity;
+    ULONG64     TotalSize;      // Sum of Ranges[].Size
+    PDMP_RANGE  Ranges;         // Ascending Base, never adjacent
+
+}DMP_RANGES, *PDMP_RANGES;
+
+
+//
+// Thread and module list stream sources, captured before memory is read
+//
+typedef struct _DMP_THREAD
+{
+    DWORD       ThreadId;
+    DWORD       SuspendCount;
+    DWORD       Priority;
+    DWORD       ContextSize;
+    ULONG64     Teb;
+    ULONG64     StackBase;      // From the TEB, 0 if unknown
+    PCONTEXT    Context;        // ContextSize bytes, owned by the snapshot
+
+}DMP_THREAD, *PDMP_THREAD;
+
+typedef struct _DMP_MODULE
+{
+    ULONG64     Base;
+    DWORD       Size;
+    DWORD       CheckSum;
+    DWORD       TimeDateStamp;
+    DWORD       CvSize;         // 0: no CodeView record
+    BYTE        Cv[DMP_MAX_CV_SIZE];
+    WCHAR       Name[MAX_PATH];
+
+}DMP_MODULE, *PDMP_MODULE;
+
+typedef struct _DMP_STREAMS
+{
+    DWORD       ThreadCount;
+    DWORD       ModuleCount;
+    PDMP_THREAD Threads;
+    PDMP_MODULE Modules;
+
+}DMP_STREAMS, *PDMP_STREAMS;
+
+
+//
+// Buffer size (or less, at the end of a range) piece of a range, and
+// where its bytes go in the minidump
+//
+typedef struct _DMP_CHUNK
+{
+    ULONG64     Base;
+    ULONG64     FileOffset;     // Also the DMPZ frame RawOffset
+    DWORD       Size;
+
+}DMP_CHUNK, *PDMP_CHUNK;
+
+//
+// Worker chunk interval [Next, End) packed in one LONG64, so the owner taking
+// from the front and thieves cutting from the back agree with one CAS
+//
+#define DMP_WORK(Next, End)     ((LONG64)(((ULONG64)(End) << 32) | (ULONG)(Next)))
+#define DMP_WORK_NEXT(Work)     ((DWORD)(ULONG64)(Work))
+#define DMP_WORK_END(Work)      ((DWORD)((ULONG64)(Work) >> 32))
+
+struct _DMP_JOB;
+struct _DMZ_READER;
+
+//
+// Chunk being filled by the driver: one overlapped IOCTL_READ_PROCESS_MEMORY
+// per DMP_DRV_READ_SIZE piece, all posted at once
+//
+typedef struct _DMP_READ_SLOT
+{
+    PBYTE               Buffer;         // Job->BufferSize
+    DWORD               Chunk;          // MAXDWORD: idle
+    DWORD               Reads;          // Pieces of Chunk
+    BOOLEAN             Posted[DMP_DRV_MAX_READS];
+    OVERLAPPED          Ovlp[DMP_DRV_MAX_READS];
+
+}DMP_READ_SLOT, *PDMP_READ_SLOT;
+
+typedef struct _DMP_WORKER
+{
+    volatile LONG64     Work;
+    struct _DMP_JOB     *Job;
+    DWORD               Index;
+    HANDLE              Thread;         // NULL for worker 0, which runs on the caller thread
+    PBYTE               Buffer;         // Job->BufferSize
+    PBYTE               Payload;        // DMPZ_PAYLOAD_SIZE(Job->BufferSize), DMP_FLAG_COMPRESS only
+    PBYTE               Packed;         // DMPZ_PAYLOAD_SIZE(Job->BufferSize), DMP_FLAG_COMPRESS only
+    COMPRESSOR_HANDLE   Compressor;     // Not thread safe, one per worker
+    struct _DMZ_READER  *Base;          // Delta: own reader of Job->Base's file, to compare pages with
+    DMP_READ_SLOT       Slots[2];       // Job->Device only: one chunk is read while the other is written
+
+    ULONG64             Bytes;          // Copied by this worker
+    ULONG64             PackedBytes;    // ... as written to the file
+    ULONG64             Missing;        // Unreadable pages
+    ULONG64             ZeroPages;      // Not written (sparse hole or DMPZ_PAGE_ZERO)
+    ULONG64             DupPages;       // Written as a reference to an earlier copy
+    ULONG64             BasePages;      // Written as DMPZ_PAGE_BASE
+    LONGLONG            ReadTicks;      // QueryPerformanceCounter ticks per stage
+    LONGLONG            ScanTicks;      // Zero check, digest, base lookup
+    LONGLONG            CompressTicks;
+    LONGLONG            WriteTicks;
+    DWORD               Chunks;
+    DWORD               Steals;
+
+}DMP_WORKER, *PDMP_WORKER;
+
+typedef struct _DMP_JOB
+{
+    HANDLE              Process;        // What memory is read from, the clone with DMP_FLAG_LIVE
+    HANDLE              Target;
+    HPSS                Snapshot;       // Threads and their contexts, and the clone with DMP_FLAG_LIVE
+    HANDLE              Device;         // Read memory through the driver instead of ReadProcessMemory
+    DWORD               ProcessId;
+    HANDLE              File;
+    DWORD               Flags;          // DMP_FLAG_*
+    DWORD               BufferSize;     // Largest chunk
+    PDMP_CHUNK          Chunks;
+    DWORD               ChunkCount;
+    DWORD               WorkerCount;
+    PDMP_WORKER         Workers;
+    volatile LONG       Failed;         // Set by the first worker that can't write, all stop
+    BOOLEAN             Sparse;         // Plain minidump on a sparse file, zero pages are left as holes
+    PAGE_TABLE          Pages;          // DMP_FLAG_COMPRESS: SHA-256 of a page -> raw offset of its DMPZ_PAGE_DATA copy
+
+    PDMPZ_FRAME         Frames;         // DMP_FLAG_COMPRESS: HeaderFrames + ChunkCount entries
+    DWORD               HeaderFrames;   // Frames holding the minidump header, before the chunks
+    volatile LONG64     FileTail;       // Where the next packed frame goes
+    ULONG64             DataRva;        // Raw offset of the first memory page
+    PPAGE_HASH          Hashes;         // DMP_FLAG_COMPRESS: one per memory page, filled by the workers
+    ULONG64             HashCount;
+    struct _DMZ_READER  *Base;          // Delta: the dump it is taken against
+    DMPZ_HEADER         Header;         // DMP_FLAG_COMPRESS: written last
+
+}DMP_JOB, *PDMP_JOB;
+
+
+typedef struct _DMP_OPTIONS
+{
+    DWORD       ThreadCount;    // 1..DMP_MAX_THREADS
+    DWORD       Flags;          // DMP_FLAG_*
+    PCWSTR      BaseFileName;   // Delta against this DMPZ file, implies DMP_FLAG_COMPRESS
+    DWORD       FreezeWarning;  // DMP_FLAG_LIVE: warn when the target was frozen longer (ms), 0 for never
+    DWORD       BufferSize;     // Per worker, power of 2 in DMP_MIN_BUFFER_SIZE..DMP_IO_CHUNK_SIZE
+    HANDLE      Device;         // Overlapped driver handle to read memory with, NULL for ReadProcessMemory
+
+}DMP_OPTIONS, *PDMP_OPTIONS;
+
+
+VOID
+DmpInitOptions(
+    _Out_ PDMP_OPTIONS Options
+);
+
+//
+// Writes a full memory minidump (MiniDumpWithFullMemory layout: system info,
+// threads with their contexts, modules and Memory64ListStream) of ProcessId
+// to FileName, readable by WinDbg / DbgHelp.
+// Memory is cut in chunks copied by ThreadCount workers (1..DMP_MAX_THREADS)
+// that steal from each other once their own share is done; every chunk has
+// a fixed place in the minidump, so they all write straight to the file.
+// With DMP_FLAG_COMPRESS every chunk is also a DMPZ frame, compressed by the
+// worker that read it and appended wherever the file ends at that moment.
+// With BaseFileName (a DMPZ file, implies DMP_FLAG_COMPRESS) it is a delta:
+// pages the base already holds at the same address are not written again.
+// With DMP_FLAG_LIVE the target runs on while it is dumped, and the image is
+// consistent. The target is frozen once, for the whole clone; PSS has no way
+// to bound that up front, so FreezeWarning (ms, 0 for never) is no budget:
+// a longer freeze is reported and the dump goes on from the clone it bought.
+// Process memory is never held in more than ThreadCount buffers of
+// BufferSize (three with DMP_FLAG_COMPRESS, one more when read through
+// Device, which fills the next chunk while the current one is written)
+//
+BOOLEAN
+DmpDumpProcess(
+    _In_ DWORD        ProcessId,
+    _In_ PCWSTR       FileName,
+    _In_ PDMP_OPTIONS Options
+);
\ No newline at end of file
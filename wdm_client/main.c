@@ -16,17 +16,42 @@ Environment:
 
 #include "main.h"
 #include "comm.h"
+#include "dump.h"
+#include "dmpz.h"
+#include "dmpmap.h"
+
+#include <TlHelp32.h>
+
+
+static
+BOOLEAN
+ParseDumpArgs(
+    _In_  WCHAR        Cmd[CMD_MAX_ARGS][MAX_PATH],
+    _In_  DWORD        CmdLen,
+    _Out_ PDMP_OPTIONS Options,
+    _Out_ PWCHAR       Path
+);
+
+static
+VOID
+SweepProcesses(
+    _In_     PCWSTR       Image,
+    _In_opt_ PCWSTR       Directory,
+    _In_     PDMP_OPTIONS Options
+);
 
 
 int
 wmain(int argc, WCHAR *argv[])
 {
-    UNREFERENCED_PARAMETER(argc);
-    UNREFERENCED_PARAMETER(argv);
+    BOOLEAN bSharedRing = FALSE;
+
+    bSharedRing = (BOOLEAN)(argc > 1 && !wcscmp(argv[1], WDM_ARG_SHARED_RING));
 
     __try
     {
-        if (!InitComm(WDM_DEFAULT_THREAD_NO))
+        // the shared ring has a single consumer
+        if (!InitComm(bSharedRing ? 1 : WDM_DEFAULT_THREAD_NO, bSharedRing))
         {
             LOG_ERROR(0, L"InitComm failed!");
             __leave;
@@ -51,6 +76,22 @@ PrintHelp(
     LOG_HELP(L"Commands:");
     LOG_HELP(L"%s        - show help", CMD_OPT_HELP);
     LOG_HELP(L"%s        - exit client", CMD_OPT_EXIT);
+    LOG_HELP(L"%s <pid> [file] [threads] [%s] [%s <base>] [%s <ms>] [%s <KB>] [%s] - write a full memory minidump of pid (default <pid>.dmp, %u thread)",
+        CMD_OPT_DUMP, CMD_DUMP_COMPRESS, CMD_DUMP_INCREMENTAL, CMD_DUMP_LIVE, CMD_DUMP_BUFFER, CMD_DUMP_KERNEL, DMP_DEFAULT_THREADS);
+    LOG_HELP(L"    %s - compress it in independently readable frames (default <pid>.dmpz)", CMD_DUMP_COMPRESS);
+    LOG_HELP(L"    %s - only keep pages that changed since the <base> DMPZ dump (implies %s)", CMD_DUMP_INCREMENTAL, CMD_DUMP_COMPRESS);
+    LOG_HELP(L"    %s - dump a copy on write clone, pid is only frozen while it is made; warn if that took over <ms> (0: never), it can't be bounded up front", CMD_DUMP_LIVE);
+    LOG_HELP(L"    %s - memory buffer per thread, power of 2 in %u..%u (default %u)",
+        CMD_DUMP_BUFFER, DMP_MIN_BUFFER_SIZE >> 10, DMP_IO_CHUNK_SIZE >> 10, DMP_DEFAULT_BUFFER_SIZE >> 10);
+    LOG_HELP(L"    %s - read memory through the driver, %u KB requests kept in flight while writing (not with %s)",
+        CMD_DUMP_KERNEL, DMP_DRV_READ_SIZE >> 10, CMD_DUMP_LIVE);
+    LOG_HELP(L"%s <image|%s> [dir] [threads] [dump options] - dump every process running image (default: current directory)",
+        CMD_OPT_SWEEP, CMD_SWEEP_ALL);
+    LOG_HELP(L"%s <dmpz> <file> - write the minidump a DMPZ file (delta or not) holds", CMD_OPT_MERGE);
+    LOG_HELP(L"%s <file> <va> <size> - hex dump size bytes (at most 0x%x) at hex address va of a dump", CMD_OPT_READ, DMM_PRINT_MAX);
+    LOG_HELP(L"%s       - driver queue counters, delivery rate and latency", CMD_OPT_STATS);
+    LOG_HELP(L"%s <%s|%s|%s> - what the driver drops when its queue is full",
+        CMD_OPT_POLICY, CMD_POLICY_NEWEST, CMD_POLICY_OLDEST, CMD_POLICY_COALESCE);
 
     return;
 }
@@ -99,6 +140,228 @@ ParseCmd(
 }
 
 
+static
+BOOLEAN
+ParseNumber(
+    _In_  PCWSTR Text,
+    _Out_ PDWORD Value
+)
+{
+    PWCHAR end = NULL;
+
+    *Value = wcstoul(Text, &end, 10);
+
+    return end != Text && *end == L'\0';
+}
+
+
+static
+BOOLEAN
+ParseDumpArgs(
+    _In_  WCHAR        Cmd[CMD_MAX_ARGS][MAX_PATH],
+    _In_  DWORD        CmdLen,
+    _Out_ PDMP_OPTIONS Options,
+    _Out_ PWCHAR       Path
+)
+{
+    DWORD positional = 0;
+    DWORD value = 0;
+    DWORD i = 0;
+
+    DmpInitOptions(Options);
+    Path[0] = L'\0';
+
+    // <target> [path] [threads], path and threads in this order, options anywhere
+    for (i = 2; i < CmdLen; ++i)
+    {
+        if (!wcscmp(Cmd[i], CMD_DUMP_INCREMENTAL) || !wcscmp(Cmd[i], CMD_DUMP_LIVE) || !wcscmp(Cmd[i], CMD_DUMP_BUFFER))
+        {
+            if (i + 1 >= CmdLen)
+            {
+                LOG_WARN(L"%s expects a value", Cmd[i]);
+                return FALSE;
+            }
+        }
+
+        if (!wcscmp(Cmd[i], CMD_DUMP_COMPRESS))
+        {
+            Options->Flags |= DMP_FLAG_COMPRESS;
+        }
+        else if (!wcscmp(Cmd[i], CMD_DUMP_INCREMENTAL))
+        {
+            Options->BaseFileName = Cmd[++i];
+            Options->Flags |= DMP_FLAG_COMPRESS;
+        }
+        else if (!wcscmp(Cmd[i], CMD_DUMP_LIVE))
+        {
+            if (!ParseNumber(Cmd[i + 1], &value))
+            {
+                LOG_WARN(L"%s expects milliseconds, found [%s]", Cmd[i], Cmd[i + 1]);
+                return FALSE;
+            }
+            ++i;
+            Options->FreezeWarning = value;
+            Options->Flags |= DMP_FLAG_LIVE;
+        }
+        else if (!wcscmp(Cmd[i], CMD_DUMP_BUFFER))
+        {
+            if (!ParseNumber(Cmd[i + 1], &value))
+            {
+                LOG_WARN(L"%s expects KB, found [%s]", Cmd[i], Cmd[i + 1]);
+                return FALSE;
+            }
+            ++i;
+            Options->BufferSize = value << 10;
+        }
+        else if (!wcscmp(Cmd[i], CMD_DUMP_KERNEL))
+        {
+            Options->Device = gDevice;
+        }
+        else if (positional++ == 0)
+        {
+            wcscpy_s(Path, MAX_PATH, Cmd[i]);
+        }
+        else if (positional == 2)
+        {
+            if (!ParseNumber(Cmd[i], &value) || value == 0)
+            {
+                LOG_WARN(L"expected a thread count, found [%s]", Cmd[i]);
+                return FALSE;
+            }
+            Options->ThreadCount = value;
+        }
+        else
+        {
+            LOG_WARN(L"unexpected argument [%s]", Cmd[i]);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static
+VOID
+SweepProcesses(
+    _In_     PCWSTR       Image,
+    _In_opt_ PCWSTR       Directory,
+    _In_     PDMP_OPTIONS Options
+)
+{
+    HANDLE          snapshot = INVALID_HANDLE_VALUE;
+    PROCESSENTRY32W entry = { 0 };
+    PIOC_DUMP_BATCH batch = NULL;
+    WCHAR           base[MAX_PATH] = L"";
+    WCHAR           fileName[MAX_PATH] = L"";
+    DWORD           dumped = 0;
+    DWORD           skipped = 0;
+    DWORD           i = 0;
+    BOOL            bMore = FALSE;
+
+    // a base is one process, it can't be shared by the sweep
+    if (Options->BaseFileName != NULL)
+    {
+        LOG_WARN(L"%s does not take %s", CMD_OPT_SWEEP, CMD_DUMP_INCREMENTAL);
+        return;
+    }
+
+    __try
+    {
+        batch = (PIOC_DUMP_BATCH)calloc(1, IOC_DUMP_BATCH_SIZE(IOC_DUMP_BATCH_MAX));
+        if (batch == NULL)
+        {
+            LOG_ERROR(0, L"calloc failed");
+            __leave;
+        }
+
+        snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+        if (snapshot == INVALID_HANDLE_VALUE)
+        {
+            LOG_ERROR(GetLastError(), L"CreateToolhelp32Snapshot failed");
+            __leave;
+        }
+
+        entry.dwSize = sizeof(entry);
+        for (bMore = Process32FirstW(snapshot, &entry); bMore; bMore = Process32NextW(snapshot, &entry))
+        {
+            // neither the idle process nor ourselves
+            if (entry.th32ProcessID == 0 || entry.th32ProcessID == GetCurrentProcessId())
+            {
+                continue;
+            }
+            if (wcscmp(Image, CMD_SWEEP_ALL) && _wcsicmp(Image, entry.szExeFile))
+            {
+                continue;
+            }
+            if (batch->Count == IOC_DUMP_BATCH_MAX)
+            {
+                LOG_WARN(L"more than %u processes, the rest is left out", IOC_DUMP_BATCH_MAX);
+                break;
+            }
+
+            batch->Entries[batch->Count].ProcessId = entry.th32ProcessID;
+            batch->Count++;
+        }
+
+        if (batch->Count == 0)
+        {
+            LOG_WARN(L"no process runs %s", Image);
+            __leave;
+        }
+
+        // one transition for all of them, each entry comes back with its own status
+        if (!SendDumpBatchToDrv(gDevice, batch))
+        {
+            __leave;
+        }
+        LOG_INFO(L"%u processes, %u tracked by the driver", batch->Count, batch->Found);
+
+        for (i = 0; i < batch->Count; ++i)
+        {
+            // processes started before the driver loaded are not tracked, they
+            // are dumped all the same
+            if (batch->Entries[i].Status < 0 && batch->Entries[i].Status != IOC_DUMP_STATUS_NOT_FOUND)
+            {
+                LOG_WARN(L"pid %u: driver status 0x%08x, skipped", batch->Entries[i].ProcessId, batch->Entries[i].Status);
+                ++skipped;
+                continue;
+            }
+
+            if (Directory != NULL)
+            {
+                swprintf_s(base, MAX_PATH, L"%s\\%u", Directory, batch->Entries[i].ProcessId);
+            }
+            else
+            {
+                swprintf_s(base, MAX_PATH, L"%u", batch->Entries[i].ProcessId);
+            }
+            swprintf_s(fileName, MAX_PATH, (Options->Flags & DMP_FLAG_COMPRESS) ? DMPZ_DEFAULT_FILE_FMT : DMP_DEFAULT_FILE_FMT, base);
+
+            if (DmpDumpProcess(batch->Entries[i].ProcessId, fileName, Options))
+            {
+                ++dumped;
+            }
+        }
+
+        LOG_INFO(L"%u of %u processes dumped, %u skipped", dumped, batch->Count, skipped);
+    }
+    __finally
+    {
+        if (snapshot != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(snapshot);
+        }
+        if (batch != NULL)
+        {
+            free(batch);
+        }
+    }
+
+    return;
+}
+
+
 VOID
 ProcessInput(
     VOID
@@ -133,16 +396,84 @@ ProcessInput(
             }
             else if (!wcscmp(cmd[0], CMD_OPT_DUMP))
             {
-                if (cmdLen != 2)
+                WCHAR fileName[MAX_PATH] = L"";
+                DMP_OPTIONS options;
+
+                if (cmdLen < 2)
                 {
-                    LOG_WARN(L"expected 1 arg, found %d", cmdLen - 1);
+                    LOG_WARN(L"expected at least 1 arg, found %d", cmdLen - 1);
                     continue;
                 }
                
-                if (!SendDumpToDrv(gDevice, cmd[1]))
+                if (!ParseDumpArgs(cmd, cmdLen, &options, fileName))
+                {
+                    continue;
+                }
+
+                if (!SendDumpToDrv(gDevice, wcstoul(cmd[1], NULL, 10)))
                 {
                     continue;
                 }
+
+                if (fileName[0] == L'\0')
+                {
+                    swprintf_s(fileName, MAX_PATH, (options.Flags & DMP_FLAG_COMPRESS) ? DMPZ_DEFAULT_FILE_FMT : DMP_DEFAULT_FILE_FMT, cmd[1]);
+                }
+
+                DmpDumpProcess(wcstoul(cmd[1], NULL, 10), fileName, &options);
+            }
+            else if (!wcscmp(cmd[0], CMD_OPT_SWEEP))
+            {
+                WCHAR directory[MAX_PATH] = L"";
+                DMP_OPTIONS options;
+
+                if (cmdLen < 2)
+                {
+                    LOG_WARN(L"expected at least 1 arg, found %d", cmdLen - 1);
+                    continue;
+                }
+
+                if (!ParseDumpArgs(cmd, cmdLen, &options, directory))
+                {
+                    continue;
+                }
+
+                SweepProcesses(cmd[1], (directory[0] != L'\0') ? directory : NULL, &options);
+            }
+            else if (!wcscmp(cmd[0], CMD_OPT_MERGE))
+            {
+                if (cmdLen != 3)
+                {
+                    LOG_WARN(L"expected 2 args, found %d", cmdLen - 1);
+                    continue;
+                }
+
+                DmzMerge(cmd[1], cmd[2]);
+            }
+            else if (!wcscmp(cmd[0], CMD_OPT_READ))
+            {
+                if (cmdLen != 4)
+                {
+                    LOG_WARN(L"expected 3 args, found %d", cmdLen - 1);
+                    continue;
+                }
+
+                DmmPrintVa(cmd[1], wcstoull(cmd[2], NULL, 16), wcstoul(cmd[3], NULL, 0));
+            }
+            else if (!wcscmp(cmd[0], CMD_OPT_STATS))
+            {
+                QueryDriverStats(gDevice);
+                DlvPrint();
+            }
+            else if (!wcscmp(cmd[0], CMD_OPT_POLICY))
+            {
+                if (cmdLen != 2)
+                {
+                    LOG_WARN(L"expected 1 arg, found %d", cmdLen - 1);
+                    continue;
+                }
+
+                SetQueuePolicy(gDevice, cmd[1]);
             }
             else
             {
@@ -162,7 +493,8 @@ ProcessInput(
 
 BOOLEAN
 InitComm(
-    _In_ DWORD NumberOfThreads
+    _In_ DWORD   NumberOfThreads,
+    _In_ BOOLEAN UseSharedRing
 )
 {
     DWORD   i   = 0;
@@ -191,6 +523,14 @@ InitComm(
             __leave;
         }
 
+        if (!QueryDriverVersion(gDevice))
+        {
+            LOG_ERROR(0, L"QueryDriverVersion failed");
+            __leave;
+        }
+        QueryPerformanceFrequency(&gQpcFrequency);
+        DlvInit();
+
         gTerminateThreadEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
         if (!gTerminateThreadEvent)
         {
@@ -198,6 +538,12 @@ InitComm(
             __leave;
         }
 
+        if (UseSharedRing && !MapSharedRing(gDevice))
+        {
+            LOG_ERROR(0, L"MapSharedRing failed");
+            __leave;
+        }
+
         for (i = 0; i < NumberOfThreads; ++i)
         {
             gThContext[i] = (PNOTIFICATION_CONTEXT)malloc(sizeof(NOTIFICATION_CONTEXT));
@@ -206,7 +552,7 @@ InitComm(
                 LOG_ERROR(GetLastError(), L"failed for PNOTIFICATION_CONTEXT");
                 break;
             }
-            ZeroMemory(gThContext[i], sizeof(gThContext[i]));
+            ZeroMemory(gThContext[i], sizeof(*gThContext[i]));
 
             gThContext[i]->Index = i;
             gThContext[i]->Ovlp.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
@@ -277,6 +623,8 @@ UninitComm(
     }
     gThreadNo = 0;
 
+    UnmapSharedRing(gDevice);
+
     CloseHandle(gTerminateThreadEvent);
     gTerminateThreadEvent = NULL;
 
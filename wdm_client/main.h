@@ -8,6 +8,7 @@
 
 #include "cmd_opts.h"
 #include "..\Public.h"
+#include "..\SharedRing.h"
 
 
 
@@ -30,7 +31,8 @@
 
 BOOLEAN
 InitComm(
-    _In_ DWORD NumberOfThreads
+    _In_ DWORD   NumberOfThreads,
+    _In_ BOOLEAN UseSharedRing
 );
 
 VOID
@@ -61,7 +63,9 @@ ProcessInput(
 
 
 #define WDM_MAX_THREAD_NO           MAXIMUM_WAIT_OBJECTS
-#define WDM_DEFAULT_THREAD_NO       (1)
+#define WDM_DEFAULT_THREAD_NO       (4)
+#define WDM_ARG_SHARED_RING         L"-shared"  // Consume events from the shared ring instead of IOCTLs
+#define WDM_NOTIFY_BATCH_COUNT      1024    // PROC_INFO records asked for per IOCTL_NOTIFY_CALLBACK_BATCH
 
 #define EVER                        (;;)
 #define WHAT_THE_FUCK               while (TRUE)
@@ -82,3 +86,6 @@ HANDLE                  gCommTh[WDM_MAX_THREAD_NO];         // Notification thre
 PNOTIFICATION_CONTEXT   gThContext[WDM_MAX_THREAD_NO];      // Notification thread contexts
 DWORD                   gThreadNo;                          // Thread count
 HANDLE                  gDevice;                            // Device Handle
+PSHARED_RING            gSharedRing;                        // Driver event ring mapped in our address space, if any
+HANDLE                  gSharedRingDoorbell;                // Signaled by the driver when gSharedRing stops being empty
+LARGE_INTEGER           gQpcFrequency;                      // PROC_INFO.Timestamp ticks per second
@@ -0,0 +1,133 @@
+#include "page.h"
+
+#include <emmintrin.h>
+#include <bcrypt.h>
+
+
+BOOLEAN
+PgIsZero(
+    _In_ const VOID *Page
+)
+{
+    const __m128i   *p = (const __m128i *)Page;
+    __m128i         acc;
+    DWORD           i = 0;
+
+    // 64 bytes per test, most non zero pages fail on the first line
+    for (i = 0; i < PG_SIZE / sizeof(__m128i); i += 4)
+    {
+        acc = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128(p + i), _mm_loadu_si128(p + i + 1)),
+            _mm_or_si128(_mm_loadu_si128(p + i + 2), _mm_loadu_si128(p + i + 3)));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+PgDigest(
+    _In_  const VOID   *Page,
+    _Out_ PPAGE_DIGEST Digest
+)
+{
+    NTSTATUS status = 0;
+
+    // the algorithm pseudo handle needs no setup and is safe to share
+    status = BCryptHash(BCRYPT_SHA256_ALG_HANDLE, NULL, 0, (PUCHAR)Page, PG_SIZE, (PUCHAR)Digest->Words, sizeof(Digest->Words));
+    if (!BCRYPT_SUCCESS(status))
+    {
+        LOG_ERROR(status, L"BCryptHash failed");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+PgTableInit(
+    _Out_ PPAGE_TABLE Table,
+    _In_  ULONG64     ExpectedPages
+)
+{
+    ULONG64 entries = PG_TABLE_MIN_ENTRIES;
+
+    while (entries < ExpectedPages * 2 && entries < PG_TABLE_MAX_ENTRIES)
+    {
+        entries <<= 1;
+    }
+
+    Table->Mask = entries - 1;
+    Table->Entries = (PPAGE_TABLE_ENTRY)VirtualAlloc(NULL, (SIZE_T)(entries * sizeof(PAGE_TABLE_ENTRY)), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (Table->Entries == NULL)
+    {
+        LOG_ERROR(GetLastError(), L"VirtualAlloc failed");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID
+PgTableUninit(
+    _Inout_ PPAGE_TABLE Table
+)
+{
+    if (Table->Entries != NULL)
+    {
+        VirtualFree(Table->Entries, 0, MEM_RELEASE);
+        Table->Entries = NULL;
+    }
+}
+
+ULONG64
+PgTableFindOrInsert(
+    _Inout_ PPAGE_TABLE  Table,
+    _In_    PPAGE_DIGEST Digest,
+    _In_    ULONG64      Ref
+)
+{
+    PPAGE_TABLE_ENTRY   entry = NULL;
+    LONG64              key = (LONG64)(Digest->Words[0] | 1);   // 0 marks a free entry
+    LONG64              seen = 0;
+    ULONG64             found = 0;
+    DWORD               probe = 0;
+
+    for (probe = 0; probe < PG_TABLE_MAX_PROBES; ++probe)
+    {
+        entry = &Table->Entries[(Digest->Words[1] + probe) & Table->Mask];
+
+        seen = entry->Key;
+        if (seen == 0)
+        {
+            seen = InterlockedCompareExchange64(&entry->Key, key, 0);
+            if (seen == 0)
+            {
+                // ours; Ref goes last, it tells readers Rest is valid
+                CopyMemory(entry->Rest, &Digest->Words[1], sizeof(entry->Rest));
+                InterlockedExchange64(&entry->Ref, (LONG64)Ref);
+                return 0;
+            }
+        }
+
+        if (seen == key)
+        {
+            found = (ULONG64)entry->Ref;
+            if (found != 0 && memcmp(entry->Rest, &Digest->Words[1], sizeof(entry->Rest)) == 0)
+            {
+                return found;
+            }
+            if (found == 0)
+            {
+                // being inserted right now; store the page, it's still correct
+                return 0;
+            }
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+#include "main.h"
+
+
+#define PG_SIZE                 0x1000
+#define PG_TABLE_MIN_ENTRIES    (1 << 10)
+#define PG_TABLE_MAX_ENTRIES    (1 << 22)   // 160 MB; pages past that are just not deduplicated
+#define PG_TABLE_MAX_PROBES     32
+
+
+//
+// 128 bit page content hash, the first half of the page's PAGE_DIGEST; only
+// ever taken as a candidate, the bytes decide
+//
+typedef struct _PAGE_HASH
+{
+    ULONG64     Lo;
+    ULONG64     Hi;
+
+}PAGE_HASH, *PPAGE_HASH;
+
+//
+// SHA-256 of a page; two pages are taken as equal when their digests are.
+// That is only wrong on a SHA-256 collision, and none is known, accidental
+// or crafted, so a reference found through it names a byte identical page
+//
+typedef struct _PAGE_DIGEST
+{
+    ULONG64     Words[4];
+
+}PAGE_DIGEST, *PPAGE_DIGEST;
+
+typedef struct _PAGE_TABLE_ENTRY
+{
+    volatile LONG64 Key;        // Words[0] | 1, 0: free
+    LONG64          Rest[3];    // Words[1..3]
+    volatile LONG64 Ref;        // Owner defined, 0 until Rest is valid
+
+}PAGE_TABLE_ENTRY, *PPAGE_TABLE_ENTRY;
+
+//
+// Lock free, insert only, open addressing PAGE_DIGEST -> Ref map
+//
+typedef struct _PAGE_TABLE
+{
+    ULONG64             Mask;   // Entries - 1
+    PPAGE_TABLE_ENTRY   Entries;
+
+}PAGE_TABLE, *PPAGE_TABLE;
+
+
+//
+// Page is PG_SIZE bytes, any alignment
+//
+BOOLEAN
+PgIsZero(
+    _In_ const VOID *Page
+);
+
+//
+// Any number of concurrent callers
+//
+BOOLEAN
+PgDigest(
+    _In_  const VOID   *Page,
+    _Out_ PPAGE_DIGEST Digest
+);
+
+//
+// Sized for ExpectedPages (twice that, rounded to a power of 2, within
+// PG_TABLE_MIN_ENTRIES..PG_TABLE_MAX_ENTRIES)
+//
+BOOLEAN
+PgTableInit(
+    _Out_ PPAGE_TABLE Table,
+    _In_  ULONG64     ExpectedPages
+);
+
+VOID
+PgTableUninit(
+    _Inout_ PPAGE_TABLE Table
+);
+
+//
+// Any number of concurrent callers
+//
+// returns:
+//      - Ref of the page that first came with Digest
+//      - 0 if Digest is new (Ref was recorded for it, unless the table is full)
+//        or its first owner hasn't finished recording it
+ULONG64
+PgTableFindOrInsert(
+    _Inout_ PPAGE_TABLE  Table,
+    _In_    PPAGE_DIGEST Digest,
+    _In_    ULONG64      Ref
+);
\ No newline at end of file